@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "tsduck_helper.hh"
+
+namespace {
+
+// clang-format off
+// Strings in the same form as the ones in EIT sections broadcasted.
+const std::vector<uint8_t> kEventName = {
+  // "ニュース・気象情報"
+  0x25, 0x4B, 0x25, 0x65, 0x21, 0x3C, 0x25, 0x39, 0x21, 0x26, 0x35, 0x24, 0x3E, 0x5D, 0x3E, 0x70,
+  0x4A, 0x73,
+};
+const std::vector<uint8_t> kText = {
+  // "今日の気象情報とニュース　"
+  0x3A, 0x23, 0x46, 0x7C, 0x24, 0x4E, 0x35, 0x24, 0x3E, 0x5D, 0x3E, 0x70, 0x4A, 0x73, 0x24, 0x48,
+  0x25, 0x4B, 0x25, 0x65, 0x21, 0x3C, 0x25, 0x39, 0x21, 0x21,
+  // "NHK" in the Alphanumeric set with MSZ
+  0x89, 0x0E, 0x4E, 0x48, 0x4B, 0x0F, 0x8A,
+  // "のニュース・気象情報"
+  0x24, 0x4E, 0x25, 0x4B, 0x25, 0x65, 0x21, 0x3C, 0x25, 0x39, 0x21, 0x26, 0x35, 0x24, 0x3E, 0x5D,
+  0x3E, 0x70, 0x4A, 0x73,
+};
+// clang-format on
+
+const std::vector<uint8_t>& GetString(int64_t index) {
+  return index == 0 ? kEventName : kText;
+}
+
+// The decoder used before FastAribStringDecoder was introduced.
+void BM_DecodeAribString_LibIsdb(benchmark::State& state) {
+  const auto& bytes = GetString(state.range(0));
+  LibISDB::ARIBString str(bytes.data(), bytes.size());
+  auto flags = GetAribStringDecodeFlag();
+  LibISDB::ARIBStringDecoder decoder;
+  LibISDB::String utf8;
+  for (auto _ : state) {
+    utf8.clear();
+    decoder.Decode(str, &utf8, flags);
+    benchmark::DoNotOptimize(utf8.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes.size()));
+}
+
+void BM_DecodeAribString_FastPath(benchmark::State& state) {
+  const auto& bytes = GetString(state.range(0));
+  LibISDB::ARIBString str(bytes.data(), bytes.size());
+  auto flags = GetAribStringDecodeFlag();
+  FastAribStringDecoder decoder;
+  LibISDB::String utf8;
+  for (auto _ : state) {
+    decoder.Decode(str, &utf8, flags);
+    benchmark::DoNotOptimize(utf8.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes.size()));
+  state.counters["fast_bytes_ratio"] =
+      static_cast<double>(decoder.num_fast_bytes()) / static_cast<double>(decoder.num_bytes());
+}
+
+}  // namespace
+
+// Arg: 0 for an event name, 1 for a text including a run in the Alphanumeric set.
+BENCHMARK(BM_DecodeAribString_LibIsdb)->Arg(0)->Arg(1);
+BENCHMARK(BM_DecodeAribString_FastPath)->Arg(0)->Arg(1);
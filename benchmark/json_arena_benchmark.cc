@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <rapidjson/document.h>
+
+#include "json_arena.hh"
+
+namespace {
+
+constexpr int kNumServices = 32;
+
+// Builds a document similar to the output of `scan-services`.
+void BuildServices(rapidjson::Document& doc) {
+  auto& allocator = doc.GetAllocator();
+  for (int i = 0; i < kNumServices; ++i) {
+    rapidjson::Value v(rapidjson::kObjectType);
+    v.AddMember("nid", 1, allocator);
+    v.AddMember("tsid", 2, allocator);
+    v.AddMember("sid", i, allocator);
+    v.AddMember("name", std::string("service name which is long enough"), allocator);
+    v.AddMember("type", 1, allocator);
+    v.AddMember("logoId", -1, allocator);
+    v.AddMember("remoteControlKeyId", 0, allocator);
+    doc.PushBack(v, allocator);
+  }
+}
+
+void BM_JsonDocument(benchmark::State& state) {
+  for (auto _ : state) {
+    rapidjson::Document doc(rapidjson::kArrayType);
+    BuildServices(doc);
+    benchmark::DoNotOptimize(doc.Size());
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+void BM_JsonArena(benchmark::State& state) {
+  JsonArena arena(static_cast<size_t>(state.range(0)));
+  for (auto _ : state) {
+    rapidjson::Document doc(rapidjson::kArrayType, &arena.Reset());
+    BuildServices(doc);
+    benchmark::DoNotOptimize(doc.Size());
+  }
+  arena.Reset();
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  // Only the first few documents should allocate memory from the heap.
+  state.counters["overflows"] = static_cast<double>(arena.num_overflows());
+  state.counters["arena_size"] = static_cast<double>(arena.size());
+}
+
+}  // namespace
+
+BENCHMARK(BM_JsonDocument);
+// The initial size is too small and enlarged in the first few iterations.
+BENCHMARK(BM_JsonArena)->Arg(256);
+BENCHMARK(BM_JsonArena)->Arg(JsonArena::kDefaultSize);
@@ -51,7 +51,15 @@ class BenchmarkFile final : public File {
     return static_cast<ssize_t>(ncopy);
   }
 
-  ssize_t Write(uint8_t*, size_t) override {
+  ssize_t ReadAt(uint8_t*, size_t, int64_t) override {
+    return 0;
+  }
+
+  ssize_t Write(const uint8_t*, size_t) override {
+    return 0;
+  }
+
+  ssize_t WriteAt(const uint8_t*, size_t, int64_t) override {
     return 0;
   }
 
@@ -67,6 +75,10 @@ class BenchmarkFile final : public File {
     return 0;
   }
 
+  bool Allocate(int64_t, bool) override {
+    return true;
+  }
+
  private:
   static constexpr size_t kBufSize = ts::PKT_SIZE * kNumPackets;
   std::string path_ = "<benchmark>";
@@ -74,6 +86,38 @@ class BenchmarkFile final : public File {
   uint8_t buf_[kBufSize];
 };
 
+class BenchmarkFileMapping final : public FileMapping {
+ public:
+  static constexpr size_t kNumPackets = 10000;
+
+  BenchmarkFileMapping(const uint8_t* data) : data_(data) {}
+  ~BenchmarkFileMapping() override {}
+
+  static void FillPackets(uint8_t* buf) {
+    for (size_t i = 0; i < kBufSize; i += ts::PKT_SIZE) {
+      ts::NullPacket.copyTo(reinterpret_cast<void*>(&buf[i]));
+    }
+  }
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  const uint8_t* data() const override {
+    return data_;
+  }
+
+  size_t size() const override {
+    return kBufSize;
+  }
+
+  static constexpr size_t kBufSize = ts::PKT_SIZE * kNumPackets;
+
+ private:
+  std::string path_ = "<benchmark>";
+  const uint8_t* data_;
+};
+
 class BenchmarkSink final : public PacketSink {
  public:
   BenchmarkSink() = default;
@@ -83,6 +127,18 @@ class BenchmarkSink final : public PacketSink {
   }
 };
 
+class BatchBenchmarkSink final : public PacketSink {
+ public:
+  BatchBenchmarkSink() = default;
+  ~BatchBenchmarkSink() override = default;
+  bool HandlePacket(const ts::TSPacket&) override {
+    return true;
+  }
+  bool HandlePackets(const ts::TSPacket*, size_t) override {
+    return true;
+  }
+};
+
 void BM_FileSource(benchmark::State& state) {
   auto file = std::make_unique<BenchmarkFile>();
   auto sink = std::make_unique<BenchmarkSink>();
@@ -94,6 +150,31 @@ void BM_FileSource(benchmark::State& state) {
   state.SetItemsProcessed(BenchmarkFile::kNumPackets * static_cast<int64_t>(state.iterations()));
 }
 
+void BM_FileSourceBatch(benchmark::State& state) {
+  auto file = std::make_unique<BenchmarkFile>();
+  auto sink = std::make_unique<BatchBenchmarkSink>();
+  FileSource src(std::move(file));
+  src.Connect(std::move(sink));
+  for (auto _ : state) {
+    src.FeedPackets();
+  }
+  state.SetItemsProcessed(BenchmarkFile::kNumPackets * static_cast<int64_t>(state.iterations()));
+}
+
+void BM_MmapFileSource(benchmark::State& state) {
+  static uint8_t buf[BenchmarkFileMapping::kBufSize];
+  BenchmarkFileMapping::FillPackets(buf);
+  for (auto _ : state) {
+    MmapFileSource src(std::make_unique<BenchmarkFileMapping>(buf));
+    src.Connect(std::make_unique<BatchBenchmarkSink>());
+    src.FeedPackets();
+  }
+  state.SetItemsProcessed(
+      BenchmarkFileMapping::kNumPackets * static_cast<int64_t>(state.iterations()));
+}
+
 }  // namespace
 
 BENCHMARK(BM_FileSource);
+BENCHMARK(BM_FileSourceBatch);
+BENCHMARK(BM_MmapFileSource);
@@ -0,0 +1,172 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include "packet_source.hh"
+#include "uring_file.hh"
+
+namespace {
+
+constexpr size_t kNumPackets = 100000;
+
+// A read-only file which reads a pipe with read(2) like PosixFile.
+class PipeFile final : public File {
+ public:
+  explicit PipeFile(int fd) : fd_(fd) {}
+  ~PipeFile() override {}
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  ssize_t Read(uint8_t* buf, size_t len) override {
+    return read(fd_, buf, len);
+  }
+
+  ssize_t ReadAt(uint8_t*, size_t, int64_t) override {
+    return -1;
+  }
+
+  ssize_t Write(const uint8_t*, size_t) override {
+    return -1;
+  }
+
+  ssize_t WriteAt(const uint8_t*, size_t, int64_t) override {
+    return -1;
+  }
+
+  bool Sync() override {
+    return false;
+  }
+
+  bool Trunc(int64_t) override {
+    return false;
+  }
+
+  int64_t Seek(int64_t, SeekMode) override {
+    return -1;
+  }
+
+  bool Allocate(int64_t, bool) override {
+    return false;
+  }
+
+ private:
+  std::string path_ = "<pipe>";
+  int fd_;
+};
+
+class BatchBenchmarkSink final : public PacketSink {
+ public:
+  BatchBenchmarkSink() = default;
+  ~BatchBenchmarkSink() override = default;
+  bool HandlePacket(const ts::TSPacket&) override {
+    return true;
+  }
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    for (size_t i = 0; i < num_packets; ++i) {
+      benchmark::DoNotOptimize(packets[i].getPID());
+    }
+    return true;
+  }
+};
+
+// Writes packets to a pipe on another thread, like a tuner command does.
+class PipeWriter {
+ public:
+  PipeWriter() {
+    // The writer stops with EPIPE when the reader is closed early.
+    std::signal(SIGPIPE, SIG_IGN);
+    if (pipe(fds_) != 0) {
+      std::abort();
+    }
+    thread_ = std::thread([fd = fds_[1]]() {
+      std::vector<uint8_t> buf(1024 * ts::PKT_SIZE);
+      for (size_t i = 0; i < buf.size(); i += ts::PKT_SIZE) {
+        ts::NullPacket.copyTo(&buf[i]);
+      }
+      size_t remaining = kNumPackets * ts::PKT_SIZE;
+      while (remaining > 0) {
+        auto n = write(fd, buf.data(), std::min(buf.size(), remaining));
+        if (n <= 0) {
+          break;
+        }
+        remaining -= static_cast<size_t>(n);
+      }
+      close(fd);
+    });
+  }
+
+  ~PipeWriter() {
+    close(fds_[0]);
+    thread_.join();
+  }
+
+  int read_fd() const {
+    return fds_[0];
+  }
+
+ private:
+  int fds_[2];
+  std::thread thread_;
+};
+
+void BM_PipeRead(benchmark::State& state) {
+  FileSourceOption option;
+  option.read_chunk_size = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    PipeWriter writer;
+    FileSource src(std::make_unique<PipeFile>(writer.read_fd()), option);
+    src.Connect(std::make_unique<BatchBenchmarkSink>());
+    src.FeedPackets();
+  }
+  state.SetBytesProcessed(kNumPackets * ts::PKT_SIZE * static_cast<int64_t>(state.iterations()));
+}
+
+#if MIRAKC_ARIB_HAS_IO_URING
+void BM_PipeIoUring(benchmark::State& state) {
+  for (auto _ : state) {
+    PipeWriter writer;
+    auto file = std::make_unique<UringFile>("/dev/fd/" + std::to_string(writer.read_fd()));
+    if (!file->Init()) {
+      state.SkipWithError("io_uring is not available");
+      break;
+    }
+    FileSource src(std::move(file));
+    src.Connect(std::make_unique<BatchBenchmarkSink>());
+    src.FeedPackets();
+  }
+  state.SetBytesProcessed(kNumPackets * ts::PKT_SIZE * static_cast<int64_t>(state.iterations()));
+}
+#endif
+
+}  // namespace
+
+// The second argument is as large as a buffer of UringFile.
+BENCHMARK(BM_PipeRead)->Arg(FileSource::kReadChunkSize)->Arg(4 * FileSource::kReadChunkSize);
+#if MIRAKC_ARIB_HAS_IO_URING
+BENCHMARK(BM_PipeIoUring);
+#endif
@@ -26,6 +26,7 @@
 #include "jsonl_source.hh"
 #include "logging.hh"
 #include "packet_sink.hh"
+#include "tsduck_helper.hh"
 
 namespace {
 
@@ -112,7 +113,7 @@ class AirtimeTracker final : public PacketSink,
     ts::MilliSecond start_time_unix = ConvertJstTimeToUnixTime(event.start_time);
     ts::MilliSecond duration = event.duration * ts::MilliSecPerSec;
 
-    rapidjson::Document json(rapidjson::kObjectType);
+    auto json = MakeDocument(rapidjson::kObjectType);
     auto& allocator = json.GetAllocator();
     json.AddMember("nid", eit.onetw_id, allocator);
     json.AddMember("tsid", eit.ts_id, allocator);
@@ -126,7 +127,7 @@ class AirtimeTracker final : public PacketSink,
 
   const AirtimeTrackerOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   bool done_ = false;
 };
 
@@ -183,6 +183,10 @@ class Clock final {
     return ready_ && baseline_.IsReady();
   }
 
+  const ClockBaseline& baseline() const {
+    return baseline_;
+  }
+
   ts::Time Now() const {
     if (IsReady()) {
       auto last_pcr = last_pcr_;
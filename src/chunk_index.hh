@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include "base.hh"
+#include "file.hh"
+#include "logging.hh"
+
+#define MIRAKC_ARIB_CHUNK_INDEX_DEBUG(...) MIRAKC_ARIB_DEBUG("chunk-index: " __VA_ARGS__)
+#define MIRAKC_ARIB_CHUNK_INDEX_INFO(...) MIRAKC_ARIB_INFO("chunk-index: " __VA_ARGS__)
+
+namespace {
+
+// Information about a chunk in a ring buffer file.
+struct ChunkIndexRecord final {
+  static constexpr uint32_t kStarted = 0x01;
+  static constexpr uint32_t kCompleted = 0x02;
+  static constexpr uint32_t kNoOffset = std::numeric_limits<uint32_t>::max();
+  static constexpr int64_t kNoPcr = -1;
+
+  uint64_t pos;
+  // Unix time in ms when started recording data in this chunk.  Valid if kStarted is set.
+  int64_t timestamp;
+  // Unix time in ms when the chunk was synced.  Valid if kCompleted is set.
+  int64_t end_timestamp;
+  // The first PCR in this chunk.
+  int64_t pcr;
+  uint32_t flags;
+  // The event being recorded when started recording data in this chunk.  0 if none.
+  uint16_t eid;
+  uint16_t reserved1;
+  // Offsets of the first packets in this chunk from the beginning of the chunk.
+  uint32_t pat_offset;
+  uint32_t pmt_offset;
+  uint32_t keyframe_offset;
+  uint32_t reserved2;
+};
+
+static_assert(sizeof(ChunkIndexRecord) == 56);
+
+// Layout of a chunk index file.
+//
+// All values are stored in the native byte order.  The file consists of a header followed by an
+// entry for each chunk in the ring buffer file.  Each entry is guarded by a sequence lock.  The
+// sequence number is odd while the entry is being updated, and readers must retry when it's odd
+// or changed while reading the entry.
+struct ChunkIndexHeader final {
+  static constexpr char kMagic[8] = {'M', 'I', 'R', 'A', 'K', 'C', 'I', 'X'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t chunk_size;
+  uint64_t num_chunks;
+  uint16_t sid;
+  uint16_t reserved1;
+  uint32_t reserved2;
+  // 1 + the index of the chunk completed last.  0 if no chunk has been completed.
+  std::atomic<uint64_t> last_chunk;
+  // The position in the ring buffer file up to which data has been written.  This is the ring
+  // buffer size when reaching the end of the ring buffer.  0 if no data has been written.
+  std::atomic<uint64_t> write_pos;
+  uint8_t reserved3[8];
+};
+
+struct ChunkIndexEntry final {
+  std::atomic<uint32_t> seq;
+  uint32_t reserved;
+  ChunkIndexRecord record;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(sizeof(ChunkIndexHeader) == 64);
+static_assert(sizeof(ChunkIndexEntry) == 64);
+
+inline size_t GetChunkIndexFileSize(size_t num_chunks) {
+  return sizeof(ChunkIndexHeader) + sizeof(ChunkIndexEntry) * num_chunks;
+}
+
+// Maintains a chunk index file next to a ring buffer file.
+//
+// The chunk index maps each chunk in the ring buffer file to the time and the event when started
+// recording data in the chunk, and offsets of packets useful for starting playback in the
+// middle of the ring buffer file.  The file is mapped in memory and shared with readers in other
+// processes.  Existing entries are kept if the file was created for the same ring buffer so that
+// readers can use them after restarting recording.  The position up to which data has been
+// written is also published so that readers can read the chunk being written.
+//
+// Offsets are collected by the positions of packets.  In the async write mode of RingFileSink,
+// packets in the next chunk may be written before the current chunk is synced.  So, offsets
+// collected for a chunk are kept in memory until the chunk is started.
+class ChunkIndex final {
+ public:
+  ChunkIndex(std::unique_ptr<MutableFileMapping>&& mapping, uint16_t sid, size_t chunk_size,
+      size_t num_chunks)
+      : mapping_(std::move(mapping)), chunk_size_(chunk_size), num_chunks_(num_chunks) {
+    MIRAKC_ARIB_ASSERT(mapping_->size() >= GetChunkIndexFileSize(num_chunks));
+    header_ = reinterpret_cast<ChunkIndexHeader*>(mapping_->data());
+    entries_ = reinterpret_cast<ChunkIndexEntry*>(mapping_->data() + sizeof(ChunkIndexHeader));
+    if (IsCompatible(sid)) {
+      MIRAKC_ARIB_CHUNK_INDEX_INFO("{}: Reuse entries", mapping_->path());
+    } else {
+      MIRAKC_ARIB_CHUNK_INDEX_INFO("{}: Initialize", mapping_->path());
+      std::memset(mapping_->data(), 0, GetChunkIndexFileSize(num_chunks));
+      std::memcpy(header_->magic, ChunkIndexHeader::kMagic, sizeof(header_->magic));
+      header_->version = ChunkIndexHeader::kVersion;
+      header_->entry_size = sizeof(ChunkIndexEntry);
+      header_->chunk_size = chunk_size;
+      header_->num_chunks = num_chunks;
+      header_->sid = sid;
+      (void)mapping_->Sync();
+    }
+  }
+
+  ~ChunkIndex() = default;
+
+  // Called for each packet written into the ring buffer file with its position.
+  void UpdatePosition(uint64_t pos) {
+    if (packet_chunk_ != kNoChunk && pos - packet_chunk_pos_ < chunk_size_) {  // fast path
+      return;
+    }
+    packet_chunk_ = pos / chunk_size_;
+    packet_chunk_pos_ = packet_chunk_ * chunk_size_;
+    ResetOffsets(&packet_record_);
+    packet_record_.pcr = ChunkIndexRecord::kNoPcr;
+  }
+
+  void SetPatOffset(uint64_t pos) {
+    UpdateOffset(pos, &ChunkIndexRecord::pat_offset);
+  }
+
+  void SetPmtOffset(uint64_t pos) {
+    UpdateOffset(pos, &ChunkIndexRecord::pmt_offset);
+  }
+
+  void SetKeyframeOffset(uint64_t pos) {
+    UpdateOffset(pos, &ChunkIndexRecord::keyframe_offset);
+  }
+
+  void SetPcr(uint64_t pos, int64_t pcr) {
+    UpdatePosition(pos);
+    if (packet_record_.pcr != ChunkIndexRecord::kNoPcr) {
+      return;
+    }
+    packet_record_.pcr = pcr;
+    if (started_chunk_ == packet_chunk_) {
+      Update(packet_chunk_, [pcr](ChunkIndexRecord& record) { record.pcr = pcr; });
+    }
+  }
+
+  // Called when started recording data in the chunk at `pos`.
+  void StartChunk(uint64_t pos, int64_t timestamp, uint16_t eid) {
+    MIRAKC_ARIB_ASSERT(pos % chunk_size_ == 0);
+    auto chunk = pos / chunk_size_;
+    MIRAKC_ARIB_ASSERT(chunk < num_chunks_);
+    started_chunk_ = chunk;
+    Update(chunk, [this, chunk, pos, timestamp, eid](ChunkIndexRecord& record) {
+      record.pos = pos;
+      record.timestamp = timestamp;
+      record.end_timestamp = 0;
+      record.flags = ChunkIndexRecord::kStarted;
+      record.eid = eid;
+      if (packet_chunk_ == chunk) {
+        // Offsets collected before the chunk is started.
+        record.pcr = packet_record_.pcr;
+        record.pat_offset = packet_record_.pat_offset;
+        record.pmt_offset = packet_record_.pmt_offset;
+        record.keyframe_offset = packet_record_.keyframe_offset;
+      } else {
+        record.pcr = ChunkIndexRecord::kNoPcr;
+        ResetOffsets(&record);
+      }
+    });
+    MIRAKC_ARIB_CHUNK_INDEX_DEBUG("Chunk#{}: Started: {}@{}", chunk, timestamp, pos);
+  }
+
+  // Called when the chunk which ends at `end_pos` has been synced.
+  void EndChunk(uint64_t end_pos, int64_t timestamp) {
+    MIRAKC_ARIB_ASSERT(end_pos != 0);
+    MIRAKC_ARIB_ASSERT(end_pos % chunk_size_ == 0);
+    auto chunk = end_pos / chunk_size_ - 1;
+    MIRAKC_ARIB_ASSERT(chunk < num_chunks_);
+    Update(chunk, [timestamp](ChunkIndexRecord& record) {
+      record.end_timestamp = timestamp;
+      record.flags |= ChunkIndexRecord::kCompleted;
+    });
+    header_->last_chunk.store(chunk + 1, std::memory_order_release);
+    if (packet_chunk_ == chunk) {
+      // No packet has been written into the next chunk yet.  Offsets collected in this chunk
+      // must not be used for the same chunk in the next lap.
+      packet_chunk_ = kNoChunk;
+    }
+    (void)mapping_->Sync();
+    MIRAKC_ARIB_CHUNK_INDEX_DEBUG("Chunk#{}: Completed: {}", chunk, timestamp);
+  }
+
+  // Called when data up to `pos` has been written into the ring buffer file.  The mapping is not
+  // synced because readers can read data written in the chunk being written before it's synced.
+  void SetWritePos(uint64_t pos) {
+    MIRAKC_ARIB_ASSERT(pos <= chunk_size_ * num_chunks_);
+    header_->write_pos.store(pos, std::memory_order_release);
+  }
+
+  // Reads an entry in the same way as readers in other processes.
+  static bool Read(const ChunkIndexEntry& entry, ChunkIndexRecord* record) {
+    static constexpr int kMaxRetries = 100;
+    for (int i = 0; i < kMaxRetries; ++i) {
+      auto seq = entry.seq.load(std::memory_order_acquire);
+      if (seq % 2 != 0) {
+        continue;
+      }
+      std::memcpy(record, &entry.record, sizeof(ChunkIndexRecord));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (entry.seq.load(std::memory_order_relaxed) == seq) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const ChunkIndexEntry& entry(size_t chunk) const {
+    MIRAKC_ARIB_ASSERT(chunk < num_chunks_);
+    return entries_[chunk];
+  }
+
+  const ChunkIndexHeader& header() const {
+    return *header_;
+  }
+
+ private:
+  static constexpr uint64_t kNoChunk = std::numeric_limits<uint64_t>::max();
+
+  static void ResetOffsets(ChunkIndexRecord* record) {
+    record->pat_offset = ChunkIndexRecord::kNoOffset;
+    record->pmt_offset = ChunkIndexRecord::kNoOffset;
+    record->keyframe_offset = ChunkIndexRecord::kNoOffset;
+  }
+
+  bool IsCompatible(uint16_t sid) const {
+    return std::memcmp(header_->magic, ChunkIndexHeader::kMagic, sizeof(header_->magic)) == 0 &&
+        header_->version == ChunkIndexHeader::kVersion &&
+        header_->entry_size == sizeof(ChunkIndexEntry) && header_->chunk_size == chunk_size_ &&
+        header_->num_chunks == num_chunks_ && header_->sid == sid;
+  }
+
+  void UpdateOffset(uint64_t pos, uint32_t ChunkIndexRecord::*field) {
+    UpdatePosition(pos);
+    if (packet_record_.*field != ChunkIndexRecord::kNoOffset) {
+      return;
+    }
+    auto offset = static_cast<uint32_t>(pos - packet_chunk_pos_);
+    packet_record_.*field = offset;
+    if (started_chunk_ == packet_chunk_) {
+      Update(packet_chunk_, [field, offset](ChunkIndexRecord& record) { record.*field = offset; });
+    }
+  }
+
+  template <typename Func>
+  void Update(uint64_t chunk, Func func) {
+    auto& entry = entries_[chunk];
+    auto seq = entry.seq.load(std::memory_order_relaxed);
+    entry.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    func(entry.record);
+    entry.seq.store(seq + 2, std::memory_order_release);
+  }
+
+  std::unique_ptr<MutableFileMapping> mapping_;
+  const uint64_t chunk_size_;
+  const uint64_t num_chunks_;
+  ChunkIndexHeader* header_ = nullptr;
+  ChunkIndexEntry* entries_ = nullptr;
+  // The chunk which packets are written into, and offsets collected in it.
+  uint64_t packet_chunk_ = kNoChunk;
+  uint64_t packet_chunk_pos_ = 0;
+  ChunkIndexRecord packet_record_ = {};
+  // The chunk started last.
+  uint64_t started_chunk_ = kNoChunk;
+
+  MIRAKC_ARIB_NON_COPYABLE(ChunkIndex);
+};
+
+// Reads a chunk index file maintained by ChunkIndex in another process.
+//
+// The file must be mapped with the changes made by the writer visible.
+class ChunkIndexReader final {
+ public:
+  ChunkIndexReader(std::unique_ptr<FileMapping>&& mapping, size_t chunk_size, size_t num_chunks)
+      : mapping_(std::move(mapping)), chunk_size_(chunk_size), num_chunks_(num_chunks) {}
+
+  ~ChunkIndexReader() = default;
+
+  // Returns true if the file was created for a ring buffer file having the same geometry.
+  bool IsValid() const {
+    if (mapping_->size() < GetChunkIndexFileSize(num_chunks_)) {
+      return false;
+    }
+    const auto& h = header();
+    return std::memcmp(h.magic, ChunkIndexHeader::kMagic, sizeof(h.magic)) == 0 &&
+        h.version == ChunkIndexHeader::kVersion && h.entry_size == sizeof(ChunkIndexEntry) &&
+        h.chunk_size == chunk_size_ && h.num_chunks == num_chunks_;
+  }
+
+  const std::string& path() const {
+    return mapping_->path();
+  }
+
+  uint16_t sid() const {
+    return header().sid;
+  }
+
+  // 1 + the index of the chunk completed last.  0 if no chunk has been completed.
+  uint64_t last_chunk() const {
+    return header().last_chunk.load(std::memory_order_acquire);
+  }
+
+  // The position in the ring buffer file up to which data has been written.  0 if unknown.
+  uint64_t write_pos() const {
+    return header().write_pos.load(std::memory_order_acquire);
+  }
+
+  bool Read(size_t chunk, ChunkIndexRecord* record) const {
+    MIRAKC_ARIB_ASSERT(chunk < num_chunks_);
+    const auto* entries =
+        reinterpret_cast<const ChunkIndexEntry*>(mapping_->data() + sizeof(ChunkIndexHeader));
+    return ChunkIndex::Read(entries[chunk], record);
+  }
+
+ private:
+  const ChunkIndexHeader& header() const {
+    return *reinterpret_cast<const ChunkIndexHeader*>(mapping_->data());
+  }
+
+  std::unique_ptr<FileMapping> mapping_;
+  const size_t chunk_size_;
+  const size_t num_chunks_;
+
+  MIRAKC_ARIB_NON_COPYABLE(ChunkIndexReader);
+};
+
+}  // namespace
@@ -20,6 +20,7 @@
 #include <map>
 #include <memory>
 #include <sstream>
+#include <string>
 
 #include <LibISDB/LibISDB.hpp>
 #include <LibISDB/EPG/EventInfo.hpp>
@@ -30,6 +31,7 @@
 #include <tsduck/tsduck.h>
 
 #include "base.hh"
+#include "eit_progress.hh"
 #include "jsonl_source.hh"
 #include "logging.hh"
 #include "packet_source.hh"
@@ -44,6 +46,7 @@ struct EitCollectorOption final {
   bool streaming = false;
   bool collect_actual = true;  // for backward-compatibility
   bool collect_others = true;  // for backward-compatibility
+  std::string progress_file;
 };
 
 class TableProgress {
@@ -459,8 +462,17 @@ class EitCollector final : public PacketSink,
 
   ~EitCollector() override {}
 
+  // Sections output in previous runs are loaded from the file and skipped.  The file is updated
+  // at the end.
+  void SetProgressFile(std::unique_ptr<EitProgressFile>&& progress_file) {
+    progress_file_ = std::move(progress_file);
+  }
+
   bool Start() override {
     start_time_ = ts::Time::CurrentUTC();
+    if (progress_file_ != nullptr) {
+      (void)progress_file_->Load(&versions_);
+    }
     return true;
   }
 
@@ -471,6 +483,28 @@ class EitCollector final : public PacketSink,
     auto ms = elapse % ts::MilliSecPerSec;
     MIRAKC_ARIB_INFO("Collected {} services, {} sections, {}:{:02d}.{:03d} elapsed",
         progress_.CountServices(), progress_.CountSections(), min, sec, ms);
+    auto flushed = FlushJson();
+    if (!flushed) {
+      output_failed_ = true;
+    }
+    if (progress_file_ != nullptr) {
+      MIRAKC_ARIB_INFO("Skipped {} sections output before", num_skipped_sections_);
+      // Sections which may not have been output must not be saved.
+      if (flushed) {
+        (void)progress_file_->Save(versions_);
+      }
+    }
+  }
+
+  int GetExitCode() const override {
+    if (output_failed_) {
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  size_t num_skipped_sections() const {
+    return num_skipped_sections_;
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
@@ -483,6 +517,10 @@ class EitCollector final : public PacketSink,
       MIRAKC_ARIB_ERROR("Timed out");
       return false;
     }
+    if (!FlushJsonIfExpired()) {
+      output_failed_ = true;
+      return false;
+    }
     return true;
   }
 
@@ -526,6 +564,14 @@ class EitCollector final : public PacketSink,
     if (CheckCollected(eit)) {
       return;
     }
+    if (versions_.Contain(eit)) {
+      MIRAKC_ARIB_DEBUG(
+          "Skip EIT: sid({:04X}) tid({:04X}) sec({:02X}) ver({:02d}), output before", eit.sid,
+          eit.tid, eit.section_number, eit.version);
+      num_skipped_sections_++;
+      UpdateProgress(eit);
+      return;
+    }
 
     MIRAKC_ARIB_INFO(
         "EIT: onid({:04X}) tsid({:04X}) sid({:04X}) tid({:04X}/{:02X})"
@@ -533,8 +579,11 @@ class EitCollector final : public PacketSink,
         eit.nid, eit.tsid, eit.sid, eit.tid, eit.last_table_id, eit.section_number,
         eit.segment_last_section_number, eit.last_section_number, eit.version);
 
-    WriteEitSection(eit);
+    auto written = WriteEitSection(eit);
     UpdateProgress(eit);
+    if (written && progress_file_ != nullptr) {
+      versions_.Update(eit);
+    }
   }
 
   void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
@@ -575,8 +624,8 @@ class EitCollector final : public PacketSink,
     return progress_.CheckCollected(eit);
   }
 
-  void WriteEitSection(const EitSection& eit) {
-    FeedDocument(MakeJsonValue(eit));
+  bool WriteEitSection(const EitSection& eit) {
+    return FeedJson([&eit](JsonWriter& writer) { WriteJson(writer, eit); });
   }
 
   void UpdateProgress(const EitSection& eit) {
@@ -608,13 +657,17 @@ class EitCollector final : public PacketSink,
 
   const EitCollectorOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   bool has_timestamp_ = false;
   ts::Time timestamp_;     // JST
   ts::Time last_updated_;  // JST
   CollectProgress progress_;
   bool show_progress_ = false;
   ts::Time start_time_;  // UTC
+  std::unique_ptr<EitProgressFile> progress_file_;
+  EitVersionTable versions_;
+  size_t num_skipped_sections_ = 0;
+  bool output_failed_ = false;
 
   MIRAKC_ARIB_NON_COPYABLE(EitCollector);
 };
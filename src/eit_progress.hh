@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "file.hh"
+#include "logging.hh"
+#include "tsduck_helper.hh"
+
+#define MIRAKC_ARIB_EIT_PROGRESS_DEBUG(...) MIRAKC_ARIB_DEBUG("eit-progress: " __VA_ARGS__)
+#define MIRAKC_ARIB_EIT_PROGRESS_INFO(...) MIRAKC_ARIB_INFO("eit-progress: " __VA_ARGS__)
+#define MIRAKC_ARIB_EIT_PROGRESS_WARN(...) MIRAKC_ARIB_WARN("eit-progress: " __VA_ARGS__)
+
+namespace {
+
+// Version numbers of EIT[schedule] sections which have been output.
+//
+// Version numbers are stored for each section in each table of each service.  A table is
+// identified by the service triple and the table ID.
+class EitVersionTable final {
+ public:
+  static constexpr size_t kNumSections = 256;
+  static constexpr uint8_t kNoVersion = 0xFF;
+
+  using Versions = std::array<uint8_t, kNumSections>;
+
+  EitVersionTable() = default;
+  ~EitVersionTable() = default;
+
+  // Returns true if the section has the same version number as the stored one.
+  bool Contain(const EitSection& eit) const {
+    auto it = tables_.find(MakeKey(eit));
+    if (it == tables_.end()) {
+      return false;
+    }
+    return it->second[eit.section_number] == eit.version;
+  }
+
+  void Update(const EitSection& eit) {
+    auto key = MakeKey(eit);
+    auto it = tables_.find(key);
+    if (it == tables_.end()) {
+      Versions versions;
+      versions.fill(kNoVersion);
+      it = tables_.emplace(key, versions).first;
+    }
+    it->second[eit.section_number] = eit.version;
+  }
+
+  void Set(uint64_t key, const Versions& versions) {
+    tables_[key] = versions;
+  }
+
+  const std::map<uint64_t, Versions>& tables() const {
+    return tables_;
+  }
+
+  size_t size() const {
+    return tables_.size();
+  }
+
+  // The lower 16 bits of the service triple are always zero.
+  static uint64_t MakeKey(const EitSection& eit) {
+    return eit.service_triple() | eit.tid;
+  }
+
+ private:
+  std::map<uint64_t, Versions> tables_;
+
+  MIRAKC_ARIB_NON_COPYABLE(EitVersionTable);
+};
+
+// Saves EitVersionTable into a file so that EitCollector can skip sections output in previous
+// runs.
+//
+// The file consists of a 16-byte header, entries for tables and the MPEG-2 CRC32 of the preceding
+// bytes.  All values are stored in the native byte order.
+//
+//   Header:
+//     magic        char[8]    "MIRAKCEP"
+//     version      uint32     1
+//     num_entries  uint32
+//
+//   Entry:
+//     key          uint64     The service triple | the table ID
+//     versions     uint8[256] The version number of each section, 0xFF if unknown
+//
+// The whole file is rewritten when saved.  A broken file is ignored when loaded.
+class EitProgressFile final {
+ public:
+  static constexpr char kMagic[8] = {'M', 'I', 'R', 'A', 'K', 'C', 'E', 'P'};
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 16;
+  static constexpr size_t kEntrySize = sizeof(uint64_t) + EitVersionTable::kNumSections;
+  static constexpr size_t kCrc32Size = sizeof(uint32_t);
+  // Large enough for all tables of all services in a TS stream.
+  static constexpr uint32_t kMaxEntries = 65536;
+
+  explicit EitProgressFile(std::unique_ptr<File>&& file) : file_(std::move(file)) {}
+
+  ~EitProgressFile() = default;
+
+  const std::string& path() const {
+    return file_->path();
+  }
+
+  // Returns false if the file is empty or broken.
+  bool Load(EitVersionTable* table) {
+    uint8_t header[kHeaderSize];
+    auto n = file_->ReadAt(header, sizeof(header), 0);
+    if (n != static_cast<ssize_t>(sizeof(header))) {
+      MIRAKC_ARIB_EIT_PROGRESS_DEBUG("{}: No progress", path());
+      return false;
+    }
+    uint32_t version;
+    uint32_t num_entries;
+    std::memcpy(&version, header + 8, sizeof(version));
+    std::memcpy(&num_entries, header + 12, sizeof(num_entries));
+    if (std::memcmp(header, kMagic, sizeof(kMagic)) != 0 || version != kVersion ||
+        num_entries > kMaxEntries) {
+      MIRAKC_ARIB_EIT_PROGRESS_WARN("{}: Invalid header", path());
+      return false;
+    }
+
+    std::vector<uint8_t> data(GetFileSize(num_entries));
+    n = file_->ReadAt(data.data(), data.size(), 0);
+    if (n != static_cast<ssize_t>(data.size())) {
+      MIRAKC_ARIB_EIT_PROGRESS_WARN("{}: Truncated", path());
+      return false;
+    }
+    uint32_t crc32;
+    auto crc32_pos = data.size() - kCrc32Size;
+    std::memcpy(&crc32, data.data() + crc32_pos, sizeof(crc32));
+    if (crc32 != ts::CRC32(data.data(), crc32_pos).value()) {
+      MIRAKC_ARIB_EIT_PROGRESS_WARN("{}: CRC32 mismatch", path());
+      return false;
+    }
+
+    const auto* p = data.data() + kHeaderSize;
+    for (uint32_t i = 0; i < num_entries; ++i) {
+      uint64_t key;
+      EitVersionTable::Versions versions;
+      std::memcpy(&key, p, sizeof(key));
+      std::memcpy(versions.data(), p + sizeof(key), versions.size());
+      table->Set(key, versions);
+      p += kEntrySize;
+    }
+    MIRAKC_ARIB_EIT_PROGRESS_INFO("{}: Loaded {} tables", path(), num_entries);
+    return true;
+  }
+
+  bool Save(const EitVersionTable& table) {
+    auto num_entries = static_cast<uint32_t>(table.size());
+    if (num_entries > kMaxEntries) {
+      MIRAKC_ARIB_EIT_PROGRESS_WARN("{}: Too many tables: {}", path(), num_entries);
+      return false;
+    }
+
+    std::vector<uint8_t> data(GetFileSize(num_entries));
+    std::memcpy(data.data(), kMagic, sizeof(kMagic));
+    std::memcpy(data.data() + 8, &kVersion, sizeof(kVersion));
+    std::memcpy(data.data() + 12, &num_entries, sizeof(num_entries));
+    auto* p = data.data() + kHeaderSize;
+    for (const auto& pair : table.tables()) {
+      std::memcpy(p, &pair.first, sizeof(pair.first));
+      std::memcpy(p + sizeof(pair.first), pair.second.data(), pair.second.size());
+      p += kEntrySize;
+    }
+    auto crc32_pos = data.size() - kCrc32Size;
+    auto crc32 = ts::CRC32(data.data(), crc32_pos).value();
+    std::memcpy(data.data() + crc32_pos, &crc32, sizeof(crc32));
+
+    auto n = file_->WriteAt(data.data(), data.size(), 0);
+    if (n != static_cast<ssize_t>(data.size())) {
+      MIRAKC_ARIB_EIT_PROGRESS_WARN("{}: Failed to write", path());
+      return false;
+    }
+    // Remove garbage left by a larger progress saved before.
+    if (!file_->Trunc(static_cast<int64_t>(data.size()))) {
+      return false;
+    }
+    if (!file_->Sync()) {
+      return false;
+    }
+    MIRAKC_ARIB_EIT_PROGRESS_INFO("{}: Saved {} tables", path(), num_entries);
+    return true;
+  }
+
+  static size_t GetFileSize(uint32_t num_entries) {
+    return kHeaderSize + static_cast<size_t>(num_entries) * kEntrySize + kCrc32Size;
+  }
+
+ private:
+  std::unique_ptr<File> file_;
+
+  MIRAKC_ARIB_NON_COPYABLE(EitProgressFile);
+};
+
+}  // namespace
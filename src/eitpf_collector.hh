@@ -52,11 +52,28 @@ class EitpfCollector final : public PacketSink,
 
   virtual ~EitpfCollector() override {}
 
+  void End() override {
+    if (!FlushJson()) {
+      output_failed_ = true;
+    }
+  }
+
+  int GetExitCode() const override {
+    if (output_failed_) {
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
   bool HandlePacket(const ts::TSPacket& packet) override {
     demux_.feedPacket(packet);
     if (Done()) {
       return false;
     }
+    if (!FlushJsonIfExpired()) {
+      output_failed_ = true;
+      return false;
+    }
     return true;
   }
 
@@ -149,14 +166,15 @@ class EitpfCollector final : public PacketSink,
   }
 
   void WriteEitSection(EitSection& eit) {
-    FeedDocument(MakeJsonValue(eit));
+    FeedJson([&eit](JsonWriter& writer) { WriteJson(writer, eit); });
   }
 
   const EitpfCollectorOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   std::map<uint64_t, uint8_t> present_versions_;
   std::map<uint64_t, uint8_t> following_versions_;
+  bool output_failed_ = false;
 };
 
 }  // namespace
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "logging.hh"
+#include "packet_sink.hh"
+
+#define MIRAKC_ARIB_FANOUT_DEBUG(...) MIRAKC_ARIB_DEBUG("fanout: " __VA_ARGS__)
+#define MIRAKC_ARIB_FANOUT_INFO(...) MIRAKC_ARIB_INFO("fanout: " __VA_ARGS__)
+#define MIRAKC_ARIB_FANOUT_ERROR(...) MIRAKC_ARIB_ERROR("fanout: " __VA_ARGS__)
+
+namespace {
+
+// Feeds the same packets to multiple pipelines.
+//
+// Each batch of packets is fed to pipelines in the order of Connect() calls.  Packets are not
+// copied.  A pipeline which stops is ended and destroyed immediately so that its outputs are
+// closed, and other pipelines keep going.  FanoutSink stops when all pipelines stop.
+//
+// The exit code is the first non-zero exit code of the pipelines in the order of Connect() calls.
+class FanoutSink final : public PacketSink {
+ public:
+  FanoutSink() = default;
+  ~FanoutSink() override = default;
+
+  void Connect(const std::string& name, std::unique_ptr<PacketSink>&& sink) {
+    pipelines_.push_back(std::make_unique<Pipeline>(name, std::move(sink)));
+  }
+
+  bool Start() override {
+    for (auto& pipeline : pipelines_) {
+      MIRAKC_ARIB_ASSERT(pipeline->sink != nullptr);
+      if (!pipeline->sink->Start()) {
+        MIRAKC_ARIB_FANOUT_ERROR("{}: Failed to start", pipeline->name);
+        // End() must not be called if Start() fails.
+        pipeline->exit_code = EXIT_FAILURE;
+        pipeline->sink.reset();
+      }
+    }
+    return num_active_pipelines() > 0;
+  }
+
+  void End() override {
+    for (auto& pipeline : pipelines_) {
+      if (pipeline->sink != nullptr) {
+        StopPipeline(*pipeline);
+      }
+    }
+  }
+
+  int GetExitCode() const override {
+    for (const auto& pipeline : pipelines_) {
+      if (pipeline->exit_code != EXIT_SUCCESS) {
+        return pipeline->exit_code;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    for (auto& pipeline : pipelines_) {
+      if (pipeline->sink == nullptr) {
+        continue;
+      }
+      if (!pipeline->sink->HandlePackets(packets, num_packets)) {
+        StopPipeline(*pipeline);
+      }
+    }
+    return num_active_pipelines() > 0;
+  }
+
+ private:
+  struct Pipeline {
+    std::string name;
+    std::unique_ptr<PacketSink> sink;
+    int exit_code = EXIT_SUCCESS;
+
+    Pipeline(const std::string& name, std::unique_ptr<PacketSink>&& sink)
+        : name(name), sink(std::move(sink)) {}
+  };
+
+  void StopPipeline(Pipeline& pipeline) {
+    pipeline.sink->End();
+    pipeline.exit_code = pipeline.sink->GetExitCode();
+    // Close outputs of the pipeline so that its reader can detect EOF.
+    pipeline.sink.reset();
+    MIRAKC_ARIB_FANOUT_INFO("{}: Ended with exit-code({})", pipeline.name, pipeline.exit_code);
+  }
+
+  size_t num_active_pipelines() const {
+    size_t n = 0;
+    for (const auto& pipeline : pipelines_) {
+      if (pipeline->sink != nullptr) {
+        n++;
+      }
+    }
+    return n;
+  }
+
+  std::vector<std::unique_ptr<Pipeline>> pipelines_;
+
+  MIRAKC_ARIB_NON_COPYABLE(FanoutSink);
+};
+
+}  // namespace
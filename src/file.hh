@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <algorithm>
+
 #include "base.hh"
 
 namespace {
@@ -33,13 +35,98 @@ class File {
   virtual ~File() = default;
   virtual const std::string& path() const = 0;
   virtual ssize_t Read(uint8_t* buf, size_t len) = 0;
-  virtual ssize_t Write(uint8_t* buf, size_t len) = 0;
+  // Reads data at the offset without changing the file position.
+  virtual ssize_t ReadAt(uint8_t* buf, size_t len, int64_t offset) = 0;
+  virtual ssize_t Write(const uint8_t* buf, size_t len) = 0;
+  // Writes data at the offset without changing the file position.
+  virtual ssize_t WriteAt(const uint8_t* buf, size_t len, int64_t offset) = 0;
   virtual bool Sync() = 0;
   virtual bool Trunc(int64_t size) = 0;
   virtual int64_t Seek(int64_t offset, SeekMode mode) = 0;
+  // Allocates disk space for the first `size` bytes.  The file size is not changed if
+  // `keep_size` is true.
+  virtual bool Allocate(int64_t size, bool keep_size) = 0;
+
+  // Returns true if the file reads data into its own buffer and supports Peek() and Consume().
+  virtual bool CanPeek() const {
+    return false;
+  }
+
+  // Sets `*data` to data read into the buffer of the file without copying it.  Returns the number
+  // of bytes available, 0 on EOF, or -1 on error.  The data is not consumed until Consume() is
+  // called, and it's valid until the next call to Peek() or Read().
+  virtual ssize_t Peek(const uint8_t**) {
+    return -1;
+  }
+
+  // Consumes `len` bytes returned by Peek().
+  virtual void Consume(size_t) {}
+
+  // Returns the capacity of the pipe if the file is a pipe.  Otherwise, returns 0.
+  virtual size_t GetPipeSize() const {
+    return 0;
+  }
+
+  // Returns the file descriptor if the file has one.  Otherwise, returns -1.
+  virtual int GetFd() const {
+    return -1;
+  }
+
+  // Copies data at the offset to `out` without changing the file position.  Returns the number
+  // of bytes copied, which may be less than `len`.  Implementations may copy the data without
+  // moving it through the user space.
+  virtual ssize_t CopyTo(File* out, size_t len, int64_t offset) {
+    uint8_t buf[kCopyBufferSize];
+    auto nread = ReadAt(buf, std::min(len, kCopyBufferSize), offset);
+    if (nread <= 0) {
+      return nread;
+    }
+    size_t nwritten = 0;
+    while (nwritten < static_cast<size_t>(nread)) {
+      auto n = out->Write(buf + nwritten, static_cast<size_t>(nread) - nwritten);
+      if (n <= 0) {
+        return -1;
+      }
+      nwritten += static_cast<size_t>(n);
+    }
+    return nread;
+  }
+
+ protected:
+  static constexpr size_t kCopyBufferSize = 16 * kBlockSize;
 
  private:
   MIRAKC_ARIB_NON_COPYABLE(File);
 };
 
+// A read-only view of the whole content of a file.
+//
+// The content must not be modified while the mapping is alive.
+class FileMapping {
+ public:
+  FileMapping() = default;
+  virtual ~FileMapping() = default;
+  virtual const std::string& path() const = 0;
+  virtual const uint8_t* data() const = 0;
+  virtual size_t size() const = 0;
+
+ private:
+  MIRAKC_ARIB_NON_COPYABLE(FileMapping);
+};
+
+// A writable view of a file shared with other processes.
+class MutableFileMapping {
+ public:
+  MutableFileMapping() = default;
+  virtual ~MutableFileMapping() = default;
+  virtual const std::string& path() const = 0;
+  virtual uint8_t* data() = 0;
+  virtual size_t size() const = 0;
+  // Schedules writing modified pages back to the file.
+  virtual bool Sync() = 0;
+
+ private:
+  MIRAKC_ARIB_NON_COPYABLE(MutableFileMapping);
+};
+
 }  // namespace
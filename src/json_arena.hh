@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include <rapidjson/document.h>
+
+#include "base.hh"
+#include "logging.hh"
+
+namespace {
+
+// A memory arena for building rapidjson documents one by one.
+//
+// Values of a document are allocated from a single buffer owned by the arena, and the buffer is
+// reused for the next document.  So, no memory is allocated from the heap in the steady state.
+// When a document doesn't fit in the buffer, the allocator allocates extra chunks from the heap
+// and the buffer is enlarged before the next document.
+class JsonArena final {
+ public:
+  using Allocator = rapidjson::Document::AllocatorType;
+
+  static constexpr size_t kDefaultSize = 16384;
+
+  // The buffer is allocated when it's used for the first time.
+  explicit JsonArena(size_t size = kDefaultSize) : size_(size) {}
+
+  ~JsonArena() = default;
+
+  // Returns an allocator for the next document.
+  //
+  // Values allocated with the allocator returned in the previous call must not be used after
+  // this call.
+  Allocator& Reset() {
+    if (allocator_.has_value()) {
+      auto used = allocator_->Size();
+      auto overflowed = allocator_->Capacity() > capacity_;
+      allocator_.reset();
+      if (overflowed) {
+        num_overflows_++;
+        size_ = std::max(size_ * 2, used * 2);
+        buffer_.reset();
+        MIRAKC_ARIB_DEBUG("json-arena: Enlarge to {} bytes", size_);
+      }
+    }
+    if (buffer_ == nullptr) {
+      buffer_ = std::make_unique<uint64_t[]>(NumWords(size_));
+    }
+    allocator_.emplace(buffer_.get(), size_);
+    capacity_ = allocator_->Capacity();
+    num_documents_++;
+    return *allocator_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // The number of allocators returned from Reset().
+  size_t num_documents() const {
+    return num_documents_;
+  }
+
+  // The number of documents which needed memory allocated from the heap.  A document is counted
+  // when the next document starts.
+  size_t num_overflows() const {
+    return num_overflows_;
+  }
+
+ private:
+  // The buffer is allocated as an array of uint64_t for the alignment.
+  static size_t NumWords(size_t size) {
+    return (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  }
+
+  size_t size_;
+  std::unique_ptr<uint64_t[]> buffer_;
+  std::optional<Allocator> allocator_;
+  size_t capacity_ = 0;
+  size_t num_documents_ = 0;
+  size_t num_overflows_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(JsonArena);
+};
+
+}  // namespace
@@ -17,14 +17,41 @@
 
 #pragma once
 
-#include <iostream>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <unistd.h>
 
 #include <rapidjson/document.h>
-#include <rapidjson/ostreamwrapper.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include "base.hh"
+#include "logging.hh"
+
 namespace {
 
+using JsonWriter = rapidjson::Writer<rapidjson::StringBuffer>;
+
+// A non-owning reference to a function which writes a JSON value with SAX events.
+class JsonGenerator final {
+ public:
+  template <typename Write>
+  explicit JsonGenerator(const Write& write)
+      : write_(&write), invoke_([](const void* write, JsonWriter& writer) {
+          (*static_cast<const Write*>(write))(writer);
+        }) {}
+
+  void operator()(JsonWriter& writer) const {
+    invoke_(write_, writer);
+  }
+
+ private:
+  const void* write_;
+  void (*invoke_)(const void*, JsonWriter&);
+};
+
 class JsonlSink {
  public:
   JsonlSink() = default;
@@ -32,20 +59,142 @@ class JsonlSink {
   virtual bool HandleDocument(const rapidjson::Document&) {
     return true;
   }
+
+  // Writes buffered lines if any.
+  virtual bool Flush() {
+    return true;
+  }
+
+  // Writes buffered lines if the deadline for them has passed.  Sources call this periodically
+  // so that buffered lines are delivered even while no line is added.
+  virtual bool FlushIfExpired() {
+    return true;
+  }
+
+  // By default, a document is built from the SAX events and passed to HandleDocument().  Sinks
+  // serializing JSON values should override this so that no document is built.
+  virtual bool HandleJson(const JsonGenerator& generator) {
+    rapidjson::StringBuffer buffer;
+    JsonWriter writer(buffer);
+    generator(writer);
+    rapidjson::Document doc;
+    doc.Parse(buffer.GetString(), buffer.GetSize());
+    MIRAKC_ARIB_ASSERT(!doc.HasParseError());
+    return HandleDocument(doc);
+  }
 };
 
+struct StdoutJsonlSinkOption final {
+  // Buffered lines are written when the size of the buffer reaches this.
+  size_t flush_size = 65536;
+  // Buffered lines are written when this time has passed since the first line was buffered.
+  // This is checked when a line is added and when FlushIfExpired() is called.
+  std::chrono::milliseconds flush_interval{1000};
+  // Write each line immediately.  Used for streaming outputs which must be delivered with low
+  // latency.
+  bool flush_each = false;
+};
+
+// Writes each document as a line to STDOUT or a file descriptor.
+//
+// Lines are accumulated in a single buffer reused for the whole lifetime, and written with a
+// single write(2) when the buffer gets large enough, when the deadline has come, or when Flush()
+// is called.  Sources check the deadline for each packet with FlushIfExpired() so that lines are
+// not kept in the buffer while no line is added.  Remaining lines are written when the sink is
+// destroyed.
 class StdoutJsonlSink final : public JsonlSink {
  public:
-  StdoutJsonlSink() = default;
-  ~StdoutJsonlSink() override = default;
+  explicit StdoutJsonlSink(const StdoutJsonlSinkOption& option = {}) : option_(option) {}
+
+  // Takes the ownership of `fd`.
+  explicit StdoutJsonlSink(int fd, const StdoutJsonlSinkOption& option = {})
+      : option_(option), fd_(fd) {}
+
+  ~StdoutJsonlSink() override {
+    (void)Flush();
+    if (fd_ != STDOUT_FILENO) {
+      close(fd_);
+    }
+  }
 
   bool HandleDocument(const rapidjson::Document& doc) override {
-    rapidjson::OStreamWrapper stream(std::cout);
-    rapidjson::Writer<rapidjson::OStreamWrapper> writer(stream);
+    JsonWriter writer(buffer_);
     doc.Accept(writer);
-    std::cout << std::endl;
+    return EndLine();
+  }
+
+  bool HandleJson(const JsonGenerator& generator) override {
+    JsonWriter writer(buffer_);
+    generator(writer);
+    return EndLine();
+  }
+
+  bool Flush() override {
+    has_deadline_ = false;
+    if (buffer_.GetSize() == 0) {
+      return true;
+    }
+    auto ok = Write(buffer_.GetString(), buffer_.GetSize());
+    buffer_.Clear();
+    num_writes_++;
+    return ok;
+  }
+
+  bool FlushIfExpired() override {
+    if (!has_deadline_ || Clock::now() < deadline_) {
+      return true;
+    }
+    return Flush();
+  }
+
+  size_t num_writes() const {
+    return num_writes_;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  bool EndLine() {
+    buffer_.Put('\n');
+    if (option_.flush_each || buffer_.GetSize() >= option_.flush_size) {
+      return Flush();
+    }
+    auto now = Clock::now();
+    if (!has_deadline_) {
+      deadline_ = now + option_.flush_interval;
+      has_deadline_ = true;
+      return true;
+    }
+    if (now >= deadline_) {
+      return Flush();
+    }
     return true;
   }
+
+  bool Write(const char* data, size_t size) {
+    while (size > 0) {
+      auto res = write(fd_, data, size);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        MIRAKC_ARIB_ERROR("Failed to write JSON: {} ({})", std::strerror(errno), errno);
+        return false;
+      }
+      data += res;
+      size -= static_cast<size_t>(res);
+    }
+    return true;
+  }
+
+  const StdoutJsonlSinkOption option_;
+  int fd_ = STDOUT_FILENO;
+  rapidjson::StringBuffer buffer_;
+  Clock::time_point deadline_;
+  bool has_deadline_ = false;
+  size_t num_writes_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(StdoutJsonlSink);
 };
 
 }  // namespace
@@ -17,7 +17,12 @@
 
 #pragma once
 
+#include <memory>
+
+#include <rapidjson/document.h>
+
 #include "base.hh"
+#include "json_arena.hh"
 #include "jsonl_sink.hh"
 
 namespace {
@@ -32,13 +37,44 @@ class JsonlSource {
   }
 
  protected:
+  // Makes a document allocating values from the arena of this source.
+  //
+  // The document must be fed before the next call.  Memory used for the previous document is
+  // reused for the new one.
+  rapidjson::Document MakeDocument(rapidjson::Type type) {
+    return rapidjson::Document(type, &arena_.Reset());
+  }
+
+  const JsonArena& arena() const {
+    return arena_;
+  }
+
   bool FeedDocument(const rapidjson::Document& doc) {
     MIRAKC_ARIB_ASSERT(sink_ != nullptr);
     return sink_->HandleDocument(doc);
   }
 
+  // `write` is called with a JsonWriter and must write a single JSON value.
+  template <typename Write>
+  bool FeedJson(const Write& write) {
+    MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    return sink_->HandleJson(JsonGenerator(write));
+  }
+
+  bool FlushJson() {
+    MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    return sink_->Flush();
+  }
+
+  // Call this for each packet so that buffered lines are written by the deadline.
+  bool FlushJsonIfExpired() {
+    MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    return sink_->FlushIfExpired();
+  }
+
  private:
   std::unique_ptr<JsonlSink> sink_;
+  JsonArena arena_;
 
   MIRAKC_ARIB_NON_COPYABLE(JsonlSource);
 };
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "logging.hh"
+
+#define MIRAKC_ARIB_KEYFRAME_DETECTOR_DEBUG(...) \
+  MIRAKC_ARIB_DEBUG("keyframe-detector: " __VA_ARGS__)
+
+namespace {
+
+enum class VideoCodec {
+  kUnknown,
+  kMpeg2,
+  kH264,
+  kHevc,
+};
+
+inline VideoCodec GetVideoCodec(uint8_t stream_type) {
+  switch (stream_type) {
+    case ts::ST_MPEG1_VIDEO:
+    case ts::ST_MPEG2_VIDEO:
+      return VideoCodec::kMpeg2;
+    case ts::ST_AVC_VIDEO:
+      return VideoCodec::kH264;
+    case ts::ST_HEVC_VIDEO:
+      return VideoCodec::kHevc;
+    default:
+      return VideoCodec::kUnknown;
+  }
+}
+
+// Detects video PES packets starting at a random access point.
+//
+// Start codes in the elementary stream are scanned from the beginning of each PES packet until a
+// start code of a parameter set or a picture is found:
+//
+//   MPEG-2: sequence_header or group_of_pictures_header
+//   H.264:  SPS or IDR slice
+//   HEVC:   VPS, SPS or IRAP slice
+//
+// Broadcasters put these in front of I-pictures, and a decoder can start decoding from the
+// beginning of such a PES packet.  Scanning stops at the first picture in the PES packet so that
+// most packets in the video stream are not scanned.  Start codes spanning multiple TS packets are
+// detected.
+class KeyframeDetector final {
+ public:
+  KeyframeDetector() = default;
+  ~KeyframeDetector() = default;
+
+  void SetStream(ts::PID pid, VideoCodec codec) {
+    if (pid_ == pid && codec_ == codec) {
+      return;
+    }
+    MIRAKC_ARIB_KEYFRAME_DETECTOR_DEBUG("Video#{:04X} codec({})", pid, static_cast<int>(codec));
+    pid_ = pid;
+    codec_ = codec;
+    scanning_ = false;
+  }
+
+  ts::PID pid() const {
+    return pid_;
+  }
+
+  size_t num_keyframes() const {
+    return num_keyframes_;
+  }
+
+  // Returns the position of the TS packet which starts the PES packet containing a keyframe.
+  // The position is returned only once for each PES packet.
+  std::optional<uint64_t> Feed(const ts::TSPacket& packet, uint64_t pos) {
+    if (codec_ == VideoCodec::kUnknown || packet.getPID() != pid_ || !packet.hasPayload() ||
+        packet.isScrambled()) {
+      return std::nullopt;
+    }
+
+    const uint8_t* data = packet.getPayload();
+    size_t size = packet.getPayloadSize();
+
+    if (packet.getPUSI()) {
+      scanning_ = false;
+      // PES header without the optional fields.
+      static constexpr size_t kPesHeaderSize = 9;
+      if (size < kPesHeaderSize || data[0] != 0x00 || data[1] != 0x00 || data[2] != 0x01) {
+        return std::nullopt;
+      }
+      // A PES header spanning TS packets is very rare.  Such a PES packet is simply ignored.
+      size_t header_size = kPesHeaderSize + data[8];
+      if (header_size > size) {
+        return std::nullopt;
+      }
+      data += header_size;
+      size -= header_size;
+      pes_pos_ = pos;
+      window_ = kInitialWindow;
+      scanning_ = true;
+    }
+
+    if (!scanning_) {
+      return std::nullopt;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+      window_ = (window_ << 8) | data[i];
+      if ((window_ & 0xFFFFFF00) != 0x00000100) {
+        continue;
+      }
+      switch (Classify(data[i])) {
+        case StartCode::kKeyframe:
+          scanning_ = false;
+          num_keyframes_++;
+          return pes_pos_;
+        case StartCode::kPicture:
+          scanning_ = false;
+          return std::nullopt;
+        case StartCode::kOther:
+          break;
+      }
+    }
+    return std::nullopt;
+  }
+
+ private:
+  static constexpr uint32_t kInitialWindow = 0xFFFFFFFF;
+
+  enum class StartCode {
+    kKeyframe,
+    kPicture,
+    kOther,
+  };
+
+  // `code` is the byte following a start code prefix (0x000001).
+  StartCode Classify(uint8_t code) const {
+    switch (codec_) {
+      case VideoCodec::kMpeg2:
+        switch (code) {
+          case 0xB3:  // sequence_header_code
+          case 0xB8:  // group_start_code
+            return StartCode::kKeyframe;
+          case 0x00:  // picture_start_code
+            return StartCode::kPicture;
+          default:
+            return StartCode::kOther;
+        }
+      case VideoCodec::kH264:
+        switch (code & 0x1F) {  // nal_unit_type
+          case 5:  // IDR slice
+          case 7:  // SPS
+            return StartCode::kKeyframe;
+          case 1:  // non-IDR slice
+            return StartCode::kPicture;
+          default:
+            return StartCode::kOther;
+        }
+      case VideoCodec::kHevc: {
+        auto type = (code >> 1) & 0x3F;  // nal_unit_type
+        if ((type >= 16 && type <= 23) || type == 32 || type == 33) {  // IRAP, VPS, SPS
+          return StartCode::kKeyframe;
+        }
+        if (type <= 9) {  // non-IRAP slices
+          return StartCode::kPicture;
+        }
+        return StartCode::kOther;
+      }
+      default:
+        return StartCode::kOther;
+    }
+  }
+
+  ts::PID pid_ = ts::PID_NULL;
+  VideoCodec codec_ = VideoCodec::kUnknown;
+  uint64_t pes_pos_ = 0;
+  uint32_t window_ = kInitialWindow;
+  size_t num_keyframes_ = 0;
+  bool scanning_ = false;
+
+  MIRAKC_ARIB_NON_COPYABLE(KeyframeDetector);
+};
+
+}  // namespace
@@ -27,7 +27,7 @@
 namespace {
 
 inline void InitLogger(const std::string& name) {
-  auto logger = spdlog::stderr_color_st(name);
+  auto logger = spdlog::stderr_color_mt(name);
   const auto* log_no_timestamp = std::getenv("MIRAKC_ARIB_LOG_NO_TIMESTAMP");
   if (log_no_timestamp != nullptr && std::string(log_no_timestamp) == "1") {
     logger->set_pattern("%^%L%$ %n %v");
@@ -209,10 +209,27 @@ class LogoCollector final : public PacketSink,
   void End() override {
     CloseEngine();
     source_bridge_ = nullptr;
+    if (!FlushJson()) {
+      output_failed_ = true;
+    }
+  }
+
+  int GetExitCode() const override {
+    if (output_failed_) {
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
-    return source_bridge_->HandlePacket(packet);
+    if (!source_bridge_->HandlePacket(packet)) {
+      return false;
+    }
+    if (!FlushJsonIfExpired()) {
+      output_failed_ = true;
+      return false;
+    }
+    return true;
   }
 
  private:
@@ -240,7 +257,7 @@ class LogoCollector final : public PacketSink,
   rapidjson::Document MakeJsonValue(const LibISDB::LogoDownloaderFilter::LogoData& logo) {
     std::string data = MakeBase64Png(logo.pData, logo.DataSize);
 
-    rapidjson::Document json(rapidjson::kObjectType);
+    auto json = MakeDocument(rapidjson::kObjectType);
     auto& allocator = json.GetAllocator();
 
     json.AddMember("type", logo.LogoType, allocator);
@@ -266,6 +283,7 @@ class LogoCollector final : public PacketSink,
 
   LibISDBLogger logger_;
   LibISDBSourceBridge* source_bridge_ = nullptr;  // not owned
+  bool output_failed_ = false;
 
   MIRAKC_ARIB_NON_COPYABLE(LogoCollector);
 };
@@ -15,42 +15,63 @@
 // not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
 // 02110-1301, USA.
 
+#include <algorithm>
 #include <cerrno>
+#include <csignal>
 #include <cstddef>
+#include <cstdlib>
 #include <cstring>
+#include <limits>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <docopt/docopt.h>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
+#include <rapidjson/document.h>
 #include <spdlog/cfg/env.h>
 #include <tsduck/tsduck.h>
 
 #include "airtime_tracker.hh"
 #include "base.hh"
+#include "chunk_index.hh"
 #include "eit_collector.hh"
 #include "eitpf_collector.hh"
+#include "fanout_sink.hh"
 #include "file.hh"
 #include "jsonl_sink.hh"
 #include "logging.hh"
 #include "logo_collector.hh"
+#include "multi_service_filter.hh"
 #include "packet_sink.hh"
 #include "packet_source.hh"
 #include "pcr_synchronizer.hh"
+#include "pipelined_sink.hh"
 #include "program_filter.hh"
 #include "program_metadata_filter.hh"
+#include "recorder_state.hh"
 #include "ring_file_sink.hh"
+#include "ring_reader.hh"
 #include "service_filter.hh"
 #include "service_recorder.hh"
 #include "service_scanner.hh"
 #include "start_seeker.hh"
 #include "tsduck_helper.hh"
 #include "pes_printer.hh"
+#include "uring_file.hh"
+#include "vmsplice_sink.hh"
 
 namespace {
 
@@ -70,19 +91,22 @@ Tools to process ARIB TS streams.
 Usage:
   mirakc-arib (-h | --help)
     [(scan-services | sync-clocks | collect-eits | collect-eitpf | collect-logos |
-      filter-service | filter-program | filter-program-metadata |
-      record-service | track-airtime | seek-start | print-pes)]
+      filter-service | filter-services | filter-program | filter-program-metadata |
+      record-service | record-services | read-ring | track-airtime | seek-start |
+      print-pes | fanout)]
   mirakc-arib --version
   mirakc-arib scan-services [--sids=<sid>...] [--xsids=<sid>...] [<file>]
   mirakc-arib sync-clocks [--sids=<sid>...] [--xsids=<sid>...] [<file>]
   mirakc-arib collect-eits [--sids=<sid>...] [--xsids=<sid>...]
                            [--time-limit=<ms>] [--streaming]
                            [--only-actual | --only-others]
+                           [--progress-file=<file>]
                            [--use-unicode-symbol] [<file>]
   mirakc-arib collect-eitpf [--sids=<sid>...]
                             [--streaming] [(--present | --following)] [<file>]
   mirakc-arib collect-logos [<file>]
   mirakc-arib filter-service --sid=<sid> [<file>]
+  mirakc-arib filter-services --sids=<sid>... --outputs=<output>... [<file>]
   mirakc-arib filter-program --sid=<sid> --eid=<eid>
     --clock-pid=<pid> --clock-pcr=<pcr> --clock-time=<unix-time-ms>
     [--audio-tags=<tag>...] [--video-tags=<tag>...]
@@ -90,11 +114,22 @@ Usage:
     [--pre-streaming] [<file>]
   mirakc-arib filter-program-metadata [--sid=<sid>] [<file>]
   mirakc-arib record-service --sid=<sid> --file=<file>
-    --chunk-size=<bytes> --num-chunks=<num> [--start-pos=<pos>] [<file>]
+    --chunk-size=<bytes> --num-chunks=<num> [--start-pos=<pos>]
+    [--async-write] [--direct-io] [--write-block-size=<bytes>]
+    [--preallocate] [--preallocate-keep-size]
+    [--chunk-index] [--state-file] [<file>]
+  mirakc-arib record-services --sids=<sid>... --files=<file>...
+    --chunk-size=<bytes> --num-chunks=<num> [--start-positions=<pos>...]
+    [--async-write] [--direct-io] [--write-block-size=<bytes>]
+    [--preallocate] [--preallocate-keep-size]
+    [--chunk-index] [--state-file] [<file>]
+  mirakc-arib read-ring --file=<file> --chunk-size=<bytes> --num-chunks=<num>
+    (--pos=<pos> | --time=<unix-time-ms> | --eid=<eid>) [--follow]
   mirakc-arib track-airtime --sid=<sid> --eid=<eid> [<file>]
   mirakc-arib seek-start --sid=<sid>
     [--max-duration=<ms>] [--max-packets=<num>] [<file>]
   mirakc-arib print-pes [<file>]
+  mirakc-arib fanout --spec=<json> [<file>]
 
 Description:
   `mirakc-arib <sub-command> -h` shows help for each sub-command.
@@ -116,6 +151,77 @@ Logging:
 
   mirakc-arib uses spdlog for logging.  See the document of spdlog for details
   about log levels.
+
+Input:
+  Packets are read from <file> mapped in memory if <file> is a regular file.
+  Otherwise, packets are read from <file> or STDIN with read(2).  The
+  MIRAKC_ARIB_INPUT environment variable is used for changing the way to read
+  packets:
+
+    mmap
+      Map <file> in memory and process packets in place.  mirakc-arib falls
+      back to read(2) when <file> cannot be mapped.  <file> must not be
+      truncated while mirakc-arib is reading it.
+
+    read
+      Read packets with read(2).
+
+    io-uring
+      Read packets ahead with io_uring on Linux.  Reads overlap with the
+      processing of packets read before, and packets are processed in the
+      buffers of io_uring without copying them.  mirakc-arib falls back to
+      read(2) when io_uring is not available.
+
+  The following environment variables are used for changing the size of
+  read(2):
+
+    MIRAKC_ARIB_READ_CHUNK_SIZE=<bytes>
+      The number of bytes to read at once.  The default value is 16384.
+
+    MIRAKC_ARIB_MAX_READ_CHUNK_SIZE=<bytes>|pipe
+      Enable the adaptive read chunk size.  The read chunk size is doubled up
+      to the specified value while reads keep returning full chunks.  `pipe`
+      means the capacity of the input pipe.  Sizes of reads are logged at the
+      end.
+
+Output:
+  Packets are written to STDOUT with write(2) by default.  The
+  MIRAKC_ARIB_OUTPUT environment variable is used for changing the way to
+  write packets:
+
+    write
+      Write packets with write(2).  This is the default.
+
+    vmsplice
+      Move packets into STDOUT with vmsplice(2) on Linux if STDOUT is a pipe.
+      The kernel doesn't copy packets.  The reader must read the pipe with
+      read(2).  Don't use this if the reader moves data from the pipe with
+      splice(2) or tee(2).  mirakc-arib falls back to write(2) when STDOUT is
+      not a pipe.
+
+Pipeline:
+  Reading, processing and writing packets are performed on a single thread by
+  default.  The MIRAKC_ARIB_PIPELINE environment variable is used for running
+  the following stages on their own threads.  Multiple stages can be specified
+  with commas like `input,output`:
+
+    input
+      Read packets on a thread separate from the processing of the packets.
+      Slow processing or writing doesn't block reading packets from the input
+      until the buffer of the stage gets full.
+
+    output
+      Write packets to STDOUT or output files on dedicated threads.  A
+      congested pipe doesn't block the processing of packets until the buffer
+      of the stage gets full.  This is not applied to JSON messages and files
+      written by `record-service`.  Use `--async-write` of `record-service`
+      for the latter.
+
+  Packets are copied into a ring buffer in each stage.  The size of the ring
+  buffer can be changed with MIRAKC_ARIB_PIPELINE_BUFFER_SIZE=<bytes>.  The
+  default value is 6160384 (32768 packets).  A histogram of the occupancy of
+  the ring buffer is logged at the end.  A high occupancy means that the next
+  stage is the bottleneck.
 )";
 
 static const std::string kScanServices = "scan-services";
@@ -241,6 +347,7 @@ Usage:
   mirakc-arib collect-eits [--sids=<sid>...] [--xsids=<sid>...]
                            [--time-limit=<ms>] [--streaming]
                            [--only-actual | --only-others]
+                           [--progress-file=<file>]
                            [--use-unicode-symbol] [<file>]
 
 Options:
@@ -273,6 +380,12 @@ Options:
   --only-others
     Collect only EIT sections with TIDs between 0x60 and 0x6F.
 
+  --progress-file=<file>
+    Path to a file to save version numbers of EIT sections which have been
+    output.  Sections having the same version numbers as the ones saved in the
+    file are not output.  The file is created if it doesn't exist, and updated
+    at the end.  See the "Progress File" section below.
+
 Obsoleted Options:
   --use-unicode-symbol
     Use the `MIRAKC_ARIB_KEEP_UNICODE_SYMBOLS` environment variable instead of
@@ -335,6 +448,29 @@ Description:
       ]
     }}
 
+Progress File:
+  When collecting EIT sections periodically, most of them are the same as the
+  ones collected in the previous run.  With `--progress-file`, only new sections
+  and sections whose version numbers have been changed are output.  The reader
+  must keep sections output in previous runs.
+
+  Sections not output are still needed for the progress.  So, the time needed
+  for collecting sections doesn't change.  Remove the file when the reader lost
+  sections output before.
+
+  The file consists of a 16-byte header, a 264-byte entry for each table and
+  the CRC32 of the preceding bytes.  Values are stored in the native byte
+  order.
+
+    Header:
+      magic        char[8]    "MIRAKCEP"
+      version      uint32     1
+      num_entries  uint32
+
+    Entry:
+      key          uint64     (nid << 48) | (tsid << 32) | (sid << 16) | tid
+      versions     uint8[256] Version number of each section, 0xFF if unknown
+
 Environment Variables:
   MIRAKC_ARIB_KEEP_UNICODE_SYMBOLS
     Set `1` if you like to keep Unicode symbols like enclosed ideographic
@@ -509,6 +645,49 @@ Description:
     * SDTT (PID=0x0023,0x0028)
 )";
 
+static const std::string kFilterServices = "filter-services";
+
+static const std::string kFilterServicesHelp = R"(
+Multi-service filter
+
+Usage:
+  mirakc-arib filter-services --sids=<sid>... --outputs=<output>... [<file>]
+
+Options:
+  -h --help
+    Print help.
+
+  --sids=<sid>
+    Service ID.  Can be specified multiple times.
+
+  --outputs=<output>
+    Path to a file or a named pipe to which packets of the service are
+    written.  The N-th output is used for the N-th service.  The number of
+    outputs must be equal to the number of SIDs.
+
+Arguments:
+  <file>
+    Path to a TS file.
+
+Description:
+  `filter-services` works like `filter-service` for multiple services at once.
+  PSI/SI tables are demuxed only once for all the services, and packets of
+  each service are written to its own output with a PAT modified for the
+  service.
+
+  A service stops when its SID is not found in PAT or writing to its output
+  fails, and its output is closed at that point.  SIGPIPE is ignored, so
+  closing the reader of an output stops only the service.  `filter-services`
+  stops when all services stop.
+
+Examples:
+  Write two service streams to named pipes:
+
+    $ mkfifo /tmp/nhk /tmp/etv
+    $ cat nhk.ts | mirakc-arib filter-services \
+        --sids=1024 --outputs=/tmp/nhk --sids=1032 --outputs=/tmp/etv
+)";
+
 static const std::string kFilterProgram = "filter-program";
 
 static const std::string kFilterProgramHelp = R"(
@@ -647,7 +826,10 @@ Record a service stream into a ring buffer file
 
 Usage:
   mirakc-arib record-service --sid=<sid> --file=<file>
-    --chunk-size=<bytes> --num-chunks=<num> [--start-pos=<pos>] [<file>]
+    --chunk-size=<bytes> --num-chunks=<num> [--start-pos=<pos>]
+    [--async-write] [--direct-io] [--write-block-size=<bytes>]
+    [--preallocate] [--preallocate-keep-size]
+    [--chunk-index] [--state-file] [<file>]
 
 Options:
   -h --help
@@ -670,6 +852,45 @@ Options:
     A file position to start recoring.
     The value must be a multiple of the chunk size.
 
+  --async-write
+    Write packets and sync chunks on a background thread.  Processing packets
+    is not blocked by slow writes and syncs until buffers for the background
+    thread get full.  The `chunk` message is sent after the chunk has been
+    synced in the same way as the synchronous mode, but it may be delayed
+    until the next packets are processed.
+
+  --direct-io
+    Open the ring buffer file with O_DIRECT in order to bypass the page cache.
+    The buffered I/O is used if the file system doesn't support it.
+
+  --write-block-size=<bytes>  [default: 8192]
+    The number of bytes written to the ring buffer file at once.
+    The value must be a multiple of 8192, and the chunk size must be a
+    multiple of the value.  A large block size like 1048576 reduces the number
+    of system calls, and is recommended with `--direct-io`.
+
+  --preallocate
+    Allocate disk space for the whole ring buffer file with fallocate(2) before
+    recording, and write data at its position in the ring buffer file with
+    pwrite(2).  The file gets contiguous extents on file systems like ext4 and
+    xfs, and the file is not truncated each time the ring buffer wraps around.
+    Data beyond the size of the ring buffer is removed before recording.
+
+  --preallocate-keep-size
+    Same as `--preallocate`, but the file size is not changed by the
+    allocation.  The file grows as data is written, and data beyond the size
+    of the ring buffer is not removed.  Supported only on Linux.
+
+  --chunk-index
+    Maintain a chunk index file at `<file>.index` where <file> is the path
+    specified with `--file`.  See the "Chunk Index" section below.
+
+  --state-file
+    Maintain a state file at `<file>.state` where <file> is the path specified
+    with `--file`.  Recording restarts at the position saved in the state
+    file unless `--start-pos` is specified.  See the "State File" section
+    below.
+
 Arguments:
   <file>
     Path to a TS file.
@@ -677,6 +898,80 @@ Arguments:
 Description:
   `record-service` records a service stream using a ring buffer file.
 
+Chunk Index:
+  The chunk index file maps each chunk in the ring buffer file to the time
+  and the event when started recording data in the chunk.  Readers can map
+  the file in memory and find the chunk to start playback without scanning
+  the ring buffer file.  Entries are kept when recording restarts with the
+  same SID, chunk size and number of chunks.
+
+  The file consists of a 64-byte header followed by a 64-byte entry for each
+  chunk.  Values are stored in the native byte order.
+
+    Header:
+      magic        char[8]  "MIRAKCIX"
+      version      uint32   1
+      entry_size   uint32   64
+      chunk_size   uint64
+      num_chunks   uint64
+      sid          uint16
+      (reserved)   6 bytes
+      last_chunk   uint64   1 + the index of the chunk synced last, or 0
+      write_pos    uint64   File position up to which data has been written
+      (reserved)   8 bytes
+
+    Entry:
+      seq          uint32   Sequence lock
+      (reserved)   4 bytes
+      pos          uint64   File position of the chunk
+      timestamp    int64    Unix time in ms when started recording the chunk
+      end_time     int64    Unix time in ms when the chunk was synced
+      pcr          int64    The first PCR in the chunk, or -1
+      flags        uint32   0x01: started, 0x02: synced
+      eid          uint16   Event ID when started recording the chunk, or 0
+      (reserved)   2 bytes
+      pat_offset   uint32   Offset of the first PAT packet in the chunk
+      pmt_offset   uint32   Offset of the first PMT packet in the chunk
+      key_offset   uint32   Offset of the first keyframe in the chunk
+      (reserved)   4 bytes
+
+  Offsets are relative to the beginning of the chunk, and 0xFFFFFFFF means
+  that no such packet has been found.  The writer makes `seq` odd while
+  updating the entry.  A reader must read `seq`, copy the entry, and read
+  `seq` again.  The copy is valid if both values are the same even number.
+
+  `key_offset` points to the first TS packet of a video PES packet which
+  contains a MPEG-2 sequence header or GOP header, a H.264 SPS or IDR slice,
+  or a HEVC VPS, SPS or IRAP slice.  Playback can start from there.
+
+State File:
+  The state file holds the state of the recording saved each time a chunk
+  has been synced.  When `record-service` restarts after a crash, it resumes
+  recording at the next chunk, and uses the saved clock baseline until the
+  next TOT comes if the state was saved within an hour.
+
+  The file has two 512-byte slots.  A new record is written into the slot not
+  holding the latest record, and then the file is synced.  So, at least one
+  of the slots holds a valid record even if the process crashes while
+  writing.  The valid record having the larger sequence number is the latest.
+  Values are stored in the native byte order.
+
+    Record:
+      magic        char[8]  "MIRAKCST"
+      version      uint32   1
+      sid          uint16
+      clock_pid    uint16
+      sequence     uint64   Incremented each time the state is saved
+      chunk_size   uint64
+      num_chunks   uint64
+      pos          uint64   File position where the next chunk starts
+      timestamp    int64    Unix time in ms when the chunk was synced
+      clock_pcr    int64    PCR of the clock baseline, or -1
+      clock_time   int64    Unix time in ms of the clock baseline
+      eid          uint16   Event ID being recorded, or 0
+      (reserved)   2 bytes
+      crc32        uint32   MPEG-2 CRC32 of the preceding 76 bytes
+
 JSON Messages:
   start
     The `start` message is sent when `record-service` starts.  The message
@@ -768,6 +1063,141 @@ Environment Variables:
     if this option is specified.
 )";
 
+static const std::string kRecordServices = "record-services";
+
+static const std::string kRecordServicesHelp = R"(
+Record multiple service streams into ring buffer files
+
+Usage:
+  mirakc-arib record-services --sids=<sid>... --files=<file>...
+    --chunk-size=<bytes> --num-chunks=<num> [--start-positions=<pos>...]
+    [--async-write] [--direct-io] [--write-block-size=<bytes>]
+    [--preallocate] [--preallocate-keep-size]
+    [--chunk-index] [--state-file] [<file>]
+
+Options:
+  -h --help
+    Print help.
+
+  --sids=<sid>
+    Service ID.  Can be specified multiple times.
+
+  --files=<file>
+    Path to the ring buffer file.  The N-th file is used for the N-th service.
+    The number of files must be equal to the number of SIDs.
+
+  --chunk-size=<bytes>
+    Chunk size of each ring buffer file.
+    The chunk size must be a multiple of 8192.
+
+  --num-chunks=<num>
+    The number of chunks in each ring buffer file.
+
+  --start-positions=<pos>
+    A file position to start recoring.  The N-th position is used for the N-th
+    service.  The number of positions must be equal to the number of SIDs if
+    specified.  Recording starts at 0 for all services if not specified.
+    The value must be a multiple of the chunk size.
+
+  --async-write
+  --direct-io
+  --write-block-size=<bytes>  [default: 8192]
+  --preallocate
+  --preallocate-keep-size
+  --chunk-index
+  --state-file
+    Same as `record-service`.  Each service has its own chunk index file and
+    state file.  Recording restarts at the positions saved in the state files
+    unless `--start-positions` is specified.
+
+Arguments:
+  <file>
+    Path to a TS file.
+
+Description:
+  `record-services` works like `record-service` for multiple services in a
+  single transport stream.  PSI/SI tables are demuxed only once for filtering
+  all the services, and each service stream is recorded into its own ring
+  buffer file.
+
+  JSON messages are the same as `record-service`, but each message has a
+  `serviceId` property at the top level like below:
+
+    {{
+      "type": "chunk",
+      "data": {{ ... }},
+      "serviceId": 1024
+    }}
+
+  A service stops when its SID is not found in PAT or writing to its ring
+  buffer file fails.  The `stop` message of the service is sent at that point.
+  `record-services` stops when all services stop.
+
+Examples:
+  Record two services:
+
+    $ cat gr27.ts | mirakc-arib record-services \
+        --sids=1024 --files=/tmp/nhk.ring --sids=1032 --files=/tmp/etv.ring \
+        --chunk-size=154009600 --num-chunks=100
+)";
+
+static const std::string kReadRing = "read-ring";
+
+static const std::string kReadRingHelp = R"(
+Read packets from a ring buffer file
+
+Usage:
+  mirakc-arib read-ring --file=<file> --chunk-size=<bytes> --num-chunks=<num>
+    (--pos=<pos> | --time=<unix-time-ms> | --eid=<eid>) [--follow]
+
+Options:
+  -h --help
+    Print help.
+
+  --file=<file>
+    Path to the ring buffer file recorded by `record-service` with the
+    `--chunk-index` option.  The chunk index file `<file>.index` is required.
+
+  --chunk-size=<bytes>
+  --num-chunks=<num>
+    Same as `record-service`.  The values must be equal to the values used for
+    recording.
+
+  --pos=<pos>
+    Start reading at the file position.
+
+  --time=<unix-time-ms>
+    Start reading in the chunk recorded last at or before the time.
+
+  --eid=<eid>
+    Start reading in the chunk in which the event started.
+
+  --follow
+    Wait for packets to be recorded after reading all recorded packets.
+
+Description:
+  `read-ring` writes packets in the ring buffer file to STDOUT, starting from a
+  position found in the chunk index file.  When seeking by the time or the
+  event ID, reading starts from the first keyframe in the chunk if it's
+  recorded in the chunk index file.
+
+  The PAT and the PMT of the service found after the start position are sent
+  first so that the receiver can start decoding immediately.  Then, packets
+  are copied from the ring buffer file with sendfile(2) if possible.
+
+  The chunk being recorded is read up to the position written by
+  `record-service`.  `read-ring` stops when reaching that position unless
+  `--follow` is specified.  It fails if a chunk is overwritten while reading
+  it.
+
+Examples:
+  Read the last 10 minutes:
+
+    $ mirakc-arib read-ring --file=/tmp/nhk.ring \
+        --chunk-size=154009600 --num-chunks=100 \
+        --time=$(( $(date +%s%3N) - 600000 )) --follow | ffplay -
+)";
+
 static const std::string kTrackAirtime = "track-airtime";
 
 static const std::string kTrackAirtimeHelp = R"(
@@ -913,9 +1343,68 @@ Examples:
     ...
 )";
 
+static const std::string kFanout = "fanout";
+
+static const std::string kFanoutHelp = R"(
+Feed a TS stream to multiple sub-commands
+
+Usage:
+  mirakc-arib fanout --spec=<json> [<file>]
+
+Options:
+  -h --help
+    Print help.
+
+  --spec=<json>
+    A JSON array of pipelines.  Each pipeline is a JSON object having the
+    following properties:
+
+      args
+        An array of command-line arguments of a sub-command, which starts
+        with the name of the sub-command.  <file> cannot be specified.
+
+      output
+        Path to a file or a named pipe to which the sub-command writes JSON
+        messages or packets.  STDOUT is used if this is omitted.  Only one
+        pipeline can write to STDOUT.
+
+    The following sub-commands cannot be used in a pipeline: fanout,
+    filter-services, print-pes and read-ring.
+
+Arguments:
+  <file>
+    Path to a TS file.
+
+Description:
+  `fanout` reads a TS stream once, and feeds each batch of packets to all
+  pipelines in order on a single thread.  Pipelines share the packets in the
+  input buffer without copying them.
+
+  Each pipeline works in the same way as its sub-command run separately.  A
+  pipeline stops when its sub-command stops, and its output is closed at that
+  point.  Other pipelines keep going.  `fanout` stops when all pipelines stop.
+
+  SIGPIPE is ignored.  A pipeline writing packets stops when the reader of its
+  output has gone, and other pipelines keep going.
+
+  The exit code is the first non-zero exit code of the pipelines in the order
+  of the spec.  Use MIRAKC_ARIB_LOG=info in order to see the exit code of each
+  pipeline.
+
+Examples:
+  Collect EIT p/f tables while recording a service:
+
+    $ mkfifo /tmp/eitpf
+    $ recdvb 26 - - | mirakc-arib fanout --spec='[
+        {"args": ["collect-eitpf", "--sids=1024", "--streaming"],
+         "output": "/tmp/eitpf"},
+        {"args": ["filter-service", "--sid=1024"]}
+      ]' >nhk.ts
+)";
+
 class PosixFile final : public File {
  public:
-  enum class Mode { kWrite };
+  enum class Mode { kWrite, kDirectWrite };
 
   PosixFile(const std::string& path) : path_(path) {
     if (path.empty()) {
@@ -933,14 +1422,18 @@ class PosixFile final : public File {
     }
   }
 
-  PosixFile(const std::string& path, Mode) : path_(path) {
+  PosixFile(const std::string& path, Mode mode) : path_(path) {
     if (path.empty()) {
       stdio_ = true;
       path_ = "<stdout>";
       fd_ = STDOUT_FILENO;
       MIRAKC_ARIB_INFO("Write packets to STDOUT...");
     } else {
-      fd_ = open(path.c_str(), O_CREAT | O_RDWR, 0644);
+      if (mode == Mode::kDirectWrite) {
+        fd_ = OpenDirect(path);
+      } else {
+        fd_ = open(path.c_str(), O_CREAT | O_RDWR, 0644);
+      }
       if (fd_ > 0) {
         MIRAKC_ARIB_INFO("Write packets to {}...", path);
       } else {
@@ -967,14 +1460,34 @@ class PosixFile final : public File {
     return result;
   }
 
-  ssize_t Write(uint8_t* buf, size_t len) override {
-    auto result = write(fd_, reinterpret_cast<void*>(buf), len);
+  ssize_t ReadAt(uint8_t* buf, size_t len, int64_t offset) override {
+    MIRAKC_ARIB_ASSERT(!stdio_);
+    auto result = pread(fd_, reinterpret_cast<void*>(buf), len, static_cast<off_t>(offset));
+    if (result < 0) {
+      MIRAKC_ARIB_ERROR(
+          "Failed to read from {} at {}: {} ({})", path_, offset, std::strerror(errno), errno);
+    }
+    return result;
+  }
+
+  ssize_t Write(const uint8_t* buf, size_t len) override {
+    auto result = write(fd_, reinterpret_cast<const void*>(buf), len);
     if (result < 0) {
       MIRAKC_ARIB_ERROR("Failed to write to {}: {} ({})", path_, std::strerror(errno), errno);
     }
     return result;
   }
 
+  ssize_t WriteAt(const uint8_t* buf, size_t len, int64_t offset) override {
+    MIRAKC_ARIB_ASSERT(!stdio_);
+    auto result = pwrite(fd_, reinterpret_cast<const void*>(buf), len, static_cast<off_t>(offset));
+    if (result < 0) {
+      MIRAKC_ARIB_ERROR(
+          "Failed to write to {} at {}: {} ({})", path_, offset, std::strerror(errno), errno);
+    }
+    return result;
+  }
+
   bool Sync() override {
     MIRAKC_ARIB_ASSERT(!stdio_);
     if (fsync(fd_) < 0) {
@@ -1019,10 +1532,236 @@ class PosixFile final : public File {
     return static_cast<int64_t>(result);
   }
 
+  bool Allocate(int64_t size, bool keep_size) override {
+    MIRAKC_ARIB_ASSERT(!stdio_);
+#if defined(__linux__)
+    int mode = keep_size ? FALLOC_FL_KEEP_SIZE : 0;
+    if (fallocate(fd_, mode, 0, static_cast<off_t>(size)) < 0) {
+      MIRAKC_ARIB_ERROR(
+          "Failed to allocate {} bytes for {}: {} ({})", size, path_, std::strerror(errno), errno);
+      return false;
+    }
+    return true;
+#else
+    (void)size;
+    (void)keep_size;
+    MIRAKC_ARIB_ERROR("{}: Preallocation is not supported on this platform", path_);
+    return false;
+#endif
+  }
+
+  size_t GetPipeSize() const override {
+#if defined(F_GETPIPE_SZ)
+    auto result = fcntl(fd_, F_GETPIPE_SZ);
+    if (result > 0) {
+      return static_cast<size_t>(result);
+    }
+#endif
+    return 0;
+  }
+
+  int GetFd() const override {
+    return fd_;
+  }
+
+  ssize_t CopyTo(File* out, size_t len, int64_t offset) override {
+#if defined(__linux__)
+    auto out_fd = out->GetFd();
+    if (out_fd >= 0 && !sendfile_unsupported_) {
+      auto off = static_cast<off_t>(offset);
+      for (;;) {
+        auto result = sendfile(out_fd, fd_, &off, len);
+        if (result >= 0) {
+          return result;
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EINVAL && errno != ENOSYS) {
+          MIRAKC_ARIB_ERROR("Failed to copy {} to {}: {} ({})", path_, out->path(),
+              std::strerror(errno), errno);
+          return -1;
+        }
+        break;
+      }
+      // For example, `out` is opened with O_APPEND.
+      MIRAKC_ARIB_WARN("sendfile(2) cannot be used for {}, fall back to read(2) and write(2)",
+          out->path());
+      sendfile_unsupported_ = true;
+    }
+#endif
+    return File::CopyTo(out, len, offset);
+  }
+
  private:
+  // Opens a file bypassing the page cache.  Falls back to the buffered I/O if the file system
+  // doesn't support it.
+  static int OpenDirect(const std::string& path) {
+#if defined(O_DIRECT)
+    auto fd = open(path.c_str(), O_CREAT | O_RDWR | O_DIRECT, 0644);
+    if (fd >= 0 || errno != EINVAL) {
+      return fd;
+    }
+    MIRAKC_ARIB_WARN("{}: O_DIRECT is not supported, use the buffered I/O", path);
+    return open(path.c_str(), O_CREAT | O_RDWR, 0644);
+#else
+    auto fd = open(path.c_str(), O_CREAT | O_RDWR, 0644);
+#if defined(F_NOCACHE)
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) < 0) {
+      MIRAKC_ARIB_WARN("{}: F_NOCACHE is not supported, use the buffered I/O", path);
+    }
+#endif
+    return fd;
+#endif
+  }
+
   std::string path_;
   int fd_ = -1;
   bool stdio_ = false;
+  bool sendfile_unsupported_ = false;
+};
+
+class PosixFileMapping final : public FileMapping {
+ public:
+  // Returns nullptr if the file is not a regular file or cannot be mapped.
+  //
+  // Changes made by other processes are visible through the mapping if `shared` is true.
+  static std::unique_ptr<FileMapping> Map(const std::string& path, bool shared = false) {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      // PosixFile will report the error.
+      MIRAKC_ARIB_DEBUG("Failed to open {}: {} ({})", path, std::strerror(errno), errno);
+      return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      MIRAKC_ARIB_ERROR("Failed to stat {}: {} ({})", path, std::strerror(errno), errno);
+      close(fd);
+      return nullptr;
+    }
+
+    // mmap() fails with a zero-length mapping.
+    if (!S_ISREG(st.st_mode) || st.st_size == 0 ||
+        static_cast<uint64_t>(st.st_size) > std::numeric_limits<size_t>::max()) {
+      MIRAKC_ARIB_DEBUG("Cannot map {}", path);
+      close(fd);
+      return nullptr;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    auto* addr = mmap(nullptr, size, PROT_READ, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    // The mapping is still valid after the file is closed.
+    close(fd);
+    if (addr == MAP_FAILED) {
+      MIRAKC_ARIB_ERROR("Failed to map {}: {} ({})", path, std::strerror(errno), errno);
+      return nullptr;
+    }
+
+    if (!shared) {
+      // These are just hints.  Errors are ignored.
+      (void)madvise(addr, size, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+      (void)madvise(addr, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    return std::unique_ptr<FileMapping>(new PosixFileMapping(path, addr, size));
+  }
+
+  ~PosixFileMapping() override {
+    munmap(addr_, size_);
+  }
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  const uint8_t* data() const override {
+    return static_cast<const uint8_t*>(addr_);
+  }
+
+  size_t size() const override {
+    return size_;
+  }
+
+ private:
+  PosixFileMapping(const std::string& path, void* addr, size_t size)
+      : path_(path), addr_(addr), size_(size) {}
+
+  std::string path_;
+  void* addr_;
+  size_t size_;
+};
+
+class PosixMutableFileMapping final : public MutableFileMapping {
+ public:
+  // Creates the file if it doesn't exist, and changes the file size to `size`.  Returns nullptr
+  // on failure.
+  static std::unique_ptr<MutableFileMapping> Create(const std::string& path, size_t size) {
+    auto fd = open(path.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+      MIRAKC_ARIB_ERROR("Failed to open {}: {} ({})", path, std::strerror(errno), errno);
+      return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      MIRAKC_ARIB_ERROR("Failed to stat {}: {} ({})", path, std::strerror(errno), errno);
+      close(fd);
+      return nullptr;
+    }
+
+    if (static_cast<uint64_t>(st.st_size) != size &&
+        ftruncate(fd, static_cast<off_t>(size)) < 0) {
+      MIRAKC_ARIB_ERROR(
+          "Failed to truncate {} to {}: {} ({})", path, size, std::strerror(errno), errno);
+      close(fd);
+      return nullptr;
+    }
+
+    auto* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping is still valid after the file is closed.
+    close(fd);
+    if (addr == MAP_FAILED) {
+      MIRAKC_ARIB_ERROR("Failed to map {}: {} ({})", path, std::strerror(errno), errno);
+      return nullptr;
+    }
+
+    return std::unique_ptr<MutableFileMapping>(new PosixMutableFileMapping(path, addr, size));
+  }
+
+  ~PosixMutableFileMapping() override {
+    munmap(addr_, size_);
+  }
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  uint8_t* data() override {
+    return static_cast<uint8_t*>(addr_);
+  }
+
+  size_t size() const override {
+    return size_;
+  }
+
+  bool Sync() override {
+    if (msync(addr_, size_, MS_ASYNC) < 0) {
+      MIRAKC_ARIB_ERROR("Failed to sync {}: {} ({})", path_, std::strerror(errno), errno);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  PosixMutableFileMapping(const std::string& path, void* addr, size_t size)
+      : path_(path), addr_(addr), size_(size) {}
+
+  std::string path_;
+  void* addr_;
+  size_t size_;
 };
 
 void Init(const Args& args) {
@@ -1038,29 +1777,166 @@ void Init(const Args& args) {
     InitLogger(kCollectLogos);
   } else if (args.at(kFilterService).asBool()) {
     InitLogger(kFilterService);
+  } else if (args.at(kFilterServices).asBool()) {
+    InitLogger(kFilterServices);
   } else if (args.at(kFilterProgram).asBool()) {
     InitLogger(kFilterProgram);
   } else if (args.at(kFilterProgramMetadata).asBool()) {
     InitLogger(kFilterProgramMetadata);
   } else if (args.at(kRecordService).asBool()) {
     InitLogger(kRecordService);
+  } else if (args.at(kRecordServices).asBool()) {
+    InitLogger(kRecordServices);
+  } else if (args.at(kReadRing).asBool()) {
+    InitLogger(kReadRing);
   } else if (args.at(kTrackAirtime).asBool()) {
     InitLogger(kTrackAirtime);
   } else if (args.at(kSeekStart).asBool()) {
     InitLogger(kSeekStart);
   } else if (args.at(kPrintPes).asBool()) {
     InitLogger(kPrintPes);
+  } else if (args.at(kFanout).asBool()) {
+    InitLogger(kFanout);
   }
 
   ts::DVBCharset::EnableARIBMode();
 }
 
+std::unique_ptr<File> OpenInputFile(const std::string& path) {
+  static const std::string kRead = "read";
+  static const std::string kIoUring = "io-uring";
+  static const std::string kMmap = "mmap";
+
+  const auto* input = std::getenv("MIRAKC_ARIB_INPUT");
+  if (input == nullptr || kRead == input || kMmap == input) {
+    return std::make_unique<PosixFile>(path);
+  }
+
+  if (kIoUring == input) {
+#if MIRAKC_ARIB_HAS_IO_URING
+    auto file = std::make_unique<UringFile>(path);
+    if (file->Init()) {
+      return file;
+    }
+    MIRAKC_ARIB_WARN("Fall back to read(2)");
+#else
+    MIRAKC_ARIB_WARN("io_uring is not supported on this platform, fall back to read(2)");
+#endif
+    return std::make_unique<PosixFile>(path);
+  }
+
+  MIRAKC_ARIB_WARN("Unknown MIRAKC_ARIB_INPUT: {}, use read(2)", input);
+  return std::make_unique<PosixFile>(path);
+}
+
+size_t LoadSize(const char* name, const char* value, size_t max) {
+  char* end = nullptr;
+  errno = 0;
+  auto size = std::strtoull(value, &end, 0);
+  if (errno != 0 || end == value || *end != '\0') {
+    MIRAKC_ARIB_ERROR("{} must be an integer: {}", name, value);
+    std::abort();
+  }
+  if (size == 0 || size > max) {
+    MIRAKC_ARIB_ERROR("{} must be in the range 1..{}", name, max);
+    std::abort();
+  }
+  return static_cast<size_t>(size);
+}
+
+void LoadOption(const File& file, FileSourceOption* opt) {
+  static const std::string kPipe = "pipe";
+
+  const auto* read_chunk_size = std::getenv("MIRAKC_ARIB_READ_CHUNK_SIZE");
+  if (read_chunk_size != nullptr) {
+    opt->read_chunk_size = LoadSize(
+        "MIRAKC_ARIB_READ_CHUNK_SIZE", read_chunk_size, FileSource::kMaxReadChunkSize);
+  }
+
+  const auto* max_read_chunk_size = std::getenv("MIRAKC_ARIB_MAX_READ_CHUNK_SIZE");
+  if (max_read_chunk_size != nullptr) {
+    if (kPipe == max_read_chunk_size) {
+      auto pipe_size = file.GetPipeSize();
+      if (pipe_size == 0) {
+        MIRAKC_ARIB_WARN("{} is not a pipe, the read chunk size is fixed", file.path());
+      }
+      opt->max_read_chunk_size = std::min(pipe_size, FileSource::kMaxReadChunkSize);
+    } else {
+      opt->max_read_chunk_size = LoadSize(
+          "MIRAKC_ARIB_MAX_READ_CHUNK_SIZE", max_read_chunk_size, FileSource::kMaxReadChunkSize);
+    }
+  }
+
+  MIRAKC_ARIB_DEBUG("FileSourceOption: read-chunk-size={} max-read-chunk-size={}",
+      opt->read_chunk_size, opt->max_read_chunk_size);
+}
+
+bool IsPipelineStageEnabled(const std::string& stage) {
+  static const std::string kInput = "input";
+  static const std::string kOutput = "output";
+
+  const auto* pipeline = std::getenv("MIRAKC_ARIB_PIPELINE");
+  if (pipeline == nullptr) {
+    return false;
+  }
+
+  bool enabled = false;
+  std::string_view stages(pipeline);
+  while (!stages.empty()) {
+    auto pos = std::min(stages.find(','), stages.size());
+    auto name = stages.substr(0, pos);
+    if (name == stage) {
+      enabled = true;
+    } else if (name != kInput && name != kOutput) {
+      MIRAKC_ARIB_WARN("Unknown stage in MIRAKC_ARIB_PIPELINE: {}", name);
+    }
+    stages.remove_prefix(std::min(pos + 1, stages.size()));
+  }
+  return enabled;
+}
+
+// Runs `sink` on its own thread if the stage is enabled.
+std::unique_ptr<PacketSink> MakePipelineStage(
+    const std::string& stage, std::unique_ptr<PacketSink>&& sink) {
+  // Limit the memory used by each stage.
+  static constexpr size_t kMaxBufferSize = 256 * 1024 * 1024;
+
+  if (!IsPipelineStageEnabled(stage)) {
+    return std::move(sink);
+  }
+
+  PipelinedSinkOption option;
+  option.name = stage;
+  const auto* buffer_size = std::getenv("MIRAKC_ARIB_PIPELINE_BUFFER_SIZE");
+  if (buffer_size != nullptr) {
+    auto size = LoadSize("MIRAKC_ARIB_PIPELINE_BUFFER_SIZE", buffer_size, kMaxBufferSize);
+    option.capacity = std::max<size_t>(size / ts::PKT_SIZE, 1);
+  }
+  MIRAKC_ARIB_DEBUG("PipelinedSinkOption: name={} capacity={}", option.name, option.capacity);
+  return std::make_unique<PipelinedSink>(std::move(sink), option);
+}
+
 std::unique_ptr<PacketSource> MakePacketSource(const Args& args) {
   static const std::string kFile = "<file>";
+  static const std::string kMmap = "mmap";
 
   std::string path = args.at(kFile).isString() ? args.at(kFile).asString() : "";
-  std::unique_ptr<File> file = std::make_unique<PosixFile>(path);
-  return std::make_unique<FileSource>(std::move(file));
+
+  const auto* input = std::getenv("MIRAKC_ARIB_INPUT");
+  if (!path.empty() && (input == nullptr || kMmap == input)) {
+    auto mapping = PosixFileMapping::Map(path);
+    if (mapping) {
+      return std::make_unique<MmapFileSource>(std::move(mapping));
+    }
+    if (input != nullptr) {
+      MIRAKC_ARIB_WARN("Fall back to read(2)");
+    }
+  }
+
+  auto file = OpenInputFile(path);
+  FileSourceOption option;
+  LoadOption(*file, &option);
+  return std::make_unique<FileSource>(std::move(file), option);
 }
 
 void LoadSidSet(const Args& args, const std::string& name, SidSet* sids) {
@@ -1129,6 +2005,7 @@ void LoadOption(const Args& args, EitCollectorOption* opt) {
   static const std::string kStreaming = "--streaming";
   static const std::string kOnlyActual = "--only-actual";
   static const std::string kOnlyOthers = "--only-others";
+  static const std::string kProgressFile = "--progress-file";
   static const std::string kUseUnicodeSymbol = "--use-unicode-symbol";
 
   LoadSidSet(args, "--sids", &opt->sids);
@@ -1139,15 +2016,18 @@ void LoadOption(const Args& args, EitCollectorOption* opt) {
   opt->streaming = args.at(kStreaming).asBool();
   opt->collect_actual = !args.at(kOnlyOthers).asBool();
   opt->collect_others = !args.at(kOnlyActual).asBool();
+  if (args.at(kProgressFile)) {
+    opt->progress_file = args.at(kProgressFile).asString();
+  }
   auto use_unicode_symbol = args.at(kUseUnicodeSymbol).asBool();
   if (use_unicode_symbol) {
     g_KeepUnicodeSymbols = true;
   }
   MIRAKC_ARIB_INFO(
       "Options: time-limit={}, streaming={} collect-actual={} "
-      "collect-others={} use-unicode-symbol={}",
+      "collect-others={} progress-file={} use-unicode-symbol={}",
       opt->time_limit, opt->streaming, opt->collect_actual, opt->collect_others,
-      use_unicode_symbol);
+      opt->progress_file, use_unicode_symbol);
 }
 
 void LoadOption(const Args& args, EitpfCollectorOption* opt) {
@@ -1175,6 +2055,39 @@ void LoadOption(const Args& args, ServiceFilterOption* opt) {
   }
 }
 
+void LoadSids(const Args& args, std::vector<uint16_t>* sids) {
+  static const std::string kSids = "--sids";
+
+  for (const auto& str : args.at(kSids).asStringList()) {
+    size_t pos = 0;
+    long sid = -1;
+    try {
+      sid = std::stol(str, &pos, 0);
+    } catch (...) {
+      pos = 0;
+    }
+    if (pos != str.length() || sid < 0 || sid > 0xFFFF) {
+      MIRAKC_ARIB_ERROR("sids must be 16-bit unsigned integers: {}", str);
+      std::abort();
+    }
+    sids->push_back(static_cast<uint16_t>(sid));
+  }
+}
+
+void LoadOption(
+    const Args& args, MultiServiceFilterOption* opt, std::vector<std::string>* outputs) {
+  static const std::string kOutputs = "--outputs";
+
+  LoadSids(args, &opt->sids);
+  *outputs = args.at(kOutputs).asStringList();
+  if (opt->sids.size() != outputs->size()) {
+    MIRAKC_ARIB_ERROR("The number of outputs must be equal to the number of SIDs");
+    std::abort();
+  }
+  MIRAKC_ARIB_INFO("MultiServiceFilterOptions: sids={:04X} outputs={}",
+      fmt::join(opt->sids, ","), fmt::join(*outputs, ","));
+}
+
 void LoadOption(const Args& args, ProgramFilterOption* opt) {
   static const std::string kSid = "--sid";
   static const std::string kEid = "--eid";
@@ -1233,52 +2146,190 @@ void LoadOption(const Args& args, ProgramMetadataFilterOption* opt) {
   }
 }
 
-void LoadOption(const Args& args, ServiceRecorderOption* opt) {
-  static const std::string kSid = "--sid";
-  static const std::string kFile = "--file";
+// Loads options for the ring buffer file which are common to `record-service`,
+// `record-services` and `read-ring`.
+void LoadRingOptions(const Args& args, size_t* chunk_size, size_t* num_chunks) {
   static const std::string kChunkSize = "--chunk-size";
   static const std::string kNumChunks = "--num-chunks";
-  static const std::string kStartPos = "--start-pos";
 
-  opt->sid = static_cast<uint16_t>(args.at(kSid).asLong());
-  opt->file = args.at(kFile).asString();
-  opt->chunk_size = static_cast<size_t>(args.at(kChunkSize).asLong());
-  if (opt->chunk_size == 0) {
+  *chunk_size = static_cast<size_t>(args.at(kChunkSize).asLong());
+  if (*chunk_size == 0) {
     MIRAKC_ARIB_ERROR("chunk-size must be a positive integer");
     std::abort();
   }
-  if (opt->chunk_size % RingFileSink::kBufferSize != 0) {
+  if (*chunk_size % RingFileSink::kBufferSize != 0) {
     MIRAKC_ARIB_ERROR("chunk-size must be a multiple of {}", RingFileSink::kBufferSize);
     std::abort();
   }
-  if (opt->chunk_size > RingFileSink::kMaxChunkSize) {
+  if (*chunk_size > RingFileSink::kMaxChunkSize) {
     MIRAKC_ARIB_ERROR("chunk-size must be less than or equal to {}", RingFileSink::kMaxChunkSize);
     std::abort();
   }
-  opt->num_chunks = static_cast<size_t>(args.at(kNumChunks).asLong());
-  if (opt->num_chunks == 0) {
+  *num_chunks = static_cast<size_t>(args.at(kNumChunks).asLong());
+  if (*num_chunks == 0) {
     MIRAKC_ARIB_ERROR("chunk-size must be a positive integer");
     std::abort();
   }
-  if (opt->num_chunks > RingFileSink::kMaxNumChunks) {
+  if (*num_chunks > RingFileSink::kMaxNumChunks) {
     MIRAKC_ARIB_ERROR("chunk-size must be less than or equal to {}", RingFileSink::kMaxNumChunks);
     std::abort();
   }
+}
+
+void LoadChunkIndexOption(const Args& args, ServiceRecorderOption* opt) {
+  static const std::string kChunkIndex = "--chunk-index";
+
+  if (args.at(kChunkIndex).asBool()) {
+    opt->index_file = opt->file + ".index";
+  }
+}
+
+void LoadStateFileOption(const Args& args, bool has_start_pos, ServiceRecorderOption* opt) {
+  static const std::string kStateFile = "--state-file";
+
+  if (args.at(kStateFile).asBool()) {
+    opt->state_file = opt->file + ".state";
+    opt->resume = !has_start_pos;
+  }
+}
+
+void CheckStartPos(const ServiceRecorderOption& opt) {
+  if (opt.start_pos % static_cast<uint64_t>(opt.chunk_size) != 0) {
+    MIRAKC_ARIB_ERROR("start-pos must be a multiple of chunk-size");
+    std::abort();
+  }
+  if (opt.start_pos >=
+      static_cast<uint64_t>(opt.chunk_size) * static_cast<uint64_t>(opt.num_chunks)) {
+    MIRAKC_ARIB_ERROR("start-pos must be a less than the maximum file size");
+    std::abort();
+  }
+}
+
+void LoadOption(const Args& args, ServiceRecorderOption* opt) {
+  static const std::string kSid = "--sid";
+  static const std::string kFile = "--file";
+  static const std::string kStartPos = "--start-pos";
+
+  opt->sid = static_cast<uint16_t>(args.at(kSid).asLong());
+  opt->file = args.at(kFile).asString();
+  LoadRingOptions(args, &opt->chunk_size, &opt->num_chunks);
+  LoadChunkIndexOption(args, opt);
+  LoadStateFileOption(args, static_cast<bool>(args.at(kStartPos)), opt);
   if (args.at(kStartPos)) {
     opt->start_pos = args.at(kStartPos).asUint64();
-    if (opt->start_pos % static_cast<uint64_t>(opt->chunk_size) != 0) {
-      MIRAKC_ARIB_ERROR("start-pos must be a multiple of chunk-size");
+    CheckStartPos(*opt);
+  }
+  MIRAKC_ARIB_INFO(
+      "ServiceRecorderOptions: sid={:04X} file={} chunk-size={} num-chunks={} start-pos={}"
+      " index-file={} state-file={} resume={}",
+      opt->sid, opt->file, opt->chunk_size, opt->num_chunks, opt->start_pos, opt->index_file,
+      opt->state_file, opt->resume);
+}
+
+void LoadOption(const Args& args, std::vector<ServiceRecorderOption>* opts) {
+  static const std::string kFiles = "--files";
+  static const std::string kStartPositions = "--start-positions";
+
+  std::vector<uint16_t> sids;
+  LoadSids(args, &sids);
+  const auto& files = args.at(kFiles).asStringList();
+  if (sids.size() != files.size()) {
+    MIRAKC_ARIB_ERROR("The number of files must be equal to the number of SIDs");
+    std::abort();
+  }
+  std::vector<std::string> positions;
+  if (args.at(kStartPositions)) {
+    positions = args.at(kStartPositions).asStringList();
+  }
+  if (!positions.empty() && sids.size() != positions.size()) {
+    MIRAKC_ARIB_ERROR("The number of start-positions must be equal to the number of SIDs");
+    std::abort();
+  }
+
+  ServiceRecorderOption base;
+  LoadRingOptions(args, &base.chunk_size, &base.num_chunks);
+  for (size_t i = 0; i < sids.size(); ++i) {
+    auto opt = base;
+    opt.sid = sids[i];
+    opt.file = files[i];
+    opt.tag_service_id = true;
+    LoadChunkIndexOption(args, &opt);
+    LoadStateFileOption(args, !positions.empty(), &opt);
+    if (!positions.empty()) {
+      const auto& str = positions[i];
+      size_t pos = 0;
+      try {
+        opt.start_pos = std::stoull(str, &pos, 0);
+      } catch (...) {
+        pos = 0;
+      }
+      if (pos != str.length()) {
+        MIRAKC_ARIB_ERROR("start-positions must be unsigned integers: {}", str);
+        std::abort();
+      }
+      CheckStartPos(opt);
+    }
+    MIRAKC_ARIB_INFO(
+        "ServiceRecorderOptions: sid={:04X} file={} chunk-size={} num-chunks={} start-pos={}"
+        " index-file={} state-file={} resume={}",
+        opt.sid, opt.file, opt.chunk_size, opt.num_chunks, opt.start_pos, opt.index_file,
+        opt.state_file, opt.resume);
+    opts->push_back(std::move(opt));
+  }
+}
+
+void LoadOption(const Args& args, RingFileSinkOption* opt) {
+  static const std::string kAsyncWrite = "--async-write";
+  static const std::string kDirectIo = "--direct-io";
+  static const std::string kWriteBlockSize = "--write-block-size";
+  static const std::string kPreallocate = "--preallocate";
+  static const std::string kPreallocateKeepSize = "--preallocate-keep-size";
+
+  opt->async = args.at(kAsyncWrite).asBool();
+  opt->direct_io = args.at(kDirectIo).asBool();
+  opt->block_size = RingFileSink::kBufferSize;
+  if (args.at(kWriteBlockSize)) {
+    opt->block_size = static_cast<size_t>(args.at(kWriteBlockSize).asLong());
+    if (opt->block_size == 0 || opt->block_size % RingFileSink::kBufferSize != 0) {
+      MIRAKC_ARIB_ERROR("write-block-size must be a multiple of {}", RingFileSink::kBufferSize);
       std::abort();
     }
-    if (opt->start_pos >=
-        static_cast<uint64_t>(opt->chunk_size) * static_cast<uint64_t>(opt->num_chunks)) {
-      MIRAKC_ARIB_ERROR("start-pos must be a less than the maximum file size");
+    if (opt->block_size > RingFileSink::kMaxBlockSize) {
+      MIRAKC_ARIB_ERROR(
+          "write-block-size must be less than or equal to {}", RingFileSink::kMaxBlockSize);
       std::abort();
     }
   }
+  opt->keep_size = args.at(kPreallocateKeepSize).asBool();
+  opt->preallocate = args.at(kPreallocate).asBool() || opt->keep_size;
   MIRAKC_ARIB_INFO(
-      "ServiceRecorderOptions: sid={:04X} file={} chunk-size={} num-chunks={} start-pos={}",
-      opt->sid, opt->file, opt->chunk_size, opt->num_chunks, opt->start_pos);
+      "RingFileSinkOptions: async={} direct-io={} write-block-size={} preallocate={} keep-size={}",
+      opt->async, opt->direct_io, opt->block_size, opt->preallocate, opt->keep_size);
+}
+
+void LoadOption(const Args& args, RingReaderOption* opt) {
+  static const std::string kFile = "--file";
+  static const std::string kPos = "--pos";
+  static const std::string kTime = "--time";
+  static const std::string kEid = "--eid";
+  static const std::string kFollow = "--follow";
+
+  opt->file = args.at(kFile).asString();
+  LoadRingOptions(args, &opt->chunk_size, &opt->num_chunks);
+  if (args.at(kPos)) {
+    opt->seek_mode = RingSeekMode::kPos;
+    opt->pos = args.at(kPos).asUint64();
+  } else if (args.at(kTime)) {
+    opt->seek_mode = RingSeekMode::kTime;
+    opt->time = args.at(kTime).asInt64();
+  } else if (args.at(kEid)) {
+    opt->seek_mode = RingSeekMode::kEid;
+    opt->eid = static_cast<uint16_t>(args.at(kEid).asLong());
+  }
+  opt->follow = args.at(kFollow).asBool();
+  MIRAKC_ARIB_INFO(
+      "RingReaderOptions: file={} chunk-size={} num-chunks={} pos={} time={} eid={:04X} follow={}",
+      opt->file, opt->chunk_size, opt->num_chunks, opt->pos, opt->time, opt->eid, opt->follow);
 }
 
 void LoadOption(const Args& args, AirtimeTrackerOption* opt) {
@@ -1310,13 +2361,179 @@ void LoadOption(const Args& args, StartSeekerOption* opt) {
       opt->max_duration, opt->max_packets);
 }
 
-std::unique_ptr<PacketSink> MakePacketSink(const Args& args) {
+int OpenOutputFile(const std::string& path) {
+  // Opening a named pipe blocks until a reader opens it.
+  auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    MIRAKC_ARIB_ERROR("Failed to open {}: {} ({})", path, std::strerror(errno), errno);
+    std::abort();
+  }
+  MIRAKC_ARIB_INFO("Write packets to {}...", path);
+  return fd;
+}
+
+std::unique_ptr<PacketSink> MakeTsWriter(int fd) {
+  static const std::string kWrite = "write";
+  static const std::string kVmsplice = "vmsplice";
+
+  if (fd != STDOUT_FILENO) {
+    return std::make_unique<StdoutSink>(fd);
+  }
+
+  const auto* output = std::getenv("MIRAKC_ARIB_OUTPUT");
+  if (output == nullptr || kWrite == output) {
+    return std::make_unique<StdoutSink>();
+  }
+
+  if (kVmsplice == output) {
+#if MIRAKC_ARIB_HAS_VMSPLICE
+    auto sink = std::make_unique<VmspliceSink>();
+    if (sink->Init()) {
+      return sink;
+    }
+    MIRAKC_ARIB_WARN("Fall back to write(2)");
+#else
+    MIRAKC_ARIB_WARN("vmsplice(2) is not supported on this platform, fall back to write(2)");
+#endif
+    return std::make_unique<StdoutSink>();
+  }
+
+  MIRAKC_ARIB_WARN("Unknown MIRAKC_ARIB_OUTPUT: {}, use write(2)", output);
+  return std::make_unique<StdoutSink>();
+}
+
+// Makes a sink which writes packets to `fd`.  The sink takes the ownership of `fd` unless it's
+// STDOUT.
+std::unique_ptr<PacketSink> MakeTsSink(int fd) {
+  return MakePipelineStage("output", MakeTsWriter(fd));
+}
+
+std::unique_ptr<PacketSink> MakePacketSink(const Args& args, int fd);
+
+std::unique_ptr<PacketSink> MakeFanoutSink(const Args& args) {
+  static const std::string kSpec = "--spec";
+  static const std::string kArgs = "args";
+  static const std::string kOutput = "output";
+
+  const auto& spec = args.at(kSpec).asString();
+  rapidjson::Document doc;
+  doc.Parse(spec.c_str());
+  if (doc.HasParseError() || !doc.IsArray() || doc.Empty()) {
+    MIRAKC_ARIB_ERROR("spec must be a non-empty JSON array: {}", spec);
+    std::abort();
+  }
+
+  // Validate all pipelines before opening outputs.
+  std::vector<Args> pipeline_args;
+  std::vector<std::string> outputs;
+  bool use_stdout = false;
+  for (const auto& pipeline : doc.GetArray()) {
+    if (!pipeline.IsObject() || !pipeline.HasMember(kArgs.c_str()) ||
+        !pipeline[kArgs.c_str()].IsArray() || pipeline[kArgs.c_str()].Empty()) {
+      MIRAKC_ARIB_ERROR("pipeline must have a non-empty args array");
+      std::abort();
+    }
+
+    std::vector<std::string> argv;
+    for (const auto& arg : pipeline[kArgs.c_str()].GetArray()) {
+      if (!arg.IsString()) {
+        MIRAKC_ARIB_ERROR("args must be an array of strings");
+        std::abort();
+      }
+      argv.emplace_back(arg.GetString(), arg.GetStringLength());
+    }
+
+    Args sub_args;
+    try {
+      sub_args = docopt::docopt_parse(kUsage, argv, false, false);
+    } catch (const std::exception& e) {
+      MIRAKC_ARIB_ERROR("Invalid args in pipeline: {}: {}", fmt::join(argv, " "), e.what());
+      std::abort();
+    }
+    if (sub_args.at("-h").asBool() || sub_args.at("--help").asBool() ||
+        sub_args.at("--version").asBool() || sub_args.at("<file>").isString() ||
+        sub_args.at(kFanout).asBool() || sub_args.at(kFilterServices).asBool() ||
+        sub_args.at(kPrintPes).asBool() || sub_args.at(kReadRing).asBool()) {
+      MIRAKC_ARIB_ERROR("Not allowed in pipeline: {}", fmt::join(argv, " "));
+      std::abort();
+    }
+
+    std::string output;
+    if (pipeline.HasMember(kOutput.c_str())) {
+      const auto& value = pipeline[kOutput.c_str()];
+      if (!value.IsString() || value.GetStringLength() == 0) {
+        MIRAKC_ARIB_ERROR("output must be a non-empty string");
+        std::abort();
+      }
+      output.assign(value.GetString(), value.GetStringLength());
+    } else {
+      if (use_stdout) {
+        MIRAKC_ARIB_ERROR("Only one pipeline can write to STDOUT");
+        std::abort();
+      }
+      use_stdout = true;
+    }
+
+    pipeline_args.push_back(std::move(sub_args));
+    outputs.push_back(std::move(output));
+  }
+
+  auto fanout = std::make_unique<FanoutSink>();
+  for (size_t i = 0; i < pipeline_args.size(); ++i) {
+    auto fd = outputs[i].empty() ? STDOUT_FILENO : OpenOutputFile(outputs[i]);
+    auto name = fmt::format("pipeline#{}", i);
+    MIRAKC_ARIB_INFO("{}: output={}", name, outputs[i].empty() ? "STDOUT" : outputs[i]);
+    fanout->Connect(name, MakePacketSink(pipeline_args[i], fd));
+  }
+  return fanout;
+}
+
+// Lines are buffered and written in bulk unless `flush_each` is true.
+std::unique_ptr<JsonlSink> MakeJsonlSink(int fd, bool flush_each) {
+  StdoutJsonlSinkOption option;
+  option.flush_each = flush_each;
+  return std::make_unique<StdoutJsonlSink>(fd, option);
+}
+
+std::unique_ptr<PacketSink> MakeServiceRecorder(const ServiceRecorderOption& recorder_option,
+    const RingFileSinkOption& sink_option, int fd) {
+  if (recorder_option.chunk_size % sink_option.block_size != 0) {
+    MIRAKC_ARIB_ERROR("chunk-size must be a multiple of write-block-size");
+    std::abort();
+  }
+  auto file_mode =
+      sink_option.direct_io ? PosixFile::Mode::kDirectWrite : PosixFile::Mode::kWrite;
+  auto file = std::make_unique<PosixFile>(recorder_option.file, file_mode);
+  auto sink = std::make_unique<RingFileSink>(
+      std::move(file), recorder_option.chunk_size, recorder_option.num_chunks, sink_option);
+  auto recorder = std::make_unique<ServiceRecorder>(recorder_option);
+  recorder->ServiceRecorder::Connect(std::move(sink));
+  if (!recorder_option.index_file.empty()) {
+    auto mapping = PosixMutableFileMapping::Create(
+        recorder_option.index_file, GetChunkIndexFileSize(recorder_option.num_chunks));
+    if (mapping == nullptr) {
+      std::abort();
+    }
+    recorder->SetChunkIndex(std::make_unique<ChunkIndex>(std::move(mapping), recorder_option.sid,
+        recorder_option.chunk_size, recorder_option.num_chunks));
+  }
+  if (!recorder_option.state_file.empty()) {
+    auto state_file =
+        std::make_unique<PosixFile>(recorder_option.state_file, PosixFile::Mode::kWrite);
+    recorder->SetStateFile(std::make_unique<RecorderStateFile>(std::move(state_file)));
+  }
+  // Chunk messages must be delivered without delay.
+  recorder->JsonlSource::Connect(MakeJsonlSink(fd, true));
+  return recorder;
+}
+
+std::unique_ptr<PacketSink> MakePacketSink(const Args& args, int fd) {
   if (args.at(kScanServices).asBool()) {
     ServiceScannerOption option;
     LoadSidSet(args, "--sids", &option.sids);
     LoadSidSet(args, "--xsids", &option.xsids);
     auto scanner = std::make_unique<ServiceScanner>(option);
-    scanner->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    scanner->Connect(MakeJsonlSink(fd, true));
     return scanner;
   }
   if (args.at(kSyncClocks).asBool()) {
@@ -1324,40 +2541,54 @@ std::unique_ptr<PacketSink> MakePacketSink(const Args& args) {
     LoadSidSet(args, "--sids", &option.sids);
     LoadSidSet(args, "--xsids", &option.xsids);
     auto sync = std::make_unique<PcrSynchronizer>(option);
-    sync->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    sync->Connect(MakeJsonlSink(fd, true));
     return sync;
   }
   if (args.at(kCollectEits).asBool()) {
     EitCollectorOption option;
     LoadOption(args, &option);
     auto collector = std::make_unique<EitCollector>(option);
-    collector->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    if (!option.progress_file.empty()) {
+      auto file = std::make_unique<PosixFile>(option.progress_file, PosixFile::Mode::kWrite);
+      collector->SetProgressFile(std::make_unique<EitProgressFile>(std::move(file)));
+    }
+    collector->Connect(MakeJsonlSink(fd, option.streaming));
     return collector;
   }
   if (args.at(kCollectEitpf).asBool()) {
     EitpfCollectorOption option;
     LoadOption(args, &option);
     auto collector = std::make_unique<EitpfCollector>(option);
-    collector->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    collector->Connect(MakeJsonlSink(fd, option.streaming));
     return collector;
   }
   if (args.at(kCollectLogos).asBool()) {
     auto collector = std::make_unique<LogoCollector>();
-    collector->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    collector->Connect(MakeJsonlSink(fd, false));
     return collector;
   }
   if (args.at(kFilterService).asBool()) {
     ServiceFilterOption option;
     LoadOption(args, &option);
     auto filter = std::make_unique<ServiceFilter>(option);
-    filter->Connect(std::make_unique<StdoutSink>());
+    filter->Connect(MakeTsSink(fd));
+    return filter;
+  }
+  if (args.at(kFilterServices).asBool()) {
+    MultiServiceFilterOption option;
+    std::vector<std::string> outputs;
+    LoadOption(args, &option, &outputs);
+    auto filter = std::make_unique<MultiServiceFilter>(option);
+    for (size_t i = 0; i < option.sids.size(); ++i) {
+      filter->Connect(option.sids[i], MakeTsSink(OpenOutputFile(outputs[i])));
+    }
     return filter;
   }
   if (args.at(kFilterProgram).asBool()) {
     ProgramFilterOption program_filter_option;
     LoadOption(args, &program_filter_option);
     auto program_filter = std::make_unique<ProgramFilter>(program_filter_option);
-    program_filter->Connect(std::make_unique<StdoutSink>());
+    program_filter->Connect(MakeTsSink(fd));
     ServiceFilterOption service_filter_option;
     LoadOption(args, &service_filter_option);
     auto service_filter = std::make_unique<ServiceFilter>(service_filter_option);
@@ -1368,44 +2599,88 @@ std::unique_ptr<PacketSink> MakePacketSink(const Args& args) {
     ProgramMetadataFilterOption option;
     LoadOption(args, &option);
     auto filter = std::make_unique<ProgramMetadataFilter>(option);
-    filter->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    filter->Connect(MakeJsonlSink(fd, true));
     return filter;
   }
   if (args.at(kRecordService).asBool()) {
     ServiceRecorderOption recorder_option;
     LoadOption(args, &recorder_option);
-    auto file = std::make_unique<PosixFile>(recorder_option.file, PosixFile::Mode::kWrite);
-    auto sink = std::make_unique<RingFileSink>(
-        std::move(file), recorder_option.chunk_size, recorder_option.num_chunks);
-    auto recorder = std::make_unique<ServiceRecorder>(recorder_option);
-    recorder->ServiceRecorder::Connect(std::move(sink));
-    recorder->JsonlSource::Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    RingFileSinkOption sink_option;
+    LoadOption(args, &sink_option);
+    auto recorder = MakeServiceRecorder(recorder_option, sink_option, fd);
     ServiceFilterOption filter_option;
     LoadOption(args, &filter_option);
     auto filter = std::make_unique<ServiceFilter>(filter_option);
     filter->Connect(std::move(recorder));
     return filter;
   }
+  if (args.at(kRecordServices).asBool()) {
+    std::vector<ServiceRecorderOption> recorder_options;
+    LoadOption(args, &recorder_options);
+    RingFileSinkOption sink_option;
+    LoadOption(args, &sink_option);
+    MultiServiceFilterOption filter_option;
+    for (const auto& recorder_option : recorder_options) {
+      filter_option.sids.push_back(recorder_option.sid);
+    }
+    auto filter = std::make_unique<MultiServiceFilter>(filter_option);
+    for (size_t i = 0; i < recorder_options.size(); ++i) {
+      // Every recorder writes JSON messages to the same output.  Each StdoutJsonlSink owns its
+      // file descriptor.
+      auto jsonl_fd = fd;
+      if (i > 0 && fd != STDOUT_FILENO) {
+        jsonl_fd = dup(fd);
+        if (jsonl_fd < 0) {
+          MIRAKC_ARIB_ERROR("Failed to dup: {} ({})", std::strerror(errno), errno);
+          std::abort();
+        }
+      }
+      const auto& recorder_option = recorder_options[i];
+      filter->Connect(
+          recorder_option.sid, MakeServiceRecorder(recorder_option, sink_option, jsonl_fd));
+    }
+    return filter;
+  }
   if (args.at(kTrackAirtime).asBool()) {
     AirtimeTrackerOption option;
     LoadOption(args, &option);
     auto tracker = std::make_unique<AirtimeTracker>(option);
-    tracker->Connect(std::move(std::make_unique<StdoutJsonlSink>()));
+    tracker->Connect(MakeJsonlSink(fd, true));
     return tracker;
   }
   if (args.at(kSeekStart).asBool()) {
     StartSeekerOption option;
     LoadOption(args, &option);
     auto seeker = std::make_unique<StartSeeker>(option);
-    seeker->Connect(std::make_unique<StdoutSink>());
+    seeker->Connect(MakeTsSink(fd));
     return seeker;
   }
   if (args.at(kPrintPes).asBool()) {
     return std::make_unique<PesPrinter>();
   }
+  if (args.at(kFanout).asBool()) {
+    return MakeFanoutSink(args);
+  }
   return std::unique_ptr<PacketSink>();
 }
 
+int ReadRing(const Args& args) {
+  RingReaderOption option;
+  LoadOption(args, &option);
+  auto index_file = option.file + ".index";
+  auto mapping = PosixFileMapping::Map(index_file, true);
+  if (mapping == nullptr) {
+    MIRAKC_ARIB_ERROR("Failed to map {}", index_file);
+    return EXIT_FAILURE;
+  }
+  auto index = std::make_unique<ChunkIndexReader>(
+      std::move(mapping), option.chunk_size, option.num_chunks);
+  auto file = std::make_unique<PosixFile>(option.file);
+  auto out = std::make_unique<PosixFile>("", PosixFile::Mode::kWrite);
+  RingReader reader(option, std::move(file), std::move(index), std::move(out));
+  return reader.Run();
+}
+
 void ShowHelp(const Args& args) {
   if (args.at(kScanServices).asBool()) {
     fmt::print(kScanServicesHelp);
@@ -1419,18 +2694,26 @@ void ShowHelp(const Args& args) {
     fmt::print(kCollectLogosHelp);
   } else if (args.at(kFilterService).asBool()) {
     fmt::print(kFilterServiceHelp);
+  } else if (args.at(kFilterServices).asBool()) {
+    fmt::print(kFilterServicesHelp);
   } else if (args.at(kFilterProgram).asBool()) {
     fmt::print(kFilterProgramHelp);
   } else if (args.at(kFilterProgramMetadata).asBool()) {
     fmt::print(kFilterProgramMetadataHelp);
   } else if (args.at(kRecordService).asBool()) {
     fmt::print(kRecordServiceHelp);
+  } else if (args.at(kRecordServices).asBool()) {
+    fmt::print(kRecordServicesHelp);
+  } else if (args.at(kReadRing).asBool()) {
+    fmt::print(kReadRingHelp);
   } else if (args.at(kTrackAirtime).asBool()) {
     fmt::print(kTrackAirtimeHelp);
   } else if (args.at(kSeekStart).asBool()) {
     fmt::print(kSeekStartHelp);
   } else if (args.at(kPrintPes).asBool()) {
     fmt::print(kPrintPesHelp);
+  } else if (args.at(kFanout).asBool()) {
+    fmt::print(kFanoutHelp);
   } else {
     fmt::print(kUsage);
   }
@@ -1460,7 +2743,17 @@ int main(int argc, char* argv[]) {
 
   Init(args);
 
+  // Closing one of multiple outputs must not kill the process.  write(2) fails with EPIPE
+  // instead, and only the service or the pipeline writing to the output stops.
+  if (args.at(kFilterServices).asBool() || args.at(kFanout).asBool()) {
+    std::signal(SIGPIPE, SIG_IGN);
+  }
+
+  if (args.at(kReadRing).asBool()) {
+    return ReadRing(args);
+  }
+
   auto src = MakePacketSource(args);
-  src->Connect(MakePacketSink(args));
+  src->Connect(MakePipelineStage("input", MakePacketSink(args, STDOUT_FILENO)));
   return src->FeedPackets();
 }
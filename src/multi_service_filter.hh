@@ -0,0 +1,482 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <unordered_set>
+#include <vector>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "logging.hh"
+#include "packet_sink.hh"
+#include "service_filter.hh"
+#include "tsduck_helper.hh"
+
+#define MIRAKC_ARIB_MULTI_SERVICE_FILTER_TRACE(...) \
+  MIRAKC_ARIB_TRACE("multi-service-filter: " __VA_ARGS__)
+#define MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG(...) \
+  MIRAKC_ARIB_DEBUG("multi-service-filter: " __VA_ARGS__)
+#define MIRAKC_ARIB_MULTI_SERVICE_FILTER_INFO(...) \
+  MIRAKC_ARIB_INFO("multi-service-filter: " __VA_ARGS__)
+#define MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN(...) \
+  MIRAKC_ARIB_WARN("multi-service-filter: " __VA_ARGS__)
+#define MIRAKC_ARIB_MULTI_SERVICE_FILTER_ERROR(...) \
+  MIRAKC_ARIB_ERROR("multi-service-filter: " __VA_ARGS__)
+
+namespace {
+
+struct MultiServiceFilterOption final {
+  std::vector<uint16_t> sids;
+  std::optional<ts::Time> time_limit = std::nullopt;  // JST
+};
+
+class MultiServiceFilterTestAccessor;
+
+// Filters packets of multiple services with a single demux.
+//
+// Each service has its own sink.  Packets are forwarded to sinks in the same way as
+// ServiceFilter.  A service stops when its SID is not found in PAT or its sink fails, but other
+// services keep going.  The sink of a stopped service is ended and destroyed at once so that the
+// reader of its output can detect EOF.  MultiServiceFilter stops when all services stop.
+class MultiServiceFilter final : public PacketSink, public ts::TableHandlerInterface {
+ public:
+  explicit MultiServiceFilter(const MultiServiceFilterOption& option)
+      : option_(option), demux_(context_) {
+    for (auto sid : option_.sids) {
+      services_.push_back(std::make_unique<Service>(sid));
+    }
+    demux_.setTableHandler(this);
+    demux_.addPID(ts::PID_PAT);
+    MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("Demux PAT");
+    demux_.addPID(ts::PID_CAT);
+    MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("Demux CAT for detecting EMM PIDs");
+    if (option_.time_limit.has_value()) {
+      demux_.addPID(ts::PID_TOT);
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("Demux TOT for checking the time limit");
+    }
+  }
+
+  ~MultiServiceFilter() override {}
+
+  void Connect(uint16_t sid, std::unique_ptr<PacketSink>&& sink) {
+    for (auto& service : services_) {
+      if (service->sid == sid && service->sink == nullptr) {
+        service->sink = std::move(sink);
+        return;
+      }
+    }
+    MIRAKC_ARIB_NEVER_REACH("No service for SID#{:04X}", sid);
+  }
+
+  bool Start() override {
+    for (auto& service : services_) {
+      MIRAKC_ARIB_ASSERT(service->sink != nullptr);
+      if (!service->sink->Start()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void End() override {
+    for (auto& service : services_) {
+      if (service->sink == nullptr) {
+        continue;  // already ended in StopService()
+      }
+      service->sink->End();
+    }
+  }
+
+  int GetExitCode() const override {
+    for (const auto& service : services_) {
+      auto exit_code =
+          service->sink != nullptr ? service->sink->GetExitCode() : service->exit_code;
+      if (exit_code != EXIT_SUCCESS) {
+        return exit_code;
+      }
+      if (service->error) {
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    for (size_t i = 0; i < num_packets; ++i) {
+      if (!ProcessPacket(packets[i])) {
+        FlushAll();
+        return false;
+      }
+    }
+    FlushAll();
+    return num_active_services() > 0;
+  }
+
+ private:
+  static constexpr uint8_t kPidRolePsi = 0x01;
+  static constexpr uint8_t kPidRoleContent = 0x02;
+  static constexpr uint8_t kPidRoleEmm = 0x04;
+
+  struct Service {
+    explicit Service(uint16_t sid)
+        : sid(sid), pat_packetizer(ts::PID_PAT, ts::CyclingPacketizer::ALWAYS) {}
+
+    uint16_t sid;
+    std::unique_ptr<PacketSink> sink;
+    PacketForwarder forwarder;
+    ts::CyclingPacketizer pat_packetizer;
+    ts::PID pmt_pid = ts::PID_NULL;
+    std::unordered_set<ts::PID> content_filter;
+    PidRoleTable pid_roles;
+    // Kept after the sink is destroyed in StopService().
+    int exit_code = EXIT_SUCCESS;
+    bool done = false;
+    bool error = false;
+  };
+
+  bool ProcessPacket(const ts::TSPacket& packet) {
+    demux_.feedPacket(packet);
+
+    if (done_) {
+      return false;
+    }
+
+    auto pid = packet.getPID();
+
+    // Most packets are dropped here.
+    if (pid_roles_.Get(pid) == 0) {
+      return true;
+    }
+
+    for (auto& service : services_) {
+      if (service->done || service->pid_roles.Get(pid) == 0) {
+        continue;
+      }
+
+      bool ok;
+      if (pid == ts::PID_PAT) {
+        // Feed a modified PAT packet
+        ts::TSPacket pat_packet;
+        service->pat_packetizer.getNextPacket(pat_packet);
+        MIRAKC_ARIB_ASSERT(pat_packet.getPID() == ts::PID_PAT);
+        ok = service->forwarder.Send(service->sink.get(), pat_packet);
+      } else {
+        MIRAKC_ARIB_ASSERT(pid != ts::PID_NULL);
+        ok = service->forwarder.Forward(service->sink.get(), packet);
+      }
+
+      if (!ok) {
+        StopService(*service, false);
+      }
+    }
+
+    return num_active_services() > 0;
+  }
+
+  void FlushAll() {
+    for (auto& service : services_) {
+      if (service->done) {
+        continue;
+      }
+      if (!service->forwarder.Flush(service->sink.get())) {
+        StopService(*service, false);
+      }
+    }
+  }
+
+  void StopService(Service& service, bool error) {
+    service.done = true;
+    service.error = error;
+    UpdatePidRoles();
+    service.sink->End();
+    service.exit_code = service.sink->GetExitCode();
+    // Close outputs of the service so that its reader can detect EOF.
+    service.sink.reset();
+    if (error) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_ERROR("SID#{:04X}: Stopped with an error", service.sid);
+    } else {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_INFO("SID#{:04X}: Stopped", service.sid);
+    }
+  }
+
+  size_t num_active_services() const {
+    size_t n = 0;
+    for (const auto& service : services_) {
+      if (!service->done) {
+        n++;
+      }
+    }
+    return n;
+  }
+
+  void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
+    switch (table.tableId()) {
+      case ts::TID_PAT:
+        HandlePat(table);
+        break;
+      case ts::TID_CAT:
+        HandleCat(table);
+        break;
+      case ts::TID_PMT:
+        HandlePmt(table);
+        break;
+      case ts::TID_TOT:
+        HandleTot(table);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void HandlePat(const ts::BinaryTable& table) {
+    if (table.sourcePID() != ts::PID_PAT) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN(
+          "PAT delivered with PID#{:04X}, skip", table.sourcePID());
+      return;
+    }
+
+    ts::PAT pat(context_, table);
+
+    if (!pat.isValid()) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN("Broken PAT, skip");
+      return;
+    }
+
+    if (pat.ts_id == 0) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN("PAT for TSID#0000, skip");
+      return;
+    }
+
+    for (auto& service : services_) {
+      if (service->done) {
+        continue;
+      }
+
+      auto pmt_it = pat.pmts.find(service->sid);
+      if (pmt_it == pat.pmts.end()) {
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_ERROR("SID#{:04X} not found in PAT", service->sid);
+        StopService(*service, true);
+        continue;
+      }
+
+      auto new_pmt_pid = pmt_it->second;
+      if (!ServiceFilter::IsSafeDynamicPid(new_pmt_pid)) {
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN(
+            "SID#{:04X}: Unsafe PMT PID#{:04X}, skip", service->sid, new_pmt_pid);
+        continue;
+      }
+
+      if (service->pmt_pid != ts::PID_NULL && service->pmt_pid != new_pmt_pid) {
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_INFO("SID#{:04X}: PID of PMT has been changed: "
+            "{:04X} -> {:04X}", service->sid, service->pmt_pid, new_pmt_pid);
+        // content_filter is not cleared at this point.  This will be cleared when a new PMT is
+        // detected.
+      }
+      service->pmt_pid = new_pmt_pid;
+
+      // Prepare packetizer for modified PAT containing only this service.
+      ts::PAT service_pat(pat);
+      service_pat.pmts.clear();
+      service_pat.pmts[service->sid] = new_pmt_pid;
+      service->pat_packetizer.removeAll();
+      service->pat_packetizer.addTable(context_, service_pat);
+    }
+
+    UpdatePmtPids();
+    UpdatePidRoles();
+  }
+
+  void HandleCat(const ts::BinaryTable& table) {
+    ts::CAT cat(context_, table);
+
+    if (!cat.isValid()) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN("Broken CAT, skip");
+      return;
+    }
+
+    emm_filter_.clear();
+    MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("Clear EMM filter");
+
+    auto i = cat.descs.search(ts::DID_CA);
+    while (i < cat.descs.size()) {
+      ts::CADescriptor desc(context_, *cat.descs[i]);
+
+      if (ServiceFilter::IsSafeDynamicPid(desc.ca_pid)) {
+        emm_filter_.insert(desc.ca_pid);
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("EMM filter += EMM#{:04X}", desc.ca_pid);
+      } else {
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN("Unsafe EMM PID#{:04X}, skip", desc.ca_pid);
+      }
+
+      i = cat.descs.search(ts::DID_CA, i + 1);
+    }
+
+    UpdatePidRoles();
+  }
+
+  void HandlePmt(const ts::BinaryTable& table) {
+    ts::PMT pmt(context_, table);
+
+    if (!pmt.isValid()) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN("Broken PMT, skip");
+      return;
+    }
+
+    for (auto& service : services_) {
+      if (service->sid != pmt.service_id || service->pmt_pid != table.sourcePID()) {
+        continue;
+      }
+
+      service->content_filter.clear();
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("SID#{:04X}: Clear content filter", service->sid);
+
+      if (ServiceFilter::IsSafeDynamicPid(pmt.pcr_pid)) {
+        service->content_filter.insert(pmt.pcr_pid);
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG(
+            "SID#{:04X}: Content filter += PCR#{:04X}", service->sid, pmt.pcr_pid);
+      } else {
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN(
+            "SID#{:04X}: Unsafe PCR PID#{:04X}, skip", service->sid, pmt.pcr_pid);
+      }
+
+      auto i = pmt.descs.search(ts::DID_CA);
+      while (i < pmt.descs.size()) {
+        ts::CADescriptor desc(context_, *pmt.descs[i]);
+        if (ServiceFilter::IsSafeDynamicPid(desc.ca_pid)) {
+          service->content_filter.insert(desc.ca_pid);
+          MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG(
+              "SID#{:04X}: Content filter += ECM#{:04X}", service->sid, desc.ca_pid);
+        } else {
+          MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN(
+              "SID#{:04X}: Unsafe ECM PID#{:04X}, skip", service->sid, desc.ca_pid);
+        }
+        i = pmt.descs.search(ts::DID_CA, i + 1);
+      }
+
+      for (auto it = pmt.streams.begin(); it != pmt.streams.end(); ++it) {
+        auto pid = it->first;
+        if (!ServiceFilter::IsSafeDynamicPid(pid)) {
+          MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN(
+              "SID#{:04X}: Unsafe stream PID#{:04X}, skip", service->sid, pid);
+          continue;
+        }
+        service->content_filter.insert(pid);
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG(
+            "SID#{:04X}: Content filter += PES#{:04X}", service->sid, pid);
+      }
+    }
+
+    UpdatePidRoles();
+  }
+
+  void HandleTot(const ts::BinaryTable& table) {
+    ts::TOT tot(context_, table);
+
+    if (!tot.isValid()) {
+      MIRAKC_ARIB_MULTI_SERVICE_FILTER_WARN("Broken TOT, skip");
+      return;
+    }
+
+    if (!option_.time_limit.has_value()) {
+      return;
+    }
+
+    if (tot.utc_time < option_.time_limit.value()) {  // JST in ARIB
+      return;
+    }
+
+    done_ = true;
+    MIRAKC_ARIB_MULTI_SERVICE_FILTER_INFO("Over the time limit, stop streaming");
+  }
+
+  // Updates PIDs of PMTs to demux.
+  void UpdatePmtPids() {
+    std::unordered_set<ts::PID> pmt_pids;
+    for (const auto& service : services_) {
+      if (service->pmt_pid != ts::PID_NULL) {
+        pmt_pids.insert(service->pmt_pid);
+      }
+    }
+
+    for (auto pid : pmt_pids_) {
+      if (pmt_pids.find(pid) == pmt_pids.end()) {
+        demux_.removePID(pid);
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("Stop to demux PMT#{:04X}", pid);
+      }
+    }
+
+    for (auto pid : pmt_pids) {
+      if (pmt_pids_.find(pid) == pmt_pids_.end()) {
+        demux_.addPID(pid);
+        MIRAKC_ARIB_MULTI_SERVICE_FILTER_DEBUG("Demux PMT#{:04X}", pid);
+      }
+    }
+
+    pmt_pids_ = std::move(pmt_pids);
+  }
+
+  // Rebuilds the PID role tables from the filter sets.
+  void UpdatePidRoles() {
+    pid_roles_.Clear();
+    for (auto& service : services_) {
+      auto& roles = service->pid_roles;
+      roles.Clear();
+      if (service->done) {
+        continue;
+      }
+      // PSI/SI packets are passed through after the PAT is accepted.
+      if (service->pmt_pid != ts::PID_NULL) {
+        for (auto pid : ServiceFilter::kPsiFilterPids) {
+          roles.Add(pid, kPidRolePsi);
+        }
+        roles.Add(service->pmt_pid, kPidRolePsi);
+      }
+      for (auto pid : service->content_filter) {
+        roles.Add(pid, kPidRoleContent);
+      }
+      for (auto pid : emm_filter_) {
+        roles.Add(pid, kPidRoleEmm);
+      }
+      pid_roles_.Merge(roles);
+    }
+  }
+
+  const MultiServiceFilterOption option_;
+  ts::DuckContext context_;
+  LazySectionDemux demux_;
+  std::vector<std::unique_ptr<Service>> services_;
+  std::unordered_set<ts::PID> pmt_pids_;
+  std::unordered_set<ts::PID> emm_filter_;
+  // Union of the PID role tables of the services.
+  PidRoleTable pid_roles_;
+  bool done_ = false;
+
+  friend class MultiServiceFilterTestAccessor;
+
+  MIRAKC_ARIB_NON_COPYABLE(MultiServiceFilter);
+};
+
+}  // namespace
@@ -21,6 +21,9 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include <tsduck/tsduck.h>
 
 #include "base.hh"
@@ -28,6 +31,10 @@
 
 namespace {
 
+// Batches of packets are passed as arrays of ts::TSPacket.  They can be viewed as contiguous
+// bytes only if ts::TSPacket has no extra members.
+static_assert(sizeof(ts::TSPacket) == ts::PKT_SIZE);
+
 class PacketSink {
  public:
   PacketSink() = default;
@@ -41,15 +48,85 @@ class PacketSink {
   }
   virtual bool HandlePacket(const ts::TSPacket& packet) = 0;
 
+  // Handles a batch of consecutive packets.
+  //
+  // The packets are valid only during the call.  Sinks processing packets in bulk should override
+  // this method in order to avoid a virtual call for each packet.
+  virtual bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) {
+    for (size_t i = 0; i < num_packets; ++i) {
+      if (!HandlePacket(packets[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
  private:
   MIRAKC_ARIB_NON_COPYABLE(PacketSink);
 };
 
+// Forwards packets to a sink.
+//
+// Packets forwarded with Forward() are accumulated while they are contiguous in memory, and fed
+// to the sink with a single HandlePackets() call.  So, packets forwarded with Forward() must be
+// valid until Flush() is called.  Use Send() for packets which are valid only during the call,
+// such as rewritten PSI packets.
+class PacketForwarder final {
+ public:
+  PacketForwarder() = default;
+  ~PacketForwarder() = default;
+
+  bool Forward(PacketSink* sink, const ts::TSPacket& packet) {
+    if (num_packets_ != 0 && &packet == packets_ + num_packets_) {
+      num_packets_++;
+      return true;
+    }
+    if (!Flush(sink)) {
+      return false;
+    }
+    packets_ = &packet;
+    num_packets_ = 1;
+    return true;
+  }
+
+  bool Send(PacketSink* sink, const ts::TSPacket& packet) {
+    if (!Flush(sink)) {
+      return false;
+    }
+    return sink->HandlePacket(packet);
+  }
+
+  bool Flush(PacketSink* sink) {
+    if (num_packets_ == 0) {
+      return true;
+    }
+    auto* packets = packets_;
+    auto num_packets = num_packets_;
+    packets_ = nullptr;
+    num_packets_ = 0;
+    return sink->HandlePackets(packets, num_packets);
+  }
+
+  // The number of packets which will be fed to the sink in the next Flush().
+  size_t num_pending_packets() const {
+    return num_packets_;
+  }
+
+ private:
+  const ts::TSPacket* packets_ = nullptr;
+  size_t num_packets_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(PacketForwarder);
+};
+
 class PacketRingObserver {
  public:
   PacketRingObserver() = default;
   virtual ~PacketRingObserver() = default;
   virtual void OnEndOfChunk(uint64_t pos) = 0;
+  // Called when data up to `pos` has been written into the file.  `pos` is the ring buffer size
+  // when reaching the end of the ring buffer.
+  virtual void OnEndOfBlock(uint64_t pos) {}
 
  private:
   MIRAKC_ARIB_NON_COPYABLE(PacketRingObserver);
@@ -67,6 +144,10 @@ class PacketRingSink : public PacketSink {
     return false;
   }
 
+  // Waits until packets written so far are processed, and notifies the observer of chunks
+  // completed.  Sinks processing packets asynchronously must implement this.
+  virtual void Drain() {}
+
  private:
   MIRAKC_ARIB_NON_COPYABLE(PacketRingSink);
 };
@@ -74,34 +155,26 @@ class PacketRingSink : public PacketSink {
 class StdoutSink final : public PacketSink {
  public:
   StdoutSink() = default;
-  ~StdoutSink() override {}
+
+  // Writes packets to `fd` instead of STDOUT.  `fd` is closed when the sink is destroyed.
+  explicit StdoutSink(int fd) : fd_(fd) {}
+
+  ~StdoutSink() override {
+    if (fd_ != kStdoutFd) {
+      close(fd_);
+    }
+  }
 
   void End() override {
     (void)Flush();
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
-    if (pos_ + ts::PKT_SIZE < kBufferSize) {
-      std::memcpy(buf_ + pos_, packet.b, ts::PKT_SIZE);
-      pos_ += ts::PKT_SIZE;
-      return true;
-    }
-
-    auto remaining = kBufferSize - pos_;
-    std::memcpy(buf_ + pos_, packet.b, remaining);
-    pos_ += remaining;
-    MIRAKC_ARIB_ASSERT(pos_ == kBufferSize);
-    if (!Flush()) {
-      return false;
-    }
-
-    if (ts::PKT_SIZE > remaining) {
-      MIRAKC_ARIB_ASSERT(pos_ == 0);
-      std::memcpy(buf_, packet.b + remaining, ts::PKT_SIZE - remaining);
-      pos_ = ts::PKT_SIZE - remaining;
-    }
+    return Write(packet.b, ts::PKT_SIZE);
+  }
 
-    return true;
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    return Write(reinterpret_cast<const uint8_t*>(packets), num_packets * ts::PKT_SIZE);
   }
 
  private:
@@ -112,10 +185,20 @@ class StdoutSink final : public PacketSink {
   // See https://man7.org/linux/man-pages/man7/pipe.7.html
   static constexpr size_t kBufferSize = 4096 * 4;
 
+  bool Write(const uint8_t* data, size_t size) {
+    if (pos_ + size < kBufferSize) {
+      std::memcpy(buf_ + pos_, data, size);
+      pos_ += size;
+      return true;
+    }
+    // Write the buffered bytes and the data at once without copying the data into the buffer.
+    return WriteDirect(data, size);
+  }
+
   bool Flush() {
     size_t nwritten = 0;
     while (nwritten < pos_) {
-      auto res = write(kStdoutFd, buf_ + nwritten, pos_ - nwritten);
+      auto res = write(fd_, buf_ + nwritten, pos_ - nwritten);
       if (res < 0) {
         MIRAKC_ARIB_ERROR("Failed to write packets: {} ({})", std::strerror(errno), errno);
         return false;
@@ -127,6 +210,37 @@ class StdoutSink final : public PacketSink {
     return true;
   }
 
+  bool WriteDirect(const uint8_t* data, size_t size) {
+    struct iovec iov[2];
+    iov[0].iov_base = buf_;
+    iov[0].iov_len = pos_;
+    iov[1].iov_base = const_cast<uint8_t*>(data);
+    iov[1].iov_len = size;
+
+    auto* vec = iov[0].iov_len > 0 ? &iov[0] : &iov[1];
+    auto* vec_end = &iov[2];
+    while (vec != vec_end) {
+      auto res = writev(fd_, vec, static_cast<int>(vec_end - vec));
+      if (res < 0) {
+        MIRAKC_ARIB_ERROR("Failed to write packets: {} ({})", std::strerror(errno), errno);
+        return false;
+      }
+      auto nwritten = static_cast<size_t>(res);
+      while (vec != vec_end && nwritten >= vec->iov_len) {
+        nwritten -= vec->iov_len;
+        vec++;
+      }
+      if (vec != vec_end) {
+        vec->iov_base = static_cast<uint8_t*>(vec->iov_base) + nwritten;
+        vec->iov_len -= nwritten;
+      }
+    }
+
+    pos_ = 0;
+    return true;
+  }
+
+  int fd_ = kStdoutFd;
   uint8_t buf_[kBufferSize];
   size_t pos_ = 0;
 
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
@@ -47,9 +49,13 @@ class PacketSource {
       MIRAKC_ARIB_ERROR("Failed to start");
       return EXIT_FAILURE;
     }
-    ts::TSPacket packet;
-    while (GetNextPacket(&packet)) {
-      if (!sink_->HandlePacket(packet)) {
+    for (;;) {
+      const ts::TSPacket* packets = nullptr;
+      auto num_packets = GetNextPackets(&packets);
+      if (num_packets == 0) {
+        break;
+      }
+      if (!sink_->HandlePackets(packets, num_packets)) {
         break;
       }
     }
@@ -60,13 +66,37 @@ class PacketSource {
   }
 
  private:
-  virtual bool GetNextPacket(ts::TSPacket* packet) = 0;
+  // Returns the number of packets stored at `*packets`, or 0 when there are no more packets.
+  //
+  // The packets are valid until the next call.  The default implementation reads packets one by
+  // one with GetNextPacket().  Sources which can provide packets in bulk should override this
+  // method.
+  virtual size_t GetNextPackets(const ts::TSPacket** packets) {
+    if (!GetNextPacket(&packet_)) {
+      return 0;
+    }
+    *packets = &packet_;
+    return 1;
+  }
+
+  virtual bool GetNextPacket(ts::TSPacket*) {
+    return false;
+  }
 
   std::unique_ptr<PacketSink> sink_;
+  ts::TSPacket packet_;
 
   MIRAKC_ARIB_NON_COPYABLE(PacketSource);
 };
 
+struct FileSourceOption final {
+  // The number of bytes to read at once.  FileSource::kReadChunkSize is used if 0.
+  size_t read_chunk_size = 0;
+  // The read chunk size grows up to this value while reads keep returning full chunks.  The read
+  // chunk size is fixed if this is not greater than the read chunk size.
+  size_t max_read_chunk_size = 0;
+};
+
 // The ts::TSFileInput class works well on many platforms including Window.  But
 // it doesn't support resync when synchronization is lost, unfortunately.
 //
@@ -76,6 +106,9 @@ class FileSource final : public PacketSource {
   static constexpr size_t kMaxDropBytes = 2 * ts::PKT_SIZE;
   static constexpr size_t kMaxResyncBytes = kMaxDropBytes + 3 * ts::PKT_SIZE;
   static constexpr size_t kReadChunkSize = 4 * kBlockSize;
+  static constexpr size_t kMaxReadChunkSize = 16 * 1024 * 1024;
+  // The read chunk size is doubled after this number of consecutive full reads.
+  static constexpr size_t kNumFullReadsToGrow = 4;
   // TODO:
   // Constants above should be private, but doing that causes compile errors
   // like below at least on macOS:
@@ -83,37 +116,102 @@ class FileSource final : public PacketSource {
   //   ../src/packet_source.hh:58:41: error: use of undeclared identifier
   //   'kReadChunkSize'
   //
-  static constexpr size_t kBufferSize = kReadChunkSize + kMaxResyncBytes;
 
-  explicit FileSource(std::unique_ptr<File>&& file) : file_(std::move(file)) {}
-  ~FileSource() override {}
+  explicit FileSource(std::unique_ptr<File>&& file, const FileSourceOption& option = {})
+      : file_(std::move(file)), peekable_(file_->CanPeek()) {
+    read_chunk_size_ = option.read_chunk_size != 0 ? option.read_chunk_size : kReadChunkSize;
+    max_read_chunk_size_ = std::max(read_chunk_size_, option.max_read_chunk_size);
+    MIRAKC_ARIB_ASSERT(max_read_chunk_size_ <= kMaxReadChunkSize);
+    buf_size_ = max_read_chunk_size_ + kMaxResyncBytes;
+    buf_ = std::make_unique<uint8_t[]>(buf_size_);
+    if (max_read_chunk_size_ > read_chunk_size_) {
+      MIRAKC_ARIB_INFO(
+          "Read chunk size: {} (adaptive up to {})", read_chunk_size_, max_read_chunk_size_);
+    } else {
+      MIRAKC_ARIB_DEBUG("Read chunk size: {}", read_chunk_size_);
+    }
+  }
+
+  ~FileSource() override {
+    LogReadStats();
+  }
 
  private:
-  bool GetNextPacket(ts::TSPacket* packet) override {
+  // Returns synchronized packets in the read buffer as a batch without copying them.
+  //
+  // The read buffer is refilled only when it contains no packet, so that each batch contains all
+  // packets read by a single call to FillBuffer().  Packets in the batch are valid until the next
+  // call because FillBuffer() moves remaining bytes to the beginning of the buffer.
+  //
+  // When the file can peek its own buffer, packets are taken from that buffer instead.  Only
+  // packets split across buffers of the file and bytes needed for resync are copied into the read
+  // buffer.
+  size_t GetNextPackets(const ts::TSPacket** packets) override {
+    if (peekable_ && available_bytes() == 0) {
+      auto num_packets = PeekPackets(packets);
+      if (num_packets != 0 || eof_) {
+        return num_packets;
+      }
+    }
+
     if (!FillBuffer(ts::PKT_SIZE)) {
-      return false;
+      return 0;
     }
 
     if (buf_[pos_] != ts::SYNC_BYTE) {
       MIRAKC_ARIB_WARN("Synchronization was lost");
       if (!Resync()) {
-        return false;
+        return 0;
       }
       MIRAKC_ARIB_ASSERT(buf_[pos_] == ts::SYNC_BYTE);
     }
 
-    std::memcpy(packet->b, &buf_[pos_], ts::PKT_SIZE);
-    pos_ += ts::PKT_SIZE;
+    // ts::TSPacket can be placed at any address.
+    static_assert(alignof(ts::TSPacket) == 1);
+    *packets = reinterpret_cast<const ts::TSPacket*>(&buf_[pos_]);
 
-    MIRAKC_ARIB_ASSERT(packet->hasValidSync());
-    return true;
+    // Stop at a packet which lost the synchronization.  It will be resynced in the next call.
+    size_t num_packets = 0;
+    do {
+      pos_ += ts::PKT_SIZE;
+      num_packets++;
+    } while (available_bytes() >= ts::PKT_SIZE && buf_[pos_] == ts::SYNC_BYTE);
+
+    MIRAKC_ARIB_ASSERT(num_packets <= buf_size_ / ts::PKT_SIZE);
+    return num_packets;
+  }
+
+  // Returns synchronized packets at the beginning of the buffer of the file.  Returns 0 if it
+  // doesn't start with a whole synchronized packet.
+  inline size_t PeekPackets(const ts::TSPacket** packets) {
+    const uint8_t* data;
+    auto nread = file_->Peek(&data);
+    if (nread <= 0) {
+      eof_ = true;
+      MIRAKC_ARIB_INFO("EOF reached");
+      return 0;
+    }
+
+    auto size = static_cast<size_t>(nread);
+    size_t pos = 0;
+    while (size - pos >= ts::PKT_SIZE && data[pos] == ts::SYNC_BYTE) {
+      pos += ts::PKT_SIZE;
+    }
+    if (pos == 0) {
+      return 0;
+    }
+
+    // The data is still valid after it's consumed, until the next call to Peek() or Read().
+    file_->Consume(pos);
+    *packets = reinterpret_cast<const ts::TSPacket*>(data);
+    return pos / ts::PKT_SIZE;
   }
 
   inline bool FillBuffer(size_t min_bytes) {
     MIRAKC_ARIB_ASSERT(min_bytes <= kMaxResyncBytes);
     MIRAKC_ARIB_ASSERT(!eof_);
     MIRAKC_ARIB_ASSERT(pos_ <= end_);
-    MIRAKC_ARIB_ASSERT(end_ <= kBufferSize);
+    MIRAKC_ARIB_ASSERT(end_ <= buf_size_);
 
     auto avail_bytes = available_bytes();
     if (avail_bytes >= min_bytes) {
@@ -125,19 +223,74 @@ class FileSource final : public PacketSource {
     end_ = avail_bytes;
 
     do {
-      MIRAKC_ARIB_ASSERT(free_bytes() >= kReadChunkSize);
-      auto nread = file_->Read(&buf_[end_], kReadChunkSize);
+      MIRAKC_ARIB_ASSERT(free_bytes() >= read_chunk_size_);
+      // Copy only the missing bytes from a peekable file so that following packets are taken from
+      // its buffer without copying them.
+      auto len = peekable_ ? min_bytes - end_ : read_chunk_size_;
+      auto nread = file_->Read(&buf_[end_], len);
       if (nread <= 0) {
         eof_ = true;
         MIRAKC_ARIB_INFO("EOF reached");
         return false;
       }
       end_ += nread;
+      if (!peekable_) {
+        UpdateReadChunkSize(static_cast<size_t>(nread));
+      }
     } while (end_ < min_bytes);
 
     return true;
   }
 
+  inline void UpdateReadChunkSize(size_t nread) {
+    read_stats_[ReadStatsIndex(nread)]++;
+
+    if (read_chunk_size_ >= max_read_chunk_size_) {
+      return;
+    }
+
+    if (nread < read_chunk_size_) {
+      num_full_reads_ = 0;
+      return;
+    }
+
+    num_full_reads_++;
+    if (num_full_reads_ < kNumFullReadsToGrow) {
+      return;
+    }
+
+    num_full_reads_ = 0;
+    read_chunk_size_ = std::min(read_chunk_size_ * 2, max_read_chunk_size_);
+    MIRAKC_ARIB_DEBUG("Read chunk size grew to {}", read_chunk_size_);
+  }
+
+  // Returns the index of the power-of-two bucket containing `nread`.
+  static inline size_t ReadStatsIndex(size_t nread) {
+    size_t index = 0;
+    while (index + 1 < kNumReadStats && (nread >> (index + 1)) != 0) {
+      index++;
+    }
+    return index;
+  }
+
+  void LogReadStats() const {
+    std::string stats;
+    for (size_t i = 0; i < kNumReadStats; ++i) {
+      if (read_stats_[i] == 0) {
+        continue;
+      }
+      if (!stats.empty()) {
+        stats.append(", ");
+      }
+      stats.append(fmt::format("{}+: {}", static_cast<size_t>(1) << i, read_stats_[i]));
+    }
+    if (stats.empty()) {
+      return;
+    }
+    MIRAKC_ARIB_INFO("Read sizes in bytes: {}", stats);
+    MIRAKC_ARIB_INFO("Last read chunk size: {}", read_chunk_size_);
+  }
+
   inline bool Resync() {
     MIRAKC_ARIB_WARN("Resync...");
 
@@ -175,16 +328,117 @@ class FileSource final : public PacketSource {
   }
 
   inline size_t free_bytes() const {
-    return kBufferSize - end_;
+    return buf_size_ - end_;
   }
 
+  static constexpr size_t kNumReadStats = 32;
+
   std::unique_ptr<File> file_;
+  bool peekable_;
   bool eof_ = false;
-  uint8_t buf_[kBufferSize];
+  std::unique_ptr<uint8_t[]> buf_;
+  size_t buf_size_;
   size_t pos_ = 0;
   size_t end_ = 0;
+  size_t read_chunk_size_;
+  size_t max_read_chunk_size_;
+  size_t num_full_reads_ = 0;
+  std::array<uint64_t, kNumReadStats> read_stats_ = {};
 
   MIRAKC_ARIB_NON_COPYABLE(FileSource);
 };
 
+// A packet source which reads packets directly from a file mapped into memory.
+//
+// Unlike the FileSource, the MmapFileSource never copies packets.  Packets are resynced in the
+// mapping and fed to the sink in place.  The resync rules are the same as the FileSource.
+class MmapFileSource final : public PacketSource {
+ public:
+  static constexpr size_t kMaxDropBytes = FileSource::kMaxDropBytes;
+  static constexpr size_t kMaxResyncBytes = FileSource::kMaxResyncBytes;
+  // Limit the number of packets in a batch so that sinks can process packets while they are
+  // still in the CPU cache.
+  static constexpr size_t kMaxBatchSize = 1024;
+
+  explicit MmapFileSource(std::unique_ptr<FileMapping>&& mapping)
+      : mapping_(std::move(mapping)), data_(mapping_->data()), size_(mapping_->size()) {
+    MIRAKC_ARIB_INFO("Read packets from {} mapped in memory...", mapping_->path());
+  }
+
+  ~MmapFileSource() override {}
+
+ private:
+  size_t GetNextPackets(const ts::TSPacket** packets) override {
+    if (available_bytes() < ts::PKT_SIZE) {
+      MIRAKC_ARIB_INFO("EOF reached");
+      return 0;
+    }
+
+    if (data_[pos_] != ts::SYNC_BYTE) {
+      MIRAKC_ARIB_WARN("Synchronization was lost");
+      if (!Resync()) {
+        return 0;
+      }
+      MIRAKC_ARIB_ASSERT(data_[pos_] == ts::SYNC_BYTE);
+    }
+
+    static_assert(alignof(ts::TSPacket) == 1);
+    *packets = reinterpret_cast<const ts::TSPacket*>(&data_[pos_]);
+
+    // Stop at a packet which lost the synchronization.  It will be resynced in the next call.
+    size_t num_packets = 0;
+    do {
+      pos_ += ts::PKT_SIZE;
+      num_packets++;
+    } while (num_packets < kMaxBatchSize && available_bytes() >= ts::PKT_SIZE &&
+        data_[pos_] == ts::SYNC_BYTE);
+
+    return num_packets;
+  }
+
+  inline bool Resync() {
+    MIRAKC_ARIB_WARN("Resync...");
+
+    if (available_bytes() < kMaxResyncBytes) {
+      MIRAKC_ARIB_INFO("EOF reached");
+      return false;
+    }
+
+    size_t resync_start = pos_;
+    size_t resync_end = pos_ + kMaxDropBytes;
+
+    while (pos_ < resync_end) {
+      if (data_[pos_] != ts::SYNC_BYTE) {
+        pos_++;
+        continue;
+      }
+      if (ValidateResync()) {
+        MIRAKC_ARIB_WARN("Resynced, {} bytes dropped", pos_ - resync_start);
+        return true;
+      }
+      pos_++;
+    }
+
+    MIRAKC_ARIB_ERROR("Resync failed");
+    return false;
+  }
+
+  inline bool ValidateResync() const {
+    return data_[pos_ + 1 * ts::PKT_SIZE] == ts::SYNC_BYTE &&
+        data_[pos_ + 2 * ts::PKT_SIZE] == ts::SYNC_BYTE &&
+        data_[pos_ + 3 * ts::PKT_SIZE] == ts::SYNC_BYTE;
+  }
+
+  inline size_t available_bytes() const {
+    return size_ - pos_;
+  }
+
+  std::unique_ptr<FileMapping> mapping_;
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(MmapFileSource);
+};
+
 }  // namespace
@@ -57,7 +57,7 @@ class PcrSynchronizer final : public PacketSink,
 
     auto time = ConvertJstTimeToUnixTime(time_);
 
-    rapidjson::Document json(rapidjson::kArrayType);
+    auto json = MakeDocument(rapidjson::kArrayType);
     auto& allocator = json.GetAllocator();
     for (const auto& [sid, pcr_pid] : pcr_pid_map_) {
       auto it = pcr_map_.find(pcr_pid);
@@ -277,7 +277,7 @@ class PcrSynchronizer final : public PacketSink,
 
   const PcrSynchronizerOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   std::map<uint16_t, ts::PID> pmt_pids_;  // SID -> PID of PMT
   uint16_t nid_ = 0;
   uint16_t tsid_ = 0;
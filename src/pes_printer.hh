@@ -256,7 +256,7 @@ class PesPrinter final : public PacketSink, public ts::TableHandlerInterface {
   };
 
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   std::set<uint16_t> sids_;
   std::vector<ts::PID> pmt_pids_;
   std::set<ts::PID> pcr_pids_;
@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fmt/format.h>
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "logging.hh"
+#include "packet_sink.hh"
+
+namespace {
+
+struct PipelinedSinkOption final {
+  // Used in log messages.
+  std::string name = "pipeline";
+  // The number of packets which can be buffered.
+  size_t capacity = 0;
+};
+
+// Feeds packets to a sink on a dedicated thread.
+//
+// Packets are copied into a single-producer single-consumer ring buffer, and the sink consumes
+// them on its own thread.  So, a slow sink doesn't block the caller until the ring buffer gets
+// full.  The thread calling HandlePackets() is the only producer, and the thread started in
+// Start() is the only consumer.  Indexes of the ring buffer are atomic variables, and the mutex
+// is used only for sleeping while the ring buffer is full or empty.
+//
+// The sink is started and ended on the caller's thread.  The consumer thread takes all contiguous
+// packets in the ring buffer up to kMaxBatchSize as a batch.
+//
+// The occupancy of the ring buffer is sampled each time packets are pushed, and a histogram of it
+// is logged at the end.  A high occupancy means that the sink is the bottleneck.
+class PipelinedSink final : public PacketSink {
+ public:
+  static constexpr size_t kDefaultCapacity = 32768;  // 6 MiB
+  static constexpr size_t kMaxBatchSize = 1024;
+  static constexpr size_t kNumOccupancyStats = 10;
+
+  explicit PipelinedSink(
+      std::unique_ptr<PacketSink>&& sink, const PipelinedSinkOption& option = {})
+      : sink_(std::move(sink)),
+        name_(option.name),
+        capacity_(option.capacity != 0 ? option.capacity : kDefaultCapacity) {
+    MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    ring_ = std::make_unique<ts::TSPacket[]>(capacity_);
+    MIRAKC_ARIB_DEBUG("{}: capacity={} packets", name_, capacity_);
+  }
+
+  ~PipelinedSink() override {
+    Join();
+  }
+
+  bool Start() override {
+    if (!sink_->Start()) {
+      return false;
+    }
+    thread_ = std::thread([this]() { Run(); });
+    return true;
+  }
+
+  void End() override {
+    Join();
+    sink_->End();
+    LogOccupancyStats();
+  }
+
+  int GetExitCode() const override {
+    return sink_->GetExitCode();
+  }
+
+  bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    while (num_packets > 0) {
+      // Only this thread updates tail_.
+      auto tail = tail_.load(std::memory_order_relaxed);
+      size_t num_free = 0;
+      auto has_free_space = [&]() {
+        num_free = capacity_ - (tail - head_.load());
+        return num_free > 0 || stopped_.load();
+      };
+      if (!has_free_space()) {
+        num_full_waits_++;
+        Wait(has_free_space);
+      }
+      if (stopped_.load()) {
+        return false;
+      }
+
+      UpdateOccupancyStats(capacity_ - num_free);
+
+      auto pos = tail % capacity_;
+      auto n = std::min({num_packets, num_free, capacity_ - pos});
+      std::memcpy(&ring_[pos], packets, n * ts::PKT_SIZE);
+      tail_.store(tail + n);
+      Notify();
+
+      packets += n;
+      num_packets -= n;
+    }
+    return !stopped_.load();
+  }
+
+  size_t max_occupancy() const {
+    return max_occupancy_;
+  }
+
+  size_t num_full_waits() const {
+    return num_full_waits_;
+  }
+
+ private:
+  void Run() {
+    for (;;) {
+      // Only this thread updates head_.
+      auto head = head_.load(std::memory_order_relaxed);
+      size_t num_packets = 0;
+      auto has_packets = [&]() {
+        // closed_ must be loaded before tail_ so that all packets pushed before closing are
+        // consumed.
+        auto closed = closed_.load();
+        num_packets = tail_.load() - head;
+        return num_packets > 0 || closed;
+      };
+      if (!has_packets()) {
+        Wait(has_packets);
+      }
+      if (num_packets == 0) {
+        break;
+      }
+
+      auto pos = head % capacity_;
+      auto n = std::min({num_packets, capacity_ - pos, kMaxBatchSize});
+      auto ok = sink_->HandlePackets(&ring_[pos], n);
+      head_.store(head + n);
+      if (!ok) {
+        MIRAKC_ARIB_DEBUG("{}: The sink stopped", name_);
+        stopped_.store(true);
+      }
+      Notify();
+      if (!ok) {
+        break;
+      }
+    }
+  }
+
+  void Join() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    closed_.store(true);
+    Notify();
+    thread_.join();
+  }
+
+  // A waiter registers itself before checking the condition, and a notifier checks waiters after
+  // updating the state.  Both are sequentially consistent, so either the waiter sees the new
+  // state or the notifier sees the waiter.
+  template <typename Pred>
+  void Wait(Pred pred) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_waiters_.fetch_add(1);
+    cv_.wait(lock, pred);
+    num_waiters_.fetch_sub(1);
+  }
+
+  void Notify() {
+    if (num_waiters_.load() == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+
+  void UpdateOccupancyStats(size_t occupancy) {
+    max_occupancy_ = std::max(max_occupancy_, occupancy);
+    auto i = std::min(occupancy * kNumOccupancyStats / capacity_, kNumOccupancyStats - 1);
+    occupancy_stats_[i]++;
+  }
+
+  void LogOccupancyStats() const {
+    std::string stats;
+    for (size_t i = 0; i < kNumOccupancyStats; ++i) {
+      if (occupancy_stats_[i] == 0) {
+        continue;
+      }
+      if (!stats.empty()) {
+        stats.append(", ");
+      }
+      stats.append(fmt::format("{}%+: {}", i * 100 / kNumOccupancyStats, occupancy_stats_[i]));
+    }
+    if (stats.empty()) {
+      return;
+    }
+    MIRAKC_ARIB_INFO("{}: Occupancy of the ring buffer: {}", name_, stats);
+    MIRAKC_ARIB_INFO("{}: Max occupancy: {}/{}, waited for free space {} times", name_,
+        max_occupancy_, capacity_, num_full_waits_);
+  }
+
+  std::unique_ptr<PacketSink> sink_;
+  const std::string name_;
+  const size_t capacity_;
+  std::unique_ptr<ts::TSPacket[]> ring_;
+  // Monotonically increasing counts of packets pushed and consumed.
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> stopped_{false};
+  std::atomic<size_t> num_waiters_{0};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+
+  // Updated only by the producer.
+  std::array<size_t, kNumOccupancyStats> occupancy_stats_ = {};
+  size_t max_occupancy_ = 0;
+  size_t num_full_waits_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(PipelinedSink);
+};
+
+}  // namespace
@@ -103,7 +103,27 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
     MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    for (size_t i = 0; i < num_packets; ++i) {
+      if (!ProcessPacket(packets[i])) {
+        (void)forwarder_.Flush(sink_.get());
+        return false;
+      }
+    }
+    return forwarder_.Flush(sink_.get());
+  }
+
+ private:
+  enum State {
+    kWaitReady,
+    kStreaming,
+  };
+
+  bool ProcessPacket(const ts::TSPacket& packet) {
     demux_.feedPacket(packet);
     switch (state_) {
       case kWaitReady:
@@ -115,12 +135,6 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
     return false;
   }
 
- private:
-  enum State {
-    kWaitReady,
-    kStreaming,
-  };
-
   bool WaitReady(const ts::TSPacket& packet) {
     if (stop_) {
       MIRAKC_ARIB_PROGRAM_FILTER_WARN("Stopped before the program starts");
@@ -133,7 +147,7 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
 
     if (pid == ts::PID_PAT) {
       if (option_.pre_streaming) {
-        return sink_->HandlePacket(packet);
+        return forwarder_.Forward(sink_.get(), packet);
       }
       // Save packets of the last PAT.
       if (packet.getPUSI()) {
@@ -187,7 +201,7 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
     if (!option_.pre_streaming) {
       MIRAKC_ARIB_ASSERT(!last_pat_packets_.empty());
       for (const auto& pat_packet : last_pat_packets_) {
-        if (!sink_->HandlePacket(pat_packet)) {
+        if (!forwarder_.Send(sink_.get(), pat_packet)) {
           return false;
         }
       }
@@ -199,13 +213,13 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
     do {
       pmt_packetizer_.getNextPacket(pmt_packet);
       MIRAKC_ARIB_ASSERT(pmt_packet.getPID() == pmt_pid_);
-      if (!sink_->HandlePacket(pmt_packet)) {
+      if (!forwarder_.Send(sink_.get(), pmt_packet)) {
         return false;
       }
     } while (!pmt_packetizer_.atCycleBoundary());
 
     state_ = kStreaming;
-    return sink_->HandlePacket(packet);
+    return forwarder_.Forward(sink_.get(), packet);
   }
 
   bool DoStreaming(const ts::TSPacket& packet) {
@@ -221,7 +235,7 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
         // Many PCR packets in a specific channel have no valid PCR...
         // See https://github.com/mirakc/mirakc-arib/issues/3
         MIRAKC_ARIB_PROGRAM_FILTER_TRACE("PCR#{:04X} has no valid PCR...", pid);
-        return sink_->HandlePacket(packet);
+        return forwarder_.Forward(sink_.get(), packet);
       }
 
       auto pcr = packet.getPCR();
@@ -232,7 +246,7 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
 
       if (NeedClockSync()) {
         // Postpone the stop until the clock synchronization is done.
-        return sink_->HandlePacket(packet);
+        return forwarder_.Forward(sink_.get(), packet);
       }
 
       if (ComparePcr(pcr, end_pcr_) >= 0) {  // pcr >= end_pcr_
@@ -245,21 +259,18 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
       ts::TSPacket pmt_packet;
       pmt_packetizer_.getNextPacket(pmt_packet);
       MIRAKC_ARIB_ASSERT(pmt_packet.getPID() == pmt_pid_);
-      return sink_->HandlePacket(pmt_packet);
+      return forwarder_.Send(sink_.get(), pmt_packet);
     }
 
     if (CheckPesBlackListForDrop(pid)) {
       return true;
     }
 
-    return sink_->HandlePacket(packet);
+    return forwarder_.Forward(sink_.get(), packet);
   }
 
   bool CheckPesBlackListForDrop(ts::PID pid) const {
-    if (pes_black_list_.find(pid) != pes_black_list_.end()) {
-      return true;
-    }
-    return false;
+    return pes_black_list_[pid];
   }
 
   void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
@@ -354,7 +365,7 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
       clock_time_ready_ = false;
     }
 
-    pes_black_list_.clear();
+    pes_black_list_.reset();
     MIRAKC_ARIB_PROGRAM_FILTER_DEBUG("Clear PES black list");
 
     for (auto it = pmt.streams.begin(); it != pmt.streams.end(); ++it) {
@@ -363,14 +374,14 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
       if (stream.isVideo() && !option_.video_tags.empty()) {
         uint8_t tag;
         if (!stream.getComponentTag(tag)) {
-          pes_black_list_.insert(pid);
+          pes_black_list_.set(pid);
           MIRAKC_ARIB_PROGRAM_FILTER_DEBUG("PES black list += PES/Video#{:04X} (no tag)", pid);
           continue;
         }
         const auto& tag_it =
             std::find(std::begin(option_.video_tags), std::end(option_.video_tags), tag);
         if (tag_it == std::end(option_.video_tags)) {
-          pes_black_list_.insert(pid);
+          pes_black_list_.set(pid);
           MIRAKC_ARIB_PROGRAM_FILTER_DEBUG(
               "PES black list += PES/Video#{:04X} (tag:{})", pid, tag);
           continue;
@@ -378,14 +389,14 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
       } else if (stream.isAudio() && !option_.audio_tags.empty()) {
         uint8_t tag;
         if (!stream.getComponentTag(tag)) {
-          pes_black_list_.insert(pid);
+          pes_black_list_.set(pid);
           MIRAKC_ARIB_PROGRAM_FILTER_DEBUG("PES black list += PES/Audio#{:04X} (no tag)", pid);
           continue;
         }
         const auto& tag_it =
             std::find(std::begin(option_.audio_tags), std::end(option_.audio_tags), tag);
         if (tag_it == std::end(option_.audio_tags)) {
-          pes_black_list_.insert(pid);
+          pes_black_list_.set(pid);
           MIRAKC_ARIB_PROGRAM_FILTER_DEBUG(
               "PES black list += PES/Audio#{:04X} (tag:{})", pid, tag);
           continue;
@@ -393,13 +404,13 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
       }
     }
 
-    if (pes_black_list_.empty()) {
+    if (pes_black_list_.none()) {
       // Forward PMT packets without modification.
     } else {
       // Remove streams included in the PES black list.
       auto it = pmt.streams.begin();
       while (it != pmt.streams.end()) {
-        if (pes_black_list_.find(it->first) != pes_black_list_.end()) {
+        if (pes_black_list_.test(it->first)) {
           it = pmt.streams.erase(it);
         } else {
           ++it;
@@ -587,11 +598,12 @@ class ProgramFilter final : public PacketSink, public ts::TableHandlerInterface
 
   const ProgramFilterOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   std::unique_ptr<PacketSink> sink_;
+  PacketForwarder forwarder_;
   State state_ = kWaitReady;
   ts::TSPacketVector last_pat_packets_;
-  std::unordered_set<ts::PID> pes_black_list_;
+  ts::PIDSet pes_black_list_;
   ts::CyclingPacketizer pmt_packetizer_;
   ts::PID clock_pid_ = ts::PID_NULL;
   int64_t clock_pcr_ = 0;
@@ -84,24 +84,27 @@ class ProgramMetadataFilter final : public PacketSink,
   }
 
   void WriteEvents(const ts::EIT& eit) {
-    rapidjson::Document json(rapidjson::kObjectType);
-    auto& allocator = json.GetAllocator();
-    rapidjson::Value events_json(rapidjson::kArrayType);
-    for (size_t i = 0; i < eit.events.size(); ++i) {
-      auto event_json = MakeJsonValue(eit.events[i], allocator);
-      events_json.PushBack(event_json, allocator);
-    }
-    json.AddMember("nid", eit.onetw_id, allocator);
-    json.AddMember("tsid", eit.ts_id, allocator);
-    json.AddMember("sid", eit.service_id, allocator);
-    json.AddMember("events", events_json, allocator);
-
-    FeedDocument(json);
+    FeedJson([&eit](JsonWriter& writer) {
+      writer.StartObject();
+      writer.Key("nid");
+      writer.Uint(eit.onetw_id);
+      writer.Key("tsid");
+      writer.Uint(eit.ts_id);
+      writer.Key("sid");
+      writer.Uint(eit.service_id);
+      writer.Key("events");
+      writer.StartArray();
+      for (size_t i = 0; i < eit.events.size(); ++i) {
+        WriteJson(writer, eit.events[i]);
+      }
+      writer.EndArray();
+      writer.EndObject();
+    });
   }
 
   const ProgramMetadataFilterOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
 };
 
 }  // namespace
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "file.hh"
+#include "logging.hh"
+
+#define MIRAKC_ARIB_RECORDER_STATE_DEBUG(...) MIRAKC_ARIB_DEBUG("recorder-state: " __VA_ARGS__)
+#define MIRAKC_ARIB_RECORDER_STATE_INFO(...) MIRAKC_ARIB_INFO("recorder-state: " __VA_ARGS__)
+#define MIRAKC_ARIB_RECORDER_STATE_WARN(...) MIRAKC_ARIB_WARN("recorder-state: " __VA_ARGS__)
+
+namespace {
+
+// State of ServiceRecorder saved when a chunk has been synced.
+//
+// All values are stored in the native byte order.  `crc32` is the MPEG-2 CRC32 of the preceding
+// bytes.
+struct RecorderStateRecord final {
+  static constexpr char kMagic[8] = {'M', 'I', 'R', 'A', 'K', 'C', 'S', 'T'};
+  static constexpr uint32_t kVersion = 1;
+  static constexpr int64_t kNoPcr = -1;
+
+  char magic[8];
+  uint32_t version;
+  uint16_t sid;
+  uint16_t clock_pid;
+  // Incremented each time the state is saved.
+  uint64_t sequence;
+  uint64_t chunk_size;
+  uint64_t num_chunks;
+  // The position where the next chunk starts.  Data before this position has been synced.
+  uint64_t pos;
+  // Unix time in ms when the chunk was synced.
+  int64_t timestamp;
+  // The clock baseline.  `clock_pcr` is kNoPcr if the clock is not ready.
+  int64_t clock_pcr;
+  // Unix time in ms.
+  int64_t clock_time;
+  // The event being recorded.  0 if none.
+  uint16_t eid;
+  uint16_t reserved1;
+  uint32_t crc32;
+};
+
+static_assert(sizeof(RecorderStateRecord) == 80);
+
+// Saves the state of ServiceRecorder into a file so that recording can be resumed quickly after
+// a crash.
+//
+// The file has two slots.  Each record is written into the slot not holding the latest record,
+// and then the file is synced.  So, one of the slots always holds a valid record even if the
+// process crashes while writing a record.  Records are validated with their CRC32, and the valid
+// record having the larger sequence number is loaded.
+class RecorderStateFile final {
+ public:
+  static constexpr size_t kNumSlots = 2;
+  static constexpr size_t kSlotSize = 512;
+
+  explicit RecorderStateFile(std::unique_ptr<File>&& file) : file_(std::move(file)) {}
+
+  ~RecorderStateFile() = default;
+
+  const std::string& path() const {
+    return file_->path();
+  }
+
+  // Returns false if no valid record exists.
+  bool Load(RecorderStateRecord* record) {
+    bool found = false;
+    for (size_t slot = 0; slot < kNumSlots; ++slot) {
+      RecorderStateRecord slot_record;
+      if (!ReadSlot(slot, &slot_record)) {
+        continue;
+      }
+      if (!found || slot_record.sequence > record->sequence) {
+        *record = slot_record;
+        found = true;
+        // Overwrite the other slot next time.
+        sequence_ = slot_record.sequence;
+        next_slot_ = (slot + 1) % kNumSlots;
+      }
+    }
+    if (found) {
+      MIRAKC_ARIB_RECORDER_STATE_DEBUG("{}: Loaded #{}", path(), record->sequence);
+    }
+    return found;
+  }
+
+  bool Save(const RecorderStateRecord& record) {
+    RecorderStateRecord slot_record = record;
+    std::memcpy(slot_record.magic, RecorderStateRecord::kMagic, sizeof(slot_record.magic));
+    slot_record.version = RecorderStateRecord::kVersion;
+    slot_record.sequence = sequence_ + 1;
+    slot_record.crc32 = ComputeCrc32(slot_record);
+
+    auto offset = static_cast<int64_t>(next_slot_ * kSlotSize);
+    auto* data = reinterpret_cast<const uint8_t*>(&slot_record);
+    auto n = file_->WriteAt(data, sizeof(slot_record), offset);
+    if (n != static_cast<ssize_t>(sizeof(slot_record))) {
+      MIRAKC_ARIB_RECORDER_STATE_WARN("{}: Failed to write #{}", path(), slot_record.sequence);
+      return false;
+    }
+    if (!file_->Sync()) {
+      return false;
+    }
+
+    sequence_ = slot_record.sequence;
+    next_slot_ = (next_slot_ + 1) % kNumSlots;
+    MIRAKC_ARIB_RECORDER_STATE_DEBUG("{}: Saved #{}: pos={}", path(), sequence_, record.pos);
+    return true;
+  }
+
+ private:
+  bool ReadSlot(size_t slot, RecorderStateRecord* record) {
+    auto* data = reinterpret_cast<uint8_t*>(record);
+    auto n = file_->ReadAt(data, sizeof(*record), static_cast<int64_t>(slot * kSlotSize));
+    if (n != static_cast<ssize_t>(sizeof(*record))) {
+      return false;
+    }
+    if (std::memcmp(record->magic, RecorderStateRecord::kMagic, sizeof(record->magic)) != 0 ||
+        record->version != RecorderStateRecord::kVersion) {
+      return false;
+    }
+    if (record->crc32 != ComputeCrc32(*record)) {
+      MIRAKC_ARIB_RECORDER_STATE_WARN("{}: Slot#{}: CRC32 mismatch", path(), slot);
+      return false;
+    }
+    return true;
+  }
+
+  static uint32_t ComputeCrc32(const RecorderStateRecord& record) {
+    return ts::CRC32(&record, offsetof(RecorderStateRecord, crc32)).value();
+  }
+
+  std::unique_ptr<File> file_;
+  uint64_t sequence_ = 0;
+  size_t next_slot_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(RecorderStateFile);
+};
+
+}  // namespace
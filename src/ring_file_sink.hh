@@ -18,9 +18,13 @@
 #pragma once
 
 #include <algorithm>
+#include <condition_variable>
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <tsduck/tsduck.h>
 
@@ -31,32 +35,116 @@
 
 namespace {
 
+struct RingFileSinkOption final {
+  // Write buffers and sync chunks on a background thread.
+  bool async = false;
+  // The number of buffers which can be queued for the background thread.  Buffers of
+  // RingFileSink::kDefaultAsyncBufferSize bytes in total are used if 0.
+  size_t num_async_buffers = 0;
+  // The number of bytes written at once.  This must be a multiple of RingFileSink::kBufferSize,
+  // and the chunk size must be a multiple of this.  RingFileSink::kBufferSize is used if 0.
+  size_t block_size = 0;
+  // The file is opened with O_DIRECT.  Every write is a whole block from an aligned buffer.
+  bool direct_io = false;
+  // Allocate disk space for the whole ring buffer in Start(), and write blocks at their
+  // positions.  The file is never truncated nor seeked while writing.
+  bool preallocate = false;
+  // Don't change the file size when allocating disk space.  Used only with `preallocate`.
+  bool keep_size = false;
+};
+
+// Writes packets to a file used as a ring buffer.
+//
+// In the async mode, filled buffers are queued and written on a background I/O thread.  The I/O
+// thread writes contiguous buffers with a single write and syncs the file at each chunk boundary.
+// The observer is notified of synced chunks and written buffers on the thread writing packets,
+// when packets are written next time or Drain() is called.  So, OnEndOfChunk() is never called
+// before the chunk is durable, and the observer doesn't need to be thread-safe.
+//
+// Buffers are aligned to kAlignment, and each write is a whole block of `block_size` bytes at a
+// block-aligned file position.  So, the file can be opened with O_DIRECT.  The ring size is a
+// multiple of the block size, so the truncation at the end of the ring keeps the alignment.
+//
+// When the ring buffer file is preallocated, blocks are written with File::WriteAt() at their
+// positions in the ring buffer.  So, the end of the ring buffer needs no truncation and no seek.
 class RingFileSink final : public PacketRingSink {
  public:
-  RingFileSink(std::unique_ptr<File>&& file, size_t chunk_size, size_t num_chunks)
+  RingFileSink(std::unique_ptr<File>&& file, size_t chunk_size, size_t num_chunks,
+      const RingFileSinkOption& option = {})
       : file_(std::move(file)),
         chunk_size_(chunk_size),
-        ring_size_(static_cast<uint64_t>(chunk_size) * static_cast<uint64_t>(num_chunks)) {
+        ring_size_(static_cast<uint64_t>(chunk_size) * static_cast<uint64_t>(num_chunks)),
+        block_size_(option.block_size != 0 ? option.block_size : kBufferSize),
+        direct_io_(option.direct_io),
+        preallocate_(option.preallocate),
+        keep_size_(option.keep_size),
+        async_(option.async) {
     MIRAKC_ARIB_ASSERT(chunk_size > 0);
     MIRAKC_ARIB_ASSERT(chunk_size <= kMaxChunkSize);
     MIRAKC_ARIB_ASSERT(num_chunks > 0);
     MIRAKC_ARIB_ASSERT(num_chunks <= kMaxNumChunks);
     MIRAKC_ARIB_ASSERT_MSG(
         chunk_size % kBufferSize == 0, "The chunk size must be a multiple of the buffer size");
+    MIRAKC_ARIB_ASSERT(block_size_ <= kMaxBlockSize);
+    MIRAKC_ARIB_ASSERT_MSG(
+        block_size_ % kBufferSize == 0, "The block size must be a multiple of the buffer size");
+    MIRAKC_ARIB_ASSERT_MSG(
+        chunk_size % block_size_ == 0, "The chunk size must be a multiple of the block size");
     MIRAKC_ARIB_INFO(
         "{}: {} bytes * {} chunks = {} bytes", file_->path(), chunk_size, num_chunks, ring_size_);
+    MIRAKC_ARIB_INFO("{}: block-size={} direct-io={} preallocate={} keep-size={}", file_->path(),
+        block_size_, direct_io_, preallocate_, keep_size_);
+    buf_ = AllocateAlignedBuffer(block_size_);
+    if (async_) {
+      num_async_buffers_ = option.num_async_buffers != 0
+          ? option.num_async_buffers
+          : std::max<size_t>(kDefaultAsyncBufferSize / block_size_, 2);
+      async_buf_ = AllocateAlignedBuffer(num_async_buffers_ * block_size_);
+      async_jobs_.resize(num_async_buffers_);
+      io_thread_ = std::thread([this]() { RunIoThread(); });
+      MIRAKC_ARIB_INFO("{}: Write asynchronously with {} buffers", file_->path(),
+          num_async_buffers_);
+    }
   }
 
-  ~RingFileSink() override = default;
+  ~RingFileSink() override {
+    StopIoThread();
+  }
 
   static constexpr size_t kBufferSize = 2 * kBlockSize;
   static constexpr size_t kMaxChunkSize = kBufferSize * 0x3FFFF;
   static constexpr size_t kMaxNumChunks = 0x7FFFFFFF;
   static constexpr uint64_t kMaxRingSize =
       static_cast<uint64_t>(kMaxChunkSize) * static_cast<uint64_t>(kMaxNumChunks);
+  static constexpr size_t kMaxBlockSize = 64 * 1024 * 1024;
+  static constexpr size_t kAlignment = kBlockSize;
+  static constexpr size_t kDefaultAsyncBufferSize = 2 * 1024 * 1024;
+
+  bool Start() override {
+    if (!preallocate_) {
+      return true;
+    }
+    // Remove data beyond the ring buffer which may remain in a reused file.  This is done only
+    // once instead of every time reaching the end of the ring buffer.
+    if (!keep_size_ && !file_->Trunc(static_cast<int64_t>(ring_size_))) {
+      broken_ = true;
+      return false;
+    }
+    MIRAKC_ARIB_INFO("{}: Allocate {} bytes", file_->path(), ring_size_);
+    if (!file_->Allocate(static_cast<int64_t>(ring_size_), keep_size_)) {
+      broken_ = true;
+      return false;
+    }
+    return true;
+  }
 
   void End() override {
-    // No need to flush the buffer at this point.
+    // No need to flush the buffer at this point.  But buffers already queued must be written.
+    Drain();
+    StopIoThread();
+    if (async_ && num_full_waits_ > 0) {
+      MIRAKC_ARIB_INFO("{}: Waited for free buffers {} times", file_->path(), num_full_waits_);
+    }
   }
 
   int GetExitCode() const override {
@@ -67,21 +155,11 @@ class RingFileSink final : public PacketRingSink {
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
-    size_t nwritten = 0;
-
-    do {
-      nwritten += FillBuffer(packet.b + nwritten, ts::PKT_SIZE - nwritten);
-      if (NeedFlush()) {
-        if (!Flush()) {
-          MIRAKC_ARIB_ERROR("Failed flushing, need reset");
-          broken_ = true;
-          return false;
-        }
-      }
-    } while (nwritten < ts::PKT_SIZE);
-    MIRAKC_ARIB_ASSERT(nwritten == ts::PKT_SIZE);
+    return Write(packet.b, ts::PKT_SIZE);
+  }
 
-    return true;
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    return Write(reinterpret_cast<const uint8_t*>(packets), num_packets * ts::PKT_SIZE);
   }
 
   uint64_t ring_size() const override {
@@ -100,8 +178,15 @@ class RingFileSink final : public PacketRingSink {
     MIRAKC_ARIB_ASSERT_MSG(
         pos % chunk_size_ == 0, "The position must be a multiple of the chunk size");
 
+    // The I/O thread must not access the file while seeking.
+    Drain();
+    if (broken_) {
+      return false;
+    }
+
+    // No need to seek.  Blocks are written at their positions.
     int64_t offset = static_cast<int64_t>(pos);
-    if (file_->Seek(offset, SeekMode::kSet) != offset) {
+    if (!preallocate_ && file_->Seek(offset, SeekMode::kSet) != offset) {
       return false;
     }
 
@@ -120,39 +205,103 @@ class RingFileSink final : public PacketRingSink {
     return broken_;
   }
 
+  void Drain() override {
+    if (!async_) {
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return async_head_ == async_tail_ || io_failed_; });
+    }
+    (void)DeliverSyncedChunks();
+  }
+
  private:
+  struct AlignedBufferDeleter {
+    void operator()(uint8_t* buf) const {
+      std::free(buf);
+    }
+  };
+
+  using AlignedBuffer = std::unique_ptr<uint8_t[], AlignedBufferDeleter>;
+
+  static AlignedBuffer AllocateAlignedBuffer(size_t size) {
+    void* buf = nullptr;
+    auto err = posix_memalign(&buf, kAlignment, size);
+    MIRAKC_ARIB_ASSERT_MSG(err == 0, "Failed to allocate an aligned buffer");
+    return AlignedBuffer(static_cast<uint8_t*>(buf));
+  }
+
+  static constexpr uint64_t kNoPos = std::numeric_limits<uint64_t>::max();
+
+  struct AsyncJob {
+    uint64_t pos = 0;  // ring_pos_ after the buffer
+    bool end_of_chunk = false;
+    bool end_of_ring = false;
+  };
+
+  bool Write(const uint8_t* data, size_t size) {
+    if (async_) {
+      return WriteAsync(data, size);
+    }
+
+    size_t nwritten = 0;
+
+    while (nwritten < size) {
+      if (!direct_io_ && buf_pos_ == 0 && size - nwritten >= block_size_) {
+        // Write a block directly from the packets without copying it into the buffer.  This
+        // cannot be used with O_DIRECT because packets are not aligned.
+        ring_pos_ += block_size_;
+        MIRAKC_ARIB_ASSERT(ring_pos_ <= ring_size_);
+        if (!WriteBlock(data + nwritten)) {
+          MIRAKC_ARIB_ERROR("Failed writing, need reset");
+          broken_ = true;
+          return false;
+        }
+        nwritten += block_size_;
+        continue;
+      }
+      nwritten += FillBuffer(data + nwritten, size - nwritten);
+      if (NeedFlush()) {
+        if (!Flush()) {
+          MIRAKC_ARIB_ERROR("Failed flushing, need reset");
+          broken_ = true;
+          return false;
+        }
+      }
+    }
+    MIRAKC_ARIB_ASSERT(nwritten == size);
+
+    return true;
+  }
+
   size_t FillBuffer(const uint8_t* data, size_t size) {
     auto fill_bytes = std::min(size, free_bytes());
-    std::memcpy(buf_ + buf_pos_, data, fill_bytes);
+    std::memcpy(buf_.get() + buf_pos_, data, fill_bytes);
     buf_pos_ += fill_bytes;
-    MIRAKC_ARIB_ASSERT(buf_pos_ <= kBufferSize);
+    MIRAKC_ARIB_ASSERT(buf_pos_ <= block_size_);
     ring_pos_ += fill_bytes;
     MIRAKC_ARIB_ASSERT(ring_pos_ <= ring_size_);
     return fill_bytes;
   }
 
   bool NeedFlush() const {
-    return buf_pos_ == kBufferSize;
+    return buf_pos_ == block_size_;
   }
 
   bool Flush() {
-    MIRAKC_ARIB_ASSERT(buf_pos_ == kBufferSize);
-
-    size_t nwritten = 0;
+    MIRAKC_ARIB_ASSERT(buf_pos_ == block_size_);
+    buf_pos_ = 0;
+    return WriteBlock(buf_.get());
+  }
 
-    while (nwritten < kBufferSize) {
-      MIRAKC_ARIB_TRACE("{}: Write the buffer", file_->path());
-      auto result = file_->Write(buf_ + nwritten, kBufferSize - nwritten);
-      if (result <= 0) {
-        return false;
-      }
-      nwritten += result;
+  // Writes a block of block_size_ bytes.  ring_pos_ must have been advanced before calling this.
+  bool WriteBlock(const uint8_t* block) {
+    if (!WriteData(block, block_size_, ring_pos_ - block_size_)) {
+      return false;
     }
-    MIRAKC_ARIB_ASSERT(nwritten == kBufferSize);
-
-    buf_pos_ = 0;
 
-    chunk_pos_ += kBufferSize;
+    chunk_pos_ += block_size_;
     MIRAKC_ARIB_ASSERT(chunk_pos_ <= chunk_size_);
 
     if (chunk_pos_ == chunk_size_) {
@@ -168,36 +317,279 @@ class RingFileSink final : public PacketRingSink {
       }
     }
 
+    if (observer_ != nullptr) {
+      observer_->OnEndOfBlock(ring_pos_);
+    }
+
     if (ring_pos_ == ring_size_) {
-      MIRAKC_ARIB_DEBUG(
-          "{}: Reached the end of the ring buffer, truncate at {}", file_->path(), ring_pos_);
-      if (!file_->Trunc(ring_size_)) {
+      if (!ResetFilePosition()) {
+        return false;
+      }
+      ring_pos_ = 0;
+    }
+
+    return true;
+  }
+
+  // Writes data at `pos` in the ring buffer.  The file position must be `pos` unless the file
+  // has been preallocated.
+  bool WriteData(const uint8_t* data, size_t size, uint64_t pos) {
+    size_t nwritten = 0;
+    while (nwritten < size) {
+      MIRAKC_ARIB_TRACE("{}: Write {} bytes at {}", file_->path(), size - nwritten, pos + nwritten);
+      ssize_t result;
+      if (preallocate_) {
+        result = file_->WriteAt(
+            data + nwritten, size - nwritten, static_cast<int64_t>(pos + nwritten));
+      } else {
+        result = file_->Write(data + nwritten, size - nwritten);
+      }
+      if (result <= 0) {
         return false;
       }
-      MIRAKC_ARIB_DEBUG("{}: Reset the position", file_->path());
-      if (file_->Seek(0, SeekMode::kSet) != 0) {
+      nwritten += result;
+    }
+    MIRAKC_ARIB_ASSERT(nwritten == size);
+    return true;
+  }
+
+  // Called when reaching the end of the ring buffer.
+  bool ResetFilePosition() {
+    if (preallocate_) {
+      MIRAKC_ARIB_DEBUG("{}: Reached the end of the ring buffer", file_->path());
+      return true;
+    }
+    MIRAKC_ARIB_DEBUG(
+        "{}: Reached the end of the ring buffer, truncate at {}", file_->path(), ring_size_);
+    if (!file_->Trunc(ring_size_)) {
+      return false;
+    }
+    MIRAKC_ARIB_DEBUG("{}: Reset the position", file_->path());
+    if (file_->Seek(0, SeekMode::kSet) != 0) {
+      return false;
+    }
+    return true;
+  }
+
+  size_t free_bytes() const {
+    return block_size_ - buf_pos_;
+  }
+
+  bool WriteAsync(const uint8_t* data, size_t size) {
+    if (!DeliverSyncedChunks()) {
+      return false;
+    }
+
+    size_t nwritten = 0;
+    while (nwritten < size) {
+      if (buf_pos_ == 0 && !WaitForFreeAsyncBuffer()) {
         return false;
       }
+      auto* buf = async_buf_.get() + (async_tail_ % num_async_buffers_) * block_size_;
+      auto fill_bytes = std::min(size - nwritten, free_bytes());
+      std::memcpy(buf + buf_pos_, data + nwritten, fill_bytes);
+      buf_pos_ += fill_bytes;
+      ring_pos_ += fill_bytes;
+      MIRAKC_ARIB_ASSERT(ring_pos_ <= ring_size_);
+      nwritten += fill_bytes;
+      if (NeedFlush()) {
+        QueueAsyncBuffer();
+      }
+    }
+    MIRAKC_ARIB_ASSERT(nwritten == size);
+
+    return true;
+  }
+
+  bool WaitForFreeAsyncBuffer() {
+    bool failed;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto has_free_buffer = [this]() {
+        return async_tail_ - async_head_ < num_async_buffers_ || io_failed_;
+      };
+      if (!has_free_buffer()) {
+        num_full_waits_++;
+        cv_.wait(lock, has_free_buffer);
+      }
+      failed = io_failed_;
+    }
+    if (failed) {
+      MIRAKC_ARIB_ERROR("Failed writing, need reset");
+      broken_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  // Performs the same state transition as WriteBlock(), and queues the buffer for the I/O thread.
+  void QueueAsyncBuffer() {
+    MIRAKC_ARIB_ASSERT(buf_pos_ == block_size_);
+    buf_pos_ = 0;
+
+    AsyncJob job;
+    chunk_pos_ += block_size_;
+    MIRAKC_ARIB_ASSERT(chunk_pos_ <= chunk_size_);
+    if (chunk_pos_ == chunk_size_) {
+      MIRAKC_ARIB_ASSERT(ring_pos_ != 0);
+      MIRAKC_ARIB_ASSERT(ring_pos_ % chunk_size_ == 0);
+      job.end_of_chunk = true;
+      chunk_pos_ = 0;
+    }
+    if (ring_pos_ == ring_size_) {
+      job.end_of_ring = true;
+    }
+    job.pos = ring_pos_;
+    if (job.end_of_ring) {
       ring_pos_ = 0;
     }
 
+    std::lock_guard<std::mutex> lock(mutex_);
+    async_jobs_[async_tail_ % num_async_buffers_] = job;
+    async_tail_++;
+    cv_.notify_all();
+  }
+
+  // Notifies the observer of chunks synced by the I/O thread, and then the position up to which
+  // buffers have been written.  Returns false if the I/O thread failed.
+  bool DeliverSyncedChunks() {
+    bool failed;
+    uint64_t written_pos;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      synced_chunks_.swap(delivering_chunks_);
+      written_pos = written_pos_;
+      written_pos_ = kNoPos;
+      failed = io_failed_;
+    }
+    for (auto pos : delivering_chunks_) {
+      if (observer_ != nullptr) {
+        observer_->OnEndOfChunk(pos);
+      }
+    }
+    delivering_chunks_.clear();
+    if (written_pos != kNoPos && observer_ != nullptr) {
+      observer_->OnEndOfBlock(written_pos);
+    }
+    if (failed) {
+      if (!broken_) {
+        MIRAKC_ARIB_ERROR("Failed writing, need reset");
+        broken_ = true;
+      }
+      return false;
+    }
     return true;
   }
 
-  size_t free_bytes() const {
-    return kBufferSize - buf_pos_;
+  void RunIoThread() {
+    for (;;) {
+      size_t head;
+      size_t tail;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return async_head_ != async_tail_ || io_closed_; });
+        if (async_head_ == async_tail_) {
+          return;
+        }
+        head = async_head_;
+        tail = async_tail_;
+      }
+
+      // Write contiguous buffers up to the first buffer which needs an action.
+      auto end = head;
+      const AsyncJob* job = nullptr;
+      while (end != tail) {
+        job = &async_jobs_[end % num_async_buffers_];
+        end++;
+        if (job->end_of_chunk || job->end_of_ring || end % num_async_buffers_ == 0) {
+          break;
+        }
+      }
+      auto* buf = async_buf_.get() + (head % num_async_buffers_) * block_size_;
+      auto size = (end - head) * block_size_;
+      // Buffers in a batch are contiguous in the ring buffer.
+      auto ok = WriteAsyncBuffers(buf, size, job->pos - size) && DoAsyncJob(*job);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!ok) {
+        io_failed_ = true;
+        cv_.notify_all();
+        return;
+      }
+      async_head_ = end;
+      written_pos_ = job->pos;
+      if (job->end_of_chunk) {
+        synced_chunks_.push_back(job->pos);
+      }
+      cv_.notify_all();
+    }
   }
 
-  uint8_t buf_[kBufferSize];
+  bool WriteAsyncBuffers(const uint8_t* buf, size_t size, uint64_t pos) {
+    if (!WriteData(buf, size, pos)) {
+      MIRAKC_ARIB_ERROR("{}: Failed to write buffers", file_->path());
+      return false;
+    }
+    return true;
+  }
+
+  bool DoAsyncJob(const AsyncJob& job) {
+    if (job.end_of_chunk) {
+      MIRAKC_ARIB_DEBUG("{}: Reached the chunk boundary {}, sync", file_->path(), job.pos);
+      if (!file_->Sync()) {
+        return false;
+      }
+    }
+    if (job.end_of_ring) {
+      return ResetFilePosition();
+    }
+    return true;
+  }
+
+  void StopIoThread() {
+    if (!io_thread_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      io_closed_ = true;
+      cv_.notify_all();
+    }
+    io_thread_.join();
+  }
+
+  AlignedBuffer buf_;
   std::unique_ptr<File> file_;
   PacketRingObserver* observer_ = nullptr;
   const uint64_t ring_size_;
   uint64_t ring_pos_ = 0;
   const size_t chunk_size_;
+  const size_t block_size_;
+  const bool direct_io_;
+  const bool preallocate_;
+  const bool keep_size_;
   size_t buf_pos_ = 0;
   size_t chunk_pos_ = 0;
   bool broken_ = false;
 
+  // Used only in the async mode.
+  const bool async_;
+  size_t num_async_buffers_ = 0;
+  AlignedBuffer async_buf_;
+  std::vector<AsyncJob> async_jobs_;
+  std::vector<uint64_t> delivering_chunks_;
+  size_t num_full_waits_ = 0;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread io_thread_;
+  // Guarded by mutex_.
+  size_t async_head_ = 0;  // the number of buffers written
+  size_t async_tail_ = 0;  // the number of buffers queued
+  std::vector<uint64_t> synced_chunks_;
+  uint64_t written_pos_ = kNoPos;  // ring_pos_ after the buffers written last
+  bool io_failed_ = false;
+  bool io_closed_ = false;
+
   MIRAKC_ARIB_NON_COPYABLE(RingFileSink);
 };
 
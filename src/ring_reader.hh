@@ -0,0 +1,621 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "chunk_index.hh"
+#include "file.hh"
+#include "logging.hh"
+
+#define MIRAKC_ARIB_RING_READER_DEBUG(...) MIRAKC_ARIB_DEBUG("ring-reader: " __VA_ARGS__)
+#define MIRAKC_ARIB_RING_READER_INFO(...) MIRAKC_ARIB_INFO("ring-reader: " __VA_ARGS__)
+#define MIRAKC_ARIB_RING_READER_WARN(...) MIRAKC_ARIB_WARN("ring-reader: " __VA_ARGS__)
+#define MIRAKC_ARIB_RING_READER_ERROR(...) MIRAKC_ARIB_ERROR("ring-reader: " __VA_ARGS__)
+
+namespace {
+
+enum class RingSeekMode {
+  kPos,
+  kTime,
+  kEid,
+};
+
+struct RingReaderOption final {
+  std::string file;
+  size_t chunk_size = 0;
+  size_t num_chunks = 0;
+  RingSeekMode seek_mode = RingSeekMode::kPos;
+  // Used with RingSeekMode::kPos.
+  uint64_t pos = 0;
+  // Unix time in ms.  Used with RingSeekMode::kTime.
+  int64_t time = 0;
+  // Used with RingSeekMode::kEid.
+  uint16_t eid = 0;
+  // Wait for packets to be written after reaching the live position.
+  bool follow = false;
+};
+
+// Reads packets from a ring buffer file written by RingFileSink.
+//
+// The start position is located by using the chunk index file maintained by ServiceRecorder.
+// When seeking by the time or the event ID, reading starts from the first keyframe in the chunk
+// found if it's recorded in the index.  Before copying the ring buffer file, a PAT and a PMT of
+// the service found after the start position are sent so that the receiver can start decoding
+// without waiting for them.
+//
+// The chunk being written is read up to the live position published in the chunk index file by
+// the writer.  Reading ends when reaching the live position unless the follow mode is enabled.
+// In the follow mode, the live position is polled and packets are copied as soon as they are
+// written.  Otherwise, the live position is loaded only once, and a partial packet at the end is
+// not sent.  Packets are copied with File::CopyTo(), which uses sendfile(2) if possible.
+//
+// The writer may overwrite a chunk while it's copied if the reader is too slow.  This is detected
+// by comparing the index entry of the chunk before and after copying, and reading stops with an
+// error in this case.
+class RingReader final : public ts::TableHandlerInterface {
+ public:
+  static constexpr size_t kMaxTableScanSize = 4 * 1024 * 1024;
+  static constexpr auto kPollInterval = std::chrono::milliseconds(100);
+
+  RingReader(const RingReaderOption& option, std::unique_ptr<File>&& file,
+      std::unique_ptr<ChunkIndexReader>&& index, std::unique_ptr<File>&& out)
+      : option_(option),
+        file_(std::move(file)),
+        index_(std::move(index)),
+        out_(std::move(out)),
+        ring_size_(static_cast<uint64_t>(option.chunk_size) * option.num_chunks),
+        demux_(context_) {
+    MIRAKC_ARIB_ASSERT(option_.chunk_size > 0);
+    MIRAKC_ARIB_ASSERT(option_.num_chunks > 0);
+    demux_.setTableHandler(this);
+  }
+
+  ~RingReader() override = default;
+
+  // Returns an exit code.
+  int Run() {
+    if (!index_->IsValid()) {
+      MIRAKC_ARIB_RING_READER_ERROR("{}: Not a chunk index of the ring buffer", index_->path());
+      return EXIT_FAILURE;
+    }
+
+    if (!Seek()) {
+      return EXIT_FAILURE;
+    }
+
+    UpdateLivePosition();
+    for (;;) {
+      if (HasCompletedChunk()) {
+        if (!ReadChunk()) {
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      if (!ReadLiveChunk()) {
+        return EXIT_FAILURE;
+      }
+      if (!option_.follow) {
+        break;
+      }
+      std::this_thread::sleep_for(kPollInterval);
+      UpdateLivePosition();
+    }
+
+    MIRAKC_ARIB_RING_READER_INFO("Copied {} bytes", num_copied_bytes_);
+    return EXIT_SUCCESS;
+  }
+
+  uint64_t num_copied_bytes() const {
+    return num_copied_bytes_;
+  }
+
+ private:
+  void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
+    switch (table.tableId()) {
+      case ts::TID_PAT:
+        HandlePat(table);
+        break;
+      case ts::TID_PMT:
+        HandlePmt(table);
+        break;
+      default:
+        break;
+    }
+  }
+
+  void HandlePat(const ts::BinaryTable& table) {
+    ts::PAT pat(context_, table);
+    if (!pat.isValid()) {
+      MIRAKC_ARIB_RING_READER_WARN("PAT: Broken, skip");
+      return;
+    }
+
+    auto it = pat.pmts.find(index_->sid());
+    if (it == pat.pmts.end()) {
+      MIRAKC_ARIB_RING_READER_WARN("PAT: SID#{:04X} not found, skip", index_->sid());
+      return;
+    }
+
+    if (pmt_pid_ != ts::PID_NULL) {
+      demux_.removePID(pmt_pid_);
+    }
+    pmt_pid_ = it->second;
+    demux_.addPID(pmt_pid_);
+    pat_ = std::make_unique<ts::PAT>(pat);
+    MIRAKC_ARIB_RING_READER_DEBUG("PAT: Demux += PMT#{:04X}", pmt_pid_);
+  }
+
+  void HandlePmt(const ts::BinaryTable& table) {
+    ts::PMT pmt(context_, table);
+    if (!pmt.isValid()) {
+      MIRAKC_ARIB_RING_READER_WARN("PMT: Broken, skip");
+      return;
+    }
+
+    if (pmt.service_id != index_->sid()) {
+      MIRAKC_ARIB_RING_READER_WARN("PMT: SID#{:04X} not matched, skip", pmt.service_id);
+      return;
+    }
+
+    pmt_ = std::make_unique<ts::PMT>(pmt);
+    MIRAKC_ARIB_RING_READER_DEBUG("PMT: Found");
+  }
+
+  bool Seek() {
+    switch (option_.seek_mode) {
+      case RingSeekMode::kPos:
+        if (option_.pos >= ring_size_) {
+          MIRAKC_ARIB_RING_READER_ERROR(
+              "pos({}) must be smaller than the ring buffer size({})", option_.pos, ring_size_);
+          return false;
+        }
+        chunk_ = static_cast<size_t>(option_.pos / option_.chunk_size);
+        offset_ = static_cast<size_t>(option_.pos % option_.chunk_size);
+        MIRAKC_ARIB_RING_READER_INFO("Start from {}", option_.pos);
+        return true;
+      case RingSeekMode::kTime:
+        return SeekByTime();
+      case RingSeekMode::kEid:
+        return SeekByEid();
+    }
+    return false;
+  }
+
+  // Finds the chunk started last at or before the time.  The oldest chunk is used if the time is
+  // older than any chunk.
+  bool SeekByTime() {
+    size_t found = kNoChunk;
+    size_t oldest = kNoChunk;
+    ChunkIndexRecord found_record = {};
+    ChunkIndexRecord oldest_record = {};
+    for (size_t chunk = 0; chunk < option_.num_chunks; ++chunk) {
+      ChunkIndexRecord record;
+      if (!ReadCompletedRecord(chunk, &record)) {
+        continue;
+      }
+      if (record.timestamp <= option_.time &&
+          (found == kNoChunk || record.timestamp > found_record.timestamp)) {
+        found = chunk;
+        found_record = record;
+      }
+      if (oldest == kNoChunk || record.timestamp < oldest_record.timestamp) {
+        oldest = chunk;
+        oldest_record = record;
+      }
+    }
+
+    if (found == kNoChunk) {
+      if (oldest == kNoChunk) {
+        MIRAKC_ARIB_RING_READER_ERROR("No chunk has been recorded");
+        return false;
+      }
+      MIRAKC_ARIB_RING_READER_WARN("{} is older than any chunk", option_.time);
+      found = oldest;
+      found_record = oldest_record;
+    }
+
+    SetStartChunk(found, found_record);
+    return true;
+  }
+
+  // Finds the chunk in which the event started.  That is the chunk followed by the oldest chunk
+  // started while the event is on air if it's contiguous to that chunk.  Otherwise, the oldest
+  // chunk started while the event is on air.
+  bool SeekByEid() {
+    size_t found = kNoChunk;
+    ChunkIndexRecord found_record = {};
+    for (size_t chunk = 0; chunk < option_.num_chunks; ++chunk) {
+      ChunkIndexRecord record;
+      if (!ReadCompletedRecord(chunk, &record)) {
+        continue;
+      }
+      if (record.eid == option_.eid &&
+          (found == kNoChunk || record.timestamp < found_record.timestamp)) {
+        found = chunk;
+        found_record = record;
+      }
+    }
+
+    if (found == kNoChunk) {
+      MIRAKC_ARIB_RING_READER_ERROR("Event#{:04X} not found", option_.eid);
+      return false;
+    }
+
+    auto prev = (found + option_.num_chunks - 1) % option_.num_chunks;
+    ChunkIndexRecord prev_record;
+    if (prev != found && ReadCompletedRecord(prev, &prev_record) &&
+        prev_record.end_timestamp <= found_record.timestamp &&
+        found_record.timestamp - prev_record.end_timestamp < kMaxChunkGapMs) {
+      found = prev;
+      found_record = prev_record;
+    }
+
+    SetStartChunk(found, found_record);
+    return true;
+  }
+
+  bool ReadCompletedRecord(size_t chunk, ChunkIndexRecord* record) const {
+    if (!index_->Read(chunk, record)) {
+      MIRAKC_ARIB_RING_READER_WARN("Chunk#{}: Failed to read the entry", chunk);
+      return false;
+    }
+    return (record->flags & ChunkIndexRecord::kCompleted) != 0;
+  }
+
+  void SetStartChunk(size_t chunk, const ChunkIndexRecord& record) {
+    chunk_ = chunk;
+    offset_ = 0;
+    if (record.keyframe_offset != ChunkIndexRecord::kNoOffset &&
+        record.keyframe_offset < option_.chunk_size) {
+      offset_ = record.keyframe_offset;
+    }
+    MIRAKC_ARIB_RING_READER_INFO("Start from chunk#{}+{}: timestamp={} eid={:04X}", chunk_,
+        offset_, record.timestamp, record.eid);
+  }
+
+  // Loads the chunk being written and the size of data written in it.  The chunk being written
+  // is found by the write position until a chunk is completed.
+  void UpdateLivePosition() {
+    last_chunk_ = index_->last_chunk();
+    auto write_pos = index_->write_pos();
+    if (last_chunk_ != 0) {
+      live_chunk_ = static_cast<size_t>(last_chunk_ % option_.num_chunks);
+    } else if (write_pos != 0) {
+      live_chunk_ = static_cast<size_t>((write_pos - 1) / option_.chunk_size);
+    } else {
+      live_chunk_ = kNoChunk;
+    }
+    live_size_ = 0;
+    if (live_chunk_ != kNoChunk) {
+      auto live_pos = static_cast<uint64_t>(live_chunk_) * option_.chunk_size;
+      // The write position may be in the next chunk if the chunk has been written but not
+      // completed yet.  It's read when completed.
+      if (write_pos > live_pos && write_pos - live_pos <= option_.chunk_size) {
+        live_size_ = static_cast<size_t>(write_pos - live_pos);
+      }
+    }
+  }
+
+  bool HasCompletedChunk() const {
+    return last_chunk_ != 0 && chunk_ != live_chunk_;
+  }
+
+  bool ReadChunk() {
+    ChunkIndexRecord record;
+    if (!index_->Read(chunk_, &record)) {
+      MIRAKC_ARIB_RING_READER_ERROR("Chunk#{}: Failed to read the entry", chunk_);
+      return false;
+    }
+
+    if ((record.flags & ChunkIndexRecord::kCompleted) == 0) {
+      // Never recorded, or recording was interrupted.  Packets have to be synchronized again.
+      MIRAKC_ARIB_RING_READER_WARN("Chunk#{}: Not completed, skip", chunk_);
+      NextChunk();
+      synced_ = false;
+      return true;
+    }
+
+    if (!synced_) {
+      if (!SyncPackets(option_.chunk_size)) {
+        MIRAKC_ARIB_RING_READER_WARN("Chunk#{}: No packet found, skip", chunk_);
+        NextChunk();
+        return true;
+      }
+      synced_ = true;
+      packet_offset_ = 0;
+    }
+
+    if (!tables_sent_) {
+      if (!SendTables()) {
+        return false;
+      }
+      tables_sent_ = true;
+    }
+
+    size_t end = option_.chunk_size;
+    size_t next_offset = 0;
+    if (!option_.follow && (chunk_ + 1) % option_.num_chunks == live_chunk_) {
+      // Don't send a partial packet at the end.  It's trimmed when reading the chunk being
+      // written if that chunk has the rest of the packet.  Otherwise, the packet is trimmed here,
+      // and the data in that chunk is skipped.
+      auto partial = (packet_offset_ + end - offset_ + live_size_) % ts::PKT_SIZE;
+      if (partial > live_size_) {
+        end -= partial - live_size_;
+        next_offset = live_size_;
+      }
+    }
+
+    auto pos = static_cast<uint64_t>(chunk_) * option_.chunk_size;
+    if (!Copy(pos + offset_, end - offset_)) {
+      return false;
+    }
+    packet_offset_ = (packet_offset_ + end - offset_) % ts::PKT_SIZE;
+
+    ChunkIndexRecord new_record;
+    if (!index_->Read(chunk_, &new_record) || new_record.timestamp != record.timestamp ||
+        (new_record.flags & ChunkIndexRecord::kCompleted) == 0) {
+      MIRAKC_ARIB_RING_READER_ERROR("Chunk#{}: Overwritten while reading", chunk_);
+      return false;
+    }
+
+    MIRAKC_ARIB_RING_READER_DEBUG("Chunk#{}: Copied {} bytes", chunk_, end - offset_);
+    NextChunk();
+    offset_ = next_offset;
+    return true;
+  }
+
+  // Reads data written so far in the chunk being written.  The offset is kept so that reading
+  // continues from there when more data is written or the chunk is completed.
+  bool ReadLiveChunk() {
+    if (chunk_ != live_chunk_ || live_size_ <= offset_) {
+      return true;
+    }
+
+    ChunkIndexRecord record;
+    if (!index_->Read(chunk_, &record)) {
+      MIRAKC_ARIB_RING_READER_ERROR("Chunk#{}: Failed to read the entry", chunk_);
+      return false;
+    }
+
+    if ((record.flags & ChunkIndexRecord::kStarted) == 0) {
+      // The write position has been published before the chunk is started.
+      return true;
+    }
+
+    if (!synced_) {
+      if (!SyncPackets(live_size_)) {
+        // Wait for more packets.
+        return true;
+      }
+      synced_ = true;
+      packet_offset_ = 0;
+    }
+
+    if (!tables_sent_) {
+      if (!SendTables()) {
+        return false;
+      }
+      tables_sent_ = true;
+    }
+
+    size_t end = live_size_;
+    if (!option_.follow) {
+      // Don't send a partial packet at the end.
+      auto partial = (packet_offset_ + end - offset_) % ts::PKT_SIZE;
+      if (partial <= end - offset_) {
+        end -= partial;
+      }
+    }
+
+    auto pos = static_cast<uint64_t>(chunk_) * option_.chunk_size;
+    if (!Copy(pos + offset_, end - offset_)) {
+      return false;
+    }
+    packet_offset_ = (packet_offset_ + end - offset_) % ts::PKT_SIZE;
+
+    ChunkIndexRecord new_record;
+    if (!index_->Read(chunk_, &new_record) || new_record.timestamp != record.timestamp) {
+      MIRAKC_ARIB_RING_READER_ERROR("Chunk#{}: Overwritten while reading", chunk_);
+      return false;
+    }
+
+    MIRAKC_ARIB_RING_READER_DEBUG("Chunk#{}: Copied {} bytes (live)", chunk_, end - offset_);
+    offset_ = end;
+    return true;
+  }
+
+  void NextChunk() {
+    chunk_ = (chunk_ + 1) % option_.num_chunks;
+    offset_ = 0;
+  }
+
+  // Moves the offset to the first packet in the current chunk.  Data up to `end` in the chunk is
+  // used.
+  bool SyncPackets(size_t end) {
+    static constexpr size_t kNumSyncPackets = 3;
+    static constexpr size_t kSyncSize = ts::PKT_SIZE * (kNumSyncPackets + 1);
+
+    auto pos = static_cast<uint64_t>(chunk_) * option_.chunk_size + offset_;
+    auto size = std::min(kSyncSize, end - offset_);
+    uint8_t buf[kSyncSize];
+    if (!ReadFully(buf, size, pos)) {
+      return false;
+    }
+
+    for (size_t i = 0; i < ts::PKT_SIZE && i + ts::PKT_SIZE * (kNumSyncPackets - 1) < size;
+         ++i) {
+      bool synced = true;
+      for (size_t n = 0; n < kNumSyncPackets; ++n) {
+        if (buf[i + ts::PKT_SIZE * n] != ts::SYNC_BYTE) {
+          synced = false;
+          break;
+        }
+      }
+      if (synced) {
+        offset_ += i;
+        MIRAKC_ARIB_RING_READER_DEBUG("Chunk#{}: Synced at +{}", chunk_, offset_);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Scans data written so far from the current position for the PAT and the PMT, and sends them.
+  bool SendTables() {
+    demux_.addPID(ts::PID_PAT);
+
+    auto live_pos =
+        (static_cast<uint64_t>(live_chunk_) * option_.chunk_size + live_size_) % ring_size_;
+    auto pos = static_cast<uint64_t>(chunk_) * option_.chunk_size + offset_;
+    std::vector<uint8_t> buf(ts::PKT_SIZE * 64);
+    size_t scanned = 0;
+    while (pmt_ == nullptr && scanned < kMaxTableScanSize && pos != live_pos) {
+      auto limit = pos < live_pos ? live_pos : ring_size_;
+      auto size = static_cast<size_t>(std::min<uint64_t>(buf.size(), limit - pos));
+      size -= size % ts::PKT_SIZE;
+      if (size == 0) {
+        // The rest is shorter than a packet, or a packet spans the end of the ring buffer.
+        // Scanning is stopped for simplicity.
+        break;
+      }
+      if (!ReadFully(buf.data(), size, pos)) {
+        return false;
+      }
+      for (size_t i = 0; i < size; i += ts::PKT_SIZE) {
+        ts::TSPacket packet;
+        std::memcpy(packet.b, buf.data() + i, ts::PKT_SIZE);
+        demux_.feedPacket(packet);
+      }
+      pos = (pos + size) % ring_size_;
+      scanned += size;
+    }
+
+    if (pat_ == nullptr || pmt_ == nullptr) {
+      MIRAKC_ARIB_RING_READER_WARN("PAT/PMT not found, send packets without them");
+      return true;
+    }
+
+    ts::CyclingPacketizer pat_packetizer(ts::PID_PAT, ts::CyclingPacketizer::ALWAYS);
+    pat_packetizer.addTable(context_, *pat_);
+    if (!SendPackets(&pat_packetizer)) {
+      return false;
+    }
+
+    ts::CyclingPacketizer pmt_packetizer(pmt_pid_, ts::CyclingPacketizer::ALWAYS);
+    pmt_packetizer.addTable(context_, *pmt_);
+    if (!SendPackets(&pmt_packetizer)) {
+      return false;
+    }
+
+    MIRAKC_ARIB_RING_READER_DEBUG("Sent PAT and PMT#{:04X}", pmt_pid_);
+    return true;
+  }
+
+  bool SendPackets(ts::CyclingPacketizer* packetizer) {
+    ts::TSPacket packet;
+    do {
+      packetizer->getNextPacket(packet);
+      if (!WriteFully(packet.b, ts::PKT_SIZE)) {
+        return false;
+      }
+    } while (!packetizer->atCycleBoundary());
+    return true;
+  }
+
+  bool ReadFully(uint8_t* buf, size_t size, uint64_t pos) {
+    while (size > 0) {
+      auto n = file_->ReadAt(buf, size, static_cast<int64_t>(pos));
+      if (n <= 0) {
+        MIRAKC_ARIB_RING_READER_ERROR("Failed to read {} bytes at {}", size, pos);
+        return false;
+      }
+      buf += n;
+      size -= static_cast<size_t>(n);
+      pos += static_cast<uint64_t>(n);
+    }
+    return true;
+  }
+
+  bool WriteFully(const uint8_t* data, size_t size) {
+    while (size > 0) {
+      auto n = out_->Write(data, size);
+      if (n <= 0) {
+        return false;
+      }
+      data += n;
+      size -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  bool Copy(uint64_t pos, size_t size) {
+    while (size > 0) {
+      auto n = file_->CopyTo(out_.get(), size, static_cast<int64_t>(pos));
+      if (n <= 0) {
+        MIRAKC_ARIB_RING_READER_ERROR("Failed to copy {} bytes at {}", size, pos);
+        return false;
+      }
+      size -= static_cast<size_t>(n);
+      pos += static_cast<uint64_t>(n);
+      num_copied_bytes_ += static_cast<uint64_t>(n);
+    }
+    return true;
+  }
+
+  static constexpr size_t kNoChunk = std::numeric_limits<size_t>::max();
+  // The maximum gap between the end of a chunk and the start of the next chunk.
+  static constexpr int64_t kMaxChunkGapMs = 1000;
+
+  const RingReaderOption option_;
+  std::unique_ptr<File> file_;
+  std::unique_ptr<ChunkIndexReader> index_;
+  std::unique_ptr<File> out_;
+  const uint64_t ring_size_;
+  ts::DuckContext context_;
+  ts::SectionDemux demux_;
+  std::unique_ptr<ts::PAT> pat_;
+  std::unique_ptr<ts::PMT> pmt_;
+  ts::PID pmt_pid_ = ts::PID_NULL;
+  size_t chunk_ = 0;
+  size_t offset_ = 0;
+  // Loaded by UpdateLivePosition().
+  uint64_t last_chunk_ = 0;
+  size_t live_chunk_ = kNoChunk;
+  size_t live_size_ = 0;
+  // The number of bytes copied since packets were synchronized, modulo the packet size.
+  size_t packet_offset_ = 0;
+  uint64_t num_copied_bytes_ = 0;
+  bool synced_ = false;
+  bool tables_sent_ = false;
+
+  MIRAKC_ARIB_NON_COPYABLE(RingReader);
+};
+
+}  // namespace
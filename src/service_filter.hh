@@ -92,49 +92,26 @@ class ServiceFilter final : public PacketSink, public ts::TableHandlerInterface
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
     if (!sink_) {
       MIRAKC_ARIB_SERVICE_FILTER_ERROR("No sink connected");
       return false;
     }
 
-    demux_.feedPacket(packet);
-
-    if (done_) {
-      return false;
-    }
-
-    auto pid = packet.getPID();
-
-    if (CheckFilterForDrop(pid)) {
-      return true;
-    }
-
-    if (pid == ts::PID_PAT) {
-      // Feed a modified PAT packet
-      ts::TSPacket pat_packet;
-      pat_packetizer_.getNextPacket(pat_packet);
-      MIRAKC_ARIB_ASSERT(pat_packet.getPID() == ts::PID_PAT);
-      return sink_->HandlePacket(pat_packet);
+    for (size_t i = 0; i < num_packets; ++i) {
+      if (!ProcessPacket(packets[i])) {
+        (void)forwarder_.Flush(sink_.get());
+        return false;
+      }
     }
 
-    MIRAKC_ARIB_ASSERT(pid != ts::PID_NULL);
-    return sink_->HandlePacket(packet);
-  }
-
- private:
-  bool CheckFilterForDrop(ts::PID pid) const {
-    if (content_filter_.find(pid) != content_filter_.end()) {
-      return false;
-    }
-    if (psi_filter_.find(pid) != psi_filter_.end()) {
-      return false;
-    }
-    if (emm_filter_.find(pid) != emm_filter_.end()) {
-      return false;
-    }
-    return true;
+    return forwarder_.Flush(sink_.get());
   }
 
+  // PSI/SI PIDs passed through.  These are shared with MultiServiceFilter.
   static constexpr std::array<ts::PID, 9> kPsiFilterPids = {
       ts::PID_PAT,
       ts::PID_CAT,
@@ -169,6 +146,57 @@ class ServiceFilter final : public PacketSink, public ts::TableHandlerInterface
     return true;
   }
 
+ private:
+  bool ProcessPacket(const ts::TSPacket& packet) {
+    demux_.feedPacket(packet);
+
+    if (done_) {
+      return false;
+    }
+
+    auto pid = packet.getPID();
+
+    if (CheckFilterForDrop(pid)) {
+      return true;
+    }
+
+    if (pid == ts::PID_PAT) {
+      // Feed a modified PAT packet
+      ts::TSPacket pat_packet;
+      pat_packetizer_.getNextPacket(pat_packet);
+      MIRAKC_ARIB_ASSERT(pat_packet.getPID() == ts::PID_PAT);
+      return forwarder_.Send(sink_.get(), pat_packet);
+    }
+
+    MIRAKC_ARIB_ASSERT(pid != ts::PID_NULL);
+    return forwarder_.Forward(sink_.get(), packet);
+  }
+
+  bool CheckFilterForDrop(ts::PID pid) const {
+    return pid_roles_.Get(pid) == 0;
+  }
+
+  // Rebuilds the PID role table from the filter sets.
+  //
+  // The filter sets are updated only when PSI tables change.  The table is used for checking
+  // each packet instead of them.
+  void UpdatePidRoles() {
+    pid_roles_.Clear();
+    for (auto pid : psi_filter_) {
+      pid_roles_.Add(pid, kPidRolePsi);
+    }
+    for (auto pid : content_filter_) {
+      pid_roles_.Add(pid, kPidRoleContent);
+    }
+    for (auto pid : emm_filter_) {
+      pid_roles_.Add(pid, kPidRoleEmm);
+    }
+  }
+
+  static constexpr uint8_t kPidRolePsi = 0x01;
+  static constexpr uint8_t kPidRoleContent = 0x02;
+  static constexpr uint8_t kPidRoleEmm = 0x04;
+
   void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
     switch (table.tableId()) {
       case ts::TID_PAT:
@@ -262,6 +290,8 @@ class ServiceFilter final : public PacketSink, public ts::TableHandlerInterface
     psi_filter_.insert(pmt_pid_);
     MIRAKC_ARIB_SERVICE_FILTER_DEBUG(
         "PSI/SI filter += PAT CAT NIT SDT EIT RST TOT BIT CDT PMT#{:04X}", pmt_pid_);
+
+    UpdatePidRoles();
   }
 
   void HandleCat(const ts::BinaryTable& table) {
@@ -288,6 +318,8 @@ class ServiceFilter final : public PacketSink, public ts::TableHandlerInterface
 
       i = cat.descs.search(ts::DID_CA, i + 1);
     }
+
+    UpdatePidRoles();
   }
 
   void HandlePmt(const ts::BinaryTable& table) {
@@ -353,6 +385,8 @@ class ServiceFilter final : public PacketSink, public ts::TableHandlerInterface
         MIRAKC_ARIB_SERVICE_FILTER_DEBUG("Content filter += Other#{:04X}", pid);
       }
     }
+
+    UpdatePidRoles();
   }
 
   void HandleTot(const ts::BinaryTable& table) {
@@ -381,12 +415,14 @@ class ServiceFilter final : public PacketSink, public ts::TableHandlerInterface
 
   const ServiceFilterOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   ts::CyclingPacketizer pat_packetizer_;
   std::unique_ptr<PacketSink> sink_;
+  PacketForwarder forwarder_;
   std::unordered_set<ts::PID> psi_filter_;
   std::unordered_set<ts::PID> content_filter_;
   std::unordered_set<ts::PID> emm_filter_;
+  PidRoleTable pid_roles_;
   ts::PID pmt_pid_ = ts::PID_NULL;
   bool done_ = false;
   bool error_ = false;
@@ -26,9 +26,12 @@
 #include <tsduck/tsduck.h>
 
 #include "base.hh"
+#include "chunk_index.hh"
 #include "jsonl_source.hh"
+#include "keyframe_detector.hh"
 #include "logging.hh"
 #include "packet_sink.hh"
+#include "recorder_state.hh"
 #include "tsduck_helper.hh"
 
 #define MIRAKC_ARIB_SERVICE_RECORDER_TRACE(...) MIRAKC_ARIB_TRACE("service-recorder: " __VA_ARGS__)
@@ -45,6 +48,16 @@ struct ServiceRecorderOption final {
   size_t chunk_size = 0;
   size_t num_chunks = 0;
   uint64_t start_pos = 0;
+  // Add `serviceId` to each message.  Used when messages of multiple services are written to the
+  // same output.
+  bool tag_service_id = false;
+  // Path to the chunk index file.  No chunk index is maintained if empty.
+  std::string index_file;
+  // Path to the state file.  No state is saved if empty.
+  std::string state_file;
+  // Start recording at the position saved in the state file instead of `start_pos` if the state
+  // is valid.
+  bool resume = false;
 };
 
 class ServiceRecorderTestAccessor;
@@ -72,13 +85,27 @@ class ServiceRecorder final : public PacketSink,
     sink_->SetObserver(this);
   }
 
+  // Optional.
+  void SetChunkIndex(std::unique_ptr<ChunkIndex>&& index) {
+    index_ = std::move(index);
+  }
+
+  // Optional.
+  void SetStateFile(std::unique_ptr<RecorderStateFile>&& state_file) {
+    state_file_ = std::move(state_file);
+  }
+
   bool Start() override {
     MIRAKC_ARIB_ASSERT(sink_ != nullptr);
     if (!sink_->Start()) {
       return false;
     }
-    if (option_.start_pos != 0) {
-      if (!sink_->SetPosition(option_.start_pos)) {
+    auto start_pos = option_.start_pos;
+    if (state_file_ != nullptr) {
+      LoadState(&start_pos);
+    }
+    if (start_pos != 0) {
+      if (!sink_->SetPosition(start_pos)) {
         return false;
       }
     }
@@ -88,6 +115,8 @@ class ServiceRecorder final : public PacketSink,
 
   void End() override {
     MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    // `chunk` messages for chunks being written must be sent before the `stop` message.
+    sink_->Drain();
     SendStopMessage(sink_->IsBroken());
     sink_->End();
   }
@@ -98,8 +127,55 @@ class ServiceRecorder final : public PacketSink,
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
     MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    for (size_t i = 0; i < num_packets; ++i) {
+      if (!ProcessPacket(packets[i])) {
+        (void)forwarder_.Flush(sink_.get());
+        return false;
+      }
+    }
+    return forwarder_.Flush(sink_.get());
+  }
+
+  void OnEndOfChunk(uint64_t pos) override {
+    auto now = clock_.Now();
+    if (index_ != nullptr) {
+      index_->EndChunk(pos, ConvertJstTimeToUnixTime(now));
+    }
+    if (pos == sink_->ring_size()) {
+      pos = 0;
+    }
+    if (state_file_ != nullptr) {
+      SaveState(now, pos);
+    }
+    // The `event-update` message must be sent before the `chunk` message.
+    // The application may purge expired programs in the message handler for
+    // the `chunk` message.  So, the program data must be updated before that.
+    if (event_started_) {
+      SendEventUpdateMessage(eit_, now, pos);
+    }
+    SendChunkMessage(now, pos);
+    StartIndexChunk(now, pos);
+  }
+
+  void OnEndOfBlock(uint64_t pos) override {
+    if (index_ != nullptr) {
+      index_->SetWritePos(pos);
+    }
+  }
 
+ private:
+  enum class State {
+    kPreparing,
+    kRecording,
+    kDone,
+  };
+
+  bool ProcessPacket(const ts::TSPacket& packet) {
     auto pid = packet.getPID();
     if (clock_.HasPid() && clock_.pid() == pid && packet.hasPCR()) {
       auto pcr = packet.getPCR();
@@ -125,27 +201,6 @@ class ServiceRecorder final : public PacketSink,
     return false;
   }
 
-  void OnEndOfChunk(uint64_t pos) override {
-    auto now = clock_.Now();
-    if (pos == sink_->ring_size()) {
-      pos = 0;
-    }
-    // The `event-update` message must be sent before the `chunk` message.
-    // The application may purge expired programs in the message handler for
-    // the `chunk` message.  So, the program data must be updated before that.
-    if (event_started_) {
-      SendEventUpdateMessage(eit_, now, pos);
-    }
-    SendChunkMessage(now, pos);
-  }
-
- private:
-  enum class State {
-    kPreparing,
-    kRecording,
-    kDone,
-  };
-
   void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
     switch (table.tableId()) {
       case ts::TID_PAT:
@@ -222,6 +277,14 @@ class ServiceRecorder final : public PacketSink,
           "PMT: PCR#{:04X} -> {:04X}, need resync", clock_.pid(), pcr_pid);
       clock_.SetPid(pcr_pid);
     }
+
+    for (const auto& [pid, stream] : pmt.streams) {
+      auto codec = GetVideoCodec(stream.stream_type);
+      if (codec != VideoCodec::kUnknown) {
+        keyframe_detector_.SetStream(pid, codec);
+        break;
+      }
+    }
   }
 
   void HandleEit(const ts::BinaryTable& table) {
@@ -295,6 +358,7 @@ class ServiceRecorder final : public PacketSink,
           event_started_ = false;
         }
       }
+      StartIndexChunk(now, pos);
       return true;
     }
     // Packets are dropped until ready.
@@ -302,6 +366,14 @@ class ServiceRecorder final : public PacketSink,
   }
 
   bool OnRecording(const ts::TSPacket& packet) {
+    // Pending packets must be written before changing the state below.  OnEndOfChunk() will be
+    // called while writing them and it uses the state.
+    if (new_eit_) {
+      if (!forwarder_.Flush(sink_.get())) {
+        return false;
+      }
+    }
+
     auto now = clock_.Now();
 
     // Copy the safe pointers on the stack in order to hold EIT objects.
@@ -331,6 +403,9 @@ class ServiceRecorder final : public PacketSink,
         } else {
           auto end_time = GetEventEndTime(GetEvent(eit));
           if (now >= end_time) {
+            if (!forwarder_.Flush(sink_.get())) {
+              return false;
+            }
             UpdateEventBoundary(end_time, sink_->pos());
             SendEventEndMessage(eit);
             event_started_ = false;  // wait for new event
@@ -343,7 +418,107 @@ class ServiceRecorder final : public PacketSink,
         event_started_ = true;
       }
     }
-    return sink_->HandlePacket(packet);
+    if (index_ != nullptr) {
+      UpdateChunkIndex(packet);
+    }
+    return forwarder_.Forward(sink_.get(), packet);
+  }
+
+  void LoadState(uint64_t* start_pos) {
+    RecorderStateRecord record;
+    if (!state_file_->Load(&record)) {
+      MIRAKC_ARIB_SERVICE_RECORDER_INFO("State: No valid state in {}", state_file_->path());
+      return;
+    }
+
+    if (record.sid != option_.sid || record.chunk_size != option_.chunk_size ||
+        record.num_chunks != option_.num_chunks || record.pos >= sink_->ring_size()) {
+      MIRAKC_ARIB_SERVICE_RECORDER_WARN("State: Not matched, ignore");
+      return;
+    }
+
+    MIRAKC_ARIB_SERVICE_RECORDER_INFO(
+        "State: pos={} timestamp={} eid={:04X}", record.pos, record.timestamp, record.eid);
+
+    if (option_.resume) {
+      MIRAKC_ARIB_SERVICE_RECORDER_INFO("State: Resume at {}", record.pos);
+      *start_pos = record.pos;
+    }
+
+    // The clock can be used until the next TOT comes.  But the PCR may wrap around after a long
+    // time.
+    auto now = ts::Time::CurrentUTC() - ts::Time::UnixEpoch;
+    if (record.clock_pcr != RecorderStateRecord::kNoPcr && IsValidPcr(record.clock_pcr) &&
+        now - record.timestamp < kMaxClockBaselineAge) {
+      ClockBaseline baseline;
+      // Don't change the order of the following method calls.
+      baseline.SetPid(record.clock_pid);
+      baseline.SetPcr(record.clock_pcr);
+      baseline.SetTime(ConvertUnixTimeToJstTime(record.clock_time));
+      clock_ = Clock(baseline);
+      MIRAKC_ARIB_SERVICE_RECORDER_INFO(
+          "State: Clock: PID={:04X} PCR={:011X} Time={}", baseline.pid(), baseline.pcr(),
+          baseline.time());
+    }
+  }
+
+  void SaveState(const ts::Time& now, uint64_t pos) {
+    RecorderStateRecord record = {};
+    record.sid = option_.sid;
+    record.chunk_size = option_.chunk_size;
+    record.num_chunks = option_.num_chunks;
+    record.pos = pos;
+    record.timestamp = ConvertJstTimeToUnixTime(now);
+    const auto& baseline = clock_.baseline();
+    if (baseline.IsReady()) {
+      record.clock_pid = baseline.pid();
+      record.clock_pcr = baseline.pcr();
+      record.clock_time = ConvertJstTimeToUnixTime(baseline.time());
+    } else {
+      record.clock_pid = ts::PID_NULL;
+      record.clock_pcr = RecorderStateRecord::kNoPcr;
+    }
+    if (event_started_) {
+      record.eid = GetEvent(eit_).event_id;
+    }
+    // Recording can continue without the state.
+    (void)state_file_->Save(record);
+  }
+
+  void StartIndexChunk(const ts::Time& time, uint64_t pos) {
+    if (index_ == nullptr) {
+      return;
+    }
+    uint16_t eid = 0;
+    if (event_started_) {
+      eid = GetEvent(eit_).event_id;
+    }
+    index_->StartChunk(pos, ConvertJstTimeToUnixTime(time), eid);
+  }
+
+  void UpdateChunkIndex(const ts::TSPacket& packet) {
+    // The position where the packet will be written.
+    auto pos = (sink_->pos() + forwarder_.num_pending_packets() * ts::PKT_SIZE) %
+        sink_->ring_size();
+    index_->UpdatePosition(pos);
+    auto pid = packet.getPID();
+    if (pid == ts::PID_PAT) {
+      index_->SetPatOffset(pos);
+    } else if (pid == pmt_pid_) {
+      index_->SetPmtOffset(pos);
+    }
+    if (clock_.HasPid() && clock_.pid() == pid && packet.hasPCR()) {
+      index_->SetPcr(pos, static_cast<int64_t>(packet.getPCR()));
+    }
+    if (pid == keyframe_detector_.pid()) {
+      auto keyframe_pos = keyframe_detector_.Feed(packet, pos);
+      // The PES packet may start in the previous chunk.  Such a keyframe is not recorded because
+      // the previous chunk may have been already completed.
+      if (keyframe_pos.has_value() &&
+          *keyframe_pos / option_.chunk_size == pos / option_.chunk_size) {
+        index_->SetKeyframeOffset(*keyframe_pos);
+      }
+    }
   }
 
   void UpdateEventBoundary(const ts::Time& time, uint64_t pos) {
@@ -355,49 +530,31 @@ class ServiceRecorder final : public PacketSink,
   void SendStartMessage() {
     MIRAKC_ARIB_SERVICE_RECORDER_INFO("Started recording SID#{:04X}", option_.sid);
 
-    rapidjson::Document doc(rapidjson::kObjectType);
-    auto& allocator = doc.GetAllocator();
-
-    doc.AddMember("type", "start", allocator);
-
-    FeedDocument(doc);
+    SendMessage("start", [](JsonWriter&) {});
   }
 
   void SendStopMessage(bool reset) {
     MIRAKC_ARIB_SERVICE_RECORDER_INFO("Stopped recording SID#{:04X}", option_.sid);
 
-    rapidjson::Document doc(rapidjson::kObjectType);
-    auto& allocator = doc.GetAllocator();
-
-    rapidjson::Value data(rapidjson::kObjectType);
-    data.AddMember("reset", reset, allocator);
-
-    doc.AddMember("type", "stop", allocator);
-    doc.AddMember("data", data, allocator);
-
-    FeedDocument(doc);
+    SendMessage("stop", [reset](JsonWriter& writer) {
+      writer.Key("data");
+      writer.StartObject();
+      writer.Key("reset");
+      writer.Bool(reset);
+      writer.EndObject();
+    });
   }
 
   void SendChunkMessage(const ts::Time& time, int64_t pos) {
     MIRAKC_ARIB_SERVICE_RECORDER_INFO("Reached next chunk: {}@{}", time, pos);
 
-    rapidjson::Document doc(rapidjson::kObjectType);
-    auto& allocator = doc.GetAllocator();
-
-    rapidjson::Value chunk(rapidjson::kObjectType);
-    {
-      const auto time_unix = ConvertJstTimeToUnixTime(time);
-      chunk.AddMember("timestamp", time_unix, allocator);
-      chunk.AddMember("pos", static_cast<uint64_t>(pos), allocator);
-    }
-
-    rapidjson::Value data(rapidjson::kObjectType);
-    data.AddMember("chunk", chunk, allocator);
-
-    doc.AddMember("type", "chunk", allocator);
-    doc.AddMember("data", data, allocator);
-
-    FeedDocument(doc);
+    SendMessage("chunk", [&time, pos](JsonWriter& writer) {
+      writer.Key("data");
+      writer.StartObject();
+      writer.Key("chunk");
+      WriteRecordJson(writer, time, static_cast<uint64_t>(pos));
+      writer.EndObject();
+    });
   }
 
   void SendEventStartMessage(const std::shared_ptr<ts::EIT>& eit) {
@@ -422,33 +579,51 @@ class ServiceRecorder final : public PacketSink,
     SendEventMessage("event-end", eit, event_boundary_time_, event_boundary_pos_);
   }
 
-  void SendEventMessage(const std::string& type, const std::shared_ptr<ts::EIT>& eit,
+  void SendEventMessage(const char* type, const std::shared_ptr<ts::EIT>& eit,
       const ts::Time& time, uint64_t pos) {
     MIRAKC_ARIB_ASSERT(eit);
 
-    rapidjson::Document doc(rapidjson::kObjectType);
-    auto& allocator = doc.GetAllocator();
-
-    auto event = MakeJsonValue(GetEvent(eit), allocator);
-
-    rapidjson::Value record(rapidjson::kObjectType);
-    {
-      const auto time_unix = ConvertJstTimeToUnixTime(time);
-      record.AddMember("timestamp", time_unix, allocator);
-      record.AddMember("pos", static_cast<uint64_t>(pos), allocator);
-    }
-
-    rapidjson::Value data(rapidjson::kObjectType);
-    data.AddMember("originalNetworkId", eit->onetw_id, allocator);
-    data.AddMember("transportStreamId", eit->ts_id, allocator);
-    data.AddMember("serviceId", eit->service_id, allocator);
-    data.AddMember("event", event, allocator);
-    data.AddMember("record", record, allocator);
+    SendMessage(type, [this, &eit, &time, pos](JsonWriter& writer) {
+      writer.Key("data");
+      writer.StartObject();
+      writer.Key("originalNetworkId");
+      writer.Uint(eit->onetw_id);
+      writer.Key("transportStreamId");
+      writer.Uint(eit->ts_id);
+      writer.Key("serviceId");
+      writer.Uint(eit->service_id);
+      writer.Key("event");
+      WriteJson(writer, GetEvent(eit));
+      writer.Key("record");
+      WriteRecordJson(writer, time, pos);
+      writer.EndObject();
+    });
+  }
 
-    doc.AddMember("type", type, allocator);
-    doc.AddMember("data", data, allocator);
+  static void WriteRecordJson(JsonWriter& writer, const ts::Time& time, uint64_t pos) {
+    writer.StartObject();
+    writer.Key("timestamp");
+    writer.Int64(ConvertJstTimeToUnixTime(time));
+    writer.Key("pos");
+    writer.Uint64(pos);
+    writer.EndObject();
+  }
 
-    FeedDocument(doc);
+  // Messages are written directly into the output buffer without building documents.
+  // `write_data` writes the `data` property if the message has it.
+  template <typename WriteData>
+  void SendMessage(const char* type, const WriteData& write_data) {
+    FeedJson([this, type, &write_data](JsonWriter& writer) {
+      writer.StartObject();
+      writer.Key("type");
+      writer.String(type);
+      write_data(writer);
+      if (option_.tag_service_id) {
+        writer.Key("serviceId");
+        writer.Uint(option_.sid);
+      }
+      writer.EndObject();
+    });
   }
 
   const ts::EIT::Event& GetEvent(const std::shared_ptr<ts::EIT>& eit) const {
@@ -464,10 +639,17 @@ class ServiceRecorder final : public PacketSink,
     return event.start_time + (event.duration * ts::MilliSecPerSec);
   }
 
+  // The clock baseline in the state is not used if the state is older than this.
+  static constexpr ts::MilliSecond kMaxClockBaselineAge = ts::MilliSecPerHour;
+
   const ServiceRecorderOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   std::unique_ptr<PacketRingSink> sink_;
+  std::unique_ptr<ChunkIndex> index_;
+  std::unique_ptr<RecorderStateFile> state_file_;
+  KeyframeDetector keyframe_detector_;
+  PacketForwarder forwarder_;
   Clock clock_;
   ts::Time event_boundary_time_;
   uint64_t event_boundary_pos_;
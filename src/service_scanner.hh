@@ -61,7 +61,7 @@ class ServiceScanner final : public PacketSink,
     }
 
     // Convert into a JSON object
-    rapidjson::Document doc(rapidjson::kArrayType);
+    auto doc = MakeDocument(rapidjson::kArrayType);
     CollectServices(&doc);
     FeedDocument(doc);
   }
@@ -252,7 +252,7 @@ class ServiceScanner final : public PacketSink,
 
   const ServiceScannerOption option_;
   ts::DuckContext context_;
-  ts::SectionDemux demux_;
+  LazySectionDemux demux_;
   std::unique_ptr<ts::PAT> pat_;
   std::unique_ptr<ts::SDT> sdt_;
   std::unique_ptr<ts::NIT> nit_;
@@ -68,8 +68,27 @@ class StartSeeker final : public PacketSink, public ts::TableHandlerInterface {
   }
 
   bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
     MIRAKC_ARIB_ASSERT(sink_ != nullptr);
+    for (size_t i = 0; i < num_packets; ++i) {
+      if (!ProcessPacket(packets[i])) {
+        (void)forwarder_.Flush(sink_.get());
+        return false;
+      }
+    }
+    return forwarder_.Flush(sink_.get());
+  }
 
+ private:
+  enum State {
+    kSeek,
+    kStreaming,
+  };
+
+  bool ProcessPacket(const ts::TSPacket& packet) {
     demux_.feedPacket(packet);
 
     switch (state_) {
@@ -83,12 +102,6 @@ class StartSeeker final : public PacketSink, public ts::TableHandlerInterface {
     return false;
   }
 
- private:
-  enum State {
-    kSeek,
-    kStreaming,
-  };
-
   bool Seek(const ts::TSPacket& packet) {
     auto pid = packet.getPID();
 
@@ -146,23 +159,21 @@ class StartSeeker final : public PacketSink, public ts::TableHandlerInterface {
   }
 
   bool SendPacket(size_t index) {
-    return sink_->HandlePacket(packets_[index]);
+    return forwarder_.Send(sink_.get(), packets_[index]);
   }
 
   bool SendPackets(size_t index = 0) {
-    bool ok = true;
-    for (auto i = index; i < packets_.size(); ++i) {
-      ok = sink_->HandlePacket(packets_[i]);
-      if (!ok) {
-        break;
-      }
+    // Buffered packets are sent in a batch.
+    bool ok = forwarder_.Flush(sink_.get());
+    if (ok && index < packets_.size()) {
+      ok = sink_->HandlePackets(&packets_[index], packets_.size() - index);
     }
     packets_.clear();
     return ok;
   }
 
   bool DoStreaming(const ts::TSPacket& packet) {
-    return sink_->HandlePacket(packet);
+    return forwarder_.Forward(sink_.get(), packet);
   }
 
   void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
@@ -270,8 +281,10 @@ class StartSeeker final : public PacketSink, public ts::TableHandlerInterface {
 
   const StartSeekerOption option_;
   ts::DuckContext context_;
+  // LazySectionDemux cannot be used because packet indexes of tables are used.
   ts::SectionDemux demux_;
   std::unique_ptr<PacketSink> sink_;
+  PacketForwarder forwarder_;
   State state_ = kSeek;
   ts::TSPacketVector packets_;
   ts::PID pmt_pid_ = ts::PID_NULL;
@@ -17,7 +17,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <LibISDB/LibISDB.hpp>
 #include <LibISDB/EPG/EventInfo.hpp>
@@ -176,166 +181,542 @@ inline LibISDB::ARIBStringDecoder::DecodeFlag GetAribStringDecodeFlag() {
   return flags;
 }
 
+// Decodes ARIB strings with a fast path for plain characters.
+//
+// Most strings in EIT sections consist only of characters in the code sets invoked by default:
+// 2-byte codes in GL (the Kanji set), 1-byte codes in GR (the Hiragana set) and SP.  None of them
+// changes the state of the decoder, so each of them is always decoded into the same UTF-8
+// sequence.  The sequence is learned by decoding the character with LibISDB when it appears for
+// the first time, and copied from a table after that.
+//
+// The leading run of plain characters is converted with the table, and 8 bytes are checked at a
+// time while the run is in the Kanji set.  The rest of the string starts in the initial state,
+// and it's decoded with LibISDB.  So, the result is always the same as LibISDB.
+class FastAribStringDecoder final {
+ public:
+  using DecodeFlag = LibISDB::ARIBStringDecoder::DecodeFlag;
+
+  FastAribStringDecoder() : table_(kTableSize) {
+    Reset(GetAribStringDecodeFlag());
+  }
+
+  ~FastAribStringDecoder() = default;
+
+  FastAribStringDecoder(const FastAribStringDecoder&) = delete;
+  FastAribStringDecoder& operator=(const FastAribStringDecoder&) = delete;
+
+  void Decode(const LibISDB::ARIBString& str, LibISDB::String* utf8, DecodeFlag flags) {
+    if (flags != flags_) {
+      Reset(flags);
+    }
+
+    const auto* data = str.data();
+    const auto size = str.size();
+    num_bytes_ += size;
+
+    utf8->clear();
+    size_t pos = 0;
+    while (pos < size) {
+      if (size - pos >= sizeof(uint64_t) && IsKanjiWord(data + pos)) {
+        size_t i = 0;
+        while (i < sizeof(uint64_t) && Put(GetKanjiIndex(data + pos + i), utf8)) {
+          i += 2;
+        }
+        pos += i;
+        if (i < sizeof(uint64_t)) {
+          break;
+        }
+        continue;
+      }
+      size_t n;
+      auto index = GetIndex(data + pos, size - pos, &n);
+      if (index == kNoIndex || !Put(index, utf8)) {
+        break;
+      }
+      pos += n;
+    }
+    num_fast_bytes_ += pos;
+
+    if (pos == 0) {
+      decoder_.Decode(str, utf8, flags);
+    } else if (pos < size) {
+      LibISDB::String rest;
+      decoder_.Decode(LibISDB::ARIBString(data + pos, size - pos), &rest, flags);
+      utf8->append(rest);
+    }
+  }
+
+  // The number of bytes converted with the table.
+  size_t num_fast_bytes() const {
+    return num_fast_bytes_;
+  }
+
+  size_t num_bytes() const {
+    return num_bytes_;
+  }
+
+ private:
+  static constexpr size_t kNumCodes = 94;  // 0x21..0x7E or 0xA1..0xFE
+  static constexpr size_t kSpIndex = kNumCodes * kNumCodes;
+  static constexpr size_t kGrIndex = kSpIndex + 1;
+  static constexpr size_t kTableSize = kGrIndex + kNumCodes;
+  static constexpr size_t kNoIndex = kTableSize;
+
+  static constexpr uint8_t kUnknown = 0xFF;
+  static constexpr uint8_t kUnsupported = 0xFE;
+
+  struct Entry {
+    uint8_t size;
+    char data[7];
+  };
+
+  void Reset(DecodeFlag flags) {
+    for (auto& entry : table_) {
+      entry.size = kUnknown;
+    }
+    flags_ = flags;
+  }
+
+  // Returns true if all bytes are in 0x21..0x7E.  A byte out of the range sets the MSB of the
+  // corresponding byte in at least one of the terms.
+  static bool IsKanjiWord(const uint8_t* data) {
+    constexpr uint64_t kOnes = 0x0101010101010101;
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    return ((word | (word - kOnes * 0x21) | (word + kOnes)) & (kOnes * 0x80)) == 0;
+  }
+
+  static bool IsGl(uint8_t b) {
+    return b >= 0x21 && b <= 0x7E;
+  }
+
+  static size_t GetKanjiIndex(const uint8_t* data) {
+    return (data[0] - 0x21) * kNumCodes + (data[1] - 0x21);
+  }
+
+  // Returns kNoIndex if the next character is not a plain character.
+  static size_t GetIndex(const uint8_t* data, size_t size, size_t* n) {
+    auto b = data[0];
+    if (IsGl(b)) {
+      if (size < 2 || !IsGl(data[1])) {
+        return kNoIndex;
+      }
+      *n = 2;
+      return GetKanjiIndex(data);
+    }
+    *n = 1;
+    if (b == 0x20) {
+      return kSpIndex;
+    }
+    if (b >= 0xA1 && b <= 0xFE) {
+      return kGrIndex + (b - 0xA1);
+    }
+    return kNoIndex;
+  }
+
+  bool Put(size_t index, LibISDB::String* utf8) {
+    auto& entry = table_[index];
+    if (entry.size == kUnknown) {
+      Learn(index, &entry);
+    }
+    if (entry.size == kUnsupported) {
+      return false;
+    }
+    utf8->append(entry.data, entry.size);
+    return true;
+  }
+
+  void Learn(size_t index, Entry* entry) {
+    uint8_t code[2];
+    size_t size;
+    if (index < kSpIndex) {
+      code[0] = static_cast<uint8_t>(0x21 + index / kNumCodes);
+      code[1] = static_cast<uint8_t>(0x21 + index % kNumCodes);
+      size = 2;
+    } else if (index == kSpIndex) {
+      code[0] = 0x20;
+      size = 1;
+    } else {
+      code[0] = static_cast<uint8_t>(0xA1 + (index - kGrIndex));
+      size = 1;
+    }
+    LibISDB::String utf8;
+    decoder_.Decode(LibISDB::ARIBString(code, size), &utf8, flags_);
+    if (utf8.size() > sizeof(entry->data)) {
+      // Some symbols are decoded into long strings.
+      entry->size = kUnsupported;
+      return;
+    }
+    std::memcpy(entry->data, utf8.data(), utf8.size());
+    entry->size = static_cast<uint8_t>(utf8.size());
+  }
+
+  LibISDB::ARIBStringDecoder decoder_;
+  std::vector<Entry> table_;
+  DecodeFlag flags_;
+  size_t num_fast_bytes_ = 0;
+  size_t num_bytes_ = 0;
+};
+
+// A cache of decoded ARIB strings.
+//
+// EIT sections are transmitted repeatedly, and most of strings in them are the same as before.
+// Decoded strings are cached with the raw bytes and the decode flags as the key.  Entries are
+// replaced with the CLOCK algorithm when the cache is full.
+//
+// Strings are decoded on the thread which processes packets.  That is the main thread by default,
+// and a worker thread with `MIRAKC_ARIB_PIPELINE=input`, which moves the whole sink chain off the
+// main thread.  Each thread has its own cache so that no lock is needed in either case.  See
+// AribStringCache::Get().  The statistics are logged when the thread exits.
+class AribStringCache final {
+ public:
+  using DecodeFlag = LibISDB::ARIBStringDecoder::DecodeFlag;
+
+  static constexpr size_t kDefaultCapacity = 4096;
+
+  explicit AribStringCache(size_t capacity = kDefaultCapacity) : capacity_(capacity) {
+    MIRAKC_ARIB_ASSERT(capacity_ > 0);
+    entries_.reserve(capacity_);
+    index_.reserve(capacity_);
+  }
+
+  ~AribStringCache() {
+    LogStats();
+  }
+
+  AribStringCache(const AribStringCache&) = delete;
+  AribStringCache& operator=(const AribStringCache&) = delete;
+
+  // Returns the cache for the current thread.  Only the thread running the sink chain decodes
+  // strings, so there is a single active cache per process in practice.
+  static AribStringCache& Get() {
+    thread_local AribStringCache cache;
+    return cache;
+  }
+
+  LibISDB::String Decode(const LibISDB::ARIBString& str, DecodeFlag flags) {
+    const auto* data = str.data();
+    const auto size = str.size();
+    if (size == 0) {
+      return LibISDB::String();
+    }
+    const auto hash = Hash(data, size, flags);
+
+    auto it = index_.find(hash);
+    if (it != index_.end()) {
+      auto& entry = entries_[it->second];
+      if (entry.flags == flags && entry.key.size() == size &&
+          std::memcmp(entry.key.data(), data, size) == 0) {
+        entry.referenced = true;
+        num_hits_++;
+        return entry.value;
+      }
+    }
+
+    num_misses_++;
+    LibISDB::String utf8;
+    decoder_.Decode(str, &utf8, flags);
+
+    // The entry is replaced when the hash collides.
+    size_t i;
+    if (it != index_.end()) {
+      i = it->second;
+    } else {
+      i = Allocate();
+      index_[hash] = i;
+    }
+    auto& entry = entries_[i];
+    entry.hash = hash;
+    entry.flags = flags;
+    entry.key.assign(reinterpret_cast<const char*>(data), size);
+    entry.value = utf8;
+    entry.referenced = false;
+    return utf8;
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  size_t num_hits() const {
+    return num_hits_;
+  }
+
+  size_t num_misses() const {
+    return num_misses_;
+  }
+
+  size_t num_evictions() const {
+    return num_evictions_;
+  }
+
+  void LogStats() const {
+    auto total = num_hits_ + num_misses_;
+    if (total == 0) {
+      return;
+    }
+    MIRAKC_ARIB_INFO("arib-string-cache: hits={} misses={} ({:.1f}% hit) evictions={} size={}",
+        num_hits_, num_misses_, num_hits_ * 100.0 / total, num_evictions_, entries_.size());
+  }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    DecodeFlag flags;
+    std::string key;
+    LibISDB::String value;
+    bool referenced;
+  };
+
+  // Bytes are processed 8 bytes at a time.  Hash collisions are detected by comparing keys.
+  static uint64_t Hash(const uint8_t* data, size_t size, DecodeFlag flags) {
+    constexpr uint64_t kMul = 0x9E3779B97F4A7C15;
+    uint64_t hash = (static_cast<uint64_t>(size) * kMul) ^ static_cast<uint64_t>(flags);
+    while (size >= sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, data, sizeof(word));
+      hash = (hash ^ word) * kMul;
+      hash ^= hash >> 32;
+      data += sizeof(word);
+      size -= sizeof(word);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data, size);
+    hash = (hash ^ tail) * kMul;
+    return hash ^ (hash >> 32);
+  }
+
+  // Returns the index of an entry for a new string.
+  size_t Allocate() {
+    if (entries_.size() < capacity_) {
+      entries_.emplace_back();
+      return entries_.size() - 1;
+    }
+    // Give a second chance to referenced entries.
+    while (entries_[hand_].referenced) {
+      entries_[hand_].referenced = false;
+      hand_ = (hand_ + 1) % capacity_;
+    }
+    auto i = hand_;
+    hand_ = (hand_ + 1) % capacity_;
+    index_.erase(entries_[i].hash);
+    num_evictions_++;
+    return i;
+  }
+
+  const size_t capacity_;
+  FastAribStringDecoder decoder_;
+  std::vector<Entry> entries_;
+  std::unordered_map<uint64_t, size_t> index_;
+  size_t hand_ = 0;
+  size_t num_hits_ = 0;
+  size_t num_misses_ = 0;
+  size_t num_evictions_ = 0;
+};
+
 inline LibISDB::String DecodeAribString(const LibISDB::ARIBString& str) {
-  LibISDB::ARIBStringDecoder decoder;
-  LibISDB::String utf8;
-  decoder.Decode(str, &utf8, GetAribStringDecodeFlag());
-  return std::move(utf8);
+  return AribStringCache::Get().Decode(str, GetAribStringDecodeFlag());
 }
 
-rapidjson::Value MakeJsonValue(
-    const LibISDB::ShortEventDescriptor* desc, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "ShortEvent", allocator);
+// JSON values are written with SAX events so that no DOM is built for each section.  `Writer`
+// is rapidjson::Writer or a compatible handler.
+
+template <typename Writer>
+void WriteJson(Writer& writer, const LibISDB::ShortEventDescriptor* desc) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("ShortEvent");
   LibISDB::ARIBString event_name;
   if (desc->GetEventName(&event_name)) {
-    json.AddMember("eventName", DecodeAribString(event_name), allocator);
+    writer.Key("eventName");
+    writer.String(DecodeAribString(event_name));
   }
   LibISDB::ARIBString text;
   if (desc->GetEventDescription(&text)) {
-    json.AddMember("text", DecodeAribString(text), allocator);
+    writer.Key("text");
+    writer.String(DecodeAribString(text));
   }
-  return json;
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(
-    const LibISDB::ComponentDescriptor* desc, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "Component", allocator);
-  json.AddMember("streamContent", desc->GetStreamContent(), allocator);
-  json.AddMember("componentType", desc->GetComponentType(), allocator);
-  json.AddMember("componentTag", desc->GetComponentTag(), allocator);
-  json.AddMember("languageCode", desc->GetLanguageCode(), allocator);
+template <typename Writer>
+void WriteJson(Writer& writer, const LibISDB::ComponentDescriptor* desc) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("Component");
+  writer.Key("streamContent");
+  writer.Uint(desc->GetStreamContent());
+  writer.Key("componentType");
+  writer.Uint(desc->GetComponentType());
+  writer.Key("componentTag");
+  writer.Uint(desc->GetComponentTag());
+  writer.Key("languageCode");
+  writer.Uint(desc->GetLanguageCode());
   LibISDB::ARIBString text;
   if (desc->GetText(&text)) {
-    json.AddMember("text", DecodeAribString(text), allocator);
+    writer.Key("text");
+    writer.String(DecodeAribString(text));
   }
-  return json;
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(
-    const LibISDB::ContentDescriptor* desc, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value nibbles(rapidjson::kArrayType);
+template <typename Writer>
+void WriteJson(Writer& writer, const LibISDB::ContentDescriptor* desc) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("Content");
+  writer.Key("nibbles");
+  writer.StartArray();
   for (int i = 0; i < desc->GetNibbleCount(); ++i) {
     LibISDB::ContentDescriptor::NibbleInfo info;
     desc->GetNibble(i, &info);
-    rapidjson::Value nibble(rapidjson::kArrayType);
-    nibble.PushBack(info.ContentNibbleLevel1, allocator);
-    nibble.PushBack(info.ContentNibbleLevel2, allocator);
-    nibble.PushBack(info.UserNibble1, allocator);
-    nibble.PushBack(info.UserNibble2, allocator);
-    nibbles.PushBack(nibble, allocator);
-  }
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "Content", allocator);
-  json.AddMember("nibbles", nibbles, allocator);
-  return json;
+    writer.StartArray();
+    writer.Uint(info.ContentNibbleLevel1);
+    writer.Uint(info.ContentNibbleLevel2);
+    writer.Uint(info.UserNibble1);
+    writer.Uint(info.UserNibble2);
+    writer.EndArray();
+  }
+  writer.EndArray();
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(
-    const LibISDB::AudioComponentDescriptor* desc, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "AudioComponent", allocator);
-  json.AddMember("streamContent", desc->GetStreamContent(), allocator);
-  json.AddMember("componentType", desc->GetComponentType(), allocator);
-  json.AddMember("componentTag", desc->GetComponentTag(), allocator);
-  json.AddMember("simulcastGroupTag", desc->GetSimulcastGroupTag(), allocator);
-  json.AddMember("esMultiLingualFlag", desc->GetESMultiLingualFlag(), allocator);
-  json.AddMember("mainComponentFlag", desc->GetMainComponentFlag(), allocator);
-  json.AddMember("qualityIndicator", desc->GetQualityIndicator(), allocator);
-  json.AddMember("samplingRate", desc->GetSamplingRate(), allocator);
-  json.AddMember("languageCode", desc->GetLanguageCode(), allocator);
+template <typename Writer>
+void WriteJson(Writer& writer, const LibISDB::AudioComponentDescriptor* desc) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("AudioComponent");
+  writer.Key("streamContent");
+  writer.Uint(desc->GetStreamContent());
+  writer.Key("componentType");
+  writer.Uint(desc->GetComponentType());
+  writer.Key("componentTag");
+  writer.Uint(desc->GetComponentTag());
+  writer.Key("simulcastGroupTag");
+  writer.Uint(desc->GetSimulcastGroupTag());
+  writer.Key("esMultiLingualFlag");
+  writer.Bool(desc->GetESMultiLingualFlag());
+  writer.Key("mainComponentFlag");
+  writer.Bool(desc->GetMainComponentFlag());
+  writer.Key("qualityIndicator");
+  writer.Uint(desc->GetQualityIndicator());
+  writer.Key("samplingRate");
+  writer.Uint(desc->GetSamplingRate());
+  writer.Key("languageCode");
+  writer.Uint(desc->GetLanguageCode());
   if (desc->GetESMultiLingualFlag()) {
-    json.AddMember("languageCode2", desc->GetLanguageCode2(), allocator);
+    writer.Key("languageCode2");
+    writer.Uint(desc->GetLanguageCode2());
   }
   LibISDB::ARIBString text;
   if (desc->GetText(&text)) {
-    json.AddMember("text", DecodeAribString(text), allocator);
+    writer.Key("text");
+    writer.String(DecodeAribString(text));
   }
-  return json;
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(
-    const LibISDB::SeriesDescriptor* desc, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "Series", allocator);
-  json.AddMember("seriesId", desc->GetSeriesID(), allocator);
-  json.AddMember("repeatLabel", desc->GetRepeatLabel(), allocator);
-  json.AddMember("programPattern", desc->GetProgramPattern(), allocator);
+template <typename Writer>
+void WriteJson(Writer& writer, const LibISDB::SeriesDescriptor* desc) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("Series");
+  writer.Key("seriesId");
+  writer.Uint(desc->GetSeriesID());
+  writer.Key("repeatLabel");
+  writer.Uint(desc->GetRepeatLabel());
+  writer.Key("programPattern");
+  writer.Uint(desc->GetProgramPattern());
   LibISDB::DateTime expire_date;
   if (desc->GetExpireDate(&expire_date)) {
-    json.AddMember(
-        "expireDate", static_cast<uint64_t>(expire_date.GetLinearMilliseconds()), allocator);
+    writer.Key("expireDate");
+    writer.Uint64(static_cast<uint64_t>(expire_date.GetLinearMilliseconds()));
   }
-  json.AddMember("episodeNumber", desc->GetEpisodeNumber(), allocator);
-  json.AddMember("lastEpisodeNumber", desc->GetLastEpisodeNumber(), allocator);
+  writer.Key("episodeNumber");
+  writer.Uint(desc->GetEpisodeNumber());
+  writer.Key("lastEpisodeNumber");
+  writer.Uint(desc->GetLastEpisodeNumber());
   LibISDB::ARIBString series_name;
   if (desc->GetSeriesName(&series_name)) {
-    json.AddMember("seriesName", DecodeAribString(series_name), allocator);
+    writer.Key("seriesName");
+    writer.String(DecodeAribString(series_name));
   }
-  return json;
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(uint8_t group_type,
-    const LibISDB::EventGroupDescriptor::EventInfo& info,
-    rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kObjectType);
+template <typename Writer>
+void WriteJson(
+    Writer& writer, uint8_t group_type, const LibISDB::EventGroupDescriptor::EventInfo& info) {
+  writer.StartObject();
   switch (group_type) {
     case LibISDB::EventGroupDescriptor::GROUP_TYPE_RELAY_TO_OTHER_NETWORK:
     case LibISDB::EventGroupDescriptor::GROUP_TYPE_MOVEMENT_FROM_OTHER_NETWORK:
-      json.AddMember("originalNetworkId", info.NetworkID, allocator);
-      json.AddMember("transportStreamId", info.TransportStreamID, allocator);
+      writer.Key("originalNetworkId");
+      writer.Uint(info.NetworkID);
+      writer.Key("transportStreamId");
+      writer.Uint(info.TransportStreamID);
       break;
     default:
       break;
   }
-  json.AddMember("serviceId", info.ServiceID, allocator);
-  json.AddMember("eventId", info.EventID, allocator);
-  return json;
+  writer.Key("serviceId");
+  writer.Uint(info.ServiceID);
+  writer.Key("eventId");
+  writer.Uint(info.EventID);
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(
-    const LibISDB::EventGroupDescriptor* desc, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "EventGroup", allocator);
-  json.AddMember("groupType", desc->GetGroupType(), allocator);
-  rapidjson::Value events(rapidjson::kArrayType);
+template <typename Writer>
+void WriteJson(Writer& writer, const LibISDB::EventGroupDescriptor* desc) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("EventGroup");
+  writer.Key("groupType");
+  writer.Uint(desc->GetGroupType());
+  writer.Key("events");
+  writer.StartArray();
   for (int i = 0; i < desc->GetEventCount(); ++i) {
     LibISDB::EventGroupDescriptor::EventInfo info;
     (void)desc->GetEventInfo(i, &info);
-    auto event = MakeJsonValue(desc->GetGroupType(), info, allocator);
-    events.PushBack(event, allocator);
+    WriteJson(writer, desc->GetGroupType(), info);
   }
-  json.AddMember("events", events, allocator);
-  return json;
+  writer.EndArray();
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(const LibISDB::String& desc, const LibISDB::String& item,
-    rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value json(rapidjson::kArrayType);
-  json.PushBack(rapidjson::Value().SetString(desc, allocator), allocator);
-  json.PushBack(rapidjson::Value().SetString(item, allocator), allocator);
-  return json;
+template <typename Writer>
+void WriteExtendedEventItemJson(
+    Writer& writer, const LibISDB::String& desc, const LibISDB::String& item) {
+  writer.StartArray();
+  writer.String(desc);
+  writer.String(item);
+  writer.EndArray();
 }
 
-rapidjson::Value MakeJsonValue(const LibISDB::ARIBString& desc, const LibISDB::ARIBString& item,
-    rapidjson::Document::AllocatorType& allocator) {
-  return MakeJsonValue(DecodeAribString(desc), DecodeAribString(item), allocator);
+template <typename Writer>
+void WriteExtendedEventItemJson(
+    Writer& writer, const LibISDB::ARIBString& desc, const LibISDB::ARIBString& item) {
+  WriteExtendedEventItemJson(writer, DecodeAribString(desc), DecodeAribString(item));
 }
 
-rapidjson::Value MakeJsonValue(const ts::ByteBlock& desc, const ts::ByteBlock& item,
-    rapidjson::Document::AllocatorType& allocator) {
-  return MakeJsonValue(LibISDB::ARIBString(desc.data(), desc.size()),
-      LibISDB::ARIBString(item.data(), item.size()), allocator);
+template <typename Writer>
+void WriteExtendedEventItemJson(
+    Writer& writer, const ts::ByteBlock& desc, const ts::ByteBlock& item) {
+  WriteExtendedEventItemJson(writer, LibISDB::ARIBString(desc.data(), desc.size()),
+      LibISDB::ARIBString(item.data(), item.size()));
 }
 
 inline bool HasExtendedEventItems(const ts::DescriptorList& descs) {
   return descs.search(ts::DID_EXTENDED_EVENT) != descs.count();
 }
 
-rapidjson::Value MakeExtendedEventJsonValue(
-    const ts::DescriptorList& descs, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value items(rapidjson::kArrayType);
+template <typename Writer>
+void WriteExtendedEventJson(Writer& writer, const ts::DescriptorList& descs) {
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("ExtendedEvent");
+  writer.Key("items");
+  writer.StartArray();
 
   ts::ByteBlock eed_desc;
   ts::ByteBlock eed_item;
@@ -366,8 +747,7 @@ rapidjson::Value MakeExtendedEventJsonValue(
       remaining -= 1;
       if (desc_len > 0) {
         if (!eed_desc.empty()) {
-          auto json = MakeJsonValue(eed_desc, eed_item, allocator);
-          items.PushBack(json, allocator);
+          WriteExtendedEventItemJson(writer, eed_desc, eed_item);
           eed_desc.clear();
           eed_item.clear();
         }
@@ -390,40 +770,81 @@ rapidjson::Value MakeExtendedEventJsonValue(
   }
 
   if (!eed_desc.empty()) {
-    auto json = MakeJsonValue(eed_desc, eed_item, allocator);
-    items.PushBack(json, allocator);
+    WriteExtendedEventItemJson(writer, eed_desc, eed_item);
   }
 
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "ExtendedEvent", allocator);
-  json.AddMember("items", items, allocator);
-  return json;
+  writer.EndArray();
+  writer.EndObject();
 }
 
-rapidjson::Value MakeExtendedEventJsonValue(
-    const LibISDB::DescriptorBlock& desc_block, rapidjson::Document::AllocatorType& allocator) {
-  LibISDB::ARIBStringDecoder decoder;
-  auto flags = GetAribStringDecodeFlag();
-  LibISDB::EventInfo::ExtendedTextInfoList ext_list;
-  if (!LibISDB::GetEventExtendedTextList(&desc_block, decoder, flags, &ext_list)) {
-    return rapidjson::Value();
+// Writes nothing if `desc_block` has no extended event.
+//
+// Items are merged in the same way as LibISDB::GetEventExtendedTextList(), and decoded with
+// DecodeAribString() so that the cache is used.  Descriptors are ordered by descriptor_number.
+// An item without description continues the previous item, and starts a new item with an empty
+// description if there is no previous item.
+template <typename Writer>
+void WriteExtendedEventJson(Writer& writer, const LibISDB::DescriptorBlock& desc_block) {
+  std::vector<const LibISDB::ExtendedEventDescriptor*> descs;
+  for (int i = 0; i < desc_block.GetDescriptorCount(); ++i) {
+    const auto* dp = desc_block.GetDescriptorByIndex(i);
+    if (!dp->IsValid()) {
+      continue;
+    }
+    if (dp->GetTag() != LibISDB::ExtendedEventDescriptor::TAG) {
+      continue;
+    }
+    descs.push_back(static_cast<const LibISDB::ExtendedEventDescriptor*>(dp));
+  }
+
+  if (descs.empty()) {
+    return;
   }
 
-  rapidjson::Value items(rapidjson::kArrayType);
-  for (const auto& ext : ext_list) {
-    auto json = MakeJsonValue(ext.Description, ext.Text, allocator);
-    items.PushBack(json, allocator);
+  std::stable_sort(descs.begin(), descs.end(), [](const auto* a, const auto* b) {
+    return a->GetDescriptorNumber() < b->GetDescriptorNumber();
+  });
+
+  writer.StartObject();
+  writer.Key("$type");
+  writer.String("ExtendedEvent");
+  writer.Key("items");
+  writer.StartArray();
+
+  bool has_item = false;
+  LibISDB::ARIBString eed_desc;
+  LibISDB::ARIBString eed_item;
+
+  for (const auto* desc : descs) {
+    for (int j = 0; j < desc->GetItemCount(); ++j) {
+      const auto* item = desc->GetItem(j);
+      if (item == nullptr) {
+        continue;
+      }
+      if (has_item && item->Description.empty()) {
+        eed_item.append(item->ItemChar);
+        continue;
+      }
+      if (has_item) {
+        WriteExtendedEventItemJson(writer, eed_desc, eed_item);
+      }
+      eed_desc = item->Description;
+      eed_item = item->ItemChar;
+      has_item = true;
+    }
+  }
+
+  if (has_item) {
+    WriteExtendedEventItemJson(writer, eed_desc, eed_item);
   }
 
-  rapidjson::Value json(rapidjson::kObjectType);
-  json.AddMember("$type", "ExtendedEvent", allocator);
-  json.AddMember("items", items, allocator);
-  return json;
+  writer.EndArray();
+  writer.EndObject();
 }
 
-rapidjson::Value MakeJsonValue(
-    const ts::DescriptorList& descs, rapidjson::Document::AllocatorType& allocator) {
-  rapidjson::Value descriptors(rapidjson::kArrayType);
+template <typename Writer>
+void WriteJson(Writer& writer, const ts::DescriptorList& descs) {
+  writer.StartArray();
   for (size_t i = 0; i < descs.size(); ++i) {
     const auto& dp = descs[i];
     if (!dp->isValid()) {
@@ -433,48 +854,42 @@ rapidjson::Value MakeJsonValue(
       case LibISDB::ShortEventDescriptor::TAG: {
         LibISDB::ShortEventDescriptor desc;
         if (desc.Parse(dp->content(), dp->size())) {
-          auto json = MakeJsonValue(&desc, allocator);
-          descriptors.PushBack(json, allocator);
+          WriteJson(writer, &desc);
         }
         break;
       }
       case LibISDB::ComponentDescriptor::TAG: {
         LibISDB::ComponentDescriptor desc;
         if (desc.Parse(dp->content(), dp->size())) {
-          auto json = MakeJsonValue(&desc, allocator);
-          descriptors.PushBack(json, allocator);
+          WriteJson(writer, &desc);
         }
         break;
       }
       case LibISDB::ContentDescriptor::TAG: {
         LibISDB::ContentDescriptor desc;
         if (desc.Parse(dp->content(), dp->size())) {
-          auto json = MakeJsonValue(&desc, allocator);
-          descriptors.PushBack(json, allocator);
+          WriteJson(writer, &desc);
         }
         break;
       }
       case LibISDB::AudioComponentDescriptor::TAG: {
         LibISDB::AudioComponentDescriptor desc;
         if (desc.Parse(dp->content(), dp->size())) {
-          auto json = MakeJsonValue(&desc, allocator);
-          descriptors.PushBack(json, allocator);
+          WriteJson(writer, &desc);
         }
         break;
       }
       case LibISDB::SeriesDescriptor::TAG: {
         LibISDB::SeriesDescriptor desc;
         if (desc.Parse(dp->content(), dp->size())) {
-          auto json = MakeJsonValue(&desc, allocator);
-          descriptors.PushBack(json, allocator);
+          WriteJson(writer, &desc);
         }
         break;
       }
       case LibISDB::EventGroupDescriptor::TAG: {
         LibISDB::EventGroupDescriptor desc;
         if (desc.Parse(dp->content(), dp->size())) {
-          auto json = MakeJsonValue(&desc, allocator);
-          descriptors.PushBack(json, allocator);
+          WriteJson(writer, &desc);
         }
         break;
       }
@@ -482,31 +897,31 @@ rapidjson::Value MakeJsonValue(
         break;
     }
   }
-  return descriptors;
+  writer.EndArray();
 }
 
-rapidjson::Value MakeJsonValue(
-    const ts::EIT::Event& event, rapidjson::Document::AllocatorType& allocator) {
-  const auto eid = event.event_id;
-  const auto start_time_unix = ConvertJstTimeToUnixTime(event.start_time);
-  const ts::MilliSecond duration = event.duration * ts::MilliSecPerSec;
-  const bool ca_controlled = event.CA_controlled;
-  auto descriptors = MakeJsonValue(event.descs, allocator);
-  rapidjson::Value value(rapidjson::kObjectType);
-  value.AddMember("eventId", eid, allocator);
-  value.AddMember("startTime", start_time_unix, allocator);
-  value.AddMember("duration", duration, allocator);
-  value.AddMember("scrambled", ca_controlled, allocator);
-  value.AddMember("descriptors", descriptors, allocator);
-  return value;
+template <typename Writer>
+void WriteJson(Writer& writer, const ts::EIT::Event& event) {
+  writer.StartObject();
+  writer.Key("eventId");
+  writer.Uint(event.event_id);
+  writer.Key("startTime");
+  writer.Int64(ConvertJstTimeToUnixTime(event.start_time));
+  writer.Key("duration");
+  writer.Int64(event.duration * ts::MilliSecPerSec);
+  writer.Key("scrambled");
+  writer.Bool(event.CA_controlled);
+  writer.Key("descriptors");
+  WriteJson(writer, event.descs);
+  writer.EndObject();
 }
 
-template <typename Allocator>
-rapidjson::Value MakeEventsJsonValue(const EitSection& eit, Allocator& allocator) {
+template <typename Writer>
+void WriteEventsJson(Writer& writer, const EitSection& eit) {
   const auto* data = eit.events_data;
   auto remain = eit.events_size;
 
-  rapidjson::Value events(rapidjson::kArrayType);
+  writer.StartArray();
 
   while (remain >= EitSection::EIT_EVENT_FIXED_SIZE) {
     const auto eid = ts::GetUInt16(data);
@@ -536,7 +951,25 @@ rapidjson::Value MakeEventsJsonValue(const EitSection& eit, Allocator& allocator
     LibISDB::DescriptorBlock desc_block;
     desc_block.ParseBlock(data, info_length);
 
-    rapidjson::Value descriptors(rapidjson::kArrayType);
+    writer.StartObject();
+    writer.Key("eventId");
+    writer.Uint(eid);
+    writer.Key("startTime");
+    if (start_time_undefined) {
+      writer.Null();
+    } else {
+      writer.Int64(start_time_unix);
+    }
+    writer.Key("duration");
+    if (duration_undefined) {
+      writer.Null();
+    } else {
+      writer.Int64(duration);
+    }
+    writer.Key("scrambled");
+    writer.Bool(ca_controlled);
+    writer.Key("descriptors");
+    writer.StartArray();
 
     for (int i = 0; i < desc_block.GetDescriptorCount(); ++i) {
       const auto* dp = desc_block.GetDescriptorByIndex(i);
@@ -544,98 +977,147 @@ rapidjson::Value MakeEventsJsonValue(const EitSection& eit, Allocator& allocator
         continue;
       }
       switch (dp->GetTag()) {
-        case LibISDB::ShortEventDescriptor::TAG: {
-          const auto* desc = static_cast<const LibISDB::ShortEventDescriptor*>(dp);
-          auto json = MakeJsonValue(desc, allocator);
-          descriptors.PushBack(json, allocator);
+        case LibISDB::ShortEventDescriptor::TAG:
+          WriteJson(writer, static_cast<const LibISDB::ShortEventDescriptor*>(dp));
           break;
-        }
-        case LibISDB::ComponentDescriptor::TAG: {
-          const auto* desc = static_cast<const LibISDB::ComponentDescriptor*>(dp);
-          auto json = MakeJsonValue(desc, allocator);
-          descriptors.PushBack(json, allocator);
+        case LibISDB::ComponentDescriptor::TAG:
+          WriteJson(writer, static_cast<const LibISDB::ComponentDescriptor*>(dp));
           break;
-        }
-        case LibISDB::ContentDescriptor::TAG: {
-          const auto* desc = static_cast<const LibISDB::ContentDescriptor*>(dp);
-          auto json = MakeJsonValue(desc, allocator);
-          descriptors.PushBack(json, allocator);
+        case LibISDB::ContentDescriptor::TAG:
+          WriteJson(writer, static_cast<const LibISDB::ContentDescriptor*>(dp));
           break;
-        }
-        case LibISDB::AudioComponentDescriptor::TAG: {
-          const auto* desc = static_cast<const LibISDB::AudioComponentDescriptor*>(dp);
-          auto json = MakeJsonValue(desc, allocator);
-          descriptors.PushBack(json, allocator);
+        case LibISDB::AudioComponentDescriptor::TAG:
+          WriteJson(writer, static_cast<const LibISDB::AudioComponentDescriptor*>(dp));
           break;
-        }
-        case LibISDB::SeriesDescriptor::TAG: {
-          const auto* desc = static_cast<const LibISDB::SeriesDescriptor*>(dp);
-          auto json = MakeJsonValue(desc, allocator);
-          descriptors.PushBack(json, allocator);
+        case LibISDB::SeriesDescriptor::TAG:
+          WriteJson(writer, static_cast<const LibISDB::SeriesDescriptor*>(dp));
           break;
-        }
-        case LibISDB::EventGroupDescriptor::TAG: {
-          const auto* desc = static_cast<const LibISDB::EventGroupDescriptor*>(dp);
-          auto json = MakeJsonValue(desc, allocator);
-          descriptors.PushBack(json, allocator);
+        case LibISDB::EventGroupDescriptor::TAG:
+          WriteJson(writer, static_cast<const LibISDB::EventGroupDescriptor*>(dp));
           break;
-        }
         default:
           break;
       }
     }
 
-    {
-      auto json = MakeExtendedEventJsonValue(desc_block, allocator);
-      if (!json.IsNull()) {
-        descriptors.PushBack(json, allocator);
-      }
-    }
-
-    rapidjson::Value event(rapidjson::kObjectType);
-    event.AddMember("eventId", eid, allocator);
-    if (start_time_undefined) {
-      // null
-      event.AddMember("startTime", rapidjson::Value(), allocator);
-    } else {
-      event.AddMember("startTime", start_time_unix, allocator);
-    }
-    if (duration_undefined) {
-      // null
-      event.AddMember("duration", rapidjson::Value(), allocator);
-    } else {
-      event.AddMember("duration", duration, allocator);
-    }
-    event.AddMember("scrambled", ca_controlled, allocator);
-    event.AddMember("descriptors", descriptors, allocator);
+    WriteExtendedEventJson(writer, desc_block);
 
-    events.PushBack(event, allocator);
+    writer.EndArray();
+    writer.EndObject();
 
     data += info_length;
     remain -= info_length;
   }
 
-  return events;
+  writer.EndArray();
 }
 
-rapidjson::Document MakeJsonValue(const EitSection& eit) {
-  rapidjson::Document eit_json(rapidjson::kObjectType);
-  auto& allocator = eit_json.GetAllocator();
+template <typename Writer>
+void WriteJson(Writer& writer, const EitSection& eit) {
+  writer.StartObject();
+  writer.Key("originalNetworkId");
+  writer.Uint(eit.nid);
+  writer.Key("transportStreamId");
+  writer.Uint(eit.tsid);
+  writer.Key("serviceId");
+  writer.Uint(eit.sid);
+  writer.Key("tableId");
+  writer.Uint(eit.tid);
+  writer.Key("sectionNumber");
+  writer.Uint(eit.section_number);
+  writer.Key("lastSectionNumber");
+  writer.Uint(eit.last_section_number);
+  writer.Key("segmentLastSectionNumber");
+  writer.Uint(eit.segment_last_section_number);
+  writer.Key("versionNumber");
+  writer.Uint(eit.version);
+  writer.Key("events");
+  WriteEventsJson(writer, eit);
+  writer.EndObject();
+}
+
+// A flat table of roles of PIDs.
+//
+// Each entry holds a bitmask of roles defined by the user of the table.  Looking up a PID is a
+// single indexed load.  The table is intended to be rebuilt when PSI tables change, not for each
+// packet.
+class PidRoleTable final {
+ public:
+  PidRoleTable() = default;
+  ~PidRoleTable() = default;
+
+  inline uint8_t Get(ts::PID pid) const {
+    return roles_[pid & kPidMask];
+  }
 
-  auto events = MakeEventsJsonValue(eit, allocator);
+  inline void Add(ts::PID pid, uint8_t role) {
+    roles_[pid & kPidMask] |= role;
+  }
 
-  eit_json.AddMember("originalNetworkId", eit.nid, allocator);
-  eit_json.AddMember("transportStreamId", eit.tsid, allocator);
-  eit_json.AddMember("serviceId", eit.sid, allocator);
-  eit_json.AddMember("tableId", eit.tid, allocator);
-  eit_json.AddMember("sectionNumber", eit.section_number, allocator);
-  eit_json.AddMember("lastSectionNumber", eit.last_section_number, allocator);
-  eit_json.AddMember("segmentLastSectionNumber", eit.segment_last_section_number, allocator);
-  eit_json.AddMember("versionNumber", eit.version, allocator);
-  eit_json.AddMember("events", events, allocator);
+  void Merge(const PidRoleTable& other) {
+    for (size_t i = 0; i < roles_.size(); ++i) {
+      roles_[i] |= other.roles_[i];
+    }
+  }
 
-  return eit_json;
-}
+  void Clear() {
+    roles_.fill(0);
+  }
+
+ private:
+  static constexpr ts::PID kPidMask = ts::PID_MAX - 1;
+  static_assert((ts::PID_MAX & kPidMask) == 0);
+
+  std::array<uint8_t, ts::PID_MAX> roles_ = {};
+};
+
+// A section demux which never passes packets of PIDs not demuxed to TSDuck.
+//
+// Most packets in a TS stream are PES packets which no demux cares about.  The PID filter is
+// checked here so that they don't enter ts::SectionDemux at all.  The number of fed packets and
+// the number of skipped packets for each PID are logged at the end.
+//
+// ts::SectionDemux doesn't count skipped packets.  So, don't use this class when packet indexes
+// such as ts::BinaryTable::getFirstTSPacketIndex() are used.
+class LazySectionDemux final : public ts::SectionDemux {
+ public:
+  explicit LazySectionDemux(ts::DuckContext& context) : ts::SectionDemux(context) {}
+
+  ~LazySectionDemux() override {
+    LogStats();
+  }
+
+  void feedPacket(const ts::TSPacket& packet) override {
+    auto pid = packet.getPID();
+    if (!hasPID(pid)) {
+      num_skipped_packets_[pid]++;
+      return;
+    }
+    num_fed_packets_++;
+    ts::SectionDemux::feedPacket(packet);
+  }
+
+ private:
+  void LogStats() const {
+    uint64_t num_skipped_packets = 0;
+    for (auto n : num_skipped_packets_) {
+      num_skipped_packets += n;
+    }
+    if (num_fed_packets_ == 0 && num_skipped_packets == 0) {
+      return;
+    }
+    MIRAKC_ARIB_DEBUG(
+        "Demux: {} packets fed, {} packets skipped", num_fed_packets_, num_skipped_packets);
+    for (size_t pid = 0; pid < num_skipped_packets_.size(); ++pid) {
+      if (num_skipped_packets_[pid] != 0) {
+        MIRAKC_ARIB_TRACE("Demux: PID#{:04X}: {} packets skipped", pid, num_skipped_packets_[pid]);
+      }
+    }
+  }
+
+  uint64_t num_fed_packets_ = 0;
+  std::array<uint64_t, ts::PID_MAX> num_skipped_packets_ = {};
+};
 
 bool IsAudioVideoService(uint8_t service_type) {
   switch (service_type) {
@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+// io_uring is used without liburing.  The kernel interface is small enough for sequential reads.
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define MIRAKC_ARIB_HAS_IO_URING 1
+#else
+#define MIRAKC_ARIB_HAS_IO_URING 0
+#endif
+
+#if MIRAKC_ARIB_HAS_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "base.hh"
+#include "file.hh"
+#include "logging.hh"
+
+namespace {
+
+// A read-only file which reads data ahead with io_uring.
+//
+// Reads are issued into registered buffers and complete while data in the previous buffer is
+// processed.  Peek() exposes the data in the buffers so that FileSource can take packets without
+// copying them.  Several reads are outstanding for a regular file.  Reads on a pipe are issued
+// one at a time because the order of completions of concurrent reads on a pipe is not
+// guaranteed, but they still rotate over all buffers so that the next read fills a buffer while
+// the previous ones are processed.
+class UringFile final : public File {
+ public:
+  static constexpr size_t kBufferSize = 16 * kBlockSize;
+  static constexpr unsigned kNumBuffers = 4;
+
+  explicit UringFile(const std::string& path) : path_(path) {
+    if (path.empty()) {
+      stdio_ = true;
+      path_ = "<stdin>";
+      fd_ = STDIN_FILENO;
+    } else {
+      fd_ = open(path.c_str(), O_RDONLY);
+      if (fd_ < 0) {
+        MIRAKC_ARIB_ERROR("Failed to open {}: {} ({})", path, std::strerror(errno), errno);
+      }
+    }
+  }
+
+  ~UringFile() override {
+    if (ring_fd_ >= 0) {
+      close(ring_fd_);
+    }
+    if (sqes_ != nullptr) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != nullptr) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    if (!stdio_ && fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  // Sets up an io_uring instance and starts reading.
+  //
+  // Returns false if io_uring is not available.  The caller should fall back to read(2) in this
+  // case.
+  bool Init() {
+    if (fd_ < 0) {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode)) {
+      seekable_ = true;
+      auto offset = lseek(fd_, 0, SEEK_CUR);
+      offset_ = offset > 0 ? static_cast<uint64_t>(offset) : 0;
+    }
+    max_reading_ = seekable_ ? kNumBuffers : 1;
+
+    struct io_uring_params params;
+#if defined(IORING_SETUP_DEFER_TASKRUN)
+    // Completions are processed only when waiting for them in Peek(), instead of interrupting the
+    // processing of packets.  This requires Linux 6.1 or later, and all reads must be issued from
+    // the thread calling Init().
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, kNumBuffers, &params));
+#endif
+    if (ring_fd_ < 0) {
+      std::memset(&params, 0, sizeof(params));
+      ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, kNumBuffers, &params));
+    }
+    if (ring_fd_ < 0) {
+      MIRAKC_ARIB_WARN("io_uring is not available: {} ({})", std::strerror(errno), errno);
+      return false;
+    }
+
+    if (!MapRings(params)) {
+      return false;
+    }
+
+    struct iovec iovecs[kNumBuffers];
+    for (unsigned i = 0; i < kNumBuffers; ++i) {
+      slots_[i].buf = std::make_unique<uint8_t[]>(kBufferSize);
+      iovecs[i].iov_base = slots_[i].buf.get();
+      iovecs[i].iov_len = kBufferSize;
+    }
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, iovecs,
+            kNumBuffers) < 0) {
+      MIRAKC_ARIB_WARN("Failed to register buffers: {} ({})", std::strerror(errno), errno);
+      return false;
+    }
+
+    QueueReads();
+    if (!Submit()) {
+      return false;
+    }
+
+    MIRAKC_ARIB_INFO(
+        "Read packets from {} with io_uring (buffers={}, depth={})...", path_, kNumBuffers,
+        max_reading_);
+    return true;
+  }
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  ssize_t Read(uint8_t* buf, size_t len) override {
+    const uint8_t* data;
+    auto nread = Peek(&data);
+    if (nread <= 0) {
+      return nread;
+    }
+    auto ncopy = std::min(len, static_cast<size_t>(nread));
+    std::memcpy(buf, data, ncopy);
+    Consume(ncopy);
+    return static_cast<ssize_t>(ncopy);
+  }
+
+  bool CanPeek() const override {
+    return true;
+  }
+
+  ssize_t Peek(const uint8_t** data) override {
+    // Slots consumed before this call are no longer referenced by the caller.  Reuse them for
+    // reading ranges following the last one.
+    for (auto& slot : slots_) {
+      if (slot.state == SlotState::kConsumed) {
+        slot.state = SlotState::kIdle;
+      }
+    }
+    QueueReads();
+
+    auto& slot = slots_[current_];
+    while (slot.state != SlotState::kCompleted) {
+      if (!WaitForCompletions()) {
+        return -1;
+      }
+    }
+    if (!Submit()) {
+      return -1;
+    }
+
+    if (slot.error != 0) {
+      MIRAKC_ARIB_ERROR(
+          "Failed to read from {}: {} ({})", path_, std::strerror(slot.error), slot.error);
+      return -1;
+    }
+
+    // Returns 0 at EOF.  Outstanding reads for subsequent ranges are never consumed.
+    *data = slot.buf.get() + slot.pos;
+    return static_cast<ssize_t>(slot.size - slot.pos);
+  }
+
+  void Consume(size_t len) override {
+    auto& slot = slots_[current_];
+    MIRAKC_ARIB_ASSERT(slot.state == SlotState::kCompleted);
+    MIRAKC_ARIB_ASSERT(len <= slot.size - slot.pos);
+    slot.pos += len;
+    if (slot.pos == slot.size && slot.size != 0) {
+      // The caller may still refer to the data until the next call to Peek().
+      slot.state = SlotState::kConsumed;
+      current_ = (current_ + 1) % kNumBuffers;
+    }
+  }
+
+  ssize_t ReadAt(uint8_t*, size_t, int64_t) override {
+    MIRAKC_ARIB_ERROR("{}: ReadAt is not supported", path_);
+    return -1;
+  }
+
+  ssize_t Write(const uint8_t*, size_t) override {
+    MIRAKC_ARIB_ERROR("{}: Write is not supported", path_);
+    return -1;
+  }
+
+  ssize_t WriteAt(const uint8_t*, size_t, int64_t) override {
+    MIRAKC_ARIB_ERROR("{}: WriteAt is not supported", path_);
+    return -1;
+  }
+
+  bool Sync() override {
+    MIRAKC_ARIB_ERROR("{}: Sync is not supported", path_);
+    return false;
+  }
+
+  bool Trunc(int64_t) override {
+    MIRAKC_ARIB_ERROR("{}: Trunc is not supported", path_);
+    return false;
+  }
+
+  int64_t Seek(int64_t, SeekMode) override {
+    MIRAKC_ARIB_ERROR("{}: Seek is not supported", path_);
+    return -1;
+  }
+
+  bool Allocate(int64_t, bool) override {
+    MIRAKC_ARIB_ERROR("{}: Allocate is not supported", path_);
+    return false;
+  }
+
+ private:
+  enum class SlotState {
+    kIdle,
+    kReading,
+    kCompleted,
+    kConsumed,
+  };
+
+  struct Slot {
+    std::unique_ptr<uint8_t[]> buf;
+    SlotState state = SlotState::kIdle;
+    uint64_t offset = 0;  // used only for a regular file
+    size_t size = 0;
+    size_t pos = 0;
+    int error = 0;
+  };
+
+  bool MapRings(const struct io_uring_params& params) {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    auto single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == nullptr) {
+      return false;
+    }
+
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+    } else {
+      cq_ring_ = Map(cq_ring_size_, IORING_OFF_CQ_RING);
+      if (cq_ring_ == nullptr) {
+        return false;
+      }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+    if (sqes_ == nullptr) {
+      return false;
+    }
+
+    auto* sq = static_cast<uint8_t*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    auto* cq = static_cast<uint8_t*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+  }
+
+  void* Map(size_t size, off_t offset) {
+    auto* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring_fd_, offset);
+    if (ptr == MAP_FAILED) {
+      MIRAKC_ARIB_WARN("Failed to map io_uring: {} ({})", std::strerror(errno), errno);
+      return nullptr;
+    }
+    return ptr;
+  }
+
+  // Queues reads into idle slots in order.  Queued reads are submitted with the next
+  // io_uring_enter(2).
+  void QueueReads() {
+    while (!eof_ && num_reading_ < max_reading_ && slots_[next_].state == SlotState::kIdle) {
+      auto& slot = slots_[next_];
+      slot.state = SlotState::kReading;
+      slot.size = 0;
+      slot.pos = 0;
+      slot.error = 0;
+      if (seekable_) {
+        slot.offset = offset_;
+        offset_ += kBufferSize;
+      }
+      QueueSqe(next_);
+      num_reading_++;
+      next_ = (next_ + 1) % kNumBuffers;
+    }
+  }
+
+  void QueueSqe(unsigned index) {
+    const auto& slot = slots_[index];
+
+    auto tail = *sq_tail_;
+    auto sq_index = tail & sq_mask_;
+    auto* sqe = &sqes_[sq_index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = fd_;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.buf.get() + slot.size);
+    sqe->len = static_cast<uint32_t>(kBufferSize - slot.size);
+    // The offset is ignored for a pipe.
+    sqe->off = seekable_ ? slot.offset + slot.size : 0;
+    sqe->buf_index = static_cast<uint16_t>(index);
+    sqe->user_data = index;
+    sq_array_[sq_index] = sq_index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  inline unsigned num_queued() const {
+    return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  }
+
+  bool Submit() {
+    if (num_queued() == 0) {
+      return true;
+    }
+    if (Enter(num_queued(), 0, 0) < 0) {
+      MIRAKC_ARIB_ERROR("Failed to submit reads: {} ({})", std::strerror(errno), errno);
+      return false;
+    }
+    return true;
+  }
+
+  // Submits queued reads and waits for at least one completion in a single system call, then
+  // handles all available completions.
+  bool WaitForCompletions() {
+    if (!HasCompletion()) {
+      if (Enter(num_queued(), 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        MIRAKC_ARIB_ERROR("Failed to wait for a read: {} ({})", std::strerror(errno), errno);
+        return false;
+      }
+    }
+
+    while (HasCompletion()) {
+      auto head = *cq_head_;
+      const auto& cqe = cqes_[head & cq_mask_];
+      auto index = static_cast<unsigned>(cqe.user_data);
+      auto res = cqe.res;
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      HandleCompletion(index, res);
+    }
+
+    // Start the next read on a pipe as soon as the previous one completes.
+    QueueReads();
+    return true;
+  }
+
+  inline bool HasCompletion() const {
+    return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  }
+
+  void HandleCompletion(unsigned index, int res) {
+    MIRAKC_ARIB_ASSERT(index < kNumBuffers);
+    auto& slot = slots_[index];
+    MIRAKC_ARIB_ASSERT(slot.state == SlotState::kReading);
+
+    if (res == -EINTR || res == -EAGAIN) {
+      QueueSqe(index);
+      return;
+    }
+
+    if (res < 0) {
+      slot.error = -res;
+    } else {
+      slot.size += static_cast<size_t>(res);
+      if (seekable_ && res > 0 && slot.size < kBufferSize) {
+        // Short read in the middle of a regular file.  Read the rest of the range so that the
+        // data in the slots stays contiguous.
+        QueueSqe(index);
+        return;
+      }
+    }
+
+    if (res <= 0) {
+      // No more reads are needed after EOF or an error.
+      eof_ = true;
+    }
+    slot.state = SlotState::kCompleted;
+    num_reading_--;
+  }
+
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0));
+  }
+
+  std::string path_;
+  int fd_ = -1;
+  bool stdio_ = false;
+  bool seekable_ = false;
+  uint64_t offset_ = 0;
+  bool eof_ = false;
+  // The maximum number of outstanding reads.
+  unsigned max_reading_ = 1;
+  unsigned num_reading_ = 0;
+  // The slot to be consumed.
+  unsigned current_ = 0;
+  // The slot to be read next.
+  unsigned next_ = 0;
+  Slot slots_[kNumBuffers];
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void* cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  struct io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  struct io_uring_cqe* cqes_ = nullptr;
+
+  MIRAKC_ARIB_NON_COPYABLE(UringFile);
+};
+
+}  // namespace
+
+#endif  // MIRAKC_ARIB_HAS_IO_URING
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#pragma once
+
+#if defined(__linux__)
+#define MIRAKC_ARIB_HAS_VMSPLICE 1
+#else
+#define MIRAKC_ARIB_HAS_VMSPLICE 0
+#endif
+
+#if MIRAKC_ARIB_HAS_VMSPLICE
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <tsduck/tsduck.h>
+
+#include "base.hh"
+#include "logging.hh"
+#include "packet_sink.hh"
+
+namespace {
+
+// A sink which moves packets into a pipe with vmsplice(2).
+//
+// Packets are copied into a ring of page-aligned buffers, and each buffer is spliced into the
+// pipe as a whole once it's filled.  The pipe refers to the pages of the buffer instead of
+// copying them.  So, a buffer must not be modified until the reader consumes it.  The ring is
+// large enough to guarantee this: the pipe can hold at most `pipe_size` bytes, and more than
+// `pipe_size` bytes have been spliced after a buffer by the time the buffer is reused.
+//
+// This guarantee does not hold if the reader moves the pages to another file with splice(2) or
+// tee(2) instead of reading them.  Use this sink only when the reader reads the pipe.
+class VmspliceSink final : public PacketSink {
+ public:
+  static constexpr size_t kMinBufferSize = 16 * kBlockSize;
+  static constexpr size_t kDefaultPipeSize = 16 * kBlockSize;
+
+  explicit VmspliceSink(int fd = STDOUT_FILENO) : fd_(fd) {}
+
+  ~VmspliceSink() override {
+    UnmapRing();
+  }
+
+  // Returns false if the file descriptor is not a pipe.  The caller should fall back to
+  // StdoutSink in this case.
+  bool Init() {
+    struct stat st;
+    if (fstat(fd_, &st) < 0 || !S_ISFIFO(st.st_mode)) {
+      MIRAKC_ARIB_DEBUG("Not a pipe, vmsplice(2) cannot be used");
+      return false;
+    }
+
+    auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    buffer_size_ = (kMinBufferSize + page_size - 1) / page_size * page_size;
+    return MapRing(GetPipeSize());
+  }
+
+  void End() override {
+    (void)Splice();
+  }
+
+  bool HandlePacket(const ts::TSPacket& packet) override {
+    return Write(packet.b, ts::PKT_SIZE);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    return Write(reinterpret_cast<const uint8_t*>(packets), num_packets * ts::PKT_SIZE);
+  }
+
+ private:
+  bool Write(const uint8_t* data, size_t size) {
+    while (size > 0) {
+      auto n = std::min(size, buffer_size_ - pos_);
+      std::memcpy(buffer() + pos_, data, n);
+      pos_ += n;
+      data += n;
+      size -= n;
+      if (pos_ == buffer_size_ && !Splice()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool Splice() {
+    if (pos_ == 0) {
+      return true;
+    }
+
+    struct iovec iov;
+    iov.iov_base = buffer();
+    iov.iov_len = pos_;
+    while (iov.iov_len > 0) {
+      auto res = vmsplice(fd_, &iov, 1, 0);
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        MIRAKC_ARIB_ERROR("Failed to splice packets: {} ({})", std::strerror(errno), errno);
+        return false;
+      }
+      iov.iov_base = static_cast<uint8_t*>(iov.iov_base) + res;
+      iov.iov_len -= static_cast<size_t>(res);
+    }
+
+    pos_ = 0;
+    index_++;
+    if (index_ == num_buffers_) {
+      index_ = 0;
+      // The reader may enlarge the pipe.  The ring must be enlarged as well.
+      auto pipe_size = GetPipeSize();
+      if (pipe_size > pipe_size_) {
+        MIRAKC_ARIB_INFO("Pipe size changed from {} to {}", pipe_size_, pipe_size);
+        // Unmapping pages referred from the pipe is safe.  The kernel holds references to them.
+        UnmapRing();
+        return MapRing(pipe_size);
+      }
+    }
+    return true;
+  }
+
+  size_t GetPipeSize() const {
+#if defined(F_GETPIPE_SZ)
+    auto result = fcntl(fd_, F_GETPIPE_SZ);
+    if (result > 0) {
+      return static_cast<size_t>(result);
+    }
+#endif
+    return kDefaultPipeSize;
+  }
+
+  bool MapRing(size_t pipe_size) {
+    // One more buffer for the buffer being filled, and one more for rounding.
+    num_buffers_ = pipe_size / buffer_size_ + 2;
+    ring_size_ = num_buffers_ * buffer_size_;
+    auto* addr =
+        mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+      MIRAKC_ARIB_ERROR("Failed to map buffers: {} ({})", std::strerror(errno), errno);
+      ring_ = nullptr;
+      return false;
+    }
+    ring_ = static_cast<uint8_t*>(addr);
+    pipe_size_ = pipe_size;
+    index_ = 0;
+    pos_ = 0;
+    MIRAKC_ARIB_DEBUG("Splice packets into the pipe: pipe-size={} buffer-size={} num-buffers={}",
+        pipe_size_, buffer_size_, num_buffers_);
+    return true;
+  }
+
+  void UnmapRing() {
+    if (ring_ != nullptr) {
+      munmap(ring_, ring_size_);
+      ring_ = nullptr;
+    }
+  }
+
+  inline uint8_t* buffer() const {
+    return ring_ + index_ * buffer_size_;
+  }
+
+  int fd_;
+  uint8_t* ring_ = nullptr;
+  size_t ring_size_ = 0;
+  size_t pipe_size_ = 0;
+  size_t buffer_size_ = 0;
+  size_t num_buffers_ = 0;
+  size_t index_ = 0;
+  size_t pos_ = 0;
+
+  MIRAKC_ARIB_NON_COPYABLE(VmspliceSink);
+};
+
+}  // namespace
+
+#endif  // MIRAKC_ARIB_HAS_VMSPLICE
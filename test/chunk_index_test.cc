@@ -0,0 +1,211 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "chunk_index.hh"
+
+#include "test_helper.hh"
+
+namespace {
+constexpr uint16_t kSid = 3;
+constexpr size_t kChunkSize = 8192 * 2;
+constexpr size_t kNumChunks = 2;
+
+std::unique_ptr<ChunkIndex> MakeChunkIndex(std::vector<uint8_t>* data) {
+  return std::make_unique<ChunkIndex>(
+      std::make_unique<MemoryMutableFileMapping>(data), kSid, kChunkSize, kNumChunks);
+}
+
+ChunkIndexRecord ReadRecord(const ChunkIndex& index, size_t chunk) {
+  ChunkIndexRecord record;
+  EXPECT_TRUE(ChunkIndex::Read(index.entry(chunk), &record));
+  return record;
+}
+}  // namespace
+
+TEST(ChunkIndexTest, Initialize) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks), 0xFF);
+  auto index = MakeChunkIndex(&data);
+
+  const auto& header = index->header();
+  EXPECT_EQ(0, std::memcmp(ChunkIndexHeader::kMagic, header.magic, sizeof(header.magic)));
+  EXPECT_EQ(ChunkIndexHeader::kVersion, header.version);
+  EXPECT_EQ(sizeof(ChunkIndexEntry), header.entry_size);
+  EXPECT_EQ(kChunkSize, header.chunk_size);
+  EXPECT_EQ(kNumChunks, header.num_chunks);
+  EXPECT_EQ(kSid, header.sid);
+  EXPECT_EQ(0, header.last_chunk.load());
+  EXPECT_EQ(0, header.write_pos.load());
+  for (size_t i = 0; i < kNumChunks; ++i) {
+    EXPECT_EQ(0, index->entry(i).seq.load());
+    EXPECT_EQ(0, ReadRecord(*index, i).flags);
+  }
+}
+
+TEST(ChunkIndexTest, StartAndEndChunk) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks));
+  auto index = MakeChunkIndex(&data);
+
+  index->StartChunk(0, 1000, 4);
+  index->UpdatePosition(0);
+  index->SetPcr(0, 12345);
+  index->SetPatOffset(ts::PKT_SIZE);
+  index->SetPatOffset(ts::PKT_SIZE * 2);  // ignored
+  index->SetPmtOffset(ts::PKT_SIZE * 3);
+
+  auto record = ReadRecord(*index, 0);
+  EXPECT_EQ(0, record.pos);
+  EXPECT_EQ(1000, record.timestamp);
+  EXPECT_EQ(ChunkIndexRecord::kStarted, record.flags);
+  EXPECT_EQ(4, record.eid);
+  EXPECT_EQ(12345, record.pcr);
+  EXPECT_EQ(ts::PKT_SIZE, record.pat_offset);
+  EXPECT_EQ(ts::PKT_SIZE * 3, record.pmt_offset);
+  EXPECT_EQ(ChunkIndexRecord::kNoOffset, record.keyframe_offset);
+  EXPECT_EQ(0, index->header().last_chunk.load());
+
+  index->EndChunk(kChunkSize, 2000);
+
+  record = ReadRecord(*index, 0);
+  EXPECT_EQ(2000, record.end_timestamp);
+  EXPECT_EQ(ChunkIndexRecord::kStarted | ChunkIndexRecord::kCompleted, record.flags);
+  EXPECT_EQ(1, index->header().last_chunk.load());
+  EXPECT_EQ(0, index->entry(0).seq.load() % 2);
+}
+
+TEST(ChunkIndexTest, OffsetsBeforeStartChunk) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks));
+  auto index = MakeChunkIndex(&data);
+
+  index->StartChunk(0, 1000, 4);
+  // Packets in the next chunk are written before the current chunk is synced.
+  index->SetPatOffset(kChunkSize + ts::PKT_SIZE);
+  index->SetKeyframeOffset(kChunkSize + ts::PKT_SIZE * 2);
+  EXPECT_EQ(ChunkIndexRecord::kNoOffset, ReadRecord(*index, 0).pat_offset);
+  EXPECT_EQ(0, ReadRecord(*index, 1).flags);
+
+  index->EndChunk(kChunkSize, 2000);
+  index->StartChunk(kChunkSize, 2000, 5);
+
+  auto record = ReadRecord(*index, 1);
+  EXPECT_EQ(kChunkSize, record.pos);
+  EXPECT_EQ(2000, record.timestamp);
+  EXPECT_EQ(5, record.eid);
+  EXPECT_EQ(ts::PKT_SIZE, record.pat_offset);
+  EXPECT_EQ(ChunkIndexRecord::kNoOffset, record.pmt_offset);
+  EXPECT_EQ(ts::PKT_SIZE * 2, record.keyframe_offset);
+  EXPECT_EQ(ChunkIndexRecord::kNoPcr, record.pcr);
+}
+
+TEST(ChunkIndexTest, WrapAround) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks));
+  auto index = MakeChunkIndex(&data);
+
+  index->StartChunk(0, 1000, 4);
+  index->SetPatOffset(0);
+  index->EndChunk(kChunkSize, 2000);
+  index->StartChunk(kChunkSize, 2000, 4);
+  index->EndChunk(kChunkSize * 2, 3000);
+  EXPECT_EQ(2, index->header().last_chunk.load());
+
+  // The first chunk is overwritten.  Stale offsets must be cleared.
+  index->StartChunk(0, 3000, 5);
+  auto record = ReadRecord(*index, 0);
+  EXPECT_EQ(3000, record.timestamp);
+  EXPECT_EQ(ChunkIndexRecord::kStarted, record.flags);
+  EXPECT_EQ(ChunkIndexRecord::kNoOffset, record.pat_offset);
+
+  index->SetPmtOffset(ts::PKT_SIZE);
+  record = ReadRecord(*index, 0);
+  EXPECT_EQ(ChunkIndexRecord::kNoOffset, record.pat_offset);
+  EXPECT_EQ(ts::PKT_SIZE, record.pmt_offset);
+}
+
+TEST(ChunkIndexTest, WritePos) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks));
+  auto index = MakeChunkIndex(&data);
+
+  index->StartChunk(0, 1000, 4);
+  index->SetWritePos(8192);
+  EXPECT_EQ(8192, index->header().write_pos.load());
+  // Not changed by completing the chunk.
+  index->EndChunk(kChunkSize, 2000);
+  EXPECT_EQ(8192, index->header().write_pos.load());
+  index->SetWritePos(kChunkSize * kNumChunks);
+  EXPECT_EQ(kChunkSize * kNumChunks, index->header().write_pos.load());
+}
+
+TEST(ChunkIndexTest, ReuseEntries) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks));
+  {
+    auto index = MakeChunkIndex(&data);
+    index->StartChunk(0, 1000, 4);
+    index->EndChunk(kChunkSize, 2000);
+  }
+  {
+    auto index = MakeChunkIndex(&data);
+    EXPECT_EQ(1, index->header().last_chunk.load());
+    auto record = ReadRecord(*index, 0);
+    EXPECT_EQ(1000, record.timestamp);
+    EXPECT_EQ(2000, record.end_timestamp);
+  }
+  {
+    // Another service.
+    auto index = std::make_unique<ChunkIndex>(
+        std::make_unique<MemoryMutableFileMapping>(&data), kSid + 1, kChunkSize, kNumChunks);
+    EXPECT_EQ(0, index->header().last_chunk.load());
+    EXPECT_EQ(0, ReadRecord(*index, 0).flags);
+  }
+}
+
+TEST(ChunkIndexTest, Reader) {
+  std::vector<uint8_t> data(GetChunkIndexFileSize(kNumChunks));
+  auto index = MakeChunkIndex(&data);
+  index->StartChunk(0, 1000, 4);
+  index->EndChunk(kChunkSize, 2000);
+
+  ChunkIndexReader reader(
+      std::make_unique<MemoryFileMapping>(std::vector<uint8_t>(data)), kChunkSize, kNumChunks);
+  EXPECT_TRUE(reader.IsValid());
+  EXPECT_EQ(kSid, reader.sid());
+  EXPECT_EQ(1, reader.last_chunk());
+  EXPECT_EQ(0, reader.write_pos());
+  ChunkIndexRecord record;
+  EXPECT_TRUE(reader.Read(0, &record));
+  EXPECT_EQ(1000, record.timestamp);
+  EXPECT_EQ(4, record.eid);
+
+  index->SetWritePos(kChunkSize + 8192);
+  ChunkIndexReader live(
+      std::make_unique<MemoryFileMapping>(std::vector<uint8_t>(data)), kChunkSize, kNumChunks);
+  EXPECT_EQ(kChunkSize + 8192, live.write_pos());
+
+  // Another geometry.
+  ChunkIndexReader invalid(
+      std::make_unique<MemoryFileMapping>(std::vector<uint8_t>(data)), kChunkSize * 2, kNumChunks);
+  EXPECT_FALSE(invalid.IsValid());
+
+  // Too small.
+  ChunkIndexReader small(
+      std::make_unique<MemoryFileMapping>(std::vector<uint8_t>(16)), kChunkSize, kNumChunks);
+  EXPECT_FALSE(small.IsValid());
+}
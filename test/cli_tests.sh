@@ -18,7 +18,8 @@
 # 02110-1301, USA.
 
 TMPFILE=$(mktemp)
-trap "rm $TMPFILE" EXIT
+TMPFILE2=$(mktemp)
+trap "rm -f $TMPFILE $TMPFILE2 $TMPFILE.index $TMPFILE2.index $TMPFILE.state $TMPFILE2.state $TMPFILE.progress" EXIT
 
 MIRAKC_ARIB="$1"
 
@@ -42,8 +43,9 @@ for opt in '-h' '--help'
 do
   assert 0 "$MIRAKC_ARIB $opt"
   for cmd in 'scan-services' 'sync-clocks' 'collect-eits' 'collect-logos' \
-             'filter-service' 'filter-program' 'record-service' 'track-airtime' \
-             'seek-start' 'print-pes'
+             'filter-service' 'filter-services' 'filter-program' 'record-service' \
+             'record-services' 'read-ring' 'track-airtime' 'seek-start' 'print-pes' \
+             'fanout'
   do
     assert 0 "$MIRAKC_ARIB $cmd $opt"
   done
@@ -61,6 +63,8 @@ assert 0 "$MIRAKC_ARIB collect-eits"
 assert 0 "$MIRAKC_ARIB collect-eits --sids=1 --sids=0xFFFF --xsids=1 --xsids=0xFFFF --time-limit=0x7FFFFFFFFFFFFFFF --streaming"
 assert 134 "$MIRAKC_ARIB collect-eits --time-limit=0xFFFFFFFFFFFFFFFF"
 assert 255 "$MIRAKC_ARIB collect-eits --only-actual --only-others"
+assert 0 "$MIRAKC_ARIB collect-eits --progress-file=$TMPFILE.progress"
+assert 0 "$MIRAKC_ARIB collect-eits --progress-file=$TMPFILE.progress"
 
 assert 0 "$MIRAKC_ARIB collect-eitpf"
 assert 0 "$MIRAKC_ARIB collect-eitpf --sids=1 --sids=0xFFFF --streaming"
@@ -71,6 +75,12 @@ assert 255 "$MIRAKC_ARIB collect-eitpf --present --following"
 assert 0 "$MIRAKC_ARIB filter-service --sid=1"
 assert 0 "$MIRAKC_ARIB filter-service --sid=0xFFFF"
 
+assert 0 "$MIRAKC_ARIB filter-services --sids=1 --outputs=$TMPFILE"
+assert 0 "$MIRAKC_ARIB filter-services --sids=1 --outputs=$TMPFILE --sids=0xFFFF --outputs=/dev/null"
+assert 134 "$MIRAKC_ARIB filter-services --sids=1 --outputs=$TMPFILE --sids=2"
+assert 134 "$MIRAKC_ARIB filter-services --sids=0x10000 --outputs=$TMPFILE"
+assert 134 "$MIRAKC_ARIB filter-services --sids=1 --outputs=/nonexistent/file"
+
 assert 0 "$MIRAKC_ARIB filter-program --sid=1 --eid=1 --clock-pid=1 --clock-pcr=1 --clock-time=1"
 assert 0 "$MIRAKC_ARIB filter-program --sid=0xFFFF --eid=0xFFFF --clock-pid=0xFFFF --clock-pcr=0x7FFFFFFFFFFFFFFF --clock-time=-9223372036854775808 --start-margin=1 --end-margin=1 --wait-until=-9223372036854775808 --pre-streaming"
 assert 134 "$MIRAKC_ARIB filter-program --sid=1 --eid=1 --clock-pid=1 --clock-pcr=0xFFFFFFFFFFFFFFFFF --clock-time=1"
@@ -89,6 +99,30 @@ assert 0 "$MIRAKC_ARIB filter-program-metadata --sid=0xFFFF"
 assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=1"
 assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=1 --start-pos=0"
 assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --start-pos=8192"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --start-pos=8192 --async-write"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=16384 --num-chunks=2 --direct-io --write-block-size=16384"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=16384 --num-chunks=2 --async-write --direct-io"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --start-pos=8192 --preallocate"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --async-write --preallocate"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --start-pos=8192 --chunk-index"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --state-file"
+assert 0 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --start-pos=8192 --state-file"
+assert 134 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=1 --write-block-size=0"
+assert 134 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=1 --write-block-size=4096"
+assert 134 "$MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=1 --write-block-size=16384"
+assert 0 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --chunk-size=8192 --num-chunks=1"
+assert 0 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --sids=2 --files=$TMPFILE2 --chunk-size=8192 --num-chunks=2 --chunk-index"
+assert 0 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --sids=2 --files=$TMPFILE2 --chunk-size=8192 --num-chunks=2 --state-file"
+assert 0 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --sids=2 --files=$TMPFILE2 --chunk-size=8192 --num-chunks=2 --start-positions=0 --start-positions=8192"
+assert 134 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --sids=2 --chunk-size=8192 --num-chunks=1"
+assert 134 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --chunk-size=8192 --num-chunks=1 --start-positions=8192"
+assert 134 "$MIRAKC_ARIB record-services --sids=1 --files=$TMPFILE --sids=2 --files=$TMPFILE2 --chunk-size=8192 --num-chunks=2 --start-positions=0"
+assert 0 "$MIRAKC_ARIB read-ring --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --pos=0"
+assert 1 "$MIRAKC_ARIB read-ring --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --pos=16384"
+assert 1 "$MIRAKC_ARIB read-ring --file=$TMPFILE --chunk-size=8192 --num-chunks=2 --eid=1"
+assert 1 "$MIRAKC_ARIB read-ring --file=$TMPFILE --chunk-size=8192 --num-chunks=1 --pos=0"
+assert 1 "$MIRAKC_ARIB read-ring --file=$TMPFILE.none --chunk-size=8192 --num-chunks=2 --pos=0"
+assert 134 "$MIRAKC_ARIB read-ring --file=$TMPFILE --chunk-size=1 --num-chunks=2 --pos=0"
 if [ -z "$CI" ]
 then
   # This test fails in GitHub Actions.
@@ -110,3 +144,39 @@ assert 0 "$MIRAKC_ARIB seek-start --sid=0xFFFF --max-duration=0x7FFFFFFFFFFFFFFF
 assert 134 "$MIRAKC_ARIB seek-start --sid=0xFFFF --max-duration=0xFFFFFFFFFFFFFFFF --max-packets=0x7FFFFFFF"
 
 assert 0 "$MIRAKC_ARIB print-pes"
+
+assert 0 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"filter-service\", \"--sid=1\"]}]'"
+assert 0 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"filter-service\", \"--sid=1\"]}, {\"args\": [\"collect-eitpf\", \"--streaming\"], \"output\": \"$TMPFILE\"}]'"
+assert 1 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"filter-service\", \"--sid=1\"]}, {\"args\": [\"scan-services\"], \"output\": \"$TMPFILE\"}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='{'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"filter-service\"]}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"filter-service\", \"--sid=1\", \"$TMPFILE\"]}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"print-pes\"]}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"fanout\", \"--spec=[]\"]}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"read-ring\", \"--file=$TMPFILE\", \"--chunk-size=8192\", \"--num-chunks=2\", \"--pos=0\"]}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"collect-logos\"]}, {\"args\": [\"collect-logos\"]}]'"
+assert 134 "$MIRAKC_ARIB fanout --spec='[{\"args\": [\"collect-logos\"], \"output\": \"/nonexistent/file\"}]'"
+
+assert 0 "MIRAKC_ARIB_INPUT=read $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_INPUT=io-uring $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_INPUT=io-uring $MIRAKC_ARIB print-pes $TMPFILE"
+assert 0 "MIRAKC_ARIB_INPUT=unknown $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_INPUT=mmap $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_INPUT=mmap $MIRAKC_ARIB print-pes $TMPFILE"
+assert 0 "MIRAKC_ARIB_READ_CHUNK_SIZE=65536 $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_MAX_READ_CHUNK_SIZE=1048576 $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_MAX_READ_CHUNK_SIZE=pipe $MIRAKC_ARIB print-pes"
+assert 134 "MIRAKC_ARIB_READ_CHUNK_SIZE=0 $MIRAKC_ARIB print-pes"
+assert 134 "MIRAKC_ARIB_READ_CHUNK_SIZE=1x $MIRAKC_ARIB print-pes"
+assert 134 "MIRAKC_ARIB_MAX_READ_CHUNK_SIZE=0x7FFFFFFF $MIRAKC_ARIB print-pes"
+assert 0 "MIRAKC_ARIB_OUTPUT=write $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_OUTPUT=vmsplice $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_OUTPUT=unknown $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_PIPELINE=input $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_PIPELINE=output $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_PIPELINE=input,output $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_PIPELINE=input,output $MIRAKC_ARIB record-service --sid=1 --file=$TMPFILE --chunk-size=8192 --num-chunks=1"
+assert 0 "MIRAKC_ARIB_PIPELINE=unknown $MIRAKC_ARIB filter-service --sid=1"
+assert 0 "MIRAKC_ARIB_PIPELINE=input MIRAKC_ARIB_PIPELINE_BUFFER_SIZE=1 $MIRAKC_ARIB filter-service --sid=1"
+assert 134 "MIRAKC_ARIB_PIPELINE=input MIRAKC_ARIB_PIPELINE_BUFFER_SIZE=0 $MIRAKC_ARIB filter-service --sid=1"
@@ -17,6 +17,7 @@
 
 #include <cstdlib>
 #include <memory>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -93,6 +94,42 @@ TEST(EitCollectorTest, Streaming) {
   EXPECT_TRUE(src.IsEmpty());
 }
 
+TEST(EitCollectorTest, ProgressFile) {
+  std::vector<uint8_t> data;
+  {
+    EitVersionTable table;
+    EitSection eit = {};
+    eit.nid = 1;
+    eit.tsid = 2;
+    eit.sid = 3;
+    eit.tid = 0x50;
+    eit.version = 1;
+    table.Update(eit);
+    EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+    ASSERT_TRUE(progress.Save(table));
+  }
+
+  MockSource src;
+  auto collector = std::make_unique<EitCollector>(kEmptyOption);
+  auto sink = std::make_unique<MockJsonlSink>();
+
+  collector->SetProgressFile(
+      std::make_unique<EitProgressFile>(std::make_unique<MemoryFile>(&data)));
+
+  EXPECT_CALL(src, GetNextPacket).WillOnce(testing::Return(false));  // EOF
+  EXPECT_CALL(*sink, HandleDocument).Times(0);
+
+  collector->Connect(std::move(sink));
+  src.Connect(std::move(collector));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+
+  // Tables loaded from the file are kept.
+  EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+  EitVersionTable table;
+  ASSERT_TRUE(progress.Load(&table));
+  EXPECT_EQ(1, table.size());
+}
+
 // TODO: Add more tests here.
 //
 // There are no classes and methods in TSDuck which can be used for generating
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "eit_progress.hh"
+
+#include "test_helper.hh"
+
+namespace {
+EitSection MakeEitSection(uint16_t sid, uint16_t tid, uint8_t section_number, uint8_t version) {
+  EitSection eit = {};
+  eit.nid = 1;
+  eit.tsid = 2;
+  eit.sid = sid;
+  eit.tid = tid;
+  eit.section_number = section_number;
+  eit.version = version;
+  return eit;
+}
+}  // namespace
+
+TEST(EitVersionTableTest, Update) {
+  EitVersionTable table;
+  const auto eit = MakeEitSection(3, 0x50, 8, 1);
+  EXPECT_FALSE(table.Contain(eit));
+  EXPECT_EQ(0, table.size());
+
+  table.Update(eit);
+  EXPECT_TRUE(table.Contain(eit));
+  EXPECT_EQ(1, table.size());
+
+  // Another version.
+  EXPECT_FALSE(table.Contain(MakeEitSection(3, 0x50, 8, 2)));
+  // Another section.
+  EXPECT_FALSE(table.Contain(MakeEitSection(3, 0x50, 9, 1)));
+  // Another table.
+  EXPECT_FALSE(table.Contain(MakeEitSection(3, 0x51, 8, 1)));
+  // Another service.
+  EXPECT_FALSE(table.Contain(MakeEitSection(4, 0x50, 8, 1)));
+
+  table.Update(MakeEitSection(3, 0x50, 8, 2));
+  EXPECT_FALSE(table.Contain(eit));
+  EXPECT_TRUE(table.Contain(MakeEitSection(3, 0x50, 8, 2)));
+  EXPECT_EQ(1, table.size());
+}
+
+TEST(EitProgressFileTest, Empty) {
+  std::vector<uint8_t> data;
+  EitProgressFile file(std::make_unique<MemoryFile>(&data));
+  EitVersionTable table;
+  EXPECT_FALSE(file.Load(&table));
+  EXPECT_EQ(0, table.size());
+}
+
+TEST(EitProgressFileTest, SaveAndLoad) {
+  std::vector<uint8_t> data;
+  {
+    EitVersionTable table;
+    table.Update(MakeEitSection(3, 0x50, 0, 1));
+    table.Update(MakeEitSection(3, 0x50, 8, 2));
+    table.Update(MakeEitSection(4, 0x58, 0, 3));
+
+    auto file = std::make_unique<MemoryFile>(&data);
+    auto* file_ptr = file.get();
+    EitProgressFile progress(std::move(file));
+    EXPECT_TRUE(progress.Save(table));
+    EXPECT_EQ(1, file_ptr->num_syncs);
+    EXPECT_EQ(EitProgressFile::GetFileSize(2), data.size());
+  }
+
+  EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+  EitVersionTable table;
+  ASSERT_TRUE(progress.Load(&table));
+  EXPECT_EQ(2, table.size());
+  EXPECT_TRUE(table.Contain(MakeEitSection(3, 0x50, 0, 1)));
+  EXPECT_TRUE(table.Contain(MakeEitSection(3, 0x50, 8, 2)));
+  EXPECT_TRUE(table.Contain(MakeEitSection(4, 0x58, 0, 3)));
+  EXPECT_FALSE(table.Contain(MakeEitSection(3, 0x50, 16, 1)));
+}
+
+TEST(EitProgressFileTest, Shrink) {
+  std::vector<uint8_t> data;
+  EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+
+  EitVersionTable table;
+  table.Update(MakeEitSection(3, 0x50, 0, 1));
+  table.Update(MakeEitSection(4, 0x50, 0, 1));
+  EXPECT_TRUE(progress.Save(table));
+  EXPECT_EQ(EitProgressFile::GetFileSize(2), data.size());
+
+  // Garbage must not be left at the end.
+  EitVersionTable table2;
+  table2.Update(MakeEitSection(3, 0x50, 0, 1));
+  EXPECT_TRUE(progress.Save(table2));
+  EXPECT_EQ(EitProgressFile::GetFileSize(1), data.size());
+
+  EitVersionTable loaded;
+  ASSERT_TRUE(progress.Load(&loaded));
+  EXPECT_EQ(1, loaded.size());
+}
+
+TEST(EitProgressFileTest, Broken) {
+  std::vector<uint8_t> data;
+  {
+    EitVersionTable table;
+    table.Update(MakeEitSection(3, 0x50, 0, 1));
+    EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+    EXPECT_TRUE(progress.Save(table));
+  }
+
+  // CRC32 mismatch.
+  data[EitProgressFile::kHeaderSize + 8] ^= 0x01;
+  {
+    EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+    EitVersionTable table;
+    EXPECT_FALSE(progress.Load(&table));
+    EXPECT_EQ(0, table.size());
+  }
+  data[EitProgressFile::kHeaderSize + 8] ^= 0x01;
+
+  // Truncated.
+  data.pop_back();
+  {
+    EitProgressFile progress(std::make_unique<MemoryFile>(&data));
+    EitVersionTable table;
+    EXPECT_FALSE(progress.Load(&table));
+  }
+}
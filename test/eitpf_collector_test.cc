@@ -43,6 +43,74 @@ TEST(EitpfCollectorTest, NoPacket) {
   EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
 }
 
+TEST(EitpfCollectorTest, FlushIfExpired) {
+  MockSource src;
+
+  // Collecting EIT[p/f] of a service never completes with null packets.
+  EitpfCollectorOption option(kOption);
+  option.sids.Add(3);
+
+  auto collector = std::make_unique<EitpfCollector>(option);
+  auto sink = std::make_unique<MockBufferedJsonlSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(src, GetNextPacket).WillOnce([](ts::TSPacket* packet) {
+      *packet = ts::NullPacket;
+      return true;
+    });
+    EXPECT_CALL(*sink, FlushIfExpired).WillOnce(testing::Return(true));
+    EXPECT_CALL(src, GetNextPacket).WillOnce(testing::Return(false));  // EOF
+    EXPECT_CALL(*sink, Flush).WillOnce(testing::Return(true));
+  }
+
+  collector->Connect(std::move(sink));
+  src.Connect(std::move(collector));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+}
+
+TEST(EitpfCollectorTest, FlushIfExpiredFailure) {
+  MockSource src;
+
+  // Collecting EIT[p/f] of a service never completes with null packets.
+  EitpfCollectorOption option(kOption);
+  option.sids.Add(3);
+
+  auto collector = std::make_unique<EitpfCollector>(option);
+  auto sink = std::make_unique<MockBufferedJsonlSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(src, GetNextPacket).WillOnce([](ts::TSPacket* packet) {
+      *packet = ts::NullPacket;
+      return true;
+    });
+    EXPECT_CALL(*sink, FlushIfExpired).WillOnce(testing::Return(false));
+    EXPECT_CALL(*sink, Flush).WillOnce(testing::Return(true));
+  }
+
+  collector->Connect(std::move(sink));
+  src.Connect(std::move(collector));
+  EXPECT_EQ(EXIT_FAILURE, src.FeedPackets());
+}
+
+TEST(EitpfCollectorTest, FlushFailureAtEnd) {
+  MockSource src;
+
+  auto collector = std::make_unique<EitpfCollector>(kOption);
+  auto sink = std::make_unique<MockBufferedJsonlSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(src, GetNextPacket).WillOnce(testing::Return(false));  // EOF
+    EXPECT_CALL(*sink, Flush).WillOnce(testing::Return(false));
+  }
+
+  collector->Connect(std::move(sink));
+  src.Connect(std::move(collector));
+  EXPECT_EQ(EXIT_FAILURE, src.FeedPackets());
+}
+
 TEST(EitpfCollectorTest, PresentFollowing) {
   TableSource src;
   src.LoadXml(R"(
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <tsduck/tsduck.h>
+
+#include "exit_code.hh"
+#include "fanout_sink.hh"
+
+#include "test_helper.hh"
+
+TEST(FanoutSinkTest, NoPacket) {
+  FanoutSink fanout;
+  auto sink1 = std::make_unique<MockBatchSink>();
+  auto sink2 = std::make_unique<MockBatchSink>();
+
+  for (auto* sink : {sink1.get(), sink2.get()}) {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+    EXPECT_CALL(*sink, HandlePackets).Times(0);
+  }
+
+  fanout.Connect("sink1", std::move(sink1));
+  fanout.Connect("sink2", std::move(sink2));
+  EXPECT_TRUE(fanout.Start());
+  fanout.End();
+  EXPECT_EQ(EXIT_SUCCESS, fanout.GetExitCode());
+}
+
+TEST(FanoutSinkTest, SharePackets) {
+  FanoutSink fanout;
+  auto sink1 = std::make_unique<MockBatchSink>();
+  auto sink2 = std::make_unique<MockBatchSink>();
+  std::vector<ts::TSPacket> packets(3, ts::NullPacket);
+
+  for (auto* sink : {sink1.get(), sink2.get()}) {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    // Packets are not copied.
+    EXPECT_CALL(*sink, HandlePackets(packets.data(), 3)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+  }
+
+  fanout.Connect("sink1", std::move(sink1));
+  fanout.Connect("sink2", std::move(sink2));
+  EXPECT_TRUE(fanout.Start());
+  EXPECT_TRUE(fanout.HandlePackets(packets.data(), packets.size()));
+  fanout.End();
+  EXPECT_EQ(EXIT_SUCCESS, fanout.GetExitCode());
+}
+
+TEST(FanoutSinkTest, PipelineStopped) {
+  FanoutSink fanout;
+  auto sink1 = std::make_unique<MockBatchSink>();
+  auto sink2 = std::make_unique<MockBatchSink>();
+  std::vector<ts::TSPacket> packets(3, ts::NullPacket);
+
+  testing::MockFunction<void(int)> check;
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink1, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink1, HandlePackets).WillOnce(testing::Return(false));
+    // Ended immediately.
+    EXPECT_CALL(*sink1, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink1, GetExitCode).WillOnce(testing::Return(EXIT_RETRY));
+    EXPECT_CALL(check, Call(1));
+  }
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink2, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink2, HandlePackets).Times(2).WillRepeatedly(testing::Return(true));
+    EXPECT_CALL(*sink2, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink2, GetExitCode).WillRepeatedly(testing::Return(EXIT_FAILURE));
+  }
+
+  fanout.Connect("sink1", std::move(sink1));
+  fanout.Connect("sink2", std::move(sink2));
+  EXPECT_TRUE(fanout.Start());
+  // Other pipelines keep going.
+  EXPECT_TRUE(fanout.HandlePackets(packets.data(), packets.size()));
+  check.Call(1);
+  EXPECT_TRUE(fanout.HandlePackets(packets.data(), packets.size()));
+  fanout.End();
+  // The first non-zero exit code in the order of Connect() calls.
+  EXPECT_EQ(EXIT_RETRY, fanout.GetExitCode());
+}
+
+TEST(FanoutSinkTest, AllPipelinesStopped) {
+  FanoutSink fanout;
+  auto sink1 = std::make_unique<MockBatchSink>();
+  auto sink2 = std::make_unique<MockBatchSink>();
+  std::vector<ts::TSPacket> packets(3, ts::NullPacket);
+
+  for (auto* sink : {sink1.get(), sink2.get()}) {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePackets).WillOnce(testing::Return(false));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+  }
+
+  fanout.Connect("sink1", std::move(sink1));
+  fanout.Connect("sink2", std::move(sink2));
+  EXPECT_TRUE(fanout.Start());
+  EXPECT_FALSE(fanout.HandlePackets(packets.data(), packets.size()));
+  // Stopped pipelines are not ended twice.
+  fanout.End();
+  EXPECT_EQ(EXIT_SUCCESS, fanout.GetExitCode());
+}
+
+TEST(FanoutSinkTest, StartFailure) {
+  FanoutSink fanout;
+  auto sink1 = std::make_unique<MockBatchSink>();
+  auto sink2 = std::make_unique<MockBatchSink>();
+  std::vector<ts::TSPacket> packets(3, ts::NullPacket);
+
+  EXPECT_CALL(*sink1, Start).WillOnce(testing::Return(false));
+  EXPECT_CALL(*sink1, HandlePackets).Times(0);
+  EXPECT_CALL(*sink1, End).Times(0);
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink2, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink2, HandlePackets).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink2, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink2, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+  }
+
+  fanout.Connect("sink1", std::move(sink1));
+  fanout.Connect("sink2", std::move(sink2));
+  EXPECT_TRUE(fanout.Start());
+  EXPECT_TRUE(fanout.HandlePackets(packets.data(), packets.size()));
+  fanout.End();
+  EXPECT_EQ(EXIT_FAILURE, fanout.GetExitCode());
+}
+
+TEST(FanoutSinkTest, AllStartFailures) {
+  FanoutSink fanout;
+  auto sink = std::make_unique<MockBatchSink>();
+
+  EXPECT_CALL(*sink, Start).WillOnce(testing::Return(false));
+  EXPECT_CALL(*sink, End).Times(0);
+
+  fanout.Connect("sink", std::move(sink));
+  EXPECT_FALSE(fanout.Start());
+}
+
+TEST(FanoutSinkTest, ClosedOutput) {
+  // main() ignores SIGPIPE for fanout.
+  auto old_handler = std::signal(SIGPIPE, SIG_IGN);
+
+  int fds1[2];
+  int fds2[2];
+  ASSERT_EQ(0, pipe(fds1));
+  ASSERT_EQ(0, pipe(fds2));
+  // The reader of the first output has gone.
+  close(fds1[0]);
+
+  FanoutSink fanout;
+  // Larger than the buffer in StdoutSink so that packets are written immediately.
+  std::vector<ts::TSPacket> packets(100, ts::NullPacket);
+
+  fanout.Connect("sink1", std::make_unique<StdoutSink>(fds1[1]));
+  fanout.Connect("sink2", std::make_unique<StdoutSink>(fds2[1]));
+  EXPECT_TRUE(fanout.Start());
+  // Other pipelines keep going.
+  EXPECT_TRUE(fanout.HandlePackets(packets.data(), packets.size()));
+  EXPECT_TRUE(fanout.HandlePackets(packets.data(), packets.size()));
+  fanout.End();
+  EXPECT_EQ(EXIT_SUCCESS, fanout.GetExitCode());
+
+  std::vector<uint8_t> buf(2 * packets.size() * ts::PKT_SIZE);
+  size_t nread = 0;
+  while (nread < buf.size()) {
+    auto n = read(fds2[0], buf.data() + nread, buf.size() - nread);
+    ASSERT_GT(n, 0);
+    nread += static_cast<size_t>(n);
+  }
+
+  close(fds2[0]);
+  std::signal(SIGPIPE, old_handler);
+}
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <string>
+
+#include <gtest/gtest.h>
+#include <rapidjson/document.h>
+
+#include "json_arena.hh"
+
+TEST(JsonArenaTest, Reuse) {
+  JsonArena arena;
+  for (int i = 0; i < 10; ++i) {
+    rapidjson::Document doc(rapidjson::kObjectType, &arena.Reset());
+    doc.AddMember("text", std::string("text"), doc.GetAllocator());
+    EXPECT_EQ("text", std::string(doc["text"].GetString()));
+  }
+  arena.Reset();
+  EXPECT_EQ(11, arena.num_documents());
+  EXPECT_EQ(0, arena.num_overflows());
+  EXPECT_EQ(JsonArena::kDefaultSize, arena.size());
+}
+
+TEST(JsonArenaTest, Enlarge) {
+  JsonArena arena(256);
+  const std::string kText(1024, 'x');
+
+  {
+    rapidjson::Document doc(rapidjson::kObjectType, &arena.Reset());
+    doc.AddMember("text", kText, doc.GetAllocator());
+  }
+  {
+    rapidjson::Document doc(rapidjson::kObjectType, &arena.Reset());
+    EXPECT_EQ(1, arena.num_overflows());
+    EXPECT_LT(1024, arena.size());
+    doc.AddMember("text", kText, doc.GetAllocator());
+    EXPECT_EQ(kText, std::string(doc["text"].GetString()));
+  }
+  arena.Reset();
+  EXPECT_EQ(1, arena.num_overflows());
+}
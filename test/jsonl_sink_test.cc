@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "jsonl_sink.hh"
+
+namespace {
+class StdoutJsonlSinkTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0, pipe(fds_));
+    ASSERT_EQ(0, fcntl(fds_[0], F_SETFL, O_NONBLOCK));
+  }
+
+  void TearDown() override {
+    close(fds_[0]);
+  }
+
+  // The sink takes the ownership of the write end of the pipe.
+  std::unique_ptr<StdoutJsonlSink> MakeSink(const StdoutJsonlSinkOption& option) {
+    return std::make_unique<StdoutJsonlSink>(fds_[1], option);
+  }
+
+  std::string ReadAll() {
+    std::string data;
+    char buf[256];
+    for (;;) {
+      auto n = read(fds_[0], buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      data.append(buf, static_cast<size_t>(n));
+    }
+    return data;
+  }
+
+  static bool WriteNumber(JsonlSink& sink, int n) {
+    auto write = [n](JsonWriter& writer) { writer.Int(n); };
+    return sink.HandleJson(JsonGenerator(write));
+  }
+
+  int fds_[2];
+};
+}  // namespace
+
+TEST_F(StdoutJsonlSinkTest, FlushEach) {
+  StdoutJsonlSinkOption option;
+  option.flush_each = true;
+  auto sink = MakeSink(option);
+  EXPECT_TRUE(WriteNumber(*sink, 1));
+  EXPECT_EQ("1\n", ReadAll());
+  EXPECT_TRUE(WriteNumber(*sink, 2));
+  EXPECT_EQ("2\n", ReadAll());
+  EXPECT_EQ(2, sink->num_writes());
+}
+
+TEST_F(StdoutJsonlSinkTest, FlushBySize) {
+  StdoutJsonlSinkOption option;
+  option.flush_size = 6;
+  option.flush_interval = std::chrono::hours(1);
+  auto sink = MakeSink(option);
+  EXPECT_TRUE(WriteNumber(*sink, 1));
+  EXPECT_TRUE(WriteNumber(*sink, 2));
+  EXPECT_EQ("", ReadAll());
+  EXPECT_TRUE(WriteNumber(*sink, 3));
+  EXPECT_EQ("1\n2\n3\n", ReadAll());
+  EXPECT_EQ(1, sink->num_writes());
+}
+
+TEST_F(StdoutJsonlSinkTest, FlushByDeadline) {
+  StdoutJsonlSinkOption option;
+  option.flush_interval = std::chrono::milliseconds(10);
+  auto sink = MakeSink(option);
+  EXPECT_TRUE(WriteNumber(*sink, 1));
+  EXPECT_EQ("", ReadAll());
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_TRUE(WriteNumber(*sink, 2));
+  EXPECT_EQ("1\n2\n", ReadAll());
+  EXPECT_EQ(1, sink->num_writes());
+}
+
+TEST_F(StdoutJsonlSinkTest, FlushIfExpired) {
+  StdoutJsonlSinkOption option;
+  option.flush_interval = std::chrono::milliseconds(10);
+  auto sink = MakeSink(option);
+  EXPECT_TRUE(sink->FlushIfExpired());
+  EXPECT_EQ(0, sink->num_writes());
+  EXPECT_TRUE(WriteNumber(*sink, 1));
+  EXPECT_TRUE(sink->FlushIfExpired());
+  EXPECT_EQ("", ReadAll());
+  // Lines are written by the deadline even if no line is added.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_TRUE(sink->FlushIfExpired());
+  EXPECT_EQ("1\n", ReadAll());
+  EXPECT_EQ(1, sink->num_writes());
+}
+
+TEST_F(StdoutJsonlSinkTest, ExplicitFlush) {
+  StdoutJsonlSinkOption option;
+  option.flush_interval = std::chrono::hours(1);
+  auto sink = MakeSink(option);
+  EXPECT_TRUE(sink->Flush());
+  EXPECT_EQ(0, sink->num_writes());
+  rapidjson::Document doc(rapidjson::kArrayType);
+  EXPECT_TRUE(sink->HandleDocument(doc));
+  EXPECT_TRUE(WriteNumber(*sink, 1));
+  EXPECT_EQ("", ReadAll());
+  EXPECT_TRUE(sink->Flush());
+  EXPECT_EQ("[]\n1\n", ReadAll());
+  EXPECT_EQ(1, sink->num_writes());
+}
+
+TEST_F(StdoutJsonlSinkTest, FlushOnDestruction) {
+  StdoutJsonlSinkOption option;
+  option.flush_interval = std::chrono::hours(1);
+  auto sink = MakeSink(option);
+  EXPECT_TRUE(WriteNumber(*sink, 1));
+  sink.reset();
+  EXPECT_EQ("1\n", ReadAll());
+}
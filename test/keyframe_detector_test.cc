@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <tsduck/tsduck.h>
+
+#include "keyframe_detector.hh"
+
+namespace {
+constexpr ts::PID kPid = 0x0111;
+
+// Makes a TS packet containing `payload` followed by stuffing bytes.
+ts::TSPacket MakePacket(ts::PID pid, bool pusi, const std::vector<uint8_t>& payload) {
+  ts::TSPacket packet;
+  std::memset(packet.b, 0xFF, ts::PKT_SIZE);
+  packet.b[0] = ts::SYNC_BYTE;
+  packet.b[1] = static_cast<uint8_t>((pusi ? 0x40 : 0x00) | ((pid >> 8) & 0x1F));
+  packet.b[2] = static_cast<uint8_t>(pid & 0xFF);
+  packet.b[3] = 0x10;  // payload only
+  std::copy_n(payload.begin(), std::min(payload.size(), ts::PKT_SIZE - 4), packet.b + 4);
+  return packet;
+}
+
+// Makes a PES packet header with a PTS followed by `es`.
+std::vector<uint8_t> MakePes(const std::vector<uint8_t>& es) {
+  std::vector<uint8_t> pes = {
+      0x00, 0x00, 0x01, 0xE0, 0x00, 0x00, 0x80, 0x80, 0x05, 0x21, 0x00, 0x01, 0x00, 0x01};
+  pes.insert(pes.end(), es.begin(), es.end());
+  return pes;
+}
+}  // namespace
+
+TEST(KeyframeDetectorTest, GetVideoCodec) {
+  EXPECT_EQ(VideoCodec::kMpeg2, GetVideoCodec(0x02));
+  EXPECT_EQ(VideoCodec::kH264, GetVideoCodec(0x1B));
+  EXPECT_EQ(VideoCodec::kHevc, GetVideoCodec(0x24));
+  EXPECT_EQ(VideoCodec::kUnknown, GetVideoCodec(0x0F));
+}
+
+TEST(KeyframeDetectorTest, NoStream) {
+  KeyframeDetector detector;
+  auto packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0xB3}));
+  EXPECT_FALSE(detector.Feed(packet, 0).has_value());
+}
+
+TEST(KeyframeDetectorTest, Mpeg2) {
+  KeyframeDetector detector;
+  detector.SetStream(kPid, VideoCodec::kMpeg2);
+
+  // sequence_header
+  auto packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0xB3, 0x00}));
+  EXPECT_EQ(188, detector.Feed(packet, 188));
+
+  // picture without sequence_header nor group_of_pictures_header
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0xB3}));
+  EXPECT_FALSE(detector.Feed(packet, 376).has_value());
+
+  // group_of_pictures_header
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0xB8, 0x00}));
+  EXPECT_EQ(564, detector.Feed(packet, 564));
+
+  EXPECT_EQ(2, detector.num_keyframes());
+}
+
+TEST(KeyframeDetectorTest, H264) {
+  KeyframeDetector detector;
+  detector.SetStream(kPid, VideoCodec::kH264);
+
+  // AUD, SPS
+  auto packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x01,
+      0x67}));
+  EXPECT_EQ(0, detector.Feed(packet, 0));
+
+  // AUD, IDR slice
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x01, 0x65}));
+  EXPECT_EQ(188, detector.Feed(packet, 188));
+
+  // AUD, non-IDR slice
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x09, 0xF0, 0x00, 0x00, 0x01, 0x41}));
+  EXPECT_FALSE(detector.Feed(packet, 376).has_value());
+}
+
+TEST(KeyframeDetectorTest, Hevc) {
+  KeyframeDetector detector;
+  detector.SetStream(kPid, VideoCodec::kHevc);
+
+  // AUD, VPS
+  auto packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x46, 0x01, 0x50, 0x00, 0x00,
+      0x01, 0x40, 0x01}));
+  EXPECT_EQ(0, detector.Feed(packet, 0));
+
+  // AUD, TRAIL_R slice
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x46, 0x01, 0x50, 0x00, 0x00, 0x01,
+      0x02, 0x01}));
+  EXPECT_FALSE(detector.Feed(packet, 188).has_value());
+
+  // CRA slice
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x2A, 0x01}));
+  EXPECT_EQ(376, detector.Feed(packet, 376));
+}
+
+TEST(KeyframeDetectorTest, StartCodeSpanningPackets) {
+  KeyframeDetector detector;
+  detector.SetStream(kPid, VideoCodec::kMpeg2);
+
+  // The start code prefix is split at the end of the first packet.
+  std::vector<uint8_t> es(ts::PKT_SIZE - 4 - 14 - 2, 0xFF);
+  es.push_back(0x00);
+  es.push_back(0x00);
+  auto packet = MakePacket(kPid, true, MakePes(es));
+  EXPECT_FALSE(detector.Feed(packet, 0).has_value());
+
+  // Packets of other PIDs are ignored.
+  packet = MakePacket(0x0112, false, {0x01, 0xB3});
+  EXPECT_FALSE(detector.Feed(packet, 188).has_value());
+
+  packet = MakePacket(kPid, false, {0x01, 0xB3});
+  EXPECT_EQ(0, detector.Feed(packet, 376));
+
+  // Reported only once in the PES packet.
+  packet = MakePacket(kPid, false, {0x00, 0x00, 0x01, 0xB3});
+  EXPECT_FALSE(detector.Feed(packet, 564).has_value());
+}
+
+TEST(KeyframeDetectorTest, ChangeStream) {
+  KeyframeDetector detector;
+  detector.SetStream(kPid, VideoCodec::kMpeg2);
+
+  auto packet = MakePacket(kPid, true, MakePes({0x00, 0x00}));
+  EXPECT_FALSE(detector.Feed(packet, 0).has_value());
+
+  // Scanning restarts from the next PES packet after the stream changes.
+  detector.SetStream(kPid, VideoCodec::kH264);
+  packet = MakePacket(kPid, false, {0x01, 0x67});
+  EXPECT_FALSE(detector.Feed(packet, 188).has_value());
+
+  packet = MakePacket(kPid, true, MakePes({0x00, 0x00, 0x01, 0x67}));
+  EXPECT_EQ(376, detector.Feed(packet, 376));
+}
@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+
+#include <unistd.h>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <tsduck/tsduck.h>
+
+#include "multi_service_filter.hh"
+
+#include "test_helper.hh"
+
+namespace {
+
+const MultiServiceFilterOption kOption{{0x0001, 0x0002}};
+
+// <generic_short_table> elements are used for emulating PES packets.
+const char kServiceStreams[] = R"(
+  <?xml version="1.0" encoding="utf-8"?>
+  <tsduck>
+    <PAT version="1" current="true" transport_stream_id="0x1234"
+         test-pid="0x0000">
+      <service service_id="0x0001" program_map_PID="0x0101" />
+      <service service_id="0x0002" program_map_PID="0x0102" />
+      <service service_id="0x0003" program_map_PID="0x0103" />
+    </PAT>
+    <PMT version="1" current="true" service_id="0x0001" PCR_PID="0x901"
+         test-pid="0x0101">
+      <component elementary_PID="0x0301" stream_type="0x02" />
+    </PMT>
+    <PMT version="1" current="true" service_id="0x0002" PCR_PID="0x902"
+         test-pid="0x0102">
+      <component elementary_PID="0x0311" stream_type="0x02" />
+    </PMT>
+    <PMT version="1" current="true" service_id="0x0003" PCR_PID="0x903"
+         test-pid="0x0103">
+      <component elementary_PID="0x0321" stream_type="0x02" />
+    </PMT>
+    <TOT UTC_time="2019-01-02 03:04:05" test-pid="0x0014" />
+    <generic_short_table table_id="0xFF" test-pid="0x0301" />
+    <generic_short_table table_id="0xFF" test-pid="0x0311" />
+    <generic_short_table table_id="0xFF" test-pid="0x0321" />
+  </tsduck>
+)";
+
+void ExpectPat(const ts::TSPacket& packet, uint16_t sid, ts::PID pmt_pid) {
+  EXPECT_EQ(ts::PID_PAT, packet.getPID());
+  TableValidator<ts::PAT> validator(ts::PID_PAT);
+  EXPECT_CALL(validator, Validate).WillOnce([sid, pmt_pid](const ts::PAT& pat) {
+    EXPECT_TRUE(pat.isValid());
+    EXPECT_EQ(1, pat.pmts.size());
+    EXPECT_EQ(pmt_pid, pat.pmts.at(sid));
+  });
+  validator.FeedPacket(packet);
+}
+
+void ExpectServiceStream(MockSink* sink, uint16_t sid, ts::PID pmt_pid, ts::PID pes_pid) {
+  testing::InSequence seq;
+  EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+  EXPECT_CALL(*sink, HandlePacket).WillOnce([sid, pmt_pid](const ts::TSPacket& packet) {
+    ExpectPat(packet, sid, pmt_pid);
+    return true;
+  });
+  EXPECT_CALL(*sink, HandlePacket).WillOnce([pmt_pid](const ts::TSPacket& packet) {
+    EXPECT_EQ(pmt_pid, packet.getPID());
+    return true;
+  });
+  EXPECT_CALL(*sink, HandlePacket).WillOnce([](const ts::TSPacket& packet) {
+    EXPECT_EQ(ts::PID_TOT, packet.getPID());
+    return true;
+  });
+  EXPECT_CALL(*sink, HandlePacket).WillOnce([pes_pid](const ts::TSPacket& packet) {
+    EXPECT_EQ(pes_pid, packet.getPID());
+    return true;
+  });
+  EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+  EXPECT_CALL(*sink, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+}
+
+}  // namespace
+
+TEST(MultiServiceFilterTest, NoPacket) {
+  TableSource src;
+  auto filter = std::make_unique<MultiServiceFilter>(kOption);
+  auto sink1 = std::make_unique<MockSink>();
+  auto sink2 = std::make_unique<MockSink>();
+
+  for (auto* sink : {sink1.get(), sink2.get()}) {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+    EXPECT_CALL(*sink, HandlePacket).Times(0);
+  }
+
+  filter->Connect(0x0001, std::move(sink1));
+  filter->Connect(0x0002, std::move(sink2));
+  src.Connect(std::move(filter));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+}
+
+TEST(MultiServiceFilterTest, ServiceStreams) {
+  TableSource src;
+  auto filter = std::make_unique<MultiServiceFilter>(kOption);
+  auto sink1 = std::make_unique<MockSink>();
+  auto sink2 = std::make_unique<MockSink>();
+
+  src.LoadXml(kServiceStreams);
+
+  ExpectServiceStream(sink1.get(), 0x0001, 0x0101, 0x0301);
+  ExpectServiceStream(sink2.get(), 0x0002, 0x0102, 0x0311);
+
+  filter->Connect(0x0001, std::move(sink1));
+  filter->Connect(0x0002, std::move(sink2));
+  src.Connect(std::move(filter));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+  EXPECT_TRUE(src.IsEmpty());
+}
+
+TEST(MultiServiceFilterTest, NoSidInPat) {
+  TableSource src;
+  auto filter = std::make_unique<MultiServiceFilter>(MultiServiceFilterOption{{0x0001, 0x0004}});
+  auto sink1 = std::make_unique<MockSink>();
+  auto sink2 = std::make_unique<MockSink>();
+
+  src.LoadXml(kServiceStreams);
+
+  // Other services keep going.
+  ExpectServiceStream(sink1.get(), 0x0001, 0x0101, 0x0301);
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink2, Start).WillOnce(testing::Return(true));
+    // Ended when the service stops, not when all services stop.
+    EXPECT_CALL(*sink2, End).WillOnce([&src]() { EXPECT_FALSE(src.IsEmpty()); });
+    // The exit code is kept after the sink is destroyed.
+    EXPECT_CALL(*sink2, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+    EXPECT_CALL(*sink2, HandlePacket).Times(0);
+  }
+
+  filter->Connect(0x0001, std::move(sink1));
+  filter->Connect(0x0004, std::move(sink2));
+  src.Connect(std::move(filter));
+  EXPECT_EQ(EXIT_FAILURE, src.FeedPackets());
+  EXPECT_TRUE(src.IsEmpty());
+}
+
+TEST(MultiServiceFilterTest, SinkFailure) {
+  TableSource src;
+  auto filter = std::make_unique<MultiServiceFilter>(kOption);
+  auto sink1 = std::make_unique<MockSink>();
+  auto sink2 = std::make_unique<MockSink>();
+
+  src.LoadXml(kServiceStreams);
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink1, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink1, HandlePacket).WillOnce(testing::Return(false));
+    // Ended when the service stops, not when all services stop.
+    EXPECT_CALL(*sink1, End).WillOnce([&src]() { EXPECT_FALSE(src.IsEmpty()); });
+    // The exit code is kept after the sink is destroyed.
+    EXPECT_CALL(*sink1, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  // Other services keep going.
+  ExpectServiceStream(sink2.get(), 0x0002, 0x0102, 0x0311);
+
+  filter->Connect(0x0001, std::move(sink1));
+  filter->Connect(0x0002, std::move(sink2));
+  src.Connect(std::move(filter));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+  EXPECT_TRUE(src.IsEmpty());
+}
+
+TEST(MultiServiceFilterTest, AllSinksFailed) {
+  TableSource src;
+  auto filter = std::make_unique<MultiServiceFilter>(kOption);
+  auto sink1 = std::make_unique<MockSink>();
+  auto sink2 = std::make_unique<MockSink>();
+
+  src.LoadXml(kServiceStreams);
+
+  for (auto* sink : {sink1.get(), sink2.get()}) {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePacket).WillOnce(testing::Return(false));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillRepeatedly(testing::Return(EXIT_SUCCESS));
+  }
+
+  filter->Connect(0x0001, std::move(sink1));
+  filter->Connect(0x0002, std::move(sink2));
+  src.Connect(std::move(filter));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+  // Stopped at the first PAT packet.
+  EXPECT_FALSE(src.IsEmpty());
+}
+
+TEST(MultiServiceFilterTest, ClosedOutput) {
+  // main() ignores SIGPIPE for filter-services.
+  auto old_handler = std::signal(SIGPIPE, SIG_IGN);
+
+  int fds1[2];
+  int fds2[2];
+  ASSERT_EQ(0, pipe(fds1));
+  ASSERT_EQ(0, pipe(fds2));
+  // The reader of the first output has gone.
+  close(fds1[0]);
+
+  TableSource src;
+  auto filter = std::make_unique<MultiServiceFilter>(kOption);
+
+  src.LoadXml(kServiceStreams);
+
+  filter->Connect(0x0001, std::make_unique<StdoutSink>(fds1[1]));
+  filter->Connect(0x0002, std::make_unique<StdoutSink>(fds2[1]));
+  src.Connect(std::move(filter));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+  EXPECT_TRUE(src.IsEmpty());
+
+  // The other service received PAT, PMT, TOT and PES packets.
+  ts::TSPacket packets[4];
+  auto* buf = reinterpret_cast<uint8_t*>(packets);
+  size_t nread = 0;
+  while (nread < sizeof(packets)) {
+    auto n = read(fds2[0], buf + nread, sizeof(packets) - nread);
+    ASSERT_GT(n, 0);
+    nread += static_cast<size_t>(n);
+  }
+  EXPECT_EQ(ts::PID_PAT, packets[0].getPID());
+  EXPECT_EQ(0x0102, packets[1].getPID());
+  EXPECT_EQ(ts::PID_TOT, packets[2].getPID());
+  EXPECT_EQ(0x0311, packets[3].getPID());
+
+  close(fds2[0]);
+  std::signal(SIGPIPE, old_handler);
+}
@@ -17,6 +17,7 @@
 
 #include <cstdlib>
 #include <memory>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -234,6 +235,374 @@ TEST(PacketSourceTest, ResyncFailedWithNoSyncByte) {
   src.FeedPackets();
 }
 
+TEST(PacketSourceTest, Batch) {
+  auto file = std::make_unique<MockFile>();
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Read).WillOnce([](uint8_t* buf, size_t) {
+      static constexpr size_t kNBytes = 5 * ts::PKT_SIZE;
+      for (auto* p = buf; p < buf + kNBytes; p += ts::PKT_SIZE) {
+        ts::NullPacket.copyTo(p);
+      }
+      return kNBytes;
+    });
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 5)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Read).WillOnce(testing::Return(0));  // EOF
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  EXPECT_CALL(*sink, HandlePacket).Times(0);  // Never called
+
+  FileSource src(std::move(file));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(PacketSourceTest, BatchSplitByResync) {
+  auto file = std::make_unique<MockFile>();
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Read).WillOnce([](uint8_t* buf, size_t) {
+      static constexpr size_t kNBytes = 2 * ts::PKT_SIZE + 1 + 5 * ts::PKT_SIZE;
+      auto* p = buf;
+      ts::NullPacket.copyTo(p);
+      p += ts::PKT_SIZE;
+      ts::NullPacket.copyTo(p);
+      p += ts::PKT_SIZE;
+      *p++ = 0;  // garbage
+      for (; p < buf + kNBytes; p += ts::PKT_SIZE) {
+        ts::NullPacket.copyTo(p);
+      }
+      return kNBytes;
+    });
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 2)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 5)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Read).WillOnce(testing::Return(0));  // EOF
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  EXPECT_CALL(*sink, HandlePacket).Times(0);  // Never called
+
+  FileSource src(std::move(file));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(PacketSourceTest, PeekPackets) {
+  static constexpr size_t kNBytes1 = 5 * ts::PKT_SIZE + 100;
+  static constexpr size_t kNBytes2 = ts::PKT_SIZE - 100 + 3 * ts::PKT_SIZE;
+  static uint8_t buf1[kNBytes1];
+  static uint8_t buf2[kNBytes2];
+  for (auto* p = buf1; p < buf1 + kNBytes1; p += ts::PKT_SIZE) {
+    ts::NullPacket.copyTo(p);
+  }
+  std::memset(buf2, 0xFF, kNBytes2);
+  for (auto* p = buf2 + ts::PKT_SIZE - 100; p < buf2 + kNBytes2; p += ts::PKT_SIZE) {
+    ts::NullPacket.copyTo(p);
+  }
+
+  auto file = std::make_unique<MockPeekableFile>();
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Peek).WillOnce([](const uint8_t** data) {
+      *data = buf1;
+      return kNBytes1;
+    });
+    EXPECT_CALL(*file, Consume(5 * ts::PKT_SIZE)).WillOnce(testing::Return());
+    // Packets in the buffer of the file are not copied.
+    EXPECT_CALL(*sink, HandlePackets(reinterpret_cast<const ts::TSPacket*>(buf1), 5))
+        .WillOnce(testing::Return(true));
+    // A packet split across buffers of the file is copied.
+    EXPECT_CALL(*file, Peek).WillOnce([](const uint8_t** data) {
+      *data = buf1 + 5 * ts::PKT_SIZE;
+      return 100;
+    });
+    EXPECT_CALL(*file, Read(testing::_, ts::PKT_SIZE)).WillOnce([](uint8_t* buf, size_t) {
+      std::memcpy(buf, buf1 + 5 * ts::PKT_SIZE, 100);
+      return 100;
+    });
+    EXPECT_CALL(*file, Read(testing::_, ts::PKT_SIZE - 100)).WillOnce([](uint8_t* buf, size_t) {
+      std::memcpy(buf, buf2, ts::PKT_SIZE - 100);
+      return ts::PKT_SIZE - 100;
+    });
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 1)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Peek).WillOnce([](const uint8_t** data) {
+      *data = buf2 + ts::PKT_SIZE - 100;
+      return 3 * ts::PKT_SIZE;
+    });
+    EXPECT_CALL(*file, Consume(3 * ts::PKT_SIZE)).WillOnce(testing::Return());
+    EXPECT_CALL(*sink,
+        HandlePackets(reinterpret_cast<const ts::TSPacket*>(buf2 + ts::PKT_SIZE - 100), 3))
+        .WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Peek).WillOnce(testing::Return(0));  // EOF
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  EXPECT_CALL(*sink, HandlePacket).Times(0);  // Never called
+
+  FileSource src(std::move(file));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(PacketSourceTest, ReadChunkSize) {
+  static constexpr size_t kReadChunkSize = 4 * ts::PKT_SIZE;
+
+  auto file = std::make_unique<MockFile>();
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*file, Read(testing::_, kReadChunkSize)).WillOnce(testing::Return(0));  // EOF
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  FileSourceOption option;
+  option.read_chunk_size = kReadChunkSize;
+  FileSource src(std::move(file), option);
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(PacketSourceTest, AdaptiveReadChunkSize) {
+  static constexpr size_t kReadChunkSize = 4 * ts::PKT_SIZE;
+  static constexpr size_t kMaxReadChunkSize = 3 * kReadChunkSize;
+
+  auto file = std::make_unique<MockFile>();
+  auto sink = std::make_unique<MockBatchSink>();
+
+  auto read_full = [](uint8_t* buf, size_t size) {
+    for (auto* p = buf; p < buf + size; p += ts::PKT_SIZE) {
+      ts::NullPacket.copyTo(p);
+    }
+    return size;
+  };
+
+  EXPECT_CALL(*sink, HandlePackets).WillRepeatedly(testing::Return(true));
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    // The read chunk size grows after kNumFullReadsToGrow consecutive full reads.
+    EXPECT_CALL(*file, Read(testing::_, kReadChunkSize))
+        .Times(FileSource::kNumFullReadsToGrow)
+        .WillRepeatedly(read_full);
+    EXPECT_CALL(*file, Read(testing::_, 2 * kReadChunkSize))
+        .Times(FileSource::kNumFullReadsToGrow)
+        .WillRepeatedly(read_full);
+    // The read chunk size never exceeds the maximum.
+    EXPECT_CALL(*file, Read(testing::_, kMaxReadChunkSize))
+        .Times(FileSource::kNumFullReadsToGrow + 1)
+        .WillRepeatedly(read_full);
+    EXPECT_CALL(*file, Read(testing::_, kMaxReadChunkSize)).WillOnce(testing::Return(0));  // EOF
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  FileSourceOption option;
+  option.read_chunk_size = kReadChunkSize;
+  option.max_read_chunk_size = kMaxReadChunkSize;
+  FileSource src(std::move(file), option);
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(PacketSourceTest, AdaptiveReadChunkSizeWithPartialReads) {
+  static constexpr size_t kReadChunkSize = 4 * ts::PKT_SIZE;
+
+  auto file = std::make_unique<MockFile>();
+  auto sink = std::make_unique<MockBatchSink>();
+
+  auto read_full = [](uint8_t* buf, size_t size) {
+    for (auto* p = buf; p < buf + size; p += ts::PKT_SIZE) {
+      ts::NullPacket.copyTo(p);
+    }
+    return size;
+  };
+
+  auto read_partial = [](uint8_t* buf, size_t) {
+    ts::NullPacket.copyTo(buf);
+    return ts::PKT_SIZE;
+  };
+
+  EXPECT_CALL(*sink, HandlePackets).WillRepeatedly(testing::Return(true));
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    // A partial read resets the count of consecutive full reads.
+    EXPECT_CALL(*file, Read(testing::_, kReadChunkSize))
+        .Times(FileSource::kNumFullReadsToGrow - 1)
+        .WillRepeatedly(read_full);
+    EXPECT_CALL(*file, Read(testing::_, kReadChunkSize)).WillOnce(read_partial);
+    EXPECT_CALL(*file, Read(testing::_, kReadChunkSize))
+        .Times(FileSource::kNumFullReadsToGrow - 1)
+        .WillRepeatedly(read_full);
+    EXPECT_CALL(*file, Read(testing::_, kReadChunkSize)).WillOnce(testing::Return(0));  // EOF
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  FileSourceOption option;
+  option.read_chunk_size = kReadChunkSize;
+  option.max_read_chunk_size = 2 * kReadChunkSize;
+  FileSource src(std::move(file), option);
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+namespace {
+
+void AppendNullPackets(std::vector<uint8_t>* data, size_t num_packets) {
+  for (size_t i = 0; i < num_packets; ++i) {
+    data->insert(data->end(), ts::NullPacket.b, ts::NullPacket.b + ts::PKT_SIZE);
+  }
+}
+
+}  // namespace
+
+TEST(MmapFileSourceTest, EmptyFile) {
+  auto mapping = std::make_unique<MemoryFileMapping>(std::vector<uint8_t>{});
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  EXPECT_CALL(*sink, HandlePackets).Times(0);  // Never called
+
+  MmapFileSource src(std::move(mapping));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(MmapFileSourceTest, Batch) {
+  std::vector<uint8_t> data;
+  AppendNullPackets(&data, 5);
+  data.push_back(ts::SYNC_BYTE);  // incomplete packet
+  const auto* head = reinterpret_cast<const ts::TSPacket*>(data.data());
+
+  auto mapping = std::make_unique<MemoryFileMapping>(std::move(data));
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    // Packets are fed in place.
+    EXPECT_CALL(*sink, HandlePackets(head, 5)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  MmapFileSource src(std::move(mapping));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(MmapFileSourceTest, MaxBatchSize) {
+  std::vector<uint8_t> data;
+  AppendNullPackets(&data, MmapFileSource::kMaxBatchSize + 1);
+
+  auto mapping = std::make_unique<MemoryFileMapping>(std::move(data));
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePackets(testing::_, MmapFileSource::kMaxBatchSize))
+        .WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 1)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  MmapFileSource src(std::move(mapping));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(MmapFileSourceTest, Resync) {
+  std::vector<uint8_t> data;
+  AppendNullPackets(&data, 2);
+  data.push_back(0);  // garbage
+  AppendNullPackets(&data, 5);
+
+  auto mapping = std::make_unique<MemoryFileMapping>(std::move(data));
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 2)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, HandlePackets(testing::_, 5)).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  MmapFileSource src(std::move(mapping));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(MmapFileSourceTest, ResyncFailure) {
+  std::vector<uint8_t> data(MmapFileSource::kMaxResyncBytes, 0);  // no sync byte
+
+  auto mapping = std::make_unique<MemoryFileMapping>(std::move(data));
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  EXPECT_CALL(*sink, HandlePackets).Times(0);  // Never called
+
+  MmapFileSource src(std::move(mapping));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
+TEST(MmapFileSourceTest, ResyncFailedWithEOF) {
+  std::vector<uint8_t> data;
+  data.push_back(0);  // garbage
+  AppendNullPackets(&data, 3);
+
+  auto mapping = std::make_unique<MemoryFileMapping>(std::move(data));
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+
+  EXPECT_CALL(*sink, HandlePackets).Times(0);  // Never called
+
+  MmapFileSource src(std::move(mapping));
+  src.Connect(std::move(sink));
+  src.FeedPackets();
+}
+
 TEST(PacketSourceTest, Successfully) {
   auto file = std::make_unique<MockFile>();
   auto sink = std::make_unique<MockSink>();
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <tsduck/tsduck.h>
+
+#include "exit_code.hh"
+#include "pipelined_sink.hh"
+
+#include "test_helper.hh"
+
+namespace {
+
+ts::TSPacket MakePacket(size_t i) {
+  ts::TSPacket packet = ts::NullPacket;
+  std::memcpy(packet.b + 4, &i, sizeof(i));
+  return packet;
+}
+
+size_t GetPacketIndex(const ts::TSPacket& packet) {
+  size_t i;
+  std::memcpy(&i, packet.b + 4, sizeof(i));
+  return i;
+}
+
+// Collects packets on the consumer thread.  Members must be accessed after End().
+class CollectSink final : public PacketSink {
+ public:
+  explicit CollectSink(size_t max_packets = SIZE_MAX) : max_packets_(max_packets) {}
+  ~CollectSink() override = default;
+
+  bool Start() override {
+    started = true;
+    return true;
+  }
+
+  void End() override {
+    ended = true;
+  }
+
+  int GetExitCode() const override {
+    return EXIT_RETRY;
+  }
+
+  bool HandlePacket(const ts::TSPacket& packet) override {
+    return HandlePackets(&packet, 1);
+  }
+
+  bool HandlePackets(const ts::TSPacket* packets, size_t num_packets) override {
+    num_batches++;
+    for (size_t i = 0; i < num_packets; ++i) {
+      indexes.push_back(GetPacketIndex(packets[i]));
+      if (indexes.size() == max_packets_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool started = false;
+  bool ended = false;
+  size_t num_batches = 0;
+  std::vector<size_t> indexes;
+
+ private:
+  size_t max_packets_;
+};
+
+}  // namespace
+
+TEST(PipelinedSinkTest, NoPacket) {
+  auto sink = std::make_unique<MockBatchSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*sink, End).WillOnce(testing::Return());
+    EXPECT_CALL(*sink, GetExitCode).WillOnce(testing::Return(EXIT_SUCCESS));
+  }
+  EXPECT_CALL(*sink, HandlePackets).Times(0);
+
+  PipelinedSink pipeline(std::move(sink));
+  EXPECT_TRUE(pipeline.Start());
+  pipeline.End();
+  EXPECT_EQ(EXIT_SUCCESS, pipeline.GetExitCode());
+  EXPECT_EQ(0, pipeline.max_occupancy());
+}
+
+TEST(PipelinedSinkTest, StartFailure) {
+  auto sink = std::make_unique<MockBatchSink>();
+
+  EXPECT_CALL(*sink, Start).WillOnce(testing::Return(false));
+  EXPECT_CALL(*sink, End).Times(0);
+  EXPECT_CALL(*sink, HandlePackets).Times(0);
+
+  PipelinedSink pipeline(std::move(sink));
+  EXPECT_FALSE(pipeline.Start());
+}
+
+TEST(PipelinedSinkTest, Packets) {
+  constexpr size_t kNumPackets = 10000;
+  constexpr size_t kCapacity = 100;
+
+  auto sink = std::make_unique<CollectSink>();
+  auto* collect = sink.get();
+
+  PipelinedSinkOption option;
+  option.capacity = kCapacity;
+  PipelinedSink pipeline(std::move(sink), option);
+  EXPECT_TRUE(pipeline.Start());
+
+  // Mix single packets and batches larger than the capacity.
+  std::vector<ts::TSPacket> batch;
+  for (size_t i = 0; i < kNumPackets; ++i) {
+    if (i % 1000 == 0) {
+      EXPECT_TRUE(pipeline.HandlePacket(MakePacket(i)));
+      continue;
+    }
+    batch.push_back(MakePacket(i));
+    if (batch.size() == 3 * kCapacity / 2) {
+      EXPECT_TRUE(pipeline.HandlePackets(batch.data(), batch.size()));
+      batch.clear();
+    }
+  }
+  EXPECT_TRUE(pipeline.HandlePackets(batch.data(), batch.size()));
+  pipeline.End();
+
+  EXPECT_TRUE(collect->started);
+  EXPECT_TRUE(collect->ended);
+  EXPECT_EQ(EXIT_RETRY, pipeline.GetExitCode());
+  EXPECT_LT(pipeline.max_occupancy(), kCapacity);
+
+  // Packets are not reordered even though they are fed in a different order.
+  ASSERT_EQ(kNumPackets, collect->indexes.size());
+  std::vector<size_t> expected;
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < kNumPackets; ++i) {
+    if (i % 1000 == 0) {
+      expected.push_back(i);
+      continue;
+    }
+    pending.push_back(i);
+    if (pending.size() == 3 * kCapacity / 2) {
+      expected.insert(expected.end(), pending.begin(), pending.end());
+      pending.clear();
+    }
+  }
+  expected.insert(expected.end(), pending.begin(), pending.end());
+  EXPECT_EQ(expected, collect->indexes);
+}
+
+TEST(PipelinedSinkTest, SinkStopped) {
+  constexpr size_t kMaxPackets = 10;
+
+  auto sink = std::make_unique<CollectSink>(kMaxPackets);
+  auto* collect = sink.get();
+
+  PipelinedSinkOption option;
+  option.capacity = 4;
+  PipelinedSink pipeline(std::move(sink), option);
+  EXPECT_TRUE(pipeline.Start());
+
+  // The producer detects the stop of the sink eventually.
+  size_t num_packets = 0;
+  for (;;) {
+    if (!pipeline.HandlePacket(MakePacket(num_packets))) {
+      break;
+    }
+    num_packets++;
+    ASSERT_LT(num_packets, 1000000);
+  }
+  EXPECT_GE(num_packets, kMaxPackets - 1);
+  pipeline.End();
+
+  EXPECT_TRUE(collect->ended);
+  ASSERT_EQ(kMaxPackets, collect->indexes.size());
+  for (size_t i = 0; i < kMaxPackets; ++i) {
+    EXPECT_EQ(i, collect->indexes[i]);
+  }
+}
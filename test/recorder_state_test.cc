@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "recorder_state.hh"
+
+#include "test_helper.hh"
+
+namespace {
+RecorderStateRecord MakeRecord(uint64_t pos) {
+  RecorderStateRecord record = {};
+  record.sid = 3;
+  record.clock_pid = 0x01FF;
+  record.chunk_size = 8192;
+  record.num_chunks = 10;
+  record.pos = pos;
+  record.timestamp = 1;
+  record.clock_pcr = 2;
+  record.clock_time = 3;
+  record.eid = 4;
+  return record;
+}
+}  // namespace
+
+TEST(RecorderStateFileTest, Empty) {
+  std::vector<uint8_t> data;
+  RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+  RecorderStateRecord record;
+  EXPECT_FALSE(state.Load(&record));
+}
+
+TEST(RecorderStateFileTest, SaveAndLoad) {
+  std::vector<uint8_t> data;
+  {
+    auto file = std::make_unique<MemoryFile>(&data);
+    auto* file_ptr = file.get();
+    RecorderStateFile state(std::move(file));
+    EXPECT_TRUE(state.Save(MakeRecord(8192)));
+    EXPECT_EQ(1, file_ptr->num_syncs);
+  }
+
+  RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+  RecorderStateRecord record;
+  ASSERT_TRUE(state.Load(&record));
+  EXPECT_EQ(0, std::memcmp(RecorderStateRecord::kMagic, record.magic, sizeof(record.magic)));
+  EXPECT_EQ(RecorderStateRecord::kVersion, record.version);
+  EXPECT_EQ(1, record.sequence);
+  EXPECT_EQ(3, record.sid);
+  EXPECT_EQ(0x01FF, record.clock_pid);
+  EXPECT_EQ(8192, record.chunk_size);
+  EXPECT_EQ(10, record.num_chunks);
+  EXPECT_EQ(8192, record.pos);
+  EXPECT_EQ(1, record.timestamp);
+  EXPECT_EQ(2, record.clock_pcr);
+  EXPECT_EQ(3, record.clock_time);
+  EXPECT_EQ(4, record.eid);
+}
+
+TEST(RecorderStateFileTest, AlternateSlots) {
+  std::vector<uint8_t> data;
+  RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+
+  EXPECT_TRUE(state.Save(MakeRecord(8192)));
+  EXPECT_EQ(sizeof(RecorderStateRecord), data.size());
+
+  EXPECT_TRUE(state.Save(MakeRecord(8192 * 2)));
+  EXPECT_EQ(RecorderStateFile::kSlotSize + sizeof(RecorderStateRecord), data.size());
+
+  EXPECT_TRUE(state.Save(MakeRecord(8192 * 3)));
+  RecorderStateRecord slot0;
+  std::memcpy(&slot0, data.data(), sizeof(slot0));
+  EXPECT_EQ(3, slot0.sequence);
+  EXPECT_EQ(8192 * 3, slot0.pos);
+
+  RecorderStateRecord record;
+  ASSERT_TRUE(state.Load(&record));
+  EXPECT_EQ(3, record.sequence);
+  EXPECT_EQ(8192 * 3, record.pos);
+}
+
+TEST(RecorderStateFileTest, FallbackToOlderSlot) {
+  std::vector<uint8_t> data;
+  {
+    RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+    EXPECT_TRUE(state.Save(MakeRecord(8192)));
+    EXPECT_TRUE(state.Save(MakeRecord(8192 * 2)));
+  }
+
+  // Break the latest record in the slot#1 as if the process crashed while writing it.
+  data[RecorderStateFile::kSlotSize + offsetof(RecorderStateRecord, pos)] ^= 0xFF;
+
+  RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+  RecorderStateRecord record;
+  ASSERT_TRUE(state.Load(&record));
+  EXPECT_EQ(1, record.sequence);
+  EXPECT_EQ(8192, record.pos);
+
+  // The broken slot is overwritten next time.
+  EXPECT_TRUE(state.Save(MakeRecord(8192 * 3)));
+  RecorderStateRecord slot1;
+  std::memcpy(&slot1, data.data() + RecorderStateFile::kSlotSize, sizeof(slot1));
+  EXPECT_EQ(2, slot1.sequence);
+  EXPECT_EQ(8192 * 3, slot1.pos);
+}
+
+TEST(RecorderStateFileTest, ContinueSequence) {
+  std::vector<uint8_t> data;
+  {
+    RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+    EXPECT_TRUE(state.Save(MakeRecord(8192)));
+    EXPECT_TRUE(state.Save(MakeRecord(8192 * 2)));
+    EXPECT_TRUE(state.Save(MakeRecord(8192 * 3)));
+  }
+
+  RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+  RecorderStateRecord record;
+  ASSERT_TRUE(state.Load(&record));
+  EXPECT_EQ(3, record.sequence);
+
+  // The latest record in the slot#0 must be kept.
+  EXPECT_TRUE(state.Save(MakeRecord(8192 * 4)));
+  RecorderStateRecord slot0;
+  std::memcpy(&slot0, data.data(), sizeof(slot0));
+  EXPECT_EQ(3, slot0.sequence);
+
+  ASSERT_TRUE(state.Load(&record));
+  EXPECT_EQ(4, record.sequence);
+  EXPECT_EQ(8192 * 4, record.pos);
+}
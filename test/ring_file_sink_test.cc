@@ -15,8 +15,11 @@
 // not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
 // 02110-1301, USA.
 
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <vector>
 
 #include <fmt/format.h>
 #include <gmock/gmock.h>
@@ -34,13 +37,20 @@ constexpr size_t kNumChunks = 2;
 constexpr size_t kChunkSize = RingFileSink::kBufferSize * kNumBuffers;
 constexpr uint64_t kRingSize = kChunkSize * kNumChunks;
 
+const RingFileSinkOption kAsyncOption{true, 2};
+
 class MockPacketRingObserver final : public PacketRingObserver {
  public:
   MockPacketRingObserver() = default;
   ~MockPacketRingObserver() override = default;
   MOCK_METHOD(void, OnEndOfChunk, (uint64_t), (override));
+  MOCK_METHOD(void, OnEndOfBlock, (uint64_t), (override));
 };
 
+std::vector<ts::TSPacket> MakePackets(size_t num_bytes) {
+  return std::vector<ts::TSPacket>((num_bytes + ts::PKT_SIZE - 1) / ts::PKT_SIZE, ts::NullPacket);
+}
+
 }  // namespace
 
 TEST(RingFileSinkTest, MaxValues) {
@@ -117,8 +127,46 @@ TEST(RingFileSinkTest, ReachBufferSize) {
       ts::NullPacket.copyTo(buf);
       return ts::PKT_SIZE;
     });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
+      EXPECT_EQ(RingFileSink::kBufferSize, size);
+      return size;
+    });
+    EXPECT_CALL(*file, Read).WillOnce(testing::Return(0));  // EOF
+  }
+
+  EXPECT_CALL(*ring, Sync).Times(0);             // never called
+  EXPECT_CALL(*ring, Trunc).Times(0);            // never called
+  EXPECT_CALL(*ring, Seek).Times(0);             // never called
+  EXPECT_CALL(observer, OnEndOfChunk).Times(0);  // never called
+
+  FileSource src(std::move(file));
+  auto sink = std::make_unique<RingFileSink>(std::move(ring), kChunkSize, kNumChunks);
+  sink->SetObserver(&observer);
+  src.Connect(std::move(sink));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+}
+
+TEST(RingFileSinkTest, WriteBatch) {
+  constexpr auto kNumPackets = FileSource::kReadChunkSize / ts::PKT_SIZE;
+  static_assert(kNumPackets * ts::PKT_SIZE > RingFileSink::kBufferSize);
+  static_assert(kNumPackets * ts::PKT_SIZE < kChunkSize);
+
+  auto file = std::make_unique<MockFile>();
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*file, Read).WillOnce([](uint8_t* buf, size_t) {
+      for (size_t i = 0; i < kNumPackets; ++i) {
+        ts::NullPacket.copyTo(buf + i * ts::PKT_SIZE);
+      }
+      return kNumPackets * ts::PKT_SIZE;
+    });
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
+      EXPECT_EQ(ts::SYNC_BYTE, buf[0]);
+      EXPECT_EQ(ts::SYNC_BYTE, buf[ts::PKT_SIZE]);
       return size;
     });
     EXPECT_CALL(*file, Read).WillOnce(testing::Return(0));  // EOF
@@ -150,7 +198,7 @@ TEST(RingFileSinkTest, ReachChunkSize) {
       ts::NullPacket.copyTo(buf);
       return ts::PKT_SIZE;
     });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -160,7 +208,7 @@ TEST(RingFileSinkTest, ReachChunkSize) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -192,7 +240,7 @@ TEST(RingFileSinkTest, ReachRingSize) {
       ts::NullPacket.copyTo(buf);
       return ts::PKT_SIZE;
     });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -202,7 +250,7 @@ TEST(RingFileSinkTest, ReachRingSize) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -214,7 +262,7 @@ TEST(RingFileSinkTest, ReachRingSize) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -224,7 +272,7 @@ TEST(RingFileSinkTest, ReachRingSize) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -291,7 +339,7 @@ TEST(RingFileSinkTest, FailSyncInFlush) {
       ts::NullPacket.copyTo(buf);
       return ts::PKT_SIZE;
     });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -301,7 +349,7 @@ TEST(RingFileSinkTest, FailSyncInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -335,7 +383,7 @@ TEST(RingFileSinkTest, FailTruncInFlush) {
       ts::NullPacket.copyTo(buf);
       return ts::PKT_SIZE;
     });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -345,7 +393,7 @@ TEST(RingFileSinkTest, FailTruncInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -357,7 +405,7 @@ TEST(RingFileSinkTest, FailTruncInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -367,7 +415,7 @@ TEST(RingFileSinkTest, FailTruncInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -403,7 +451,7 @@ TEST(RingFileSinkTest, FailSeekInFlush) {
       ts::NullPacket.copyTo(buf);
       return ts::PKT_SIZE;
     });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -413,7 +461,7 @@ TEST(RingFileSinkTest, FailSeekInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -425,7 +473,7 @@ TEST(RingFileSinkTest, FailSeekInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -435,7 +483,7 @@ TEST(RingFileSinkTest, FailSeekInFlush) {
           ts::NullPacket.copyTo(buf);
           return ts::PKT_SIZE;
         });
-    EXPECT_CALL(*ring, Write).WillOnce([](uint8_t* buf, size_t size) {
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
       EXPECT_EQ(RingFileSink::kBufferSize, size);
       return size;
     });
@@ -484,3 +532,390 @@ TEST(RingFileSinkTest, SetPosition) {
   src.Connect(std::move(sink));
   EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
 }
+
+TEST(RingFileSinkTest, AsyncReachRingSize) {
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+  std::atomic<size_t> num_written{0};
+  std::atomic<size_t> num_synced{0};
+
+  EXPECT_CALL(*ring, Write).WillRepeatedly([&num_written](const uint8_t* buf, size_t size) {
+    EXPECT_EQ(0, size % RingFileSink::kBufferSize);
+    num_written += size;
+    return size;
+  });
+  EXPECT_CALL(*ring, Sync).Times(2).WillRepeatedly([&num_synced]() {
+    num_synced++;
+    return true;
+  });
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(observer, OnEndOfChunk).WillOnce([&num_synced](uint64_t pos) {
+      EXPECT_EQ(kChunkSize, pos);
+      // Notified after the chunk has been synced.
+      EXPECT_LE(1, num_synced.load());
+    });
+    EXPECT_CALL(observer, OnEndOfChunk).WillOnce([&num_synced](uint64_t pos) {
+      EXPECT_EQ(kRingSize, pos);
+      EXPECT_EQ(2, num_synced.load());
+    });
+  }
+  EXPECT_CALL(*ring, Trunc).WillOnce([](int64_t size) {
+    EXPECT_EQ(kRingSize, size);
+    return true;
+  });
+  EXPECT_CALL(*ring, Seek).WillOnce([](int64_t offset, SeekMode mode) {
+    EXPECT_EQ(0, offset);
+    EXPECT_EQ(SeekMode::kSet, mode);
+    return 0;
+  });
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kAsyncOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  // More than the number of buffers.  Some packets are left in the buffer being filled.
+  auto packets = MakePackets(kRingSize + 1);
+  for (const auto& packet : packets) {
+    EXPECT_TRUE(sink.HandlePacket(packet));
+  }
+  sink.End();
+  EXPECT_EQ(kRingSize, num_written.load());
+  EXPECT_EQ(ts::PKT_SIZE * packets.size() - kRingSize, sink.pos());
+  EXPECT_FALSE(sink.IsBroken());
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, AsyncDrain) {
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  EXPECT_CALL(*ring, Write).WillRepeatedly([](const uint8_t* buf, size_t size) { return size; });
+  EXPECT_CALL(*ring, Sync).WillOnce(testing::Return(true));
+  EXPECT_CALL(*ring, Trunc).Times(0);
+  EXPECT_CALL(*ring, Seek).Times(0);
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kAsyncOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kChunkSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+
+  // The observer is notified in Drain() at the latest.
+  EXPECT_CALL(observer, OnEndOfChunk).WillOnce([](uint64_t pos) { EXPECT_EQ(kChunkSize, pos); });
+  sink.Drain();
+  testing::Mock::VerifyAndClearExpectations(&observer);
+
+  EXPECT_CALL(observer, OnEndOfChunk).Times(0);
+  sink.End();
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, AsyncFailWrite) {
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  EXPECT_CALL(*ring, Write).WillOnce(testing::Return(-1));
+  EXPECT_CALL(*ring, Sync).Times(0);
+  EXPECT_CALL(*ring, Trunc).Times(0);
+  EXPECT_CALL(*ring, Seek).Times(0);
+  EXPECT_CALL(observer, OnEndOfChunk).Times(0);
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kAsyncOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(RingFileSink::kBufferSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.Drain();
+  EXPECT_TRUE(sink.IsBroken());
+  // Fails once the failure of the I/O thread is detected.
+  EXPECT_FALSE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(EXIT_FAILURE, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, AsyncFailSync) {
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  EXPECT_CALL(*ring, Write).WillRepeatedly([](const uint8_t* buf, size_t size) { return size; });
+  EXPECT_CALL(*ring, Sync).WillOnce(testing::Return(false));
+  EXPECT_CALL(*ring, Trunc).Times(0);
+  EXPECT_CALL(*ring, Seek).Times(0);
+  EXPECT_CALL(observer, OnEndOfChunk).Times(0);
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kAsyncOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kChunkSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_TRUE(sink.IsBroken());
+  EXPECT_EQ(EXIT_FAILURE, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, LargeBlockSize) {
+  const RingFileSinkOption kOption{false, 0, kChunkSize, false};
+
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*ring, Write).WillOnce([](const uint8_t* buf, size_t size) {
+      EXPECT_EQ(kChunkSize, size);
+      return size;
+    });
+    EXPECT_CALL(*ring, Sync).WillOnce(testing::Return(true));
+    EXPECT_CALL(observer, OnEndOfChunk).WillOnce([](uint64_t pos) { EXPECT_EQ(kChunkSize, pos); });
+  }
+  EXPECT_CALL(*ring, Trunc).Times(0);
+  EXPECT_CALL(*ring, Seek).Times(0);
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  // Less than the block size.
+  auto packets = MakePackets(kChunkSize - RingFileSink::kBufferSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  // Reach the block size.
+  packets = MakePackets(RingFileSink::kBufferSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, DirectIo) {
+  const RingFileSinkOption kOption{false, 0, 0, true};
+
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  // Packets are always copied into the aligned buffer.
+  EXPECT_CALL(*ring, Write).Times(kNumBuffers).WillRepeatedly([](const uint8_t* buf, size_t size) {
+    EXPECT_EQ(RingFileSink::kBufferSize, size);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(buf) % RingFileSink::kAlignment);
+    return size;
+  });
+  EXPECT_CALL(*ring, Sync).WillOnce(testing::Return(true));
+  EXPECT_CALL(*ring, Trunc).Times(0);
+  EXPECT_CALL(*ring, Seek).Times(0);
+  EXPECT_CALL(observer, OnEndOfChunk).WillOnce([](uint64_t pos) { EXPECT_EQ(kChunkSize, pos); });
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kChunkSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, AsyncDirectIoReachRingSize) {
+  const RingFileSinkOption kOption{true, 2, kChunkSize, true};
+
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+  std::atomic<size_t> num_written{0};
+
+  EXPECT_CALL(*ring, Write).WillRepeatedly([&num_written](const uint8_t* buf, size_t size) {
+    EXPECT_EQ(0, size % kChunkSize);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(buf) % RingFileSink::kAlignment);
+    num_written += size;
+    return size;
+  });
+  EXPECT_CALL(*ring, Sync).Times(2).WillRepeatedly(testing::Return(true));
+  EXPECT_CALL(observer, OnEndOfChunk).Times(2);
+  EXPECT_CALL(*ring, Trunc).WillOnce([](int64_t size) {
+    EXPECT_EQ(kRingSize, size);
+    return true;
+  });
+  EXPECT_CALL(*ring, Seek).WillOnce([](int64_t offset, SeekMode mode) {
+    EXPECT_EQ(0, offset);
+    EXPECT_EQ(SeekMode::kSet, mode);
+    return 0;
+  });
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kRingSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(kRingSize, num_written.load());
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, PreallocateReachRingSize) {
+  const RingFileSinkOption kOption{false, 0, 0, false, true, false};
+
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+  std::vector<int64_t> offsets;
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*ring, Trunc).WillOnce([](int64_t size) {
+      EXPECT_EQ(kRingSize, size);
+      return true;
+    });
+    EXPECT_CALL(*ring, Allocate).WillOnce([](int64_t size, bool keep_size) {
+      EXPECT_EQ(kRingSize, size);
+      EXPECT_FALSE(keep_size);
+      return true;
+    });
+  }
+  EXPECT_CALL(*ring, Write).Times(0);
+  EXPECT_CALL(*ring, WriteAt).WillRepeatedly(
+      [&offsets](const uint8_t* buf, size_t size, int64_t offset) {
+        EXPECT_EQ(RingFileSink::kBufferSize, size);
+        offsets.push_back(offset);
+        return size;
+      });
+  EXPECT_CALL(*ring, Sync).Times(kNumChunks + 1).WillRepeatedly(testing::Return(true));
+  EXPECT_CALL(*ring, Seek).Times(0);
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(observer, OnEndOfChunk).WillOnce([](uint64_t pos) { EXPECT_EQ(kChunkSize, pos); });
+    EXPECT_CALL(observer, OnEndOfChunk).WillOnce([](uint64_t pos) { EXPECT_EQ(kRingSize, pos); });
+    EXPECT_CALL(observer, OnEndOfChunk).WillOnce([](uint64_t pos) { EXPECT_EQ(kChunkSize, pos); });
+  }
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  // Wrap around and write the first chunk again.
+  auto packets = MakePackets(kRingSize + kChunkSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+
+  std::vector<int64_t> expected;
+  for (uint64_t pos = 0; pos < kRingSize + kChunkSize; pos += RingFileSink::kBufferSize) {
+    expected.push_back(static_cast<int64_t>(pos % kRingSize));
+  }
+  EXPECT_EQ(expected, offsets);
+}
+
+TEST(RingFileSinkTest, PreallocateSetPosition) {
+  const RingFileSinkOption kOption{false, 0, 0, false, true, true};
+
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  EXPECT_CALL(*ring, Trunc).Times(0);
+  EXPECT_CALL(*ring, Allocate).WillOnce([](int64_t size, bool keep_size) {
+    EXPECT_EQ(kRingSize, size);
+    EXPECT_TRUE(keep_size);
+    return true;
+  });
+  EXPECT_CALL(*ring, Seek).Times(0);
+  EXPECT_CALL(*ring, WriteAt).WillOnce([](const uint8_t* buf, size_t size, int64_t offset) {
+    EXPECT_EQ(RingFileSink::kBufferSize, size);
+    EXPECT_EQ(kChunkSize, offset);
+    return size;
+  });
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  EXPECT_TRUE(sink.SetPosition(kChunkSize));
+  auto packets = MakePackets(RingFileSink::kBufferSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, PreallocateFailAllocate) {
+  const RingFileSinkOption kOption{false, 0, 0, false, true, true};
+
+  auto ring = std::make_unique<MockFile>();
+
+  EXPECT_CALL(*ring, Allocate).WillOnce(testing::Return(false));
+  EXPECT_CALL(*ring, WriteAt).Times(0);
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  EXPECT_FALSE(sink.Start());
+  EXPECT_TRUE(sink.IsBroken());
+  EXPECT_EQ(EXIT_FAILURE, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, AsyncPreallocateReachRingSize) {
+  const RingFileSinkOption kOption{true, 2, 0, false, true, false};
+
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+  std::atomic<size_t> num_written{0};
+
+  EXPECT_CALL(*ring, Trunc).WillOnce(testing::Return(true));
+  EXPECT_CALL(*ring, Allocate).WillOnce(testing::Return(true));
+  EXPECT_CALL(*ring, Write).Times(0);
+  EXPECT_CALL(*ring, WriteAt)
+      .WillRepeatedly([&num_written](const uint8_t* buf, size_t size, int64_t offset) {
+        // Only the I/O thread writes, so the file is written sequentially.
+        EXPECT_EQ(num_written.load() % kRingSize, offset);
+        num_written += size;
+        return size;
+      });
+  EXPECT_CALL(*ring, Sync).Times(kNumChunks + 1).WillRepeatedly(testing::Return(true));
+  EXPECT_CALL(*ring, Seek).Times(0);
+  EXPECT_CALL(observer, OnEndOfChunk).Times(kNumChunks + 1);
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kRingSize + kChunkSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(kRingSize + kChunkSize, num_written.load());
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, EndOfBlock) {
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+
+  EXPECT_CALL(*ring, Write).WillRepeatedly([](const uint8_t* buf, size_t size) { return size; });
+  EXPECT_CALL(*ring, Sync).WillOnce(testing::Return(true));
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(observer, OnEndOfBlock(RingFileSink::kBufferSize));
+    EXPECT_CALL(observer, OnEndOfChunk(kChunkSize));
+    EXPECT_CALL(observer, OnEndOfBlock(kChunkSize));
+    EXPECT_CALL(observer, OnEndOfBlock(kChunkSize + RingFileSink::kBufferSize));
+  }
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kChunkSize + RingFileSink::kBufferSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
+
+TEST(RingFileSinkTest, AsyncEndOfBlock) {
+  auto ring = std::make_unique<MockFile>();
+  MockPacketRingObserver observer;
+  uint64_t written_pos = 0;
+
+  EXPECT_CALL(*ring, Write).WillRepeatedly([](const uint8_t* buf, size_t size) { return size; });
+  EXPECT_CALL(*ring, Sync).WillOnce(testing::Return(true));
+  EXPECT_CALL(observer, OnEndOfChunk(kChunkSize)).WillOnce([&written_pos](uint64_t) {
+    // Notified before the position after the chunk.
+    EXPECT_LE(written_pos, kChunkSize);
+  });
+  EXPECT_CALL(observer, OnEndOfBlock).WillRepeatedly([&written_pos](uint64_t pos) {
+    EXPECT_LT(written_pos, pos);
+    written_pos = pos;
+  });
+
+  RingFileSink sink(std::move(ring), kChunkSize, kNumChunks, kAsyncOption);
+  sink.SetObserver(&observer);
+  EXPECT_TRUE(sink.Start());
+  auto packets = MakePackets(kChunkSize + RingFileSink::kBufferSize);
+  EXPECT_TRUE(sink.HandlePackets(packets.data(), packets.size()));
+  sink.End();
+  // Notified in Drain().
+  EXPECT_EQ(kChunkSize + RingFileSink::kBufferSize, written_pos);
+  EXPECT_EQ(EXIT_SUCCESS, sink.GetExitCode());
+}
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <tsduck/tsduck.h>
+
+#include "chunk_index.hh"
+#include "ring_reader.hh"
+
+#include "test_helper.hh"
+
+using ::testing::_;
+using ::testing::Invoke;
+
+namespace {
+constexpr uint16_t kSid = 3;
+constexpr ts::PID kPid = 0x0111;
+constexpr size_t kChunkSize = ts::PKT_SIZE * 10;
+constexpr size_t kNumChunks = 4;
+constexpr size_t kRingSize = kChunkSize * kNumChunks;
+
+// Fills the ring buffer with packets numbered from 0.
+std::vector<uint8_t> MakeRing(size_t ring_size) {
+  std::vector<uint8_t> ring(ring_size, 0xFF);
+  for (size_t pos = 0; pos + ts::PKT_SIZE <= ring_size; pos += ts::PKT_SIZE) {
+    ring[pos] = ts::SYNC_BYTE;
+    ring[pos + 1] = static_cast<uint8_t>(kPid >> 8);
+    ring[pos + 2] = static_cast<uint8_t>(kPid & 0xFF);
+    ring[pos + 3] = 0x10;
+    ring[pos + 4] = static_cast<uint8_t>(pos / ts::PKT_SIZE);
+  }
+  return ring;
+}
+
+class RingReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    index_data_.resize(GetChunkIndexFileSize(kNumChunks));
+    index_ = std::make_unique<ChunkIndex>(
+        std::make_unique<MemoryMutableFileMapping>(&index_data_), kSid, kChunkSize, kNumChunks);
+    ring_ = MakeRing(kRingSize);
+  }
+
+  void SetChunkSize(size_t chunk_size) {
+    chunk_size_ = chunk_size;
+    index_data_.assign(GetChunkIndexFileSize(kNumChunks), 0);
+    index_ = std::make_unique<ChunkIndex>(std::make_unique<MemoryMutableFileMapping>(&index_data_),
+        kSid, chunk_size, kNumChunks);
+    ring_ = MakeRing(chunk_size * kNumChunks);
+  }
+
+  void Record(size_t chunk, int64_t timestamp, uint16_t eid) {
+    index_->StartChunk(chunk * kChunkSize, timestamp, eid);
+    index_->EndChunk((chunk + 1) * kChunkSize, timestamp + 1000);
+  }
+
+  int Read(const RingReaderOption& base_option) {
+    auto option = base_option;
+    option.chunk_size = chunk_size_;
+    option.num_chunks = kNumChunks;
+
+    auto file = std::make_unique<MockFile>();
+    EXPECT_CALL(*file, ReadAt(_, _, _))
+        .WillRepeatedly(Invoke([this](uint8_t* buf, size_t len, int64_t offset) {
+          auto pos = static_cast<size_t>(offset);
+          if (pos >= ring_.size()) {
+            return static_cast<ssize_t>(0);
+          }
+          len = std::min(len, ring_.size() - pos);
+          std::memcpy(buf, ring_.data() + pos, len);
+          return static_cast<ssize_t>(len);
+        }));
+
+    auto out = std::make_unique<MockFile>();
+    EXPECT_CALL(*out, Write(_, _))
+        .WillRepeatedly(Invoke([this](const uint8_t* buf, size_t len) {
+          output_.insert(output_.end(), buf, buf + len);
+          return static_cast<ssize_t>(len);
+        }));
+
+    auto index = std::make_unique<ChunkIndexReader>(
+        std::make_unique<MemoryFileMapping>(std::vector<uint8_t>(index_data_)), chunk_size_,
+        kNumChunks);
+
+    RingReader reader(option, std::move(file), std::move(index), std::move(out));
+    return reader.Run();
+  }
+
+  std::vector<uint8_t> Slice(size_t begin, size_t end) const {
+    return std::vector<uint8_t>(ring_.begin() + begin, ring_.begin() + end);
+  }
+
+  size_t chunk_size_ = kChunkSize;
+  std::vector<uint8_t> index_data_;
+  std::unique_ptr<ChunkIndex> index_;
+  std::vector<uint8_t> ring_;
+  std::vector<uint8_t> output_;
+};
+}  // namespace
+
+TEST_F(RingReaderTest, InvalidIndex) {
+  std::fill(index_data_.begin(), index_data_.end(), 0);
+  RingReaderOption option;
+  EXPECT_EQ(EXIT_FAILURE, Read(option));
+  EXPECT_TRUE(output_.empty());
+}
+
+TEST_F(RingReaderTest, NoChunk) {
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kTime;
+  option.time = 1000;
+  EXPECT_EQ(EXIT_FAILURE, Read(option));
+}
+
+TEST_F(RingReaderTest, SeekByPos) {
+  Record(0, 1000, 1);
+  Record(1, 2000, 1);
+  Record(2, 3000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = kChunkSize;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  // No PAT/PMT in the ring buffer.  The chunk being written is not read.
+  EXPECT_EQ(Slice(kChunkSize, kChunkSize * 3), output_);
+}
+
+TEST_F(RingReaderTest, SeekByPosOutOfRange) {
+  Record(0, 1000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = kRingSize;
+  EXPECT_EQ(EXIT_FAILURE, Read(option));
+}
+
+TEST_F(RingReaderTest, SeekByTime) {
+  Record(0, 1000, 1);
+  index_->StartChunk(kChunkSize, 2000, 1);
+  index_->SetKeyframeOffset(kChunkSize + ts::PKT_SIZE * 2);
+  index_->EndChunk(kChunkSize * 2, 3000);
+  Record(2, 3000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kTime;
+  option.time = 2500;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  // Starts from the keyframe.
+  EXPECT_EQ(Slice(kChunkSize + ts::PKT_SIZE * 2, kChunkSize * 3), output_);
+}
+
+TEST_F(RingReaderTest, SeekByTimeWrapAround) {
+  Record(0, 1000, 1);
+  Record(1, 2000, 1);
+  Record(2, 3000, 1);
+  Record(3, 4000, 1);
+  Record(0, 5000, 1);
+  // Chunk#1 is being overwritten.
+  index_->StartChunk(kChunkSize, 6000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kTime;
+  option.time = 1500;  // older than any chunk
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  auto expected = Slice(kChunkSize * 2, kRingSize);
+  auto first = Slice(0, kChunkSize);
+  expected.insert(expected.end(), first.begin(), first.end());
+  EXPECT_EQ(expected, output_);
+}
+
+TEST_F(RingReaderTest, SeekByEid) {
+  Record(0, 1000, 1);
+  Record(1, 2000, 2);
+  Record(2, 3000, 2);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kEid;
+  option.eid = 2;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  // The event started in the chunk#0.
+  EXPECT_EQ(Slice(0, kChunkSize * 3), output_);
+}
+
+TEST_F(RingReaderTest, SeekByEidNotContiguous) {
+  Record(0, 1000, 1);
+  Record(1, 5000, 2);
+  Record(2, 6000, 2);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kEid;
+  option.eid = 2;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  EXPECT_EQ(Slice(kChunkSize, kChunkSize * 3), output_);
+}
+
+TEST_F(RingReaderTest, SeekByEidNotFound) {
+  Record(0, 1000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kEid;
+  option.eid = 2;
+  EXPECT_EQ(EXIT_FAILURE, Read(option));
+}
+
+TEST_F(RingReaderTest, SkipChunkNotCompleted) {
+  Record(0, 1000, 1);
+  // Chunk#1 has never been recorded.
+  index_->StartChunk(kChunkSize * 2, 3000, 1);
+  index_->EndChunk(kChunkSize * 3, 4000);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = 0;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  auto expected = Slice(0, kChunkSize);
+  auto last = Slice(kChunkSize * 2, kChunkSize * 3);
+  expected.insert(expected.end(), last.begin(), last.end());
+  EXPECT_EQ(expected, output_);
+}
+
+TEST_F(RingReaderTest, SyncPackets) {
+  // Packets span chunk boundaries.
+  static constexpr size_t kUnalignedChunkSize = 2000;
+  index_data_.assign(GetChunkIndexFileSize(kNumChunks), 0);
+  index_ = std::make_unique<ChunkIndex>(std::make_unique<MemoryMutableFileMapping>(&index_data_),
+      kSid, kUnalignedChunkSize, kNumChunks);
+  ring_ = MakeRing(kUnalignedChunkSize * kNumChunks);
+  index_->StartChunk(0, 1000, 1);
+  index_->EndChunk(kUnalignedChunkSize, 2000);
+  index_->StartChunk(kUnalignedChunkSize, 2000, 1);
+  index_->EndChunk(kUnalignedChunkSize * 2, 3000);
+
+  auto file = std::make_unique<MockFile>();
+  EXPECT_CALL(*file, ReadAt(_, _, _))
+      .WillRepeatedly(Invoke([this](uint8_t* buf, size_t len, int64_t offset) {
+        std::memcpy(buf, ring_.data() + offset, len);
+        return static_cast<ssize_t>(len);
+      }));
+  auto out = std::make_unique<MockFile>();
+  EXPECT_CALL(*out, Write(_, _)).WillRepeatedly(Invoke([this](const uint8_t* buf, size_t len) {
+    output_.insert(output_.end(), buf, buf + len);
+    return static_cast<ssize_t>(len);
+  }));
+  auto index = std::make_unique<ChunkIndexReader>(
+      std::make_unique<MemoryFileMapping>(std::vector<uint8_t>(index_data_)),
+      kUnalignedChunkSize, kNumChunks);
+
+  RingReaderOption option;
+  option.chunk_size = kUnalignedChunkSize;
+  option.num_chunks = kNumChunks;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = kUnalignedChunkSize;
+  RingReader reader(option, std::move(file), std::move(index), std::move(out));
+  EXPECT_EQ(EXIT_SUCCESS, reader.Run());
+
+  // Starts from the first packet in the chunk#1, and ends at the last packet in the chunk#1.
+  auto begin = ts::PKT_SIZE * 11;
+  auto end = ts::PKT_SIZE * 21;
+  EXPECT_EQ(Slice(begin, end), output_);
+}
+
+TEST_F(RingReaderTest, SendTables) {
+  ts::DuckContext context;
+
+  ts::PAT pat(0, true, 0x0001);
+  pat.pmts[kSid] = 0x0101;
+  ts::CyclingPacketizer pat_packetizer(ts::PID_PAT, ts::CyclingPacketizer::ALWAYS);
+  pat_packetizer.addTable(context, pat);
+  ts::TSPacket pat_packet;
+  pat_packetizer.getNextPacket(pat_packet);
+
+  ts::PMT pmt(0, true, kSid, kPid);
+  pmt.streams[kPid].stream_type = ts::ST_MPEG2_VIDEO;
+  ts::CyclingPacketizer pmt_packetizer(0x0101, ts::CyclingPacketizer::ALWAYS);
+  pmt_packetizer.addTable(context, pmt);
+  ts::TSPacket pmt_packet;
+  pmt_packetizer.getNextPacket(pmt_packet);
+
+  std::memcpy(ring_.data() + kChunkSize + ts::PKT_SIZE * 3, pat_packet.b, ts::PKT_SIZE);
+  std::memcpy(ring_.data() + kChunkSize + ts::PKT_SIZE * 5, pmt_packet.b, ts::PKT_SIZE);
+
+  Record(0, 1000, 1);
+  Record(1, 2000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = 0;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+
+  ASSERT_EQ(ts::PKT_SIZE * 2 + kChunkSize * 2, output_.size());
+  ts::TSPacket packet;
+  std::memcpy(packet.b, output_.data(), ts::PKT_SIZE);
+  EXPECT_EQ(ts::PID_PAT, packet.getPID());
+  std::memcpy(packet.b, output_.data() + ts::PKT_SIZE, ts::PKT_SIZE);
+  EXPECT_EQ(0x0101, packet.getPID());
+  EXPECT_EQ(Slice(0, kChunkSize * 2),
+      std::vector<uint8_t>(output_.begin() + ts::PKT_SIZE * 2, output_.end()));
+}
+
+TEST_F(RingReaderTest, LiveChunk) {
+  Record(0, 1000, 1);
+  Record(1, 2000, 1);
+  index_->StartChunk(kChunkSize * 2, 3000, 1);
+  index_->SetWritePos(kChunkSize * 2 + ts::PKT_SIZE * 3 + 100);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = 0;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  // Read up to the write position.  The partial packet at the end is not sent.
+  EXPECT_EQ(Slice(0, kChunkSize * 2 + ts::PKT_SIZE * 3), output_);
+}
+
+TEST_F(RingReaderTest, LiveChunkWritten) {
+  Record(0, 1000, 1);
+  index_->StartChunk(kChunkSize, 2000, 1);
+  // Written but not completed.
+  index_->SetWritePos(kChunkSize * 2);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = 0;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  EXPECT_EQ(Slice(0, kChunkSize * 2), output_);
+}
+
+TEST_F(RingReaderTest, LiveChunkBeforeCompletingChunk) {
+  index_->StartChunk(kChunkSize, 1000, 1);
+  index_->SetWritePos(kChunkSize + ts::PKT_SIZE * 5);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = kChunkSize;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  EXPECT_EQ(Slice(kChunkSize, kChunkSize + ts::PKT_SIZE * 5), output_);
+}
+
+TEST_F(RingReaderTest, LiveChunkNotStarted) {
+  Record(0, 1000, 1);
+  index_->SetWritePos(kChunkSize + ts::PKT_SIZE * 5);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = 0;
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  EXPECT_EQ(Slice(0, kChunkSize), output_);
+}
+
+TEST_F(RingReaderTest, LiveChunkPartialPacket) {
+  // Packets span chunk boundaries.
+  static constexpr size_t kUnalignedChunkSize = 2000;
+  SetChunkSize(kUnalignedChunkSize);
+  index_->StartChunk(0, 1000, 1);
+  index_->EndChunk(kUnalignedChunkSize, 2000);
+  index_->StartChunk(kUnalignedChunkSize, 2000, 1);
+
+  RingReaderOption option;
+  option.seek_mode = RingSeekMode::kPos;
+  option.pos = 0;
+
+  // The rest of the last packet in the chunk#0 has not been written.
+  index_->SetWritePos(kUnalignedChunkSize + 50);
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  EXPECT_EQ(Slice(0, ts::PKT_SIZE * 10), output_);
+
+  output_.clear();
+  index_->SetWritePos(kUnalignedChunkSize + 300);
+  EXPECT_EQ(EXIT_SUCCESS, Read(option));
+  EXPECT_EQ(Slice(0, ts::PKT_SIZE * 12), output_);
+}
@@ -56,6 +56,10 @@ class ServiceFilterTestAccessor final {
   static bool Done(const ServiceFilter& filter) {
     return filter.done_;
   }
+
+  static bool CheckFilterForDrop(const ServiceFilter& filter, ts::PID pid) {
+    return filter.CheckFilterForDrop(pid);
+  }
 };
 
 }  // namespace
@@ -118,6 +122,9 @@ TEST(ServiceFilterTest, IgnoreUnsafePmtPidFromPat) {
   EXPECT_THAT(ServiceFilterTestAccessor::PsiFilter(*filter_ptr),
       testing::UnorderedElementsAre(ts::PID_PAT, ts::PID_CAT, ts::PID_NIT, ts::PID_SDT,
           ts::PID_EIT, ts::PID_RST, ts::PID_TOT, ts::PID_BIT, ts::PID_CDT, 0x0101));
+  EXPECT_FALSE(ServiceFilterTestAccessor::CheckFilterForDrop(*filter_ptr, ts::PID_PAT));
+  EXPECT_FALSE(ServiceFilterTestAccessor::CheckFilterForDrop(*filter_ptr, 0x0101));
+  EXPECT_TRUE(ServiceFilterTestAccessor::CheckFilterForDrop(*filter_ptr, ts::PID_NULL));
 
   // demux_ must still contain the PIDs added in the constructor, in addition to the safe PMT PID
   // (0x0101).
@@ -163,6 +170,8 @@ TEST(ServiceFilterTest, IgnoreUnsafeEmmPidsFromCatDescriptors) {
 
   EXPECT_THAT(
       ServiceFilterTestAccessor::EmmFilter(*filter_ptr), testing::UnorderedElementsAre(0x0101));
+  EXPECT_FALSE(ServiceFilterTestAccessor::CheckFilterForDrop(*filter_ptr, 0x0101));
+  EXPECT_TRUE(ServiceFilterTestAccessor::CheckFilterForDrop(*filter_ptr, ts::PID_EIT));
 }
 
 TEST(ServiceFilterTest, IgnoreUnsafePcrPidFromPmt) {
@@ -75,6 +75,38 @@ TEST(ServiceRecorderTest, NoPacket) {
   EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
 }
 
+TEST(ServiceRecorderTest, TagServiceId) {
+  ServiceRecorderOption option = kOption;
+  option.tag_service_id = true;
+
+  MockSource src;
+  auto file = std::make_unique<MockFile>();
+  auto json_sink = std::make_unique<MockJsonlSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*json_sink, HandleDocument).WillOnce([](const rapidjson::Document& doc) {
+      EXPECT_EQ(R"({"type":"start","serviceId":3})", MockJsonlSink::Stringify(doc));
+      return true;
+    });
+    EXPECT_CALL(*json_sink, HandleDocument).WillOnce([](const rapidjson::Document& doc) {
+      EXPECT_EQ(R"({"type":"stop","data":{"reset":false},"serviceId":3})",
+          MockJsonlSink::Stringify(doc));
+      return true;
+    });
+  }
+
+  EXPECT_CALL(src, GetNextPacket).WillOnce(testing::Return(false));  // EOF
+
+  auto ring =
+      std::make_unique<RingFileSink>(std::move(file), option.chunk_size, option.num_chunks);
+  auto recorder = std::make_unique<ServiceRecorder>(option);
+  recorder->ServiceRecorder::Connect(std::move(ring));
+  recorder->JsonlSource::Connect(std::move(json_sink));
+  src.Connect(std::move(recorder));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+}
+
 TEST(ServiceRecorderTest, IgnoreInvalidPcr) {
   TableSource src;
   auto ring_sink = std::make_unique<MockRingSink>(kOption.chunk_size, kOption.num_chunks);
@@ -853,3 +885,84 @@ TEST(ServiceRecorderTest, UnspecifiedEventEnd) {
   EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
   EXPECT_TRUE(src.IsEmpty());
 }
+
+TEST(ServiceRecorderTest, ResumeFromStateFile) {
+  ServiceRecorderOption option = kOption;
+  option.resume = true;
+
+  std::vector<uint8_t> data;
+  {
+    RecorderStateRecord record = {};
+    record.sid = option.sid;
+    record.chunk_size = option.chunk_size;
+    record.num_chunks = option.num_chunks;
+    record.pos = kChunkSize;
+    record.clock_pcr = RecorderStateRecord::kNoPcr;
+    RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+    EXPECT_TRUE(state.Save(record));
+  }
+
+  MockSource src;
+  auto ring_sink = std::make_unique<MockRingSink>(option.chunk_size, option.num_chunks);
+  auto* ring_sink_ptr = ring_sink.get();
+  auto json_sink = std::make_unique<MockJsonlSink>();
+
+  {
+    testing::InSequence seq;
+    EXPECT_CALL(*ring_sink, Start).WillOnce(testing::Return(true));
+    EXPECT_CALL(*json_sink, HandleDocument).WillOnce([](const rapidjson::Document& doc) {
+      EXPECT_EQ(R"({"type":"start"})", MockJsonlSink::Stringify(doc));
+      return true;
+    });
+    EXPECT_CALL(*json_sink, HandleDocument).WillOnce([](const rapidjson::Document& doc) {
+      EXPECT_EQ(R"({"type":"stop","data":{"reset":false}})", MockJsonlSink::Stringify(doc));
+      return true;
+    });
+    EXPECT_CALL(*ring_sink, End).WillOnce(testing::Return());
+  }
+
+  EXPECT_CALL(src, GetNextPacket).WillOnce(testing::Return(false));  // EOF
+
+  auto recorder = std::make_unique<ServiceRecorder>(option);
+  recorder->ServiceRecorder::Connect(std::move(ring_sink));
+  recorder->JsonlSource::Connect(std::move(json_sink));
+  recorder->SetStateFile(std::make_unique<RecorderStateFile>(std::make_unique<MemoryFile>(&data)));
+  src.Connect(std::move(recorder));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+  EXPECT_EQ(kChunkSize, ring_sink_ptr->pos());
+}
+
+TEST(ServiceRecorderTest, IgnoreUnmatchedStateFile) {
+  ServiceRecorderOption option = kOption;
+  option.resume = true;
+
+  std::vector<uint8_t> data;
+  {
+    RecorderStateRecord record = {};
+    record.sid = option.sid + 1;
+    record.chunk_size = option.chunk_size;
+    record.num_chunks = option.num_chunks;
+    record.pos = kChunkSize;
+    record.clock_pcr = RecorderStateRecord::kNoPcr;
+    RecorderStateFile state(std::make_unique<MemoryFile>(&data));
+    EXPECT_TRUE(state.Save(record));
+  }
+
+  MockSource src;
+  auto ring_sink = std::make_unique<MockRingSink>(option.chunk_size, option.num_chunks);
+  auto* ring_sink_ptr = ring_sink.get();
+  auto json_sink = std::make_unique<MockJsonlSink>();
+
+  EXPECT_CALL(*ring_sink, Start).WillOnce(testing::Return(true));
+  EXPECT_CALL(*ring_sink, End).WillOnce(testing::Return());
+  EXPECT_CALL(*json_sink, HandleDocument).WillRepeatedly(testing::Return(true));
+  EXPECT_CALL(src, GetNextPacket).WillOnce(testing::Return(false));  // EOF
+
+  auto recorder = std::make_unique<ServiceRecorder>(option);
+  recorder->ServiceRecorder::Connect(std::move(ring_sink));
+  recorder->JsonlSource::Connect(std::move(json_sink));
+  recorder->SetStateFile(std::make_unique<RecorderStateFile>(std::make_unique<MemoryFile>(&data)));
+  src.Connect(std::move(recorder));
+  EXPECT_EQ(EXIT_SUCCESS, src.FeedPackets());
+  EXPECT_EQ(0, ring_sink_ptr->pos());
+}
@@ -17,10 +17,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <queue>
+#include <string>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <tsduck/tsduck.h>
@@ -42,15 +46,158 @@ class MockFile final : public File {
   }
 
   MOCK_METHOD(ssize_t, Read, (uint8_t* buf, size_t len), (override));
-  MOCK_METHOD(ssize_t, Write, (uint8_t* buf, size_t len), (override));
+  MOCK_METHOD(ssize_t, ReadAt, (uint8_t* buf, size_t len, int64_t offset), (override));
+  MOCK_METHOD(ssize_t, Write, (const uint8_t* buf, size_t len), (override));
+  MOCK_METHOD(ssize_t, WriteAt, (const uint8_t* buf, size_t len, int64_t offset), (override));
   MOCK_METHOD(bool, Sync, (), (override));
   MOCK_METHOD(bool, Trunc, (int64_t), (override));
   MOCK_METHOD(int64_t, Seek, (int64_t, SeekMode), (override));
+  MOCK_METHOD(bool, Allocate, (int64_t, bool), (override));
 
  private:
   std::string path_ = "<mock>";
 };
 
+// A file which reads data into its own buffer like UringFile.
+class MockPeekableFile final : public File {
+ public:
+  MockPeekableFile() = default;
+  ~MockPeekableFile() override = default;
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  bool CanPeek() const override {
+    return true;
+  }
+
+  MOCK_METHOD(ssize_t, Read, (uint8_t* buf, size_t len), (override));
+  MOCK_METHOD(ssize_t, ReadAt, (uint8_t* buf, size_t len, int64_t offset), (override));
+  MOCK_METHOD(ssize_t, Write, (const uint8_t* buf, size_t len), (override));
+  MOCK_METHOD(ssize_t, WriteAt, (const uint8_t* buf, size_t len, int64_t offset), (override));
+  MOCK_METHOD(bool, Sync, (), (override));
+  MOCK_METHOD(bool, Trunc, (int64_t), (override));
+  MOCK_METHOD(int64_t, Seek, (int64_t, SeekMode), (override));
+  MOCK_METHOD(bool, Allocate, (int64_t, bool), (override));
+  MOCK_METHOD(ssize_t, Peek, (const uint8_t** data), (override));
+  MOCK_METHOD(void, Consume, (size_t len), (override));
+
+ private:
+  std::string path_ = "<mock>";
+};
+
+// A file backed by a vector so that its content can be inspected and broken.
+class MemoryFile final : public File {
+ public:
+  explicit MemoryFile(std::vector<uint8_t>* data) : data_(data) {}
+  ~MemoryFile() override = default;
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  ssize_t Read(uint8_t*, size_t) override {
+    return -1;
+  }
+
+  ssize_t ReadAt(uint8_t* buf, size_t len, int64_t offset) override {
+    auto pos = static_cast<size_t>(offset);
+    if (pos >= data_->size()) {
+      return 0;
+    }
+    auto n = std::min(len, data_->size() - pos);
+    std::memcpy(buf, data_->data() + pos, n);
+    return static_cast<ssize_t>(n);
+  }
+
+  ssize_t Write(const uint8_t*, size_t) override {
+    return -1;
+  }
+
+  ssize_t WriteAt(const uint8_t* buf, size_t len, int64_t offset) override {
+    auto pos = static_cast<size_t>(offset);
+    if (data_->size() < pos + len) {
+      data_->resize(pos + len);
+    }
+    std::memcpy(data_->data() + pos, buf, len);
+    return static_cast<ssize_t>(len);
+  }
+
+  bool Sync() override {
+    num_syncs++;
+    return true;
+  }
+
+  bool Trunc(int64_t size) override {
+    data_->resize(static_cast<size_t>(size));
+    return true;
+  }
+
+  int64_t Seek(int64_t, SeekMode) override {
+    return -1;
+  }
+
+  bool Allocate(int64_t, bool) override {
+    return false;
+  }
+
+  size_t num_syncs = 0;
+
+ private:
+  std::vector<uint8_t>* data_;
+  std::string path_ = "<memory>";
+};
+
+class MemoryFileMapping final : public FileMapping {
+ public:
+  explicit MemoryFileMapping(std::vector<uint8_t>&& data) : data_(std::move(data)) {}
+  ~MemoryFileMapping() override = default;
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  const uint8_t* data() const override {
+    return data_.data();
+  }
+
+  size_t size() const override {
+    return data_.size();
+  }
+
+ private:
+  std::string path_ = "<memory>";
+  std::vector<uint8_t> data_;
+};
+
+// Shares the buffer with the test so that it can be mapped again.
+class MemoryMutableFileMapping final : public MutableFileMapping {
+ public:
+  explicit MemoryMutableFileMapping(std::vector<uint8_t>* data) : data_(data) {}
+  ~MemoryMutableFileMapping() override = default;
+
+  const std::string& path() const override {
+    return path_;
+  }
+
+  uint8_t* data() override {
+    return data_->data();
+  }
+
+  size_t size() const override {
+    return data_->size();
+  }
+
+  bool Sync() override {
+    return true;
+  }
+
+ private:
+  std::string path_ = "<memory>";
+  std::vector<uint8_t>* data_;
+};
+
 class MockSource final : public PacketSource {
  public:
   MockSource() {}
@@ -70,6 +217,18 @@ class MockSink final : public PacketSink {
   MOCK_METHOD(bool, HandlePacket, (const ts::TSPacket&), (override));
 };
 
+class MockBatchSink final : public PacketSink {
+ public:
+  MockBatchSink() {}
+  ~MockBatchSink() override {}
+
+  MOCK_METHOD(bool, Start, (), (override));
+  MOCK_METHOD(void, End, (), (override));
+  MOCK_METHOD(int, GetExitCode, (), (const override));
+  MOCK_METHOD(bool, HandlePacket, (const ts::TSPacket&), (override));
+  MOCK_METHOD(bool, HandlePackets, (const ts::TSPacket*, size_t), (override));
+};
+
 class MockRingSink final : public PacketRingSink {
  public:
   MockRingSink(size_t chunk_size, size_t num_chunks)
@@ -277,6 +436,17 @@ class MockJsonlSink final : public JsonlSink {
   }
 };
 
+// A JSONL sink which buffers lines like StdoutJsonlSink.
+class MockBufferedJsonlSink final : public JsonlSink {
+ public:
+  MockBufferedJsonlSink() {}
+  ~MockBufferedJsonlSink() override {}
+
+  MOCK_METHOD(bool, HandleDocument, (const rapidjson::Document&), (override));
+  MOCK_METHOD(bool, Flush, (), (override));
+  MOCK_METHOD(bool, FlushIfExpired, (), (override));
+};
+
 // Workaround for tsduck/tsduck/issues/549.
 #define MY_XML_NAME u"stream_identifier_descriptor"
 #define MY_DID ts::DID_STREAM_ID
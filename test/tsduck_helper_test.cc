@@ -15,6 +15,10 @@
 // not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
 // 02110-1301, USA.
 
+#include <cstring>
+#include <random>
+#include <string>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -30,7 +34,7 @@ TEST(TsduckHelperTest, ConvertJstTimeToUnixTime) {
   EXPECT_EQ(0, ConvertJstTimeToUnixTime(unix_epoch_jst));
 }
 
-TEST(TsduckHelperTest, MakeEventsJsonValue) {
+TEST(TsduckHelperTest, WriteEventsJson) {
   // clang-format off
   static const uint8_t kData[] = {
     // event_id
@@ -44,18 +48,17 @@ TEST(TsduckHelperTest, MakeEventsJsonValue) {
   EitSection eit;
   eit.events_data = kData;
   eit.events_size = sizeof(kData);
-  rapidjson::Document doc(rapidjson::kObjectType);
-  auto& allocator = doc.GetAllocator();
-  auto events = MakeEventsJsonValue(eit, allocator);
-  EXPECT_EQ(1, events.Size());
-  EXPECT_EQ(1, events[0]["eventId"]);
-  EXPECT_EQ(-9 * 3600000, events[0]["startTime"]);
-  EXPECT_EQ(12 * 3600000 + 34 * 60000 + 56000, events[0]["duration"]);
-  EXPECT_TRUE(events[0]["scrambled"].IsFalse());
-  EXPECT_EQ(0, events[0]["descriptors"].Size());
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  WriteEventsJson(writer, eit);
+  // startTime: -9 * 3600000
+  // duration: 12 * 3600000 + 34 * 60000 + 56000
+  EXPECT_EQ(R"([{"eventId":1,"startTime":-32400000,"duration":45296000,"scrambled":false,)"
+            R"("descriptors":[]}])",
+      std::string(buffer.GetString()));
 }
 
-TEST(TsduckHelperTest, MakeEventsJsonValue_UndefinedStartTimeAndDuration) {
+TEST(TsduckHelperTest, WriteEventsJson_UndefinedStartTimeAndDuration) {
   // clang-format off
   static const uint8_t kData[] = {
     // event_id
@@ -69,13 +72,325 @@ TEST(TsduckHelperTest, MakeEventsJsonValue_UndefinedStartTimeAndDuration) {
   EitSection eit;
   eit.events_data = kData;
   eit.events_size = sizeof(kData);
-  rapidjson::Document doc(rapidjson::kObjectType);
-  auto& allocator = doc.GetAllocator();
-  auto events = MakeEventsJsonValue(eit, allocator);
-  EXPECT_EQ(1, events.Size());
-  EXPECT_EQ(1, events[0]["eventId"]);
-  EXPECT_TRUE(events[0]["startTime"].IsNull());
-  EXPECT_TRUE(events[0]["duration"].IsNull());
-  EXPECT_TRUE(events[0]["scrambled"].IsFalse());
-  EXPECT_EQ(0, events[0]["descriptors"].Size());
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  WriteEventsJson(writer, eit);
+  EXPECT_EQ(R"([{"eventId":1,"startTime":null,"duration":null,"scrambled":false,)"
+            R"("descriptors":[]}])",
+      std::string(buffer.GetString()));
+}
+
+TEST(TsduckHelperTest, WriteJson_EitSection) {
+  // clang-format off
+  static const uint8_t kData[] = {
+    // event_id
+    0x00, 0x01,
+    // start_time, duration(undefined)
+    0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF,
+    // running_status, free_CA_mode, descriptors_loop_length
+    0x10, 0x00,
+  };
+  // clang-format on
+  EitSection eit;
+  eit.nid = 1;
+  eit.tsid = 2;
+  eit.sid = 3;
+  eit.tid = 0x50;
+  eit.section_number = 4;
+  eit.last_section_number = 5;
+  eit.segment_last_section_number = 6;
+  eit.version = 7;
+  eit.events_data = kData;
+  eit.events_size = sizeof(kData);
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  WriteJson(writer, eit);
+  EXPECT_EQ(R"({"originalNetworkId":1,"transportStreamId":2,"serviceId":3,"tableId":80,)"
+            R"("sectionNumber":4,"lastSectionNumber":5,"segmentLastSectionNumber":6,)"
+            R"("versionNumber":7,"events":[{"eventId":1,"startTime":-32400000,)"
+            R"("duration":null,"scrambled":true,"descriptors":[]}]})",
+      std::string(buffer.GetString()));
+}
+
+TEST(TsduckHelperTest, WriteEventsJson_ExtendedEventUsesCache) {
+  // clang-format off
+  static const uint8_t kData[] = {
+    // event_id
+    0x00, 0x01,
+    // start_time, duration
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00,
+    // running_status, free_CA_mode, descriptors_loop_length
+    0x00, 0x0E,
+    // extended_event_descriptor
+    0x4E, 0x0C,
+    // descriptor_number, last_descriptor_number, ISO_639_language_code
+    0x00, 'j', 'p', 'n',
+    // length_of_items, item_description, item
+    0x06, 0x02, 0x30, 0x21, 0x02, 0x30, 0x22,
+    // text_length
+    0x00,
+  };
+  // clang-format on
+  EitSection eit;
+  eit.events_data = kData;
+  eit.events_size = sizeof(kData);
+
+  auto write = [&eit]() {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    WriteEventsJson(writer, eit);
+    return std::string(buffer.GetString());
+  };
+
+  auto& cache = AribStringCache::Get();
+  const auto json = write();
+  EXPECT_NE(std::string::npos, json.find(R"("$type":"ExtendedEvent")"));
+  const auto num_hits = cache.num_hits();
+  const auto num_misses = cache.num_misses();
+  // The description and the item of the same event are decoded from the cache.
+  EXPECT_EQ(json, write());
+  EXPECT_EQ(num_hits + 2, cache.num_hits());
+  EXPECT_EQ(num_misses, cache.num_misses());
+}
+
+TEST(TsduckHelperTest, WriteExtendedEventJson_SameAsGetEventExtendedTextList) {
+  // clang-format off
+  static const uint8_t kData[] = {
+    // extended_event_descriptor
+    0x4E, 0x10,
+    // descriptor_number, last_descriptor_number, ISO_639_language_code
+    0x11, 'j', 'p', 'n',
+    // length_of_items
+    0x0A,
+    // continues the last item in the previous descriptor
+    0x00, 0x02, 0x30, 0x23,
+    0x02, 0x30, 0x24, 0x02, 0x30, 0x25,
+    // text_length
+    0x00,
+    // extended_event_descriptor
+    0x4E, 0x10,
+    // descriptor_number, last_descriptor_number, ISO_639_language_code
+    0x01, 'j', 'p', 'n',
+    // length_of_items
+    0x0A,
+    // a leading item without description
+    0x00, 0x02, 0x30, 0x26,
+    0x02, 0x30, 0x21, 0x02, 0x30, 0x22,
+    // text_length
+    0x00,
+  };
+  // clang-format on
+  LibISDB::DescriptorBlock desc_block;
+  desc_block.ParseBlock(kData, sizeof(kData));
+
+  // The implementation used before the cache was introduced.
+  LibISDB::ARIBStringDecoder decoder;
+  LibISDB::EventInfo::ExtendedTextInfoList ext_list;
+  ASSERT_TRUE(LibISDB::GetEventExtendedTextList(
+      &desc_block, decoder, GetAribStringDecodeFlag(), &ext_list));
+  ASSERT_FALSE(ext_list.empty());
+  rapidjson::StringBuffer expected;
+  {
+    rapidjson::Writer<rapidjson::StringBuffer> writer(expected);
+    writer.StartObject();
+    writer.Key("$type");
+    writer.String("ExtendedEvent");
+    writer.Key("items");
+    writer.StartArray();
+    for (const auto& ext : ext_list) {
+      WriteExtendedEventItemJson(writer, ext.Description, ext.Text);
+    }
+    writer.EndArray();
+    writer.EndObject();
+  }
+
+  rapidjson::StringBuffer actual;
+  {
+    rapidjson::Writer<rapidjson::StringBuffer> writer(actual);
+    WriteExtendedEventJson(writer, desc_block);
+  }
+
+  EXPECT_STREQ(expected.GetString(), actual.GetString());
+}
+
+TEST(TsduckHelperTest, AribStringCache) {
+  auto make_string = [](const char* str) {
+    return LibISDB::ARIBString(reinterpret_cast<const uint8_t*>(str), std::strlen(str));
+  };
+  auto decode = [](const LibISDB::ARIBString& str, AribStringCache::DecodeFlag flags) {
+    LibISDB::ARIBStringDecoder decoder;
+    LibISDB::String utf8;
+    decoder.Decode(str, &utf8, flags);
+    return utf8;
+  };
+  const auto a = make_string("ab");
+  const auto b = make_string("cd");
+  const auto c = make_string("ef");
+  const auto flags = LibISDB::ARIBStringDecoder::DecodeFlag::UseCharSize;
+  const auto flags2 = flags | LibISDB::ARIBStringDecoder::DecodeFlag::UnicodeSymbol;
+
+  AribStringCache cache(2);
+
+  EXPECT_EQ(decode(a, flags), cache.Decode(a, flags));
+  EXPECT_EQ(0, cache.num_hits());
+  EXPECT_EQ(1, cache.num_misses());
+
+  EXPECT_EQ(decode(a, flags), cache.Decode(a, flags));
+  EXPECT_EQ(1, cache.num_hits());
+  EXPECT_EQ(1, cache.num_misses());
+
+  // Decode flags are a part of the key.
+  EXPECT_EQ(decode(a, flags2), cache.Decode(a, flags2));
+  EXPECT_EQ(1, cache.num_hits());
+  EXPECT_EQ(2, cache.num_misses());
+  EXPECT_EQ(2, cache.size());
+
+  // `a` has been referenced.  So, `a` with `flags2` is evicted.
+  EXPECT_EQ(decode(b, flags), cache.Decode(b, flags));
+  EXPECT_EQ(3, cache.num_misses());
+  EXPECT_EQ(1, cache.num_evictions());
+  EXPECT_EQ(2, cache.size());
+
+  EXPECT_EQ(decode(a, flags), cache.Decode(a, flags));
+  EXPECT_EQ(2, cache.num_hits());
+
+  // `b` is evicted.
+  EXPECT_EQ(decode(c, flags), cache.Decode(c, flags));
+  EXPECT_EQ(4, cache.num_misses());
+  EXPECT_EQ(2, cache.num_evictions());
+
+  EXPECT_EQ(decode(a, flags), cache.Decode(a, flags));
+  EXPECT_EQ(decode(c, flags), cache.Decode(c, flags));
+  EXPECT_EQ(4, cache.num_hits());
+  EXPECT_EQ(4, cache.num_misses());
+
+  // Empty strings are not cached.
+  EXPECT_EQ(LibISDB::String(), cache.Decode(LibISDB::ARIBString(), flags));
+  EXPECT_EQ(4, cache.num_hits());
+  EXPECT_EQ(4, cache.num_misses());
+  EXPECT_EQ(2, cache.size());
+
+  // Strings which differ only in the tail shorter than 8 bytes.
+  const auto d = make_string("0123456789abcdefg");
+  const auto e = make_string("0123456789abcdefh");
+  EXPECT_EQ(decode(d, flags), cache.Decode(d, flags));
+  EXPECT_EQ(decode(e, flags), cache.Decode(e, flags));
+  EXPECT_EQ(decode(d, flags), cache.Decode(d, flags));
+  EXPECT_EQ(5, cache.num_hits());
+  EXPECT_EQ(6, cache.num_misses());
+}
+
+TEST(TsduckHelperTest, FastAribStringDecoder) {
+  auto decode = [](const LibISDB::ARIBString& str, FastAribStringDecoder::DecodeFlag flags) {
+    LibISDB::ARIBStringDecoder decoder;
+    LibISDB::String utf8;
+    decoder.Decode(str, &utf8, flags);
+    return utf8;
+  };
+  const auto flags = LibISDB::ARIBStringDecoder::DecodeFlag::UseCharSize;
+  const auto flags2 = flags | LibISDB::ARIBStringDecoder::DecodeFlag::UnicodeSymbol;
+
+  FastAribStringDecoder decoder;
+  LibISDB::String utf8;
+
+  // clang-format off
+  // "今日の ニュース" followed by "あい" in GR.
+  const uint8_t kPlain[] = {
+    0x3A, 0x23, 0x46, 0x7C, 0x24, 0x4E, 0x20, 0x25, 0x4B, 0x25, 0x65, 0x21, 0x3C, 0x25, 0x39,
+    0xA2, 0xA4,
+  };
+  // "ニュース" followed by "NHK" in the Alphanumeric set with MSZ, and "今日" after that.
+  const uint8_t kMixed[] = {
+    0x25, 0x4B, 0x25, 0x65, 0x21, 0x3C, 0x25, 0x39,
+    0x89, 0x0E, 0x4E, 0x48, 0x4B, 0x0F, 0x8A,
+    0x3A, 0x23, 0x46, 0x7C,
+  };
+  // clang-format on
+
+  const LibISDB::ARIBString plain(kPlain, sizeof(kPlain));
+  decoder.Decode(plain, &utf8, flags);
+  EXPECT_EQ(decode(plain, flags), utf8);
+  EXPECT_EQ(sizeof(kPlain), decoder.num_fast_bytes());
+
+  // Only the leading run is converted with the table.
+  const LibISDB::ARIBString mixed(kMixed, sizeof(kMixed));
+  decoder.Decode(mixed, &utf8, flags);
+  EXPECT_EQ(decode(mixed, flags), utf8);
+  EXPECT_EQ(sizeof(kPlain) + 8, decoder.num_fast_bytes());
+
+  // An incomplete 2-byte code is decoded with LibISDB.
+  const LibISDB::ARIBString incomplete(kPlain, 5);
+  decoder.Decode(incomplete, &utf8, flags);
+  EXPECT_EQ(decode(incomplete, flags), utf8);
+  EXPECT_EQ(sizeof(kPlain) + 12, decoder.num_fast_bytes());
+
+  decoder.Decode(plain, &utf8, flags2);
+  EXPECT_EQ(decode(plain, flags2), utf8);
+
+  // Random strings including control codes.
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (int i = 0; i < 1000; ++i) {
+    LibISDB::ARIBString str;
+    auto len = dist(rng) % 32;
+    for (int j = 0; j < len; ++j) {
+      // Mostly plain characters.
+      auto b = static_cast<uint8_t>(dist(rng));
+      if (j % 8 != 7) {
+        b = static_cast<uint8_t>(0x21 + b % 94);
+      }
+      str.push_back(b);
+    }
+    decoder.Decode(str, &utf8, flags);
+    EXPECT_EQ(decode(str, flags), utf8);
+  }
+}
+
+TEST(TsduckHelperTest, PidRoleTable) {
+  PidRoleTable table;
+  EXPECT_EQ(0, table.Get(ts::PID_PAT));
+  EXPECT_EQ(0, table.Get(ts::PID_NULL));
+
+  table.Add(0x0100, 0x01);
+  table.Add(0x0100, 0x02);
+  table.Add(ts::PID_NULL, 0x04);
+  EXPECT_EQ(0x03, table.Get(0x0100));
+  EXPECT_EQ(0x04, table.Get(ts::PID_NULL));
+  EXPECT_EQ(0, table.Get(0x0101));
+
+  table.Clear();
+  EXPECT_EQ(0, table.Get(0x0100));
+  EXPECT_EQ(0, table.Get(ts::PID_NULL));
+}
+
+TEST(TsduckHelperTest, LazySectionDemux) {
+  class Handler final : public ts::TableHandlerInterface {
+   public:
+    void handleTable(ts::SectionDemux&, const ts::BinaryTable& table) override {
+      if (table.tableId() == ts::TID_PAT) {
+        num_pats++;
+      }
+    }
+    int num_pats = 0;
+  };
+
+  ts::DuckContext context;
+  Handler handler;
+  LazySectionDemux demux(context);
+  demux.setTableHandler(&handler);
+
+  ts::PAT pat(0, true, 0x0001);
+  pat.pmts[0x0001] = 0x0101;
+  ts::CyclingPacketizer packetizer(ts::PID_PAT, ts::CyclingPacketizer::ALWAYS);
+  packetizer.addTable(context, pat);
+
+  ts::TSPacket packet;
+  packetizer.getNextPacket(packet);
+  demux.feedPacket(packet);  // skipped
+  EXPECT_EQ(0, handler.num_pats);
+
+  demux.addPID(ts::PID_PAT);
+  packetizer.getNextPacket(packet);
+  demux.feedPacket(packet);
+  EXPECT_EQ(1, handler.num_pats);
 }
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// mirakc-arib
+// Copyright (C) 2019 masnagam
+//
+// This program is free software; you can redistribute it and/or modify it under the terms of the
+// GNU General Public License as published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+// the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with this program; if
+// not, write to the Free Software Foundation, 51 Franklin Street, Fifth Floor, Boston, MA
+// 02110-1301, USA.
+
+#include "vmsplice_sink.hh"
+
+#if MIRAKC_ARIB_HAS_VMSPLICE
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// Enough packets to reuse buffers in the ring several times.
+constexpr size_t kNumPackets = 2000;
+
+ts::TSPacket MakePacket(size_t i) {
+  ts::TSPacket packet = ts::NullPacket;
+  std::memset(packet.b + 4, static_cast<int>(i & 0xFF), ts::PKT_SIZE - 4);
+  return packet;
+}
+
+}  // namespace
+
+TEST(VmspliceSinkTest, NotPipe) {
+  auto* file = std::tmpfile();
+  ASSERT_NE(nullptr, file);
+  VmspliceSink sink(fileno(file));
+  EXPECT_FALSE(sink.Init());
+  std::fclose(file);
+}
+
+TEST(VmspliceSinkTest, Splice) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+
+  std::vector<uint8_t> received;
+  std::thread reader([&received, fd = fds[0]]() {
+    uint8_t buf[4096];
+    for (;;) {
+      auto nread = read(fd, buf, sizeof(buf));
+      if (nread <= 0) {
+        break;
+      }
+      received.insert(received.end(), buf, buf + nread);
+    }
+  });
+
+  {
+    VmspliceSink sink(fds[1]);
+    ASSERT_TRUE(sink.Init());
+    std::vector<ts::TSPacket> batch;
+    for (size_t i = 0; i < kNumPackets; ++i) {
+      // Mix single packets and batches.
+      if (i % 3 == 0) {
+        EXPECT_TRUE(sink.HandlePacket(MakePacket(i)));
+        continue;
+      }
+      batch.push_back(MakePacket(i));
+      if (batch.size() == 7) {
+        EXPECT_TRUE(sink.HandlePackets(batch.data(), batch.size()));
+        batch.clear();
+      }
+    }
+    EXPECT_TRUE(sink.HandlePackets(batch.data(), batch.size()));
+    sink.End();
+  }
+
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+
+  ASSERT_EQ(kNumPackets * ts::PKT_SIZE, received.size());
+
+  // Reconstruct the expected order of packets.
+  std::vector<size_t> order;
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < kNumPackets; ++i) {
+    if (i % 3 == 0) {
+      order.push_back(i);
+      continue;
+    }
+    pending.push_back(i);
+    if (pending.size() == 7) {
+      order.insert(order.end(), pending.begin(), pending.end());
+      pending.clear();
+    }
+  }
+  order.insert(order.end(), pending.begin(), pending.end());
+
+  for (size_t i = 0; i < kNumPackets; ++i) {
+    auto expected = MakePacket(order[i]);
+    EXPECT_EQ(0, std::memcmp(expected.b, &received[i * ts::PKT_SIZE], ts::PKT_SIZE)) << i;
+  }
+}
+
+#endif  // MIRAKC_ARIB_HAS_VMSPLICE